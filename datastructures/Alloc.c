@@ -1,19 +1,23 @@
 #include "Alloc.h"
 #include "config.h"
 #include <assert.h>
+#include <string.h>
 #include <unistd.h>
 
 /* Uses malloc to allocate memory. */
 void *Allocator_malloc(Alloc *a, void *old_data, size_t size)
 {
     void *new_data;
-    size_t new_size;
+    size_t old_size, new_size;
 
     if (size == 0)
     {
         /* Free allocation */
         if (old_data != NULL)
+        {
+            FS_account(a->ms.usage, a->ms.capacity, 0);
             free(old_data);
+        }
         return NULL;
     }
 
@@ -22,7 +26,11 @@ void *Allocator_malloc(Alloc *a, void *old_data, size_t size)
         return old_data;
     }
 
-    new_size = size;
+    /* Grow geometrically, in whole chunks */
+    old_size = old_data != NULL ? a->ms.capacity : 0;
+    new_size = 2*old_size;
+    if (new_size < size)
+        new_size = size;
     if (new_size%ALLOC_CHUNK_SIZE != 0)
     {
         new_size += ALLOC_CHUNK_SIZE - new_size%ALLOC_CHUNK_SIZE;
@@ -32,13 +40,19 @@ void *Allocator_malloc(Alloc *a, void *old_data, size_t size)
     new_data = realloc(old_data, new_size);
     if (new_data == NULL)
         return NULL;
+    memset((char*)new_data + old_size, 0, new_size - old_size);
+    if (old_data == NULL)
+        a->ms.usage = FS_current_usage();
+    FS_account(a->ms.usage, old_size, new_size);
     a->ms.capacity = new_size;
     return new_data;
 }
 
 /* Uee the FileStorage to mmap() data backed by a temporary file. */
-void *Allocator_mmap(Alloc *a, void *old_data, size_t size)
+static void *mmap_pages(Alloc *a, void *old_data, size_t size, FS_Pages pages)
 {
+    void *data;
+
     if (size == 0)
     {
         /* Free allocation */
@@ -50,10 +64,13 @@ void *Allocator_mmap(Alloc *a, void *old_data, size_t size)
     if (old_data == NULL)
     {
         assert(size > 0);
-        if (!FS_create(&a->fs, NULL))
+        if (!FS_create_pages(&a->fs, NULL, pages))
             return NULL;
 
-        return FS_resize(&a->fs, NULL, size);
+        data = FS_resize(&a->fs, NULL, size);
+        if (data == NULL)
+            FS_destroy(&a->fs, NULL);
+        return data;
     }
     else
     {
@@ -61,3 +78,23 @@ void *Allocator_mmap(Alloc *a, void *old_data, size_t size)
         return FS_resize(&a->fs, old_data, size);
     }
 }
+
+void *Allocator_mmap(Alloc *a, void *old_data, size_t size)
+{
+    return mmap_pages(a, old_data, size, FS_PAGES_DEFAULT);
+}
+
+void *Allocator_mmap_thp(Alloc *a, void *old_data, size_t size)
+{
+    return mmap_pages(a, old_data, size, FS_PAGES_THP);
+}
+
+void *Allocator_mmap_2m(Alloc *a, void *old_data, size_t size)
+{
+    return mmap_pages(a, old_data, size, FS_PAGES_2M);
+}
+
+void *Allocator_mmap_1g(Alloc *a, void *old_data, size_t size)
+{
+    return mmap_pages(a, old_data, size, FS_PAGES_1G);
+}
@@ -14,15 +14,25 @@ typedef struct MemStorage MemStorage;
    The return value is either a non-NULL pointer (if allocation succeeds) or
    NULL if allocation fails (in that case, the old pointer should still be
    valid). On deallocation, NULL is returned.
+
+   Newly allocated memory (including memory added by resizing) is
+   zero-filled.
 */
 typedef void *(Allocator)(Alloc *a, void *old, size_t size);
 
 void *Allocator_malloc(Alloc *a, void *old, size_t size);
 void *Allocator_mmap(Alloc *a, void *old, size_t size);
 
+/* Like Allocator_mmap, but maps memory using transparent huge pages or
+   explicit 2 MiB or 1 GiB huge pages (see FS_create_pages). */
+void *Allocator_mmap_thp(Alloc *a, void *old, size_t size);
+void *Allocator_mmap_2m(Alloc *a, void *old, size_t size);
+void *Allocator_mmap_1g(Alloc *a, void *old, size_t size);
+
 struct MemStorage
 {
     size_t capacity;        /* Size of memory allocated */
+    FS_Usage *usage;        /* Usage record the memory counts towards */
 };
 
 union Alloc
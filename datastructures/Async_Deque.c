@@ -0,0 +1,753 @@
+#include "config.h"
+#include "Deque.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Deque implementation with asynchronous write-behind and read-ahead
+
+   Elements are stored in the same format as in File_Deque.c (with the size
+   stored at both ends of the data, which is padded to a multiple of
+   sizeof(size_t)) but grouped into blocks of about ASYNC_DEQUE_BLOCK_SIZE
+   bytes. Only a few blocks are kept in memory: the head block (from which
+   elements are removed), the tail block (to which elements are added) and
+   a list of full blocks in between:
+
+    +------+--~ ~------------+--~ ~-----------+--~ ~----------+------+
+    | head | read-ahead      | on disk        | write-behind  | tail |
+    +------+--~ ~------------+--~ ~-----------+--~ ~----------+------+
+
+   A background I/O thread writes blocks that are not among the first
+   ASYNC_DEQUE_READ_AHEAD blocks of the list to a temporary file, and reads
+   back blocks that are, so the next blocks needed at the head are in memory
+   by the time they are needed. When the tail block is full, it is appended
+   to the list and the search continues with a fresh buffer; this only waits
+   for the I/O thread when more than ASYNC_DEQUE_WRITE_BEHIND blocks are
+   waiting to be written. Similarly, the head only waits when the next block
+   has not been read yet. Disk space of blocks that have been read back is
+   released, and the file offset is reset when no blocks are on disk.
+
+   When the head block is empty and the list is empty, the head and tail
+   blocks are swapped, so adding elements never affects the head block, and
+   elements retrieved from the front remain valid while elements are added.
+   Removing elements from the back works the same way in reverse, but
+   blocks are read back synchronously.
+
+   Pushing data in front of the deque is not supported.
+*/
+
+typedef struct Block Block;
+typedef struct AsyncDeque AsyncDeque;
+
+typedef enum BlockState
+{
+    BLOCK_IN_MEMORY,                    /* Data is in memory only */
+    BLOCK_WRITING,                      /* Data is being written to disk */
+    BLOCK_ON_DISK,                      /* Data is on disk only */
+    BLOCK_READING                       /* Data is being read from disk */
+} BlockState;
+
+struct Block
+{
+    Block       *prev, *next;           /* Neighbours in list */
+    BlockState  state;                  /* Where the data is */
+    char        *data;                  /* Elements (NULL if on disk only) */
+    size_t      capacity;               /* Size of allocated data */
+    size_t      begin;                  /* Offset to first element */
+    size_t      end;                    /* Offset to end of last element */
+    size_t      count;                  /* Number of elements */
+    off_t       offset;                 /* Position of data in file */
+};
+
+struct AsyncDeque
+{
+    Deque           base;
+    size_t          count;              /* Number of elements */
+    Block           *head;              /* Block elements are removed from */
+    Block           *tail;              /* Block elements are added to */
+
+    /* The following are protected by the mutex: */
+    Block           *first, *last;      /* List of full blocks */
+    Block           *unwritten;         /* First of the unwritten blocks at
+                                           the end of the list */
+    size_t          blocks;             /* Number of blocks in list */
+    size_t          resident;           /* Number of block buffers allocated */
+    char            *spare[ASYNC_DEQUE_READ_AHEAD +
+                           ASYNC_DEQUE_WRITE_BEHIND + 2];
+    size_t          spares;             /* Number of spare buffers */
+    size_t          on_disk;            /* Number of blocks with data on disk */
+    off_t           file_end;           /* End of data written to file */
+    bool            stop;               /* Whether the I/O thread must stop */
+    bool            error;              /* Whether an I/O error occurred */
+
+    int             fd;                 /* Temporary file */
+    pthread_t       thread;             /* I/O thread */
+    pthread_mutex_t mutex;
+    pthread_cond_t  work;               /* Signalled when there is I/O to do */
+    pthread_cond_t  done;               /* Signalled when I/O completes */
+
+    /* Statistics */
+    size_t          bytes_written, bytes_read, sync_reads, stalls;
+    double          io_time, stall_time, time_start;
+};
+
+/* Maximum number of block buffers in memory */
+#define MAX_RESIDENT (ASYNC_DEQUE_READ_AHEAD + ASYNC_DEQUE_WRITE_BEHIND + 2)
+
+/* Rounds argument up to a multiple of sizeof(size_t) */
+static size_t align(size_t size)
+{
+    if (size%sizeof(size_t) != 0)
+        size = size - size%sizeof(size_t) + sizeof(size_t);
+    return size;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/* Allocates a buffer of ``capacity'' bytes for a block, reusing a spare
+   buffer if possible. Must be called with the mutex locked. */
+static bool alloc_data(AsyncDeque *deque, Block *block, size_t capacity)
+{
+    if (capacity < ASYNC_DEQUE_BLOCK_SIZE)
+        capacity = ASYNC_DEQUE_BLOCK_SIZE;
+    if (capacity == ASYNC_DEQUE_BLOCK_SIZE && deque->spares > 0)
+    {
+        block->data = deque->spare[--deque->spares];
+    }
+    else
+    {
+        block->data = malloc(capacity);
+        if (block->data == NULL)
+            return false;
+    }
+    block->capacity = capacity;
+    ++deque->resident;
+    return true;
+}
+
+/* Releases the buffer of a block (if any). Must be called with the mutex
+   locked. */
+static void free_data(AsyncDeque *deque, Block *block)
+{
+    if (block->data == NULL)
+        return;
+    if ( block->capacity == ASYNC_DEQUE_BLOCK_SIZE &&
+         deque->spares < sizeof(deque->spare)/sizeof(*deque->spare) )
+        deque->spare[deque->spares++] = block->data;
+    else
+        free(block->data);
+    block->data     = NULL;
+    block->capacity = 0;
+    --deque->resident;
+}
+
+/* Records the time spent waiting for the I/O thread since ``start'' */
+static void stalled(AsyncDeque *deque, double start)
+{
+    deque->stall_time += now() - start;
+    ++deque->stalls;
+}
+
+/* Releases the disk space of a block that has been read back. Must be
+   called with the mutex locked. */
+static void discard(AsyncDeque *deque, Block *block)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate( deque->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+               block->offset, (off_t)align(block->end - block->begin) );
+#endif
+    if (--deque->on_disk == 0)
+        deque->file_end = 0;
+}
+
+/* Writes the data of a block to the file at its offset */
+static bool write_block(AsyncDeque *deque, Block *block)
+{
+    size_t size = block->end - block->begin, pos;
+    ssize_t res;
+
+    for (pos = 0; pos < size; pos += (size_t)res)
+    {
+        res = pwrite( deque->fd, block->data + block->begin + pos, size - pos,
+                      block->offset + (off_t)pos );
+        if (res < 0 && errno != EINTR)
+            return false;
+        if (res < 0)
+            res = 0;
+    }
+    return true;
+}
+
+/* Reads the data of a block from the file into its (allocated) buffer */
+static bool read_block(AsyncDeque *deque, Block *block)
+{
+    size_t size = block->end - block->begin, pos;
+    ssize_t res;
+
+    for (pos = 0; pos < size; pos += (size_t)res)
+    {
+        res = pread( deque->fd, block->data + pos, size - pos,
+                     block->offset + (off_t)pos );
+        if (res == 0 || (res < 0 && errno != EINTR))
+            return false;
+        if (res < 0)
+            res = 0;
+    }
+    block->begin = 0;
+    block->end   = size;
+    return true;
+}
+
+/* Returns the next block the I/O thread should read or write, or NULL if
+   there is none. Must be called with the mutex locked.
+
+   Beyond the read-ahead window, the blocks that have been written precede
+   those that have not, since blocks are written in order and new blocks are
+   appended at the end. Unwritten blocks inside the window need not be
+   written at all. */
+static Block *next_io(AsyncDeque *deque)
+{
+    Block *block;
+    bool unwritten_seen = false;
+    size_t n;
+
+    if (deque->error)
+        return NULL;
+
+    /* Read ahead blocks near the head */
+    for ( block = deque->first, n = 0;
+          block != NULL && n < ASYNC_DEQUE_READ_AHEAD;
+          block = block->next, ++n )
+    {
+        if (block->state == BLOCK_ON_DISK)
+            return block;
+        if (block == deque->unwritten)
+            unwritten_seen = true;
+    }
+
+    /* Write behind blocks away from the head */
+    return unwritten_seen ? block : deque->unwritten;
+}
+
+static void *io_main(void *arg)
+{
+    AsyncDeque *deque = arg;
+    Block *block;
+    double t;
+    size_t size;
+    bool ok;
+
+    pthread_mutex_lock(&deque->mutex);
+    while (!deque->stop)
+    {
+        block = next_io(deque);
+        if (block == NULL)
+        {
+            pthread_cond_wait(&deque->work, &deque->mutex);
+            continue;
+        }
+
+        size = block->end - block->begin;
+        if (block->state == BLOCK_IN_MEMORY)
+        {
+            block->state     = BLOCK_WRITING;
+            block->offset    = deque->file_end;
+            deque->file_end += (off_t)align(size);
+            deque->unwritten = block->next;
+            ++deque->on_disk;
+            pthread_mutex_unlock(&deque->mutex);
+            t = now();
+            ok = write_block(deque, block);
+            t = now() - t;
+            pthread_mutex_lock(&deque->mutex);
+            if (ok)
+            {
+                block->state = BLOCK_ON_DISK;
+                free_data(deque, block);
+                deque->bytes_written += size;
+            }
+            else
+            {
+                /* Keep the block in memory */
+                block->state = BLOCK_IN_MEMORY;
+                --deque->on_disk;
+                deque->error = true;
+            }
+        }
+        else
+        {
+            assert(block->state == BLOCK_ON_DISK);
+            if (!alloc_data(deque, block, size))
+            {
+                deque->error = true;
+                pthread_cond_broadcast(&deque->done);
+                continue;
+            }
+            block->state = BLOCK_READING;
+            pthread_mutex_unlock(&deque->mutex);
+            t = now();
+            ok = read_block(deque, block);
+            t = now() - t;
+            pthread_mutex_lock(&deque->mutex);
+            if (ok)
+            {
+                block->state = BLOCK_IN_MEMORY;
+                discard(deque, block);
+                deque->bytes_read += size;
+            }
+            else
+            {
+                block->state = BLOCK_ON_DISK;
+                free_data(deque, block);
+                deque->error = true;
+            }
+        }
+        deque->io_time += t;
+        pthread_cond_broadcast(&deque->done);
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return NULL;
+}
+
+/* Removes a block from the list, waiting for I/O on it to complete and
+   reading it back if necessary. Returns false if it could not be read, in
+   which case the block remains in the list. */
+static bool detach(AsyncDeque *deque, Block *block)
+{
+    size_t size;
+    double t;
+    bool ok;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (block->state == BLOCK_WRITING || block->state == BLOCK_READING)
+    {
+        t = now();
+        do {
+            pthread_cond_wait(&deque->done, &deque->mutex);
+        } while ( block->state == BLOCK_WRITING ||
+                  block->state == BLOCK_READING );
+        stalled(deque, t);
+    }
+    if (block->state == BLOCK_ON_DISK)
+    {
+        /* Read back synchronously */
+        size = block->end - block->begin;
+        if (!alloc_data(deque, block, size))
+        {
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+        ok = read_block(deque, block);
+        if (!ok)
+        {
+            free_data(deque, block);
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+        block->state = BLOCK_IN_MEMORY;
+        discard(deque, block);
+        deque->bytes_read += size;
+        ++deque->sync_reads;
+    }
+
+    if (deque->unwritten == block)
+        deque->unwritten = block->next;
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        deque->first = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    else
+        deque->last = block->prev;
+    block->prev = block->next = NULL;
+    --deque->blocks;
+
+    /* The read-ahead window has moved */
+    pthread_cond_signal(&deque->work);
+    pthread_mutex_unlock(&deque->mutex);
+    return true;
+}
+
+/* Exchanges the head and tail blocks */
+static void swap_blocks(AsyncDeque *deque)
+{
+    Block *block;
+
+    block       = deque->head;
+    deque->head = deque->tail;
+    deque->tail = block;
+}
+
+/* Returns the (non-empty) head block, taking the next block from the list
+   if necessary, or NULL on failure. */
+static Block *head_block(AsyncDeque *deque)
+{
+    Block *block;
+
+    if (deque->head->count == 0)
+    {
+        if (deque->first == NULL)
+        {
+            swap_blocks(deque);
+        }
+        else
+        {
+            block = deque->first;
+            if (!detach(deque, block))
+                return NULL;
+            pthread_mutex_lock(&deque->mutex);
+            free_data(deque, deque->head);
+            pthread_mutex_unlock(&deque->mutex);
+            free(deque->head);
+            deque->head = block;
+        }
+    }
+    return deque->head;
+}
+
+/* Returns the (non-empty) tail block, taking the last block from the list
+   if necessary, or NULL on failure. */
+static Block *tail_block(AsyncDeque *deque)
+{
+    Block *block;
+
+    if (deque->tail->count == 0)
+    {
+        if (deque->last == NULL)
+        {
+            swap_blocks(deque);
+        }
+        else
+        {
+            block = deque->last;
+            if (!detach(deque, block))
+                return NULL;
+            pthread_mutex_lock(&deque->mutex);
+            free_data(deque, deque->tail);
+            pthread_mutex_unlock(&deque->mutex);
+            free(deque->tail);
+            deque->tail = block;
+        }
+    }
+    return deque->tail;
+}
+
+/* Appends the (full) tail block to the list and replaces it with a new,
+   empty block that can hold at least ``capacity'' bytes. */
+static bool flush_tail(AsyncDeque *deque, size_t capacity)
+{
+    Block *block;
+    double t;
+    bool ok;
+
+    block = malloc(sizeof(Block));
+    if (block == NULL)
+        return false;
+
+    pthread_mutex_lock(&deque->mutex);
+    deque->tail->prev = deque->last;
+    deque->tail->next = NULL;
+    if (deque->last != NULL)
+        deque->last->next = deque->tail;
+    else
+        deque->first = deque->tail;
+    deque->last = deque->tail;
+    if (deque->unwritten == NULL)
+        deque->unwritten = deque->tail;
+    ++deque->blocks;
+    pthread_cond_signal(&deque->work);
+
+    /* Wait until enough blocks have been written */
+    if (deque->resident >= MAX_RESIDENT && !deque->error)
+    {
+        t = now();
+        do {
+            pthread_cond_wait(&deque->done, &deque->mutex);
+        } while (deque->resident >= MAX_RESIDENT && !deque->error);
+        stalled(deque, t);
+    }
+    ok = alloc_data(deque, block, capacity);
+    pthread_mutex_unlock(&deque->mutex);
+    if (!ok)
+    {
+        /* Allocate when the next element is added */
+        block->data     = NULL;
+        block->capacity = 0;
+    }
+    block->prev  = block->next = NULL;
+    block->state = BLOCK_IN_MEMORY;
+    block->begin = block->end = block->count = 0;
+    block->offset = 0;
+    deque->tail = block;
+    return ok;
+}
+
+static void destroy(AsyncDeque *deque)
+{
+    Block *block;
+
+    pthread_mutex_lock(&deque->mutex);
+    deque->stop = true;
+    pthread_cond_signal(&deque->work);
+    pthread_mutex_unlock(&deque->mutex);
+    pthread_join(deque->thread, NULL);
+
+    while ((block = deque->first) != NULL)
+    {
+        deque->first = block->next;
+        free(block->data);
+        free(block);
+    }
+    while (deque->spares > 0)
+        free(deque->spare[--deque->spares]);
+    free(deque->head->data);
+    free(deque->head);
+    free(deque->tail->data);
+    free(deque->tail);
+    close(deque->fd);
+    pthread_cond_destroy(&deque->work);
+    pthread_cond_destroy(&deque->done);
+    pthread_mutex_destroy(&deque->mutex);
+    free(deque);
+}
+
+static size_t size(AsyncDeque *deque)
+{
+    return deque->count;
+}
+
+static bool empty(AsyncDeque *deque)
+{
+    return deque->count == 0;
+}
+
+static bool push_back(AsyncDeque *deque, const void *data, size_t size)
+{
+    Block *block = deque->tail;
+    size_t aligned_size = align(size), record;
+    bool ok;
+
+    record = 2*sizeof(size_t) + aligned_size;
+    if (block->count > 0 && block->end + record > block->capacity)
+    {
+        /* Tail block is full */
+        if (!flush_tail(deque, record))
+            return false;
+        block = deque->tail;
+    }
+    else
+    if (block->end + record > block->capacity)
+    {
+        /* Element does not fit in an empty block */
+        pthread_mutex_lock(&deque->mutex);
+        free_data(deque, block);
+        ok = alloc_data(deque, block, record);
+        pthread_mutex_unlock(&deque->mutex);
+        if (!ok)
+            return false;
+        block->begin = block->end = 0;
+    }
+
+    /* Append item */
+    memcpy(block->data + block->end, &size, sizeof(size_t));
+    memcpy(block->data + block->end + sizeof(size_t), data, size);
+    memcpy( block->data + block->end + sizeof(size_t) + aligned_size,
+            &size, sizeof(size_t) );
+    block->end += record;
+    ++block->count;
+    ++deque->count;
+
+    return true;
+}
+
+static bool push_front(AsyncDeque *deque, const void *data, size_t size)
+{
+    /* NOT IMPLEMENTED */
+    return false;
+}
+
+static bool get_back(AsyncDeque *deque, void **data, size_t *size)
+{
+    Block *block;
+
+    if (deque->count == 0 || (block = tail_block(deque)) == NULL)
+        return false;
+
+    memcpy(size, block->data + block->end - sizeof(size_t), sizeof(size_t));
+    *data = block->data + block->end - sizeof(size_t) - align(*size);
+    return true;
+}
+
+static bool get_front(AsyncDeque *deque, void **data, size_t *size)
+{
+    Block *block;
+
+    if (deque->count == 0 || (block = head_block(deque)) == NULL)
+        return false;
+
+    memcpy(size, block->data + block->begin, sizeof(size_t));
+    *data = block->data + block->begin + sizeof(size_t);
+    return true;
+}
+
+static bool pop_back(AsyncDeque *deque)
+{
+    Block *block;
+    size_t size;
+
+    if (deque->count == 0 || (block = tail_block(deque)) == NULL)
+        return false;
+
+    memcpy(&size, block->data + block->end - sizeof(size_t), sizeof(size_t));
+    block->end -= 2*sizeof(size_t) + align(size);
+    if (--block->count == 0)
+        block->begin = block->end = 0;
+    --deque->count;
+
+    return true;
+}
+
+static bool pop_front(AsyncDeque *deque)
+{
+    Block *block;
+    size_t size;
+
+    if (deque->count == 0 || (block = head_block(deque)) == NULL)
+        return false;
+
+    memcpy(&size, block->data + block->begin, sizeof(size_t));
+    block->begin += 2*sizeof(size_t) + align(size);
+    if (--block->count == 0)
+        block->begin = block->end = 0;
+    --deque->count;
+
+    return true;
+}
+
+static bool reserve(AsyncDeque *deque, size_t count, size_t size)
+{
+    /* Blocks are allocated on demand */
+    return true;
+}
+
+/* Creates an empty block with a buffer */
+static Block *create_block(AsyncDeque *deque)
+{
+    Block *block;
+
+    block = malloc(sizeof(Block));
+    if (block == NULL)
+        return NULL;
+    if (!alloc_data(deque, block, ASYNC_DEQUE_BLOCK_SIZE))
+    {
+        free(block);
+        return NULL;
+    }
+    block->prev  = block->next = NULL;
+    block->state = BLOCK_IN_MEMORY;
+    block->begin = block->end = block->count = 0;
+    block->offset = 0;
+    return block;
+}
+
+Deque *Async_Deque_create(const char *dir)
+{
+    AsyncDeque *deque;
+    char *path;
+
+    /* Allocate memory */
+    deque = malloc(sizeof(AsyncDeque));
+    if (deque == NULL)
+        return NULL;
+    memset(deque, 0, sizeof(AsyncDeque));
+
+    deque->base.destroy    = (void*)destroy;
+    deque->base.empty      = (void*)empty;
+    deque->base.size       = (void*)size;
+    deque->base.push_back  = (void*)push_back;
+    deque->base.push_front = (void*)push_front;
+    deque->base.get_back   = (void*)get_back;
+    deque->base.get_front  = (void*)get_front;
+    deque->base.pop_back   = (void*)pop_back;
+    deque->base.pop_front  = (void*)pop_front;
+    deque->base.reserve    = (void*)reserve;
+
+    /* Create temporary file */
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+    if (dir == NULL)
+        dir = "/tmp";
+    path = malloc(strlen(dir) + 16);
+    if (path == NULL)
+    {
+        free(deque);
+        return NULL;
+    }
+    sprintf(path, "%s/queue-XXXXXX", dir);
+    deque->fd = mkstemp(path);
+    if (deque->fd >= 0)
+        unlink(path);
+    free(path);
+    if (deque->fd < 0)
+    {
+        free(deque);
+        return NULL;
+    }
+
+    deque->head = create_block(deque);
+    deque->tail = create_block(deque);
+    pthread_mutex_init(&deque->mutex, NULL);
+    pthread_cond_init(&deque->work, NULL);
+    pthread_cond_init(&deque->done, NULL);
+    deque->time_start = now();
+    if ( deque->head == NULL || deque->tail == NULL ||
+         pthread_create(&deque->thread, NULL, io_main, deque) != 0 )
+    {
+        if (deque->head != NULL)
+            free(deque->head->data);
+        if (deque->tail != NULL)
+            free(deque->tail->data);
+        free(deque->head);
+        free(deque->tail);
+        close(deque->fd);
+        pthread_cond_destroy(&deque->work);
+        pthread_cond_destroy(&deque->done);
+        pthread_mutex_destroy(&deque->mutex);
+        free(deque);
+        return NULL;
+    }
+
+    return &deque->base;
+}
+
+void Async_Deque_report(Deque *base, FILE *fp)
+{
+    AsyncDeque *deque = (AsyncDeque*)base;
+    double elapsed;
+
+    pthread_mutex_lock(&deque->mutex);
+    elapsed = now() - deque->time_start;
+    fprintf( fp, "Queue I/O: %.1f MiB written, %.1f MiB read, "
+                 "%.1f MiB/s while busy (%.1f%% of the time), "
+                 "%lu stalls (%.3f s), %lu synchronous reads\n",
+             deque->bytes_written/1048576.0, deque->bytes_read/1048576.0,
+             (deque->bytes_written + deque->bytes_read)/1048576.0/
+                 (deque->io_time + (deque->io_time == 0)),
+             100.0*deque->io_time/(elapsed + (elapsed == 0)),
+             (unsigned long)deque->stalls, deque->stall_time,
+             (unsigned long)deque->sync_reads );
+    pthread_mutex_unlock(&deque->mutex);
+}
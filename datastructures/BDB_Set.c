@@ -58,11 +58,13 @@ static Set *BDB_Set_create(const char *filepath, int type)
     if (set == NULL)
         return NULL;
 
-    set->base.destroy  = (void*)set_destroy;
-    set->base.insert   = (void*)set_insert;
-    set->base.contains = (void*)set_contains;
-    set->base.compare  = type == DB_BTREE ? default_compare : NULL;
-    set->base.hash     = type == DB_HASH  ? default_hash    : NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = NULL;
+    set->base.enumerate    = NULL;
+    set->base.compare      = type == DB_BTREE ? default_compare : NULL;
+    set->base.hash         = type == DB_HASH  ? default_hash    : NULL;
     set->db = db;
 
     return &set->base;
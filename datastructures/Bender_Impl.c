@@ -1,12 +1,16 @@
 #include "config.h"
 #include "comparison.h"
 #include "Bender_Impl.h"
+#include "CacheSim.h"
+#include "EventTrace.h"
 #include "FileStorage.h"
+#include "VEB_Layout.h"
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <stddef.h>
+#include <unistd.h>
 
 /* Implementation of Bender's cache-oblivious set data structure.
 
@@ -25,9 +29,11 @@
    Therefore, there are L=O-ceil(log2(O)) levels (numbered from 0 to L-1);
    level x consists of 2^x windows of size C/(2^x).
 
-   For the windows on the lowest level (level L-1) a population count is kept
-   (the number of non-blank values stored in the window). These counts are
-   used to compute the population counts of higher-level windows on the fly.
+   For each window on each level a population count is kept (the number of
+   non-blank values stored in the window). The counts form a complete binary
+   tree with the lowest-level windows as leaves, stored like a heap, so the
+   population of any window can be looked up directly, and the population of
+   an arbitrary range of lowest-level windows can be computed in O(L) time.
 
    Each level has an associated lower and upper bound on the number of values
    stored in it. If a window stores more (/less) values than its upper
@@ -48,14 +54,35 @@
    updated accordingly.
 
    For fast finding of elements (both when inserting and looking up element)
-   a binary search tree index is kept. Its leaf nodes store the same elements
-   as the array (i.e. the i-th leaf node stores the i-th element in the array,
-   which may be blank if there is no value at index i in the sparse array)
-   while each interior node stores the maximum non-blank value of its children
-   (or a blank value if there are no non-blank children).
+   a binary search tree index is kept. Its leaves are the elements of the
+   array, while each interior node refers to the maximum non-blank value of
+   its children (or is blank if there are no non-blank children). Since the
+   array is sorted, that is simply the rightmost non-blank element, so nodes
+   store the index of that element (plus one, so zero means blank) and the
+   tree can be updated without comparing values.
 
    The tree index then is stored in van Emde Boas lay-out to make it
-   cache-friendly without requiring parametrization.
+   cache-friendly without requiring parametrization. Node positions are
+   computed from their breadth-first indices (see VEB_Layout.h) so nodes do
+   not store any pointers.
+
+   In normalized-key mode (when a prefix function is given) each node also
+   stores an integer prefix of the value it refers to, which orders values
+   consistently with the comparison function. Searching then compares these
+   integers first, and only calls the comparison function (which also needs
+   to access the array) when the prefixes are equal.
+
+   Blank values in the array and the tree are represented by zero bytes, so
+   newly allocated memory (which is zero-filled) forms an empty table that
+   does not need to be initialized.
+
+   The array and its index together form a table. When the top-level window
+   of the table overflows, a new table of twice the capacity is created next
+   to the old one. The values in the old table are then copied to the new
+   table in order, a few windows at a time (after each insertion) and queries
+   consult both tables until the old table has been migrated completely and
+   is freed. This avoids rebuilding the entire index in the middle of a
+   single insertion.
 */
 
 
@@ -72,36 +99,107 @@
 */
 const bool opt_fast_update = true;
 
+/* Number of lowest-level windows of the old table that are migrated to the
+   new table on each insertion while the set is growing. Since each insertion
+   adds at most one value, and a lowest-level window is at least four values
+   in size, migration finishes long before the new table overflows. */
+#define MIGRATE_WINDOWS 2
+
+/* Windows of at least this many elements are redistributed by multiple
+   threads (if more than one processor is available). */
+#define PARALLEL_MIN_WINDOW ((size_t)1 << 20)
+
+/* Maximum number of threads used to redistribute a single window. */
+#define MAX_THREADS 8
+
+
+typedef struct BatchEntry BatchEntry;
+
+/* A value to be inserted by Bender_Impl_insert_batch() */
+struct BatchEntry
+{
+    const void  *data;
+    size_t      size;
+    size_t      input;          /* Index of the value in the batch */
+};
+
 
 /* Returns a pointer to the i-th element in the data array. */
-#define ARRAY_AT(i) ((ArrayNode*)(bi->data+(i)*(sizeof(ArrayNode)+bi->V)))
+#define ARRAY_AT(i) ((ArrayNode*)(t->data+(i)*(sizeof(ArrayNode)+bi->V)))
+
+/* Size of an element of the data array. */
+#define ARRAY_ELEM_SIZE (sizeof(ArrayNode) + bi->V)
 
-/* Copy value of ArrayNode *q to ArrayNode *p while keeping the pointer data
-   unmodified. */
+/* Move ``n'' consecutive elements starting at ArrayNode *q to ArrayNode *p
+   (the ranges may overlap). */
+#define ARRAY_MOVE(p, q, n) memmove((p), (q), (n)*ARRAY_ELEM_SIZE)
+
+/* Copy value of ArrayNode *q to ArrayNode *p. */
 #define ARRAY_COPY(p, q)                                                    \
     do { if (p == q) break; /* Necessary because memset doesn't allow       \
                                overlapping memory regions. */               \
-         memcpy( (char*)(p) + offsetof(ArrayNode, size),                    \
-                 (char*)(q) + offsetof(ArrayNode, size),                    \
-                 sizeof(ArrayNode) + bi->V - offsetof(ArrayNode, size) );   \
+         memcpy((p), (q), sizeof(ArrayNode) + bi->V);                       \
     } while(0);
 
-/* Convert ArrayNode pointer to index */
-#define ARRAY_IDX(an) (((char*)(an) - bi->data)/(sizeof(ArrayNode) + bi->V))
+/* Returns whether ArrayNode *an is blank */
+#define IS_BLANK(an) ((an)->size == 0)
+
+/* Returns the size of the value stored in non-blank ArrayNode *an */
+#define VALUE_SIZE(an) ((an)->size - 1)
 
-/* Convert TreeNode pointer to index */
-#define TREE_IDX(tn) (((char*)(tn) - (char*)bi->tree)/(sizeof(TreeNode) + bi->V))
+/* Compares the value at index i in the array with the given value. */
+#define COMPARE_AT(i, data, size)                                           \
+    bi->compare( bi->context, ARRAY_AT(i)->data, VALUE_SIZE(ARRAY_AT(i)),   \
+                 data, size )
+
+/* Number of words in a tree node in normalized-key mode */
+#define PREFIX_NODE_WORDS (sizeof(PrefixNode)/sizeof(size_t))
+
+/* Number of words in a tree node */
+#define NODE_WORDS (bi->prefix != NULL ? PREFIX_NODE_WORDS : 1)
+
+/* Returns the index stored in the tree node at position p (which is the
+   index of the rightmost non-blank value in its subtree plus one, or zero
+   if the subtree is blank). */
+#define TREE_INDEX(p) (t->tree[(p)*NODE_WORDS])
+
+/* Returns the prefix stored in the tree node at position p (only valid in
+   normalized-key mode, for non-blank nodes). */
+#define TREE_PREFIX(p) (((PrefixNode*)(t->tree + (p)*PREFIX_NODE_WORDS))->prefix)
+
+/* Report accesses to the elements [i:j) of the array, the i-th element
+   (its size field, and its value if not blank) and the tree node at
+   position p to the cache simulator (see CacheSim.h) */
+#define ACCESS_ARRAY(i, j)                                                  \
+    CACHE_ACCESS(ARRAY_AT(i), ((j) - (i))*ARRAY_ELEM_SIZE)
+#define ACCESS_ELEMENT(i)                                                   \
+    CACHE_ACCESS( ARRAY_AT(i), sizeof(ArrayNode) +                          \
+                  (IS_BLANK(ARRAY_AT(i)) ? 0 : VALUE_SIZE(ARRAY_AT(i))) )
+#define ACCESS_NODE(p)                                                      \
+    CACHE_ACCESS(&TREE_INDEX(p), NODE_WORDS*sizeof(size_t))
 
 /* Returns the number of elements in each window at the i-th level. */
-#define WINDOW_SIZE(i) ((size_t)1 << (bi->O - (i)))
+#define WINDOW_SIZE(i) ((size_t)1 << (t->O - (i)))
 
 /* Returns the number of windows at the i-th level. */
 #define NUM_WINDOWS(i) ((size_t)1 << (i))
 
+/* Returns the population count of the w-th window at the i-th level. */
+#define POPULATION(i, w) (t->population[NUM_WINDOWS(i) + (w)])
+
+/* Returns the rank of the element that is placed at offset x when a window
+   of size W containing T elements is redistributed evenly, or equivalently
+   the number of elements placed before offset x. */
+#define SPREAD_RANK(x, T, W) ((x)*(T)/(W))
+
+/* Returns the offset in a window of size W containing T elements at which
+   the element with rank r is placed when the window is redistributed. */
+#define SPREAD_OFFSET(r, T, W) ((((r) + 1)*(W) - 1)/(T))
+
 /* Capacity of the set */
-#define C ((size_t)1 << (bi->O))
+#define C ((size_t)1 << (t->O))
 
-static void debug_print_array(Bender_Impl *bi, FILE *fp)
+static void debug_print_array(Bender_Impl *bi, Bender_Table *t, FILE *fp)
 {
     size_t n, s, total;
     char *p;
@@ -110,7 +208,7 @@ static void debug_print_array(Bender_Impl *bi, FILE *fp)
     total = 0;
     for (n = 0; n < C; ++n)
     {
-        if (ARRAY_AT(n)->size == (size_t)-1)
+        if (IS_BLANK(ARRAY_AT(n)))
         {
             fputc('.', fp);
         }
@@ -126,9 +224,9 @@ static void debug_print_array(Bender_Impl *bi, FILE *fp)
     /* Print data */
     for (n = 0; n < C; ++n)
     {
-        s = ARRAY_AT(n)->size;
-        if (s != (size_t)-1)
+        if (!IS_BLANK(ARRAY_AT(n)))
         {
+            s = VALUE_SIZE(ARRAY_AT(n));
             fprintf(fp, "%7d ", (int)n);
             p = ARRAY_AT(n)->data;
             while (s--)
@@ -143,50 +241,44 @@ static void debug_print_array(Bender_Impl *bi, FILE *fp)
 
 /* Generates a graph representation of the tree with values associated with
    nodes, in the GraphViz DOT language. */
-static void debug_dump_tree(Bender_Impl *bi, const char *filepath)
+static void debug_dump_tree( Bender_Impl *bi, Bender_Table *t,
+                             const char *filepath )
 {
     FILE *fp;
-    size_t n, m;
-    TreeNode *node;
+    size_t index, n, pos[VEB_MAX_HEIGHT];
+    int depth;
 
     fp = fopen(filepath, "wt");
     assert(fp != NULL);
     fprintf(fp, "digraph {\n");
 
-    /* Output node labels */
-    for (n = 0; n < 2*C - 1; ++n)
+    /* Output node labels and edges to parent nodes */
+    for (depth = 0; depth < t->O; ++depth)
     {
-        char buf[100];
-        size_t len;
-
-        node = (TreeNode*)((char*)bi->tree + n*(sizeof(TreeNode) + bi->V));
-        if (node->size == (size_t)-1)
-        {
-            strcpy(buf, "[blank]");
-        }
-        else
+        for (index = (size_t)1 << depth; index < (size_t)2 << depth; ++index)
         {
-            len = node->size >= sizeof(buf) ? sizeof(buf) - 1 : node->size;
-            memcpy(buf, node->data, len);
-            buf[len] = '\0';
-        }
+            char buf[100];
+            size_t len;
 
-        fprintf(fp, "\tn%d [shape=plaintext,label=\"%s (%d)\"]\n", (int)n, buf, (int)n);
-    }
+            VEB_Layout_path(&t->layout, index, depth, pos);
+            n = TREE_INDEX(pos[depth]);
+            if (n == 0)
+            {
+                strcpy(buf, "[blank]");
+            }
+            else
+            {
+                len = VALUE_SIZE(ARRAY_AT(n - 1));
+                if (len >= sizeof(buf))
+                    len = sizeof(buf) - 1;
+                memcpy(buf, ARRAY_AT(n - 1)->data, len);
+                buf[len] = '\0';
+            }
 
-    /* Output graph configuration */
-    for (n = 0; n < 2*C - 1; ++n)
-    {
-        node = (TreeNode*)((char*)bi->tree + n*(sizeof(TreeNode) + bi->V));
-        if (node->left != NULL)
-        {
-            m = ((char*)node->left - (char*)bi->tree)/(sizeof(TreeNode) + bi->V);
-            fprintf(fp, "\tn%d -> n%d\n", (int)n, (int)m);
-        }
-        if (node->right != NULL)
-        {
-            m = ((char*)node->right - (char*)bi->tree)/(sizeof(TreeNode) + bi->V);
-            fprintf(fp, "\tn%d -> n%d\n", (int)n, (int)m);
+            fprintf( fp, "\tn%d [shape=plaintext,label=\"%s (%d)\"]\n",
+                     (int)index, buf, (int)pos[depth] );
+            if (depth > 0)
+                fprintf(fp, "\tn%d -> n%d\n", (int)index/2, (int)index);
         }
     }
 
@@ -195,26 +287,38 @@ static void debug_dump_tree(Bender_Impl *bi, const char *filepath)
 }
 
 /* Verifies the population count of all windows */
-static void debug_check_counts(Bender_Impl *bi)
+static void debug_check_counts(Bender_Impl *bi, Bender_Table *t)
 {
     size_t win, pop, n;
+    int lev;
 
-    for (win = 0; win < NUM_WINDOWS(bi->L - 1); ++win)
+    for (lev = t->L - 1; lev >= 0; --lev)
     {
-        /* Recompute for lowest-level window */
-        pop = 0;
-        for (n = 0; n < WINDOW_SIZE(bi->L - 1); ++n)
-            pop += (ARRAY_AT(win*WINDOW_SIZE(bi->L - 1) + n)->size != (size_t)-1);
-
-        if (bi->population[win] != pop)
+        for (win = 0; win < NUM_WINDOWS(lev); ++win)
         {
-            fprintf( stderr,
-                        "Window %llu has incorrect population!"
-                        " (Was: %llu; expected: %llu)\n",
-                        (unsigned long long)win,
-                        (unsigned long long)bi->population[win],
-                        (unsigned long long)pop );
-            abort();
+            if (lev == t->L - 1)
+            {
+                /* Recompute for lowest-level window */
+                pop = 0;
+                for (n = 0; n < WINDOW_SIZE(lev); ++n)
+                    pop += !IS_BLANK(ARRAY_AT(win*WINDOW_SIZE(lev) + n));
+            }
+            else
+            {
+                /* Sum populations of child windows */
+                pop = POPULATION(lev + 1, 2*win) + POPULATION(lev + 1, 2*win + 1);
+            }
+
+            if (POPULATION(lev, win) != pop)
+            {
+                fprintf( stderr,
+                            "Window %llu at level %d has incorrect population!"
+                            " (Was: %llu; expected: %llu)\n",
+                            (unsigned long long)win, lev,
+                            (unsigned long long)POPULATION(lev, win),
+                            (unsigned long long)pop );
+                abort();
+            }
         }
     }
 }
@@ -229,160 +333,91 @@ static int log2i(unsigned long long x)
     return (8*sizeof(unsigned long long) - __builtin_clzll(x));
 }
 
-/* Given a node (which is assumed to be a leaf node; i.e. its children
-   are not considered) returns the next leaf node in order or NULL if none. */
-static TreeNode *next_leaf(TreeNode *node)
+/* Updates the tree nodes corresponding to array elements in the ``n''
+   ranges [begin[k]:end[k]) (which must be disjoint, non-empty and sorted)
+   in the subtree rooted at the node with breadth-first index ``index'' at
+   depth ``depth'', which covers the array elements starting from ``first''.
+   The positions of the node and its ancestors are stored in ``pos''.
+   The tree is traversed in postorder for optimal performance. */
+static void update_subtree( Bender_Impl *bi, Bender_Table *t, size_t *pos,
+    int depth, size_t index, size_t first,
+    const size_t *begin, const size_t *end, size_t n )
 {
-    /* Go up to the next turning point */
-    while (node->parent != NULL && node == node->parent->right)
-        node = node->parent;
-    if (node->parent == NULL)
-        return NULL;
+    size_t half, left, right, k, l, r, c;
 
-    /* Now go to the next node in-order */
-    node = node->parent->right;
-    while (node->left != NULL)
-        node = node->left;
-
-    return node;
-}
-
-/* Creates a tree in van Emde Boas lay-out of the required ``height'',
-   on level ``level'' and returns the root. */
-static TreeNode *create_subtree(
-    Bender_Impl *bi, size_t *tree_pos, size_t *array_pos,
-    int height, int level )
-{
-    if (height == 1)
+    if (depth + 1 == t->O)
     {
-        /* Create a single node */
-        TreeNode *node;
-
-        /* Create a new empty node */
-        node = (TreeNode*)((char*)bi->tree +
-                           *tree_pos*(sizeof(TreeNode) + bi->V));
-        *tree_pos += 1;
-        node->left   = NULL;
-        node->right  = NULL;
-        node->parent = NULL;
-        node->size   = (size_t)-1;
-
-        if (level == bi->O)
+        /* Children are array elements; refer to the rightmost non-blank
+           one (if any). */
+        c = !IS_BLANK(ARRAY_AT(first + 1)) ? first + 2 :
+            !IS_BLANK(ARRAY_AT(first))     ? first + 1 : 0;
+        TREE_INDEX(pos[depth]) = c;
+        ACCESS_ARRAY(first, first + 2);
+        ACCESS_NODE(pos[depth]);
+        if (bi->prefix != NULL && c != 0)
         {
-            /* This node is a leaf node in the complete tree;
-               link it with the corresponding array node. */
-            node->array = ARRAY_AT(*array_pos);
-            *array_pos += 1;
-            node->array->tree = node;
+            TREE_PREFIX(pos[depth]) = bi->prefix( bi->context,
+                ARRAY_AT(c - 1)->data, VALUE_SIZE(ARRAY_AT(c - 1)) );
         }
-        else
-        {
-            node->array = NULL;
-        }
-
-        return node;
     }
     else
     {
-        /* Create a subtree by dividing the height into two halves, first
-           creating the top subtree, and then creating the bottom subtrees,
-           which are connected to the leaf nodes of the top subtree. */
-        TreeNode *root, *leaf;
+        half = WINDOW_SIZE(depth + 1);
 
-        root = create_subtree(bi, tree_pos, array_pos, height/2, level);
-
-        /* Find first leaf node in subtree */
-        leaf = root;
-        while (leaf->left != NULL)
-            leaf = leaf->left;
-
-        /* Create all subtrees */
-        do {
-            leaf->left = create_subtree( bi, tree_pos, array_pos,
-                                         height - height/2, level + height/2 );
-            leaf->left->parent = leaf;
-            leaf->right = create_subtree( bi, tree_pos, array_pos,
-                                          height - height/2, level + height/2 );
-            leaf->right->parent = leaf;
-        } while ((leaf = next_leaf(leaf)) != NULL);
-
-        return root;
+        /* Find the first range that extends into the right subtree; at most
+           one range (the k-th) extends into both subtrees. */
+        l = 0, r = n;
+        while (l < r)
+        {
+            k = (l + r)/2;
+            if (end[k] > first + half)
+                r = k;
+            else
+                l = k + 1;
+        }
+        k = l;
+
+        /* Traverse left subtree */
+        pos[depth + 1] = VEB_POS(&t->layout, pos, depth + 1, 2*index);
+        l = (k < n && begin[k] < first + half) ? k + 1 : k;
+        if (l > 0)
+            update_subtree( bi, t, pos, depth + 1, 2*index,
+                            first, begin, end, l );
+        left = pos[depth + 1];
+
+        /* Traverse right subtree */
+        pos[depth + 1] = VEB_POS(&t->layout, pos, depth + 1, 2*index + 1);
+        if (k < n)
+            update_subtree( bi, t, pos, depth + 1, 2*index + 1,
+                            first + half, begin + k, end + k, n - k );
+        right = pos[depth + 1];
+
+        /* Refer to the rightmost non-blank value of the child nodes */
+        c = TREE_INDEX(right) != 0 ? right : left;
+        TREE_INDEX(pos[depth]) = TREE_INDEX(c);
+        ACCESS_NODE(right);
+        ACCESS_NODE(pos[depth]);
+        if (bi->prefix != NULL)
+            TREE_PREFIX(pos[depth]) = TREE_PREFIX(c);
     }
 }
 
-/* Creates the tree index structure. */
-static void create_tree(Bender_Impl *bi)
+/* Updates the contents of the tree corresponding to ``n'' ranges of array
+   nodes (see update_subtree() for requirements). */
+static void update_tree_ranges( Bender_Impl *bi, Bender_Table *t,
+    const size_t *begin, const size_t *end, size_t n )
 {
-    size_t tree_pos, array_pos;
+    size_t pos[VEB_MAX_HEIGHT];
 
-    tree_pos = array_pos = 0;
-    create_subtree(bi, &tree_pos, &array_pos, bi->O + 1, 0);
-    assert(array_pos == C);
-    assert(tree_pos = 2*array_pos - 1);
+    pos[0] = 0;
+    update_subtree(bi, t, pos, 0, 1, 0, begin, end, n);
 }
 
-/* Updates the contents of the tree corresponding to a range of array nodes
-   The tree must be traversed in postorder for optimal performance. */
-static void update_tree_window(
-    Bender_Impl *bi, TreeNode *node, int level, ssize_t begin, ssize_t end )
+/* Updates the contents of the tree corresponding to a range of array nodes */
+static void update_tree_window( Bender_Impl *bi, Bender_Table *t,
+                                size_t begin, size_t end )
 {
-    if (node->array)
-    {
-        /* Leaf node */
-        node->size = node->array->size;
-        if (node->size != (size_t)-1)
-            memcpy(node->data, node->array->data, node->size);
-    }
-    else
-    {
-        /* Internal node */
-        TreeNode *greatest;
-        ssize_t k = (ssize_t)WINDOW_SIZE(level + 1);
-        if (begin < k)
-        {
-            /* Traverse left subtree */
-            update_tree_window(bi, node->left, level + 1, begin, end);
-        }
-        if (end > k)
-        {
-            /* Traverse right subtree */
-            update_tree_window(bi, node->right, level + 1, begin - k, end - k);
-        }
-
-        /* Copy maximum value of child nodes to current node. */
-        if (node->left->size != (size_t)-1 && node->right->size != (size_t)-1)
-        {
-            greatest = bi->compare( bi->context,
-                                    node->left->data,  node->left->size,
-                                    node->right->data, node->right->size ) >= 0
-                    ? node->left : node->right;
-        }
-        else
-        if (node->left->size != (size_t)-1)
-        {
-            greatest = node->left;
-        }
-        else
-        if (node->right->size != (size_t)-1)
-        {
-            greatest = node->right;
-        }
-        else
-        {
-            greatest = NULL;
-        }
-
-        if (greatest != NULL)
-        {
-            node->size = greatest->size;
-            if (node->size != (size_t)-1)
-                memcpy(node->data, greatest->data, node->size);
-        }
-        else
-        {
-            node->size = (size_t)-1;
-        }
-    }
+    update_tree_ranges(bi, t, &begin, &end, 1);
 }
 
 /*  Overwrites a blank value in the array with a new value and updates the
@@ -391,344 +426,865 @@ static void update_tree_window(
     This is used as an alternative method of inserting new values in the
     data structure. (See opt_fast_update for a description)
 */
-static void overwrite_blank( Bender_Impl *bi, size_t i,
+static void overwrite_blank( Bender_Impl *bi, Bender_Table *t, size_t i,
                              const void *data, size_t size )
 {
-    TreeNode *node;
-    size_t win;
+    size_t win, pos[VEB_MAX_HEIGHT];
+    unsigned long long prefix;
+    int depth;
 
     /* Set value */
-    ARRAY_AT(i)->size = size;
+    ARRAY_AT(i)->size = size + 1;
     memcpy(ARRAY_AT(i)->data, data, size);
+    ACCESS_ELEMENT(i);
 
-    /* Update population count */
-    win = i/WINDOW_SIZE(bi->L - 1);
-    bi->population[win] += 1;
+    /* Update population counts of all windows containing the value */
+    for ( win = NUM_WINDOWS(t->L - 1) + i/WINDOW_SIZE(t->L - 1);
+          win > 0; win /= 2 )
+    {
+        t->population[win] += 1;
+        CACHE_ACCESS(&t->population[win], sizeof(size_t));
+    }
 
-    /* Update tree index */
-    node = ARRAY_AT(i)->tree;
-    do {
-        node->size = size;
-        memcpy(node->data, data, size);
-        node = node->parent;
-    } while ( node != NULL &&
-              ( node->size == (size_t)-1 ||
-                bi->compare( bi->context, node->data, node->size,
-                             data, size ) < 0 ) );
+    /* Update tree index: the new value is the maximum of all subtrees
+       containing it that have no non-blank values further to the right. */
+    prefix = bi->prefix != NULL ? bi->prefix(bi->context, data, size) : 0;
+    depth = t->O - 1;
+    VEB_Layout_path(&t->layout, ((size_t)1 << depth) + i/2, depth, pos);
+    while (depth >= 0 && TREE_INDEX(pos[depth]) < i + 1)
+    {
+        ACCESS_NODE(pos[depth]);
+        TREE_INDEX(pos[depth]) = i + 1;
+        if (bi->prefix != NULL)
+            TREE_PREFIX(pos[depth]) = prefix;
+        --depth;
+    }
 
-    /* debug_dump_tree(bi, "tree.dot"); */
+    /* debug_dump_tree(bi, t, "tree.dot"); */
 }
 
-/* Returns the population count for window ``win'' of level ``lev''. */
-static size_t count(Bender_Impl *bi, int lev, size_t win)
+/* Returns the population count for the range [begin:end) of the array,
+   which must be aligned to the lowest-level windows. */
+static size_t count(Bender_Table *t, size_t begin, size_t end)
 {
     size_t i, j, N;
 
-    i =  win      << (bi->L - 1 - lev);
-    j = (win + 1) << (bi->L - 1 - lev);
+    /* Sum the counts of the largest windows covering the range, moving up
+       the tree from both ends. */
+    i = NUM_WINDOWS(t->L - 1) + begin/WINDOW_SIZE(t->L - 1);
+    j = NUM_WINDOWS(t->L - 1) + end/WINDOW_SIZE(t->L - 1);
     N = 0;
-    do N += bi->population[i]; while (++i < j);
+    while (i < j)
+    {
+        if (i%2 == 1)
+            N += t->population[i++];
+        if (j%2 == 1)
+            N += t->population[--j];
+        i /= 2;
+        j /= 2;
+    }
 
     return N;
 }
 
+/* Updates the population counts of all windows containing the lowest-level
+   windows in range [i:j), after the counts of the latter have changed. */
+static void update_populations(Bender_Table *t, size_t i, size_t j)
+{
+    size_t n;
+
+    i += NUM_WINDOWS(t->L - 1);
+    j += NUM_WINDOWS(t->L - 1);
+    while (i > 1)
+    {
+        i = i/2;
+        j = (j + 1)/2;
+        for (n = i; n < j; ++n)
+            t->population[n] = t->population[2*n] + t->population[2*n + 1];
+    }
+}
+
+/* Sets the population counts after the window [begin:end) has been
+   redistributed to contain ``T'' elements. The window must be aligned
+   to the lowest-level windows. */
+static void spread_populations( Bender_Table *t,
+                                size_t begin, size_t end, size_t T )
+{
+    size_t i, j, x, W;
+
+    W = end - begin;
+    i = begin/WINDOW_SIZE(t->L - 1);
+    j = end/WINDOW_SIZE(t->L - 1);
+    for (x = 0; x < W; x += WINDOW_SIZE(t->L - 1))
+    {
+        POPULATION(t->L - 1, i + x/WINDOW_SIZE(t->L - 1)) =
+            SPREAD_RANK(x + WINDOW_SIZE(t->L - 1), T, W) - SPREAD_RANK(x, T, W);
+    }
+    update_populations(t, i, j);
+}
+
+/* Compares the value referred to by the tree node at position ``p'' with
+   the given value, which has prefix ``prefix'' in normalized-key mode.
+   Blank nodes compare less than all values. */
+static int compare_node( Bender_Impl *bi, Bender_Table *t, size_t p,
+    unsigned long long prefix, const void *data, size_t size )
+{
+    size_t n;
+
+    n = TREE_INDEX(p);
+    ACCESS_NODE(p);
+    if (n == 0)
+        return -1;
+
+    if (bi->prefix != NULL && TREE_PREFIX(p) != prefix)
+        return TREE_PREFIX(p) < prefix ? -1 : +1;
+
+    ACCESS_ELEMENT(n - 1);
+    return COMPARE_AT(n - 1, data, size);
+}
+
 /* Returns the index into the data array of the first element not smaller
    than the argument, or C if no smaller element exists. */
-static size_t find_successor(Bender_Impl *bi,
-                             const void *data, size_t size, int *diff)
+static size_t find_successor( Bender_Impl *bi, Bender_Table *t,
+                              const void *data, size_t size, int *diff )
 {
-    TreeNode *node;
+    size_t pos[VEB_MAX_HEIGHT], index, n;
+    unsigned long long prefix;
+    int depth;
+
+    prefix = bi->prefix != NULL ? bi->prefix(bi->context, data, size) : 0;
 
     /* First, see if any successor exists, by comparing against the root
-       which stores the maximum value in the array. */
-    node = bi->tree;
-    if (node->size == (size_t)-1 ||
-        bi->compare(bi->context, node->data, node->size, data, size) < 0)
-    {
+       which refers to the maximum value in the array. */
+    if (compare_node(bi, t, 0, prefix, data, size) < 0)
         return C;
-    }
 
     /* Now find the real successor by moving down the tree.*/
-    while (node->array == NULL)
+    pos[0] = 0;
+    index  = 1;
+    for (depth = 1; depth < t->O; ++depth)
     {
-        if ( node->left->size == (size_t)-1 ||
-             bi->compare( bi->context, node->left->data, node->left->size,
-                                       data, size ) < 0 )
-        {
-            /* Values in left subtree too small -- go to right subtree */
-            node = node->right;
-        }
-        else
+        index = 2*index;
+        pos[depth] = VEB_POS(&t->layout, pos, depth, index);
+        if (compare_node(bi, t, pos[depth], prefix, data, size) < 0)
         {
-            /* Left subtree has a successor. */
-            node = node->left;
+            /* Values in left subtree too small -- go to right subtree
+               (which is stored right after the left subtree) */
+            index += 1;
+            pos[depth] += t->layout.bottom_size[depth];
         }
     }
 
-    *diff = bi->compare(bi->context, node->data, node->size, data, size);
+    /* The children of the last node are array elements */
+    n = 2*(index - ((size_t)1 << (t->O - 1)));
+    ACCESS_ELEMENT(n);
+    if (IS_BLANK(ARRAY_AT(n)) || COMPARE_AT(n, data, size) < 0)
+    {
+        n += 1;
+        ACCESS_ELEMENT(n);
+    }
 
-    /* Convert pointer to index (a bit ugly) */
-    return ARRAY_IDX(node->array);
+    *diff = COMPARE_AT(n, data, size);
+
+    return n;
 }
 
-/* Recomputes the population count for windows in range [i:j) */
-static void recompute_populations(Bender_Impl *bi, size_t i, size_t j)
+/* Creates an empty table of order ``order''. */
+static void create_table(Bender_Impl *bi, Bender_Table *t, int order)
 {
-    size_t p, n;
+    int l;
 
-    p = i*WINDOW_SIZE(bi->L - 1);
-    while (i < j)
+    /* Allocate file; we need C array elements and C-1 interior tree nodes.
+       (Since the allocated memory is zero-filled, all values are blank.) */
+    t->O    = order;
+    t->data = (*bi->allocator)(&t->alloc, NULL,
+        ((sizeof(ArrayNode) + bi->V)<<order) +
+        sizeof(size_t)*NODE_WORDS*(((size_t)1<<order) - 1) );
+    assert(t->data != NULL);
+
+    /* Create levels */
+    t->L = order - log2i(order) + 1;
+    assert(t->L >= 2);
+    t->upper_bound = malloc(sizeof(size_t)*t->L);
+    t->population  = malloc(sizeof(size_t)*2*NUM_WINDOWS(t->L - 1));
+    assert(t->upper_bound != NULL && t->population != NULL);
+    for (l = 0; l < t->L; ++l)
     {
-        bi->population[i] = 0;
-        for (n = 0; n < WINDOW_SIZE(bi->L-1); ++n)
-        {
-            bi->population[i] += ARRAY_AT(p)->size != (size_t)-1;
-            p += 1;
-        }
-        ++i;
+        t->upper_bound[l] = (size_t)WINDOW_SIZE(l)*
+            (bi->density + (1 - bi->density)*l/(t->L - 1));
     }
+    memset(t->population, 0, sizeof(size_t)*2*NUM_WINDOWS(t->L - 1));
+
+    /* Locate tree index (which is blank, like the array) */
+    t->tree = (size_t*)(t->data + ((sizeof(ArrayNode) + bi->V)<<order));
+    VEB_Layout_init(&t->layout, order);
 }
 
-static void resize(Bender_Impl *bi, int new_order)
+/* Frees all resources associated with a table. */
+static void destroy_table(Bender_Impl *bi, Bender_Table *t)
 {
-    int l;
-    size_t n;
+    (*bi->allocator)(&t->alloc, t->data, 0);
+    free(t->upper_bound);
+    free(t->population);
+}
+
+typedef struct Redistribution    Redistribution;
+typedef struct RedistributeTask  RedistributeTask;
+
+/* A window being redistributed by multiple threads */
+struct Redistribution
+{
+    Bender_Impl         *bi;
+    Bender_Table        *t;
+    size_t              begin;      /* Start of window */
+    size_t              W;          /* Size of window */
+    size_t              T;          /* Number of elements after merging */
+    size_t              m;          /* Number of new elements */
+    const void * const  *data;      /* Data of new elements */
+    const size_t        *size;      /* Size of new elements */
+    const size_t        *rank;      /* Ranks of new elements */
+    char                *buffer;    /* Packed existing elements */
+};
+
+/* The part of a redistribution performed by a single thread: packing the
+   elements in range [begin:end) of the array into the buffer starting at
+   ``offset'', or spreading elements with ranks in range [first:last) over
+   the window. */
+struct RedistributeTask
+{
+    const Redistribution *r;
+    size_t              begin, end, offset;
+    size_t              first, last;
+};
+
+/* Packs a range of the array into the buffer (see RedistributeTask) */
+static void *pack_part(void *arg)
+{
+    const RedistributeTask *task = arg;
+    Bender_Impl *bi = task->r->bi;
+    Bender_Table *t = task->r->t;
+    char *q;
+    size_t p, e;
+
+    q = task->r->buffer + task->offset*ARRAY_ELEM_SIZE;
+    p = task->begin;
+    while (p < task->end)
+    {
+        /* Copy run of non-blank elements [p:e) */
+        for (e = p; e < task->end && !IS_BLANK(ARRAY_AT(e)); ++e) { }
+        memcpy(q, ARRAY_AT(p), (e - p)*ARRAY_ELEM_SIZE);
+        q += (e - p)*ARRAY_ELEM_SIZE;
+
+        /* Skip blanks */
+        for (p = e; p < task->end && IS_BLANK(ARRAY_AT(p)); ++p) { }
+    }
 
-    /* Resize file; we need C array elements and 2*C-1 tree nodes. */
-    bi->data = (*bi->allocator)(&bi->alloc, bi->data, 
-        ((sizeof(ArrayNode) + bi->V)<<new_order) +
-        2*((sizeof(TreeNode) + bi->V)<<(new_order)) - 1);
-    assert(bi->data != NULL);
+    return NULL;
+}
 
-    /* Write blank values to the new part of the array */
-    for ( n = (bi->O > 0) ? ((size_t)1 << (bi->O)) : 0;
-          n < ((size_t)1 << new_order); ++n )
+/* Spreads a range of elements over the window (see RedistributeTask) */
+static void *spread_part(void *arg)
+{
+    const RedistributeTask *task = arg;
+    const Redistribution *r = task->r;
+    Bender_Impl *bi = r->bi;
+    Bender_Table *t = r->t;
+    size_t j, k, n, p, x;
+
+    /* Find first new element in range */
+    for (k = 0; k < r->m && r->rank[k] + k < task->first; ++k) { }
+
+    p = r->begin + (task->first == 0 ? 0 :
+                    SPREAD_OFFSET(task->first - 1, r->T, r->W) + 1);
+    for (j = task->first; j < task->last; j += n)
     {
-        ARRAY_AT(n)->size = (size_t)-1;
+        /* Blank the gap before the next element */
+        x = r->begin + SPREAD_OFFSET(j, r->T, r->W);
+        while (p < x)
+            ARRAY_AT(p++)->size = 0;
+
+        if (k < r->m && r->rank[k] + k == j)
+        {
+            /* Place new element */
+            ARRAY_AT(x)->size = r->size[k] + 1;
+            memcpy(ARRAY_AT(x)->data, r->data[k], r->size[k]);
+            n = 1;
+            ++k;
+        }
+        else
+        {
+            /* Copy run of existing elements that are placed consecutively */
+            n = 1;
+            while ( j + n < task->last &&
+                    !(k < r->m && r->rank[k] + k == j + n) &&
+                    SPREAD_OFFSET(j + n, r->T, r->W) ==
+                    SPREAD_OFFSET(j, r->T, r->W) + n )
+                ++n;
+            memcpy( ARRAY_AT(x), r->buffer + (j - k)*ARRAY_ELEM_SIZE,
+                    n*ARRAY_ELEM_SIZE );
+        }
+        p = x + n;
     }
-    bi->O = new_order;
 
-    /* Create new levels */
-    free(bi->upper_bound);
-    free(bi->population);
-    bi->L = new_order - log2i(new_order) + 1;
-    assert(bi->L >= 2);
-    bi->upper_bound = malloc(sizeof(size_t)*bi->L);
-    bi->population  = malloc(sizeof(size_t)*NUM_WINDOWS(bi->L - 1));
-    for (l = 0; l < bi->L; ++l)
+    return NULL;
+}
+
+/* Calls ``func'' for each of the ``n'' tasks in parallel and waits for all
+   of them to complete. */
+static void run_tasks( void *(*func)(void *), RedistributeTask *tasks, int n )
+{
+    pthread_t thread[MAX_THREADS];
+    bool started[MAX_THREADS];
+    int i;
+
+    for (i = 1; i < n; ++i)
+        started[i] = pthread_create(&thread[i], NULL, func, &tasks[i]) == 0;
+    func(&tasks[0]);
+    for (i = 1; i < n; ++i)
     {
-        bi->upper_bound[l] = (size_t)WINDOW_SIZE(l)*
-            (bi->density + (1 - bi->density)*l/(bi->L - 1));
+        if (started[i])
+            pthread_join(thread[i], NULL);
+        else
+            func(&tasks[i]);
     }
+}
 
-    /* Recompute population counts */
-    recompute_populations(bi, 0, NUM_WINDOWS(bi->L - 1));
+/* Redistributes a large window like merge_and_redistribute(), using multiple
+   threads: the existing elements are first packed into a temporary buffer
+   (each thread packing part of the window to a position in the buffer that
+   follows from the population counts) after which they are spread over the
+   window again (each thread filling the slots for a range of ranks).
+
+   Returns false if only a single processor is available or the buffer could
+   not be allocated, in which case nothing is modified. */
+static bool parallel_redistribute( Bender_Impl *bi, Bender_Table *t,
+    size_t begin, size_t end, size_t N, size_t m,
+    const void * const *data, const size_t *size, size_t *idx )
+{
+    RedistributeTask tasks[MAX_THREADS];
+    Redistribution r;
+    size_t k, i, p, leaves;
+    long threads;
+    int n;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 2)
+        return false;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    r.buffer = malloc(N*ARRAY_ELEM_SIZE + 1);
+    if (r.buffer == NULL)
+        return false;
+
+    /* Replace the insertion indices of new elements by the number of
+       existing elements that precede them. */
+    for (k = 0; k < m; ++k)
+    {
+        i = idx[k]/WINDOW_SIZE(t->L - 1)*WINDOW_SIZE(t->L - 1);
+        p = idx[k];
+        idx[k] = count(t, begin, i);
+        for ( ; i < p; ++i)
+            idx[k] += !IS_BLANK(ARRAY_AT(i));
+    }
 
-    /* Recreate tree index */
-    bi->tree = (TreeNode*)(bi->data +
-                          ((sizeof(ArrayNode) + bi->V)<<new_order));
-    create_tree(bi);
+    r.bi    = bi;
+    r.t     = t;
+    r.begin = begin;
+    r.W     = end - begin;
+    r.T     = N + m;
+    r.m     = m;
+    r.data  = data;
+    r.size  = size;
+    r.rank  = idx;
+
+    /* Pack existing elements, dividing the window at lowest-level window
+       boundaries. */
+    leaves = (end - begin)/WINDOW_SIZE(t->L - 1);
+    for (n = 0; n < threads; ++n)
+    {
+        tasks[n].r      = &r;
+        tasks[n].begin  = begin + leaves*n/threads*WINDOW_SIZE(t->L - 1);
+        tasks[n].end    = begin + leaves*(n + 1)/threads*WINDOW_SIZE(t->L - 1);
+        tasks[n].offset = count(t, begin, tasks[n].begin);
+        tasks[n].first  = r.T*n/threads;
+        tasks[n].last   = r.T*(n + 1)/threads;
+    }
+    run_tasks(pack_part, tasks, threads);
 
-    /* Update entire tree */
-    update_tree_window(bi, bi->tree, 0, 0, C);
+    /* Spread elements over the window */
+    run_tasks(spread_part, tasks, threads);
 
-    /* debug_dump_tree(bi, "tree.dot"); */
+    free(r.buffer);
+    return true;
 }
 
-/* Redistributes window ``win'' at level ``lev'' containing ``N'' elements
-   while inserting a new data element (described by ``data'' and ``size'')
-   at index ``idx''. The caller must ensure that the window has a free slot. */
-static void insert_and_redistribute (Bender_Impl *bi,
-    int lev, size_t win, size_t idx, size_t N, const void *data, size_t size )
+/* Redistributes the window [begin:end) containing ``N'' elements while
+   merging ``m'' new data elements into it (described by ``data'' and
+   ``size'', in order) which are to be inserted before the elements at
+   indices ``idx'' (which is overwritten). The caller must ensure that the
+   window has enough free slots. The window must be aligned to the
+   lowest-level windows.
+
+   "Evenly" redistributing means that if the window has size W and will
+   contain T elements, then the element with rank r is placed at offset
+   ceil((r + 1)*W/T) - 1, so elements are separated by gaps that differ in
+   size by at most one and the last slot of the window is occupied.
+   Consecutive elements that stay consecutive are moved as a block. */
+static void merge_and_redistribute( Bender_Impl *bi, Bender_Table *t,
+    size_t begin, size_t end, size_t N, size_t m,
+    const void * const *data, const size_t *size, size_t *idx )
 {
-    size_t begin, end, n, p, q, W;
+    size_t k, e, p, q, r, x, j, T, W, run;
 
-    W = WINDOW_SIZE(lev);
-    begin = win*W;
-    end   = begin + W;
-    /* printf("Redistributing window %d on level %d/%d (%d/%d elements); inserting at %d\n",
-              (int)win, (int)lev, bi->L, (int)N + 1, (int)W, (int)idx); */
+    W = end - begin;
+    T = N + m;
+    assert(T <= W);
+    ACCESS_ARRAY(begin, end);
 
-    /* We start by packing all the elements to the front of the array.
-       If there is a gap at or before ``idx'' this is easy, otherwise
-       we need to do something smart.
+    if ( W >= PARALLEL_MIN_WINDOW &&
+         parallel_redistribute(bi, t, begin, end, N, m, data, size, idx) )
+    {
+        spread_populations(t, begin, end, T);
+        return;
+    }
 
-       In the following, p will iterate from begin to end over the original
-       data and q will indicate where the next element is written, so
-       q <= p. The goal is to pack all elements (including the new one) in
-       range [begin:q).
-    */
+    /* Pack existing elements to the front of the window, and replace the
+       insertion indices of new elements by the number of existing elements
+       that precede them. */
+    q = begin;
+    k = 0;
+    p = begin;
+    while (p < end)
+    {
+        /* Skip blanks, and find run of non-blank elements [p:r) */
+        while (p < end && IS_BLANK(ARRAY_AT(p)))
+            ++p;
+        for (r = p; r < end && !IS_BLANK(ARRAY_AT(r)); ++r) { }
 
-    /* Find first gap. */
-    for (p = begin; p < idx; ++p)
+        while (k < m && idx[k] < r)
+        {
+            idx[k] = q - begin + (idx[k] > p ? idx[k] - p : 0);
+            ++k;
+        }
+        if (q != p)
+            ARRAY_MOVE(ARRAY_AT(q), ARRAY_AT(p), r - p);
+        q += r - p;
+        p = r;
+    }
+    while (k < m)
+        idx[k++] = q - begin;
+    assert(q - begin == N);
+
+    /* Redistribute elements evenly while merging new elements with the
+       packed ones, working backwards so that packed elements are never
+       overwritten before they have been moved. Existing elements that are
+       placed consecutively are collected in a run (of ``run'' elements
+       starting at ``e'', to be moved to ``p'') which is moved at once. */
+    e = N;
+    k = m;
+    p = end;
+    run = 0;
+    for (j = T; j > 0; --j)
     {
-        if (ARRAY_AT(p)->size == (size_t)-1)
-            break;
+        x = begin + SPREAD_OFFSET(j - 1, T, W);
+        if ((k > 0 && idx[k - 1] >= e) || x + 1 != p)
+        {
+            /* Move pending run and blank the gap after the element */
+            ARRAY_MOVE(ARRAY_AT(p), ARRAY_AT(begin + e), run);
+            run = 0;
+            for (q = x + 1; q < p; ++q)
+                ARRAY_AT(q)->size = 0;
+        }
+        if (k > 0 && idx[k - 1] >= e)
+        {
+            /* Place new element */
+            k -= 1;
+            ARRAY_AT(x)->size = size[k] + 1;
+            memcpy(ARRAY_AT(x)->data, data[k], size[k]);
+        }
+        else
+        {
+            /* Add existing element to run */
+            e -= 1;
+            run += 1;
+        }
+        p = x;
     }
-    q = p; /* elements in range [begin:p) are already packed */
+    ARRAY_MOVE(ARRAY_AT(p), ARRAY_AT(begin + e), run);
+    for (q = begin; q < p; ++q)
+        ARRAY_AT(q)->size = 0;
+    assert(k == 0 && e == 0);
+
+    /* Update population counts. */
+    spread_populations(t, begin, end, T);
+}
+
+/* Returns the number of elements in each window at the i-th level of
+   table ``s''. */
+#define WINDOW_SIZE_OF(s, i) ((size_t)1 << ((s)->O - (i)))
+
+/* Returns a pointer to the i-th element in the data array of table ``s''. */
+#define TABLE_AT(s, i) ((ArrayNode*)((s)->data+(i)*(sizeof(ArrayNode)+bi->V)))
+
+/* Starts growing the set: the current table becomes the old table, and a new
+   (empty) table of twice the capacity is created, into which the contents of
+   the old table are migrated by subsequent calls to migrate(). */
+static void grow(Bender_Impl *bi)
+{
+    Bender_Table *t = bi->table;
+    unsigned long long start = TRACE_START();
+
+    assert(bi->old == NULL);
+
+    /* printf("growing to %d\n", t->O + 1); */
+    bi->old      = t;
+    bi->table    = (t == &bi->tables[0]) ? &bi->tables[1] : &bi->tables[0];
+    bi->migrated = 0;
+    create_table(bi, bi->table, t->O + 1);
+    TRACE_END(TRACE_BENDER_GROW, start, t->O + 1, (size_t)1 << (t->O + 1));
+}
+
+/* Migrates the next ``windows'' lowest-level windows of the old table into
+   the current table, and frees the old table when it has been migrated
+   entirely.
 
-    if (p < idx)
+   The value at index i in the old table is copied to index 2i in the new
+   table, which preserves the distribution of values over the array (at half
+   the density) without having to search or rebalance anything. This works
+   because the new table is only modified below index 2i (see
+   Bender_Impl_insert()) until value i has been migrated. */
+static void migrate(Bender_Impl *bi, size_t windows)
+{
+    Bender_Table *s = bi->old, *t = bi->table;
+    size_t n, begin, end;
+
+    if (s == NULL)
+        return;
+
+    begin = bi->migrated*WINDOW_SIZE_OF(s, s->L - 1);
+    end   = begin + windows*WINDOW_SIZE_OF(s, s->L - 1);
+    if (end > ((size_t)1 << s->O))
+        end = (size_t)1 << s->O;
+
+    CACHE_ACCESS(TABLE_AT(s, begin), (end - begin)*ARRAY_ELEM_SIZE);
+    ACCESS_ARRAY(2*begin, 2*end);
+    for (n = begin; n < end; ++n)
     {
-        /* Copy remaining elements before ``idx''. */
-        for ( ; p < idx; ++p)
+        if (!IS_BLANK(TABLE_AT(s, n)))
         {
-            if (ARRAY_AT(p)->size != (size_t)-1)
-            {
-                ARRAY_COPY(ARRAY_AT(q), ARRAY_AT(p));
-                q += 1;
-            }
+            ARRAY_COPY(ARRAY_AT(2*n), TABLE_AT(s, n));
+            POPULATION(t->L - 1, 2*n/WINDOW_SIZE(t->L - 1)) += 1;
         }
+    }
+    bi->migrated = end/WINDOW_SIZE_OF(s, s->L - 1);
+
+    /* Update population counts and tree index of the new table. (Twice the
+       size of a lowest-level window of the old table is always a multiple
+       of the size of a lowest-level window of the new table.) */
+    update_populations( t, 2*begin/WINDOW_SIZE(t->L - 1),
+                           2*end/WINDOW_SIZE(t->L - 1) );
+    update_tree_window(bi, t, 2*begin, 2*end);
 
-        /* Insert new element. */
-        ARRAY_AT(q)->size = size;
-        memcpy(ARRAY_AT(q)->data, data, size);
-        q += 1;
+    if (end == ((size_t)1 << s->O))
+    {
+        destroy_table(bi, s);
+        bi->old = NULL;
     }
-    else
+}
+
+/* Inserts a value that is not yet present in table ``t'' at index ``i''
+   (which is the index of its successor) while modifying only elements in
+   the range [lo:hi), which must be aligned to the lowest-level windows.
+
+   Normally, the range spans the entire table, and the smallest window that
+   is not overflowing is rebalanced. While migrating, windows are clipped to
+   the range and their upper bounds are scaled accordingly, and if all of
+   them are overflowing, the smallest window with a free slot is used.
+
+   Returns false if no suitable window exists (in which case the table is
+   unmodified). */
+static bool table_insert( Bender_Impl *bi, Bender_Table *t, size_t i,
+                          const void *key_data, size_t key_size,
+                          size_t lo, size_t hi )
+{
+    size_t j, begin, end, N;
+    unsigned long long start;
+    int lev;
+
+    if (opt_fast_update)
     {
-        /* No gap before ``idx''; find first gap after ``idx''.*/
-        for ( ; p < end; ++p)
+        /* Find size of gap before successor (looking no further back than
+           the size of a lowest-level window, to bound the cost of scanning
+           a nearly empty array) */
+        j = i;
+        while ( j > lo && i - j < WINDOW_SIZE(t->L - 1) &&
+                IS_BLANK(ARRAY_AT(j - 1)) )
+            --j;
+        ACCESS_ARRAY(j > lo ? j - 1 : j, i);
+
+        if (j < i)
         {
-            if (ARRAY_AT(p)->size == (size_t)-1)
-                break;
+            /* Insert in the middle of the gap. */
+            overwrite_blank(bi, t, (i + j)/2, key_data, key_size);
+            return true;
         }
+    }
 
-        /* Now move consecutive elements one place to the right to create
-           a gap to insert the new element in */
-        for (n = p; n > q; --n)
-            ARRAY_COPY(ARRAY_AT(n), ARRAY_AT(n - 1));
-
-        /* Insert new element in newly created gap */
-        ARRAY_AT(q)->size = size;
-        memcpy(ARRAY_AT(q)->data, data, size);
+    /* There was no free space; we need to rebalance a window to fit the
+       element in. */
+    j = (i == hi) ? i - 1 : i;
+    assert(j >= lo && j < hi);
 
-        q = p; /* [begin:p) is packed */
+    /* Find a suitable window */
+    for (lev = t->L - 1; lev >= 0; --lev)
+    {
+        begin = j/WINDOW_SIZE(lev)*WINDOW_SIZE(lev);
+        end   = begin + WINDOW_SIZE(lev);
+        if (begin >= lo && end <= hi)
+        {
+            N = POPULATION(lev, j/WINDOW_SIZE(lev));
+        }
+        else
+        {
+            if (begin < lo)
+                begin = lo;
+            if (end > hi)
+                end = hi;
+            N = count(t, begin, end);
+        }
+        if ( (unsigned long long)N*WINDOW_SIZE(lev) <
+             (unsigned long long)t->upper_bound[lev]*(end - begin) )
+            break;
     }
-
-    /* Copy remaining elements after ``idx'' */
-    for ( ; p < end; ++p)
+    if (lev < 0 && bi->old != NULL)
     {
-        if (ARRAY_AT(p)->size != (size_t)-1)
+        /* While migrating, the current table may not grow and the old table
+           need not stay balanced; settle for any window with a free slot. */
+        for (lev = t->L - 1; lev >= 0; --lev)
         {
-            ARRAY_COPY(ARRAY_AT(q), ARRAY_AT(p));
-            q += 1;
+            begin = j/WINDOW_SIZE(lev)*WINDOW_SIZE(lev);
+            end   = begin + WINDOW_SIZE(lev);
+            if (begin < lo)
+                begin = lo;
+            if (end > hi)
+                end = hi;
+            N = count(t, begin, end);
+            if (N < end - begin)
+                break;
         }
     }
+    if (lev < 0)
+        return false;
 
-    /* At this point, elements are packed into the range [begin:q) and the
-       contents of [q:end) are undefined. (Not necessarily all blank!) */
+    start = TRACE_START();
+    merge_and_redistribute(bi, t, begin, end, N, 1, &key_data, &key_size, &i);
+    TRACE_END(TRACE_BENDER_REDISTRIBUTE, start, lev, end - begin);
+    /* debug_check_counts(bi, t); */
+
+    /* Now update tree index to reflect the changes */
+    update_tree_window(bi, t, begin, end);
+    /* debug_dump_tree(bi, t, "tree.dot"); */
 
+    return true;
+}
 
-    /* Redistribute elements evenly.
+/* Returns whether table ``t'' contains the given value. */
+static bool table_contains( Bender_Impl *bi, Bender_Table *t,
+                            const void *key_data, size_t key_size )
+{
+    int diff;
 
-       "Evenly" means that if the window has size "W" and contains "N"
-       elements, then there are (W-N) spaces to be divided over N+1 gaps,
-       which means that each gap is at least (W-N)/(N+1) (rounded down)
-       in size; there are (W-N)%(N+1) gaps with an extra space, which must
-       be divided uniformly over all windows.
-    */
-    N += 1;
+    return find_successor(bi, t, key_data, key_size, &diff) < C && diff == 0;
+}
 
-    p = end;
-    while (p > begin)
+/* Merges ``n'' new values (described by ``data'' and ``size'', in order)
+   into the current table, given the indices of their successors in ``idx'',
+   rebalancing each affected window only once. Changed ranges are collected
+   in ``begin'' and ``end'' (which must have room for ``n'' entries) so that
+   the tree index can be updated in one pass afterwards.
+
+   Returns the number of values merged, which is less than ``n'' only if
+   the table is full. */
+static size_t merge_batch( Bender_Impl *bi, size_t n,
+    const void * const *data, const size_t *size, size_t *idx,
+    size_t *begin, size_t *end )
+{
+    Bender_Table *t = bi->table;
+    size_t k, m, i, j, N, b, e, ranges;
+    unsigned long long start;
+    int lev;
+
+    k = 0;
+    ranges = 0;
+    while (k < n)
     {
-        /* FIXME: potential overflow here (though unlikely when using 64-bit
-                  aritmetic); try to implement in a safer way (and if possible,
-                  more efficiently as well). */
-        if ((q - begin)*W >= (p - begin)*N)
+        i = idx[k];
+
+        /* Find size of gap before successor (see table_insert()) */
+        j = i;
+        while ( opt_fast_update && j > 0 && i - j < WINDOW_SIZE(t->L - 1) &&
+                IS_BLANK(ARRAY_AT(j - 1)) )
+            --j;
+        if (opt_fast_update)
+            ACCESS_ARRAY(j > 0 ? j - 1 : j, i);
+
+        if (j < i)
         {
-            p -= 1, q -= 1;
-            ARRAY_COPY(ARRAY_AT(p), ARRAY_AT(q));
+            /* Insert in the middle of the gap. (Updating the tree right away
+               is fine: nodes that are out of date because of changes that
+               have not been propagated yet are updated again later.) */
+            overwrite_blank(bi, t, (i + j)/2, data[k], size[k]);
+            k += 1;
+            continue;
         }
-        else
+
+        /* Find the smallest window that can hold all new values that
+           are to be inserted in it. */
+        j = (i == C) ? i - 1 : i;
+        m = 0;
+        for (lev = t->L - 1; lev >= 0; --lev)
+        {
+            b = j/WINDOW_SIZE(lev)*WINDOW_SIZE(lev);
+            e = b + WINDOW_SIZE(lev);
+            while (k + m < n && (idx[k + m] == C ? C - 1 : idx[k + m]) < e)
+                ++m;
+            N = POPULATION(lev, j/WINDOW_SIZE(lev));
+            if (N + m <= t->upper_bound[lev] && N + m <= e - b)
+                break;
+        }
+        if (lev < 0)
+            break;  /* Array is full */
+
+        start = TRACE_START();
+        merge_and_redistribute( bi, t, b, e, N, m,
+                                data + k, size + k, idx + k );
+        TRACE_END(TRACE_BENDER_REDISTRIBUTE, start, lev, e - b);
+        k += m;
+
+        /* Add to changed ranges, merging overlapping ones */
+        while (ranges > 0 && b <= end[ranges - 1])
         {
-            p -= 1;
-            ARRAY_AT(p)->size = (size_t)-1;
+            --ranges;
+            if (begin[ranges] < b)
+                b = begin[ranges];
+            if (end[ranges] > e)
+                e = end[ranges];
         }
+        begin[ranges] = b;
+        end[ranges]   = e;
+        ++ranges;
     }
 
-    /* Update population counts. */
-    recompute_populations( bi, win << (bi->L - 1 - lev),
-                               (win + 1) << (bi->L - 1 - lev) );
+    /* Now update tree index to reflect the changes */
+    if (ranges > 0)
+        update_tree_ranges(bi, t, begin, end, ranges);
+    /* debug_check_counts(bi, t); */
+
+    return k;
 }
 
+/* Orders batch entries by value, and equal values by their index in the
+   batch. */
+static int compare_entries(const void *a, const void *b, void *arg)
+{
+    Bender_Impl *bi = arg;
+    const BatchEntry *x = a, *y = b;
+    int d;
+
+    d = bi->compare(bi->context, x->data, x->size, y->data, y->size);
+    if (d == 0)
+        d = (x->input > y->input) - (x->input < y->input);
+    return d;
+}
 
 void Bender_Impl_create( Bender_Impl *bi, Allocator *allocator,
-                         size_t value_size, double density )
+    size_t value_size, double density,
+    unsigned long long (*prefix)(const void *, const void *, size_t) )
 {
     /* Check for valid size (positive integer multiple of sizeof(size_t)) */
     assert(value_size > 0 && value_size%sizeof(size_t) == 0);
 
     /* Initialize structure */
     bi->V           = value_size;
-    bi->O           = 0;
-    bi->L           = 0;
     bi->density     = density;
-    bi->upper_bound = NULL;
-    bi->population  = NULL;
-    bi->data        = NULL;
+    bi->table       = &bi->tables[0];
+    bi->old         = NULL;
+    bi->migrated    = 0;
     bi->allocator   = allocator;
-    resize(bi, 4);
+    bi->prefix      = prefix;
+    create_table(bi, bi->table, 4);
 }
 
 void Bender_Impl_destroy(Bender_Impl *bi)
 {
-    (*bi->allocator)(&bi->alloc, bi->data, 0);
+    destroy_table(bi, bi->table);
+    if (bi->old != NULL)
+        destroy_table(bi, bi->old);
 }
 
 bool Bender_Impl_insert( Bender_Impl *bi,
                          const void *key_data, size_t key_size )
 {
-    size_t i, j, win, N;
-    int lev, diff;
+    Bender_Table *t;
+    size_t i, f;
+    int diff;
 
     assert(key_size <= bi->V);
 
-    /* First, find successor node */
-    i = find_successor(bi, key_data, key_size, &diff);
-    if (i < C && diff == 0)
-        return true;    /* value already exists */
-
-    if (opt_fast_update)
+    for (;;)
     {
-        /* Find size of gap before successor */
-        j = i;
-        while (j > 0 && ARRAY_AT(j - 1)->size == (size_t)-1)
-            --j;
-
-        if (j < i)
+        if (bi->old == NULL)
         {
-            /* Insert in the middle of the gap. */
-            overwrite_blank(bi, (i + j)/2, key_data, key_size);
-            return false;
+            t = bi->table;
+            i = find_successor(bi, t, key_data, key_size, &diff);
+            if (i < C && diff == 0)
+                return true;    /* value already exists */
+
+            if (table_insert(bi, t, i, key_data, key_size, 0, C))
+                break;
+
+            /* Array is full -- resize to next order of size. */
+            grow(bi);
+            continue;
         }
-    }
 
-    /* There was no free space; we need to rebalance a window to fit the
-       element in. */
-    j = (i == C) ? i - 1 : i;
+        /* While migrating, values in the old table below index ``f'' have
+           been migrated to the current table (but are still present in the
+           old table) and the current table stores only values smaller than
+           those at index ``f'' and above in the old table. */
+        t = bi->old;
+        f = bi->migrated*WINDOW_SIZE(t->L - 1);
+        i = find_successor(bi, t, key_data, key_size, &diff);
+        if (i < C && diff == 0)
+            return true;    /* value already exists */
+
+        if (i >= f)
+        {
+            /* Value belongs in the part that has not been migrated yet. */
+            if (table_insert(bi, t, i, key_data, key_size, f, C))
+                break;
+        }
+        else
+        {
+            /* Value belongs in the part that has been migrated. */
+            t = bi->table;
+            i = find_successor(bi, t, key_data, key_size, &diff);
+            if (i < C && diff == 0)
+                return true;    /* value already exists */
+            if (i > 2*f)
+                i = 2*f;
+
+            if (table_insert(bi, t, i, key_data, key_size, 0, 2*f))
+                break;
+        }
 
-    /* Find a suitable window */
-    lev = bi->L - 1;
-    do {
-        win = j/WINDOW_SIZE(lev);
-        N = count(bi, lev, win);
-    } while (N >= bi->upper_bound[lev] && --lev >= 0);
-    if (lev < 0)
-    {
-        /* Array is full -- resize to next order of size. */
-        /* printf("resizing to %d\n", bi->O + 1); */
-        resize(bi, bi->O + 1);
-        lev = 0;
+        /* No room; migrate some more and try again. */
+        migrate(bi, 1);
     }
 
-    insert_and_redistribute(bi, lev, win, i, N, key_data, key_size);
-    /* debug_check_counts(bi); */
-
-    /* Now update tree index to reflect the changes */
-    update_tree_window( bi, bi->tree, 0,
-                        win*WINDOW_SIZE(lev), (win + 1)*WINDOW_SIZE(lev) );
-    /* debug_dump_tree(bi, "tree.dot"); */
+    /* Migrate part of the old table (if any) */
+    migrate(bi, MIGRATE_WINDOWS);
 
     return false;
 }
@@ -736,7 +1292,145 @@ bool Bender_Impl_insert( Bender_Impl *bi,
 bool Bender_Impl_contains( Bender_Impl *bi,
                            const void *key_data, size_t key_size )
 {
+    return table_contains(bi, bi->table, key_data, key_size) ||
+           ( bi->old != NULL &&
+             table_contains(bi, bi->old, key_data, key_size) );
+}
+
+bool Bender_Impl_enumerate( Bender_Impl *bi,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    Bender_Table *t;
+    size_t n;
+
+    /* Enumerate values that have not been migrated yet */
+    t = bi->old;
+    if (t != NULL)
+    {
+        for (n = bi->migrated*WINDOW_SIZE(t->L - 1); n < C; ++n)
+        {
+            if ( !IS_BLANK(ARRAY_AT(n)) &&
+                 !callback(arg, ARRAY_AT(n)->data, VALUE_SIZE(ARRAY_AT(n))) )
+                return false;
+        }
+    }
+
+    /* Enumerate values in the current table */
+    t = bi->table;
+    for (n = 0; n < C; ++n)
+    {
+        if ( !IS_BLANK(ARRAY_AT(n)) &&
+             !callback(arg, ARRAY_AT(n)->data, VALUE_SIZE(ARRAY_AT(n))) )
+            return false;
+    }
+
+    return true;
+}
+
+void Bender_Impl_insert_batch( Bender_Impl *bi, size_t num_values,
+    const void * const *key_data, const size_t *key_size, bool *result,
+    void (*prepare)(void *), void *arg )
+{
+    Bender_Table *t;
+    BatchEntry *entries;
+    const void **data;
+    size_t *size, *idx, *begin, *end;
+    size_t n, k, i, j;
     int diff;
 
-    return find_successor(bi, key_data, key_size, &diff) < C && diff == 0;
+    if (num_values == 0)
+        return;
+
+    /* Do the migration work that inserting the values one by one would do,
+       so that the batch can usually be merged into a single table. */
+    migrate(bi, MIGRATE_WINDOWS*num_values);
+
+    entries = malloc(sizeof(BatchEntry)*num_values);
+    data    = malloc(sizeof(void*)*num_values);
+    size    = malloc(sizeof(size_t)*num_values);
+    idx     = malloc(sizeof(size_t)*num_values);
+    begin   = malloc(sizeof(size_t)*num_values);
+    end     = malloc(sizeof(size_t)*num_values);
+    assert( entries != NULL && data != NULL && size != NULL &&
+            idx != NULL && begin != NULL && end != NULL );
+
+    /* Sort values */
+    for (k = 0; k < num_values; ++k)
+    {
+        assert(key_size[k] <= bi->V);
+        entries[k].data  = key_data[k];
+        entries[k].size  = key_size[k];
+        entries[k].input = k;
+    }
+    qsort_r(entries, num_values, sizeof(BatchEntry), compare_entries, bi);
+
+    /* Determine which values are new, and find their successors */
+    t = bi->table;
+    n = 0;
+    for (k = 0; k < num_values; ++k)
+    {
+        if ( k > 0 && bi->compare( bi->context,
+                                   entries[k - 1].data, entries[k - 1].size,
+                                   entries[k].data, entries[k].size ) == 0 )
+        {
+            /* Value occurs earlier in the batch */
+            result[entries[k].input] = true;
+            continue;
+        }
+
+        if (bi->old == NULL)
+        {
+            i = find_successor(bi, t, entries[k].data, entries[k].size, &diff);
+            result[entries[k].input] = i < C && diff == 0;
+        }
+        else
+        {
+            i = 0;  /* unused */
+            result[entries[k].input] =
+                Bender_Impl_contains(bi, entries[k].data, entries[k].size);
+        }
+
+        if (!result[entries[k].input])
+        {
+            data[n] = entries[k].data;
+            size[n] = entries[k].size;
+            idx[n]  = i;
+            ++n;
+        }
+    }
+    free(entries);
+
+    if (prepare != NULL)
+        prepare(arg);
+
+    /* Merge new values into the table. If it fills up, grow it, and if
+       migration can be completed with as much work as inserting the
+       remaining values one by one would do, merge them into the new table. */
+    k = 0;
+    while (bi->old == NULL)
+    {
+        k += merge_batch(bi, n - k, data + k, size + k, idx + k, begin, end);
+        if (k == n)
+            break;
+
+        /* Array is full -- resize to next order of size. */
+        grow(bi);
+        migrate(bi, MIGRATE_WINDOWS*(n - k));
+        if (bi->old == NULL)
+        {
+            t = bi->table;
+            for (j = k; j < n; ++j)
+                idx[j] = find_successor(bi, t, data[j], size[j], &diff);
+        }
+    }
+
+    /* Insert remaining values one by one (while migrating) */
+    for ( ; k < n; ++k)
+        Bender_Impl_insert(bi, data[k], size[k]);
+
+    free(data);
+    free(size);
+    free(idx);
+    free(begin);
+    free(end);
 }
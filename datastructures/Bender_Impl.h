@@ -2,6 +2,7 @@
 #define BENDER_IMPL_H_INCLUDED
 
 #include "Alloc.h"
+#include "VEB_Layout.h"
 
 /* Implementation of Bender's cache-oblivious set data structure.
 
@@ -11,55 +12,69 @@
 */
 
 typedef struct Bender_Impl  Bender_Impl;
+typedef struct Bender_Table Bender_Table;
 typedef struct ArrayNode    ArrayNode;
-typedef struct TreeNode     TreeNode;
+typedef struct PrefixNode   PrefixNode;
 
 struct ArrayNode
 {
-    TreeNode *tree;
-
-    /* NB. Any additional members must be added here, before ``size'', as
-           values are copied by copyinging the contents starting from ``size''.
-    */
-
-    size_t   size;
+    size_t   size;      /* Size of the value plus one, or zero if blank */
     char     data[];
 };
 
-struct TreeNode
+/* A node of the index tree in normalized-key mode. (Otherwise, nodes
+   consist of the index only.) */
+struct PrefixNode
 {
-    TreeNode  *left, *right, *parent;
-    ArrayNode *array;
-
-    /* NB. Any additional members must be added here, before ``size'', as
-           values are copied by copyinging the contents starting from ``size''.
-    */
-
-    size_t    size;
-    char      data[];
+    size_t              index;  /* Index of the rightmost value plus one */
+    unsigned long long  prefix; /* Prefix of the value */
 };
 
-struct Bender_Impl
+/* A sparse array of fixed capacity with its tree index. */
+struct Bender_Table
 {
-    size_t      V;              /* Size of values */
     int         O;              /* Order (capacity == pow(2,order)) */
     int         L;              /* Number of levels */
-    double      density;        /* Upper bound on density on level 0 */
     size_t      *upper_bound;   /* Population upper bound per level */
     size_t      *population;    /* Population per window */
-    TreeNode    *tree;          /* Pointer to index tree root */
+    size_t      *tree;          /* Interior nodes of the index tree */
+    VEB_Layout  layout;         /* Lay-out of the index tree */
     char        *data;          /* Allocated data */
-    Allocator   *allocator;     /* Allocator function */
     Alloc       alloc;          /* Allocator context */
+};
+
+/* When the array overflows, a new table of twice the capacity is created
+   and values are migrated from the old table to the new one a few windows
+   at a time, while both tables are used to answer queries. */
+struct Bender_Impl
+{
+    size_t      V;              /* Size of values */
+    double      density;        /* Upper bound on density on level 0 */
+    Bender_Table *table;        /* Current table */
+    Bender_Table *old;          /* Table being migrated (or NULL) */
+    size_t      migrated;       /* Number of lowest-level windows migrated */
+    Bender_Table tables[2];     /* Storage for current and old table */
+    Allocator   *allocator;     /* Allocator function */
 
     /* Custom comparison function */
     int (*compare)(const void *, const void *, size_t, const void *, size_t);
     const void *context;
+
+    /* Prefix function for normalized-key mode (or NULL) */
+    unsigned long long (*prefix)(const void *, const void *, size_t);
 };
 
-/* Create a Bender set implementation. */
+/* Create a Bender set implementation.
+
+   If ``prefix'' is not NULL, the implementation works in normalized-key
+   mode: ``prefix'' is called (with the context of the comparison function)
+   to map values to integers that are stored in the tree index and compared
+   before calling the comparison function. If the prefix of one value is less
+   than that of another, the first value must compare less than the second.
+*/
 void Bender_Impl_create( Bender_Impl *bi, Allocator *allocator,
-                         size_t value_size, double density );
+    size_t value_size, double density,
+    unsigned long long (*prefix)(const void *, const void *, size_t) );
 
 /* Destroy a Bender set implementation and free all associated resources. */
 void Bender_Impl_destroy(Bender_Impl *bi);
@@ -74,4 +89,24 @@ bool Bender_Impl_insert( Bender_Impl *bi,
 bool Bender_Impl_contains( Bender_Impl *set,
                            const void *key_data, size_t key_size );
 
+/* Inserts ``num_values'' values into a set implementation, with the same results
+   as calling Bender_Impl_insert() for each of them in order, which are
+   stored in ``result''. This is more efficient, since each window that
+   receives new values is rebalanced (and its index updated) only once.
+
+   If ``prepare'' is not NULL, it is called with ``arg'' after it has been
+   determined which values are new (i.e. ``result'' has been filled in) but
+   before any of them have been stored. It may modify the new values, as
+   long as they compare the same. */
+void Bender_Impl_insert_batch( Bender_Impl *bi, size_t num_values,
+    const void * const *key_data, const size_t *key_size, bool *result,
+    void (*prepare)(void *), void *arg );
+
+/* Calls ``callback'' for all values in the set implementation, in no
+   particular order (while the table is being migrated, values in the old
+   and new tables are visited separately). Returns false if the callback
+   stopped the enumeration, or true otherwise. */
+bool Bender_Impl_enumerate( Bender_Impl *bi,
+    bool (*callback)(void *, const void *, size_t), void *arg );
+
 #endif /* ndef BENDER_H_INCLUDED */
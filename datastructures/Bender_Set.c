@@ -1,4 +1,5 @@
 #include "config.h"
+#include "CacheSim.h"
 #include "comparison.h"
 #include "Set.h"
 #include "Bender_Impl.h"
@@ -14,14 +15,68 @@
    implementation is required that keeps different sets storing elements of
    different maximum sizes, ranging from 2**4 to 2**15. (Here, ** denotes
    exponentiation.)
+
+   Alternatively, in variable-length mode, a single implementation is used
+   that stores fixed-size references to keys, which are stored back-to-back
+   in a separate key heap. References are ordered by a hash tag first, so
+   most comparisons do not need to access the heap at all. (As a result,
+   keys are not stored in key order, but no user of the set relies on that.)
+
+   In prefix mode, the implementations work in normalized-key mode (see
+   Bender_Impl_create()) with the first 8 bytes of keys as prefixes, or, in
+   variable-length mode, the tag followed by the first 4 bytes of the key.
+   This requires the default comparison function.
 */
 
+/* Offsets from PROBE up refer to keys being looked up (which are not
+   stored in the key heap): offset PROBE + i refers to set->probes[i]. */
+#define PROBE ((size_t)1 << (8*sizeof(size_t) - 1))
+
 typedef struct Bender_Set Bender_Set;
+typedef struct KeyRef KeyRef;
+typedef struct EnumerateArgs EnumerateArgs;
+typedef struct BatchArgs BatchArgs;
 
 struct Bender_Set
 {
     Set         base;
-    Bender_Impl impl[12];
+    bool        varlen;         /* Use variable-length mode */
+    bool        prefix;         /* Use prefix mode */
+    Bender_Impl impl[12];       /* Only impl[0] is used in varlen mode */
+
+    /* Key heap (used in variable-length mode only) */
+    char        *heap;          /* Key data */
+    size_t      heap_size;      /* Size of key data in use */
+    size_t      heap_capacity;  /* Size of key data allocated */
+    Alloc       heap_alloc;     /* Allocator context */
+    Allocator   *allocator;     /* Allocator function */
+    const void * const *probes; /* Data of keys referred to by PROBE + i */
+    const void  *probe;         /* Storage for probes of a single key */
+};
+
+/* Reference to a key stored in the key heap */
+struct KeyRef
+{
+    unsigned    tag;            /* Hash value of the key */
+    unsigned    size;           /* Size of the key */
+    size_t      offset;         /* Offset of the key in the heap (or PROBE) */
+};
+
+struct EnumerateArgs
+{
+    Bender_Set  *set;
+    bool        (*callback)(void *, const void *, size_t);
+    void        *arg;
+};
+
+struct BatchArgs
+{
+    Bender_Set  *set;
+    size_t      count;
+    const void  * const *key_data;
+    const size_t *key_size;
+    KeyRef      *refs;
+    bool        *result;
 };
 
 /* Computes the index of the set to use for storage.
@@ -35,8 +90,8 @@ static unsigned get_index(size_t size)
     int index;
 
     assert((unsigned)size == size); /* check for overflow */
-    if (size == 0)
-        return 0;
+    if (size <= 16)
+        return 0;   /* also avoids __builtin_clz(0), which is undefined */
     index = (int)(8*sizeof(unsigned) - __builtin_clz(size - 1)) - 4;
 
     return index < 0 ? 0 : (unsigned)index;
@@ -46,9 +101,18 @@ static Bender_Impl *get_impl(Bender_Set *set, size_t key_size)
 {
     unsigned index = get_index(key_size);
     assert(index < 12);
+    assert(!set->prefix || set->base.compare == default_compare);
     return &set->impl[index];
 }
 
+/* Returns the prefix of a key; used as the prefix function of the
+   implementations in prefix mode. */
+static unsigned long long key_prefix( const void *ignored,
+                                      const void *data, size_t size )
+{
+    return default_prefix(data, size);
+}
+
 static bool set_insert(Bender_Set *set, const void *key_data, size_t key_size)
 {
     Bender_Impl *impl = get_impl(set, key_size);
@@ -65,19 +129,261 @@ static bool set_contains(Bender_Set *set, const void *key_data, size_t key_size)
     return Bender_Impl_contains(impl, key_data, key_size);
 }
 
+/* Returns the key data referred to by ``ref''. */
+static const void *ref_data(const Bender_Set *set, const KeyRef *ref)
+{
+    return ref->offset >= PROBE ? set->probes[ref->offset - PROBE]
+                                : set->heap + ref->offset;
+}
+
+/* Compares two key references; used as the comparison function of the
+   implementation in variable-length mode. */
+static int compare_refs( const void *context, const void *data1, size_t size1,
+                                              const void *data2, size_t size2 )
+{
+    const Bender_Set *set = context;
+    const KeyRef *r1 = data1, *r2 = data2;
+
+    assert(size1 == sizeof(KeyRef) && size2 == sizeof(KeyRef));
+
+    if (r1->tag != r2->tag)
+        return r1->tag < r2->tag ? -1 : +1;
+
+    if (r1->offset < PROBE)
+        CACHE_ACCESS(set->heap + r1->offset, r1->size);
+    if (r2->offset < PROBE)
+        CACHE_ACCESS(set->heap + r2->offset, r2->size);
+    return set->base.compare( set->base.context,
+                              ref_data(set, r1), r1->size,
+                              ref_data(set, r2), r2->size );
+}
+
+/* Returns the prefix of a key reference (its tag, followed by the first
+   4 bytes of the key); used as the prefix function of the implementation
+   in variable-length prefix mode. */
+static unsigned long long ref_prefix( const void *context,
+                                      const void *data, size_t size )
+{
+    const Bender_Set *set = context;
+    const KeyRef *ref = data;
+
+    assert(size == sizeof(KeyRef));
+    return ((unsigned long long)ref->tag << 32) |
+           (default_prefix(ref_data(set, ref), ref->size) >> 32);
+}
+
+/* Creates a reference to the key being looked up. */
+static void make_probe( Bender_Set *set, KeyRef *ref,
+                        const void *key_data, size_t key_size )
+{
+    assert((unsigned)key_size == key_size); /* check for overflow */
+    assert(!set->prefix || set->base.compare == default_compare);
+    ref->tag    = set->base.hash(set->base.context, key_data, key_size);
+    ref->size   = (unsigned)key_size;
+    ref->offset = PROBE;
+    set->probe  = key_data;
+    set->probes = &set->probe;
+    set->impl[0].compare = compare_refs;
+    set->impl[0].context = set;
+}
+
+/* Ensures there is room for ``size'' more bytes in the key heap. */
+static void reserve_heap(Bender_Set *set, size_t size)
+{
+    char *heap;
+    size_t capacity;
+
+    if (set->heap_size + size > set->heap_capacity)
+    {
+        capacity = 2*set->heap_capacity;
+        while (set->heap_size + size > capacity)
+            capacity *= 2;
+        heap = (*set->allocator)(&set->heap_alloc, set->heap, capacity);
+        assert(heap != NULL);
+        set->heap = heap;
+        set->heap_capacity = capacity;
+    }
+}
+
+static bool set_insert_varlen( Bender_Set *set,
+                               const void *key_data, size_t key_size )
+{
+    KeyRef ref;
+
+    /* Append the key to the heap tentatively, and only keep it there if it
+       was actually inserted. */
+    reserve_heap(set, key_size);
+    make_probe(set, &ref, key_data, key_size);
+    memcpy(set->heap + set->heap_size, key_data, key_size);
+    CACHE_ACCESS(set->heap + set->heap_size, key_size);
+    ref.offset = set->heap_size;
+    if (Bender_Impl_insert(&set->impl[0], &ref, sizeof(ref)))
+        return true;
+    set->heap_size += key_size;
+    return false;
+}
+
+static bool set_contains_varlen( Bender_Set *set,
+                                 const void *key_data, size_t key_size )
+{
+    KeyRef ref;
+
+    make_probe(set, &ref, key_data, key_size);
+    return Bender_Impl_contains(&set->impl[0], &ref, sizeof(ref));
+}
+
+/* Stores the keys of a batch that are new in the key heap, and updates
+   their references accordingly (called by Bender_Impl_insert_batch()). */
+static void store_batch(BatchArgs *args)
+{
+    Bender_Set *set = args->set;
+    size_t n;
+
+    for (n = 0; n < args->count; ++n)
+    {
+        if (!args->result[n])
+        {
+            reserve_heap(set, args->key_size[n]);
+            memcpy( set->heap + set->heap_size,
+                    args->key_data[n], args->key_size[n] );
+            args->refs[n].offset = set->heap_size;
+            set->heap_size += args->key_size[n];
+        }
+    }
+}
+
+static void set_insert_batch_varlen( Bender_Set *set, size_t count,
+    const void * const *key_data, const size_t *key_size, bool *result )
+{
+    BatchArgs args;
+    const void **ref_data;
+    size_t *ref_size, n;
+
+    args.set      = set;
+    args.count    = count;
+    args.key_data = key_data;
+    args.key_size = key_size;
+    args.result   = result;
+    args.refs     = malloc(sizeof(KeyRef)*count);
+    ref_data      = malloc(sizeof(void*)*count);
+    ref_size      = malloc(sizeof(size_t)*count);
+    assert(args.refs != NULL && ref_data != NULL && ref_size != NULL);
+
+    /* Refer to the keys in the batch until they are stored in the heap */
+    for (n = 0; n < count; ++n)
+    {
+        make_probe(set, &args.refs[n], key_data[n], key_size[n]);
+        args.refs[n].offset = PROBE + n;
+        ref_data[n] = &args.refs[n];
+        ref_size[n] = sizeof(KeyRef);
+    }
+    set->probes = key_data;
+
+    Bender_Impl_insert_batch( &set->impl[0], count, ref_data, ref_size,
+                              result, (void*)store_batch, &args );
+
+    free(args.refs);
+    free(ref_data);
+    free(ref_size);
+}
+
+/* Resolves a key reference and passes the key to the user's callback */
+static bool enumerate_ref( EnumerateArgs *args,
+                           const void *data, size_t size )
+{
+    const KeyRef *ref = data;
+
+    assert(size == sizeof(KeyRef));
+    return args->callback( args->arg,
+                           args->set->heap + ref->offset, ref->size );
+}
+
+static bool set_enumerate_varlen( Bender_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    EnumerateArgs args;
+
+    args.set      = set;
+    args.callback = callback;
+    args.arg      = arg;
+    return Bender_Impl_enumerate(&set->impl[0], (void*)enumerate_ref, &args);
+}
+
+static void set_insert_batch( Bender_Set *set, size_t count,
+    const void * const *key_data, const size_t *key_size, bool *result )
+{
+    const void **data;
+    size_t *size, *pos, n, m;
+    bool *res;
+    unsigned index;
+
+    data = malloc(sizeof(void*)*count);
+    size = malloc(sizeof(size_t)*count);
+    pos  = malloc(sizeof(size_t)*count);
+    res  = malloc(sizeof(bool)*count);
+    assert(data != NULL && size != NULL && pos != NULL && res != NULL);
+
+    /* Insert the keys stored by each implementation as a separate batch */
+    for (index = 0; index < 12; ++index)
+    {
+        m = 0;
+        for (n = 0; n < count; ++n)
+        {
+            if (get_index(key_size[n]) == index)
+            {
+                data[m] = key_data[n];
+                size[m] = key_size[n];
+                pos[m]  = n;
+                ++m;
+            }
+        }
+        if (m == 0)
+            continue;
+
+        set->impl[index].compare = set->base.compare;
+        set->impl[index].context = set->base.context;
+        Bender_Impl_insert_batch( &set->impl[index], m, data, size, res,
+                                  NULL, NULL );
+        for (n = 0; n < m; ++n)
+            result[pos[n]] = res[n];
+    }
+
+    free(data);
+    free(size);
+    free(pos);
+    free(res);
+}
+
+static bool set_enumerate( Bender_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    int n;
+
+    for (n = 0; n < 12; ++n)
+    {
+        if (!Bender_Impl_enumerate(&set->impl[n], callback, arg))
+            return false;
+    }
+
+    return true;
+}
+
 /* Destroys a set data structure, by closing the backing file
    and freeing all associated resources. */
 static void set_destroy(Bender_Set *set)
 {
     int n;
 
-    for (n = 0; n < 12; ++n)
+    for (n = 0; n < (set->varlen ? 1 : 12); ++n)
         Bender_Impl_destroy(&set->impl[n]);
+    if (set->heap != NULL)
+        (*set->allocator)(&set->heap_alloc, set->heap, 0);
     free(set);
 }
 
 /* Creates a set data structure. */
-Set *Bender_Set_create(Allocator *allocator, double density)
+Set *Bender_Set_create( Allocator *allocator, double density,
+                        bool varlen, bool prefix )
 {
     Bender_Set *set;
     int index;
@@ -87,15 +393,47 @@ Set *Bender_Set_create(Allocator *allocator, double density)
     if (set == NULL)
         return NULL;
 
-    set->base.context  = NULL;
-    set->base.destroy  = (void*)set_destroy;
-    set->base.insert   = (void*)set_insert;
-    set->base.contains = (void*)set_contains;
-    set->base.compare  = default_compare;
+    set->base.context      = NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = (void*)set_insert_batch;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.compare      = default_compare;
+    set->base.hash         = default_hash;
+    set->varlen            = varlen;
+    set->prefix            = prefix;
+    set->heap              = NULL;
+    set->heap_size         = 0;
+    set->heap_capacity     = 0;
+    set->allocator         = allocator;
+    set->probes            = NULL;
+    set->probe             = NULL;
+
+    if (varlen)
+    {
+        set->base.insert       = (void*)set_insert_varlen;
+        set->base.contains     = (void*)set_contains_varlen;
+        set->base.insert_batch = (void*)set_insert_batch_varlen;
+        set->base.enumerate    = (void*)set_enumerate_varlen;
+
+        /* Create key heap and a single set of key references */
+        set->heap_capacity = ALLOC_CHUNK_SIZE;
+        set->heap = (*allocator)(&set->heap_alloc, NULL, set->heap_capacity);
+        if (set->heap == NULL)
+        {
+            free(set);
+            return NULL;
+        }
+        Bender_Impl_create( &set->impl[0], allocator, sizeof(KeyRef),
+                            density, prefix ? ref_prefix : NULL );
+        return &set->base;
+    }
 
     /* Create statically sized sets */
     for (index = 0; index < 12; ++index)
-        Bender_Impl_create(&set->impl[index], allocator, 16 << index, density);
+        Bender_Impl_create( &set->impl[index], allocator, 16 << index,
+                            density, prefix ? key_prefix : NULL );
 
     return &set->base;
 }
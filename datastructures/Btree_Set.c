@@ -8,6 +8,8 @@
 */
 
 #include "config.h"
+#include "CacheSim.h"
+#include "EventTrace.h"
 #include "comparison.h"
 #include "Alloc.h"
 #include "Set.h"
@@ -42,7 +44,7 @@
 */
 
 /* Note: these macros assume 'set' is in scope */
-#define DATA(index)     (set->data + (index)*set->pagesize)
+#define DATA(index)     (page_data(set, (index)))
 #define IDX(p)          ((int*)(DATA(p) + set->pagesize))
 #define COUNT(p)        (IDX(p)[-1])          /* number of values in page */
 #define BEGIN(p, i)     (IDX(p)[-2*(i)-2])    /* offset to start of i-th value */
@@ -63,6 +65,13 @@ typedef struct Btree_Set
     Allocator   *allocator;     /* Allocator function */
     Alloc       alloc;          /* Allocator context */
 
+    /* When pages are cached by a buffer pool (instead of allocated), they
+       must be pinned while they are accessed. */
+    BufferPool  *pool;          /* Buffer pool (or NULL) */
+    int         file;           /* File number in buffer pool */
+    int         last_page;      /* Pinned page last accessed (or -1) */
+    char        *last_data;     /* Contents of last accessed page */
+
     /* Temporary memory pool */
     char        *mem;           /* Allocated memory pool */
     size_t      mem_size;       /* Total amount of memory allocated */
@@ -76,6 +85,44 @@ typedef struct PageEntry
     char   data[1];         /* Data */
 } PageEntry;
 
+/* Returns the contents of the given page (which must be pinned if a buffer
+   pool is used). */
+static char *page_data(Btree_Set *set, int page)
+{
+    if (set->pool == NULL)
+        return set->data + page*set->pagesize;
+    if (page != set->last_page)
+    {
+        set->last_data = BufferPool_data(set->pool, set->file, (size_t)page);
+        set->last_page = page;
+    }
+    return set->last_data;
+}
+
+/* Pins the given page, if a buffer pool is used. The set cannot continue
+   without the page, so the process is aborted if it cannot be read (the
+   shared pool has enough frames that they are never all pinned). */
+static void pin_page(Btree_Set *set, int page, bool create)
+{
+    if ( set->pool != NULL &&
+         BufferPool_pin(set->pool, set->file, (size_t)page, create) == NULL )
+    {
+        perror("Could not read B-tree page from buffer pool");
+        abort();
+    }
+}
+
+/* Unpins the given page, if a buffer pool is used. */
+static void unpin_page(Btree_Set *set, int page, bool dirty)
+{
+    if (set->pool != NULL)
+    {
+        BufferPool_unpin(set->pool, set->file, (size_t)page, dirty);
+        if (page == set->last_page)
+            set->last_page = -1;
+    }
+}
+
 /* Prints the contents of the given page in a human-readable format.
    Useful for debugging. */
 static void debug_print_page(Btree_Set *set, int page, FILE *fp)
@@ -131,19 +178,31 @@ static void *alloc_mem(Btree_Set *set, size_t size)
    and freeing all associated resources. */
 static void set_destroy(Btree_Set *set)
 {
-    set->allocator(&set->alloc, set->data, 0);
+    if (set->pool != NULL)
+        BufferPool_close(set->pool, set->file);
+    else
+        set->allocator(&set->alloc, set->data, 0);
     free(set->mem);
     free(set);
 }
 
-/* Allocates a new page and returns its index. */
+/* Allocates a new page and returns its index. With a buffer pool, the new
+   page is pinned and must be unpinned by the caller. */
 static int create_page(Btree_Set *set)
 {
     int page;
 
     page = set->pages++;
-    set->data = set->allocator(&set->alloc, set->data, set->pages*set->pagesize);
-    assert(set->data != NULL);
+    if (set->pool != NULL)
+    {
+        pin_page(set, page, true);
+    }
+    else
+    {
+        set->data = set->allocator( &set->alloc, set->data,
+                                    set->pages*set->pagesize );
+        assert(set->data != NULL);
+    }
 
     return page;
 }
@@ -182,11 +241,13 @@ static PageEntry *insert_entry( Btree_Set *set,
 
         /* No need to split, just insert */
         result = NULL;
+        k = BEGIN(page, pos);
+        CACHE_ACCESS(DATA(page) + k, size - k);
+        CACHE_ACCESS(DATA(page) + set->pagesize - ISIZE(N+1), ISIZE(N+1));
 
         /* NB. This uses some knowledge of the page lay-out */
 
         /* Insert value at position 'pos' */
-        k = BEGIN(page, pos);
         memmove(DATA(page) + k + entry->size, DATA(page) + k, size - k);
         memcpy(DATA(page) + k, entry->data, entry->size);
 
@@ -203,6 +264,7 @@ static PageEntry *insert_entry( Btree_Set *set,
     {
         /* Split required */
         int n, k, new_page;
+        unsigned long long start = TRACE_START();
 
         /* For now, just split in the middle.
            This works because we require all keys to be less than 1/2 of a
@@ -210,6 +272,8 @@ static PageEntry *insert_entry( Btree_Set *set,
            can always insert the new element in either of the two new pages. */
         k = N/2;
         new_page = create_page(set);
+        CACHE_ACCESS(DATA(page), set->pagesize);
+        CACHE_ACCESS(DATA(new_page), set->pagesize);
 
         /* Take out middle page */
         result = make_entry(set, SIZE(page, k), new_page, DATA(page) + BEGIN(page, k));
@@ -236,6 +300,9 @@ static PageEntry *insert_entry( Btree_Set *set,
             insert_entry(set, page, pos, entry);
         else
             insert_entry(set, new_page, pos - k - 1, entry);
+
+        unpin_page(set, new_page, true);
+        TRACE_END(TRACE_BTREE_SPLIT, start, page, new_page);
     }
 
     return result;
@@ -247,7 +314,9 @@ static PageEntry *find_or_insert_page( Btree_Set *set, int page,
     int N, n, m, child;
     PageEntry *entry;
 
+    pin_page(set, page, false);
     N = COUNT(page);
+    CACHE_ACCESS(&COUNT(page), sizeof(int));
 
     /* Binary search for first element larger than key. */
     n = 0;
@@ -257,6 +326,8 @@ static PageEntry *find_or_insert_page( Btree_Set *set, int page,
         int d, mid;
 
         mid = (n + m)/2;
+        CACHE_ACCESS(&END(page, mid), 2*sizeof(int));
+        CACHE_ACCESS(DATA(page) + BEGIN(page, mid), SIZE(page, mid));
         d = set->base.compare( set->base.context,
                                DATA(page) + BEGIN(page, mid), SIZE(page, mid),
                                key_data, key_size );
@@ -273,6 +344,7 @@ static PageEntry *find_or_insert_page( Btree_Set *set, int page,
         else
         {
             /* Entry found! */
+            unpin_page(set, page, false);
             *found = true;
             return NULL;
         }
@@ -281,6 +353,7 @@ static PageEntry *find_or_insert_page( Btree_Set *set, int page,
     /* Entry was not found in the current page.
        Search child page, if there is one. */
     child = CHILD(page, n);
+    CACHE_ACCESS(&CHILD(page, n), sizeof(int));
     if (child == -1)
     {
         if (*found)
@@ -305,6 +378,11 @@ static PageEntry *find_or_insert_page( Btree_Set *set, int page,
     {
         /* We must insert the given entry in this page at index n */
         entry = insert_entry(set, page, n, entry);
+        unpin_page(set, page, true);
+    }
+    else
+    {
+        unpin_page(set, page, false);
     }
 
     return entry;
@@ -322,6 +400,7 @@ static bool find_or_insert( Btree_Set *set,
     if (entry != NULL)
     {
         /* New root page must be created */
+        unsigned long long start = TRACE_START();
         int page = create_page(set);
         COUNT(page) = 1;
         BEGIN(page, 0) = 0;
@@ -329,6 +408,8 @@ static bool find_or_insert( Btree_Set *set,
         memcpy(DATA(page), entry->data, entry->size);
         CHILD(page, 0) = set->root;
         CHILD(page, 1) = entry->child;
+        unpin_page(set, page, true);
+        TRACE_END(TRACE_BTREE_NEW_ROOT, start, page, set->root);
         set->root = page;
     }
 
@@ -349,7 +430,38 @@ static bool set_contains(Btree_Set *set, const void *key_data, size_t key_size)
     return find_or_insert(set, key_data, key_size, false);
 }
 
-Set *Btree_Set_create(Allocator *allocator, int pagesize)
+/* Calls ``callback'' for all values stored in the subtree rooted at ``page''
+   in order. Returns false if the callback stopped the enumeration. */
+static bool enumerate_page( Btree_Set *set, int page,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    int n, N;
+    bool result = true;
+
+    pin_page(set, page, false);
+    N = COUNT(page);
+    for (n = 0; n <= N && result; ++n)
+    {
+        if (CHILD(page, n) != -1 &&
+            !enumerate_page(set, CHILD(page, n), callback, arg))
+            result = false;
+        else
+        if (n < N && !callback(arg, DATA(page) + BEGIN(page, n), SIZE(page, n)))
+            result = false;
+    }
+    unpin_page(set, page, false);
+
+    return result;
+}
+
+static bool set_enumerate( Btree_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    return enumerate_page(set, set->root, callback, arg);
+}
+
+static Set *create( Allocator *allocator, BufferPool *pool, int file,
+                    int pagesize )
 {
     Btree_Set *set;
     char *mem;
@@ -375,10 +487,13 @@ Set *Btree_Set_create(Allocator *allocator, int pagesize)
         return NULL;
     }
 
-    set->base.destroy  = (void*)set_destroy;
-    set->base.insert   = (void*)set_insert;
-    set->base.contains = (void*)set_contains;
-    set->base.compare  = default_compare;
+    set->base.context      = NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = NULL;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.compare      = default_compare;
 
     set->pagesize   = pagesize;
     set->pages      = 0;
@@ -388,12 +503,36 @@ Set *Btree_Set_create(Allocator *allocator, int pagesize)
     set->mem_used   = 0;
     set->data       = NULL;
     set->allocator  = allocator;
+    set->pool       = pool;
+    set->file       = file;
+    set->last_page  = -1;
+    set->last_data  = NULL;
 
     /* Create root page. */
     create_page(set);
     COUNT(0)    = 0;
     BEGIN(0, 0) = 0;
     CHILD(0, 0) = -1;
+    unpin_page(set, 0, true);
 
     return &set->base;
 }
+
+Set *Btree_Set_create(Allocator *allocator, int pagesize)
+{
+    return create(allocator, NULL, -1, pagesize);
+}
+
+Set *Btree_Set_create_pooled(BufferPool *pool)
+{
+    Set *set;
+    int file;
+
+    file = BufferPool_open(pool);
+    if (file < 0)
+        return NULL;
+    set = create(NULL, pool, file, (int)BufferPool_page_size(pool));
+    if (set == NULL)
+        BufferPool_close(pool, file);
+    return set;
+}
@@ -0,0 +1,633 @@
+#include "config.h"
+#include "PriorityQueue.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Priority queue implemented as a bucket heap that spills to sorted runs
+
+   Priorities are small integers: each priority has a bucket, which holds
+   its elements in order of insertion in a list of segments (of increasing
+   size, up to MAX_SEGMENT_SIZE bytes). Each element is stored with its size
+   in front, and padded to a multiple of sizeof(size_t). A bitmap of
+   non-empty buckets is used to find the lowest priority quickly, even when
+   priorities do not increase monotonically (as they do not in best-first
+   search). Priorities above BUCKET_HEAP_MAX_PRIORITY are rejected, since
+   they would need more buckets than the heap can track.
+
+   When the elements in memory take up more than the memory limit, the
+   buckets with the highest priorities are spilled to disk until the
+   elements in memory take up at most half of it. Spilled elements are
+   written (in order of priority) to a run in a temporary file, from which
+   they are read back sequentially through a small buffer, like in the
+   external sequence heap of Sanders: the lowest element is taken either
+   from the buckets or from the front of one of the runs. When there are
+   too many runs, they are merged into one.
+*/
+
+#define MIN_SEGMENT_SIZE    ((size_t)4 << 10)
+#define MAX_SEGMENT_SIZE    ((size_t)1 << 20)
+#define RUN_BUFFER_SIZE     ((size_t)64 << 10)
+#define MAX_RUNS            16
+#define NONE                ((size_t)-1)
+
+typedef struct Segment Segment;
+typedef struct Bucket Bucket;
+typedef struct RunHeader RunHeader;
+typedef struct Run Run;
+typedef struct RunWriter RunWriter;
+typedef struct BucketHeap BucketHeap;
+
+struct Segment
+{
+    Segment     *next;                  /* Next segment in bucket */
+    size_t      capacity;               /* Size of data */
+    size_t      begin;                  /* Offset to first element */
+    size_t      end;                    /* Offset to end of last element */
+    char        data[];                 /* Elements */
+};
+
+struct Bucket
+{
+    Segment     *first, *last;          /* List of segments */
+    size_t      count;                  /* Number of elements */
+    size_t      bytes;                  /* Size of elements */
+};
+
+/* Header of an element in a run */
+struct RunHeader
+{
+    unsigned long   priority;
+    size_t          size;
+};
+
+struct Run
+{
+    int         fd;                     /* Temporary file */
+    off_t       pos;                    /* Offset in file after buffer */
+    size_t      count;                  /* Number of elements left */
+    char        *buffer;                /* Buffered data from file */
+    size_t      capacity;               /* Size of buffer */
+    size_t      begin;                  /* Offset to first element */
+    size_t      end;                    /* Offset to end of buffered data */
+    RunHeader   head;                   /* Header of first element */
+};
+
+struct RunWriter
+{
+    int         fd;                     /* Temporary file */
+    off_t       pos;                    /* Offset in file after buffer */
+    size_t      count;                  /* Number of elements written */
+    char        *buffer;                /* Data to be written */
+    size_t      used;                   /* Size of data in buffer */
+};
+
+struct BucketHeap
+{
+    PriorityQueue   base;
+    size_t          count;              /* Number of elements */
+    size_t          memory;             /* Memory limit */
+    size_t          used;               /* Size of elements in memory */
+    Bucket          *buckets;           /* Buckets by priority */
+    size_t          nbucket;            /* Number of buckets */
+    uint64_t        *nonempty;          /* Bitmap of non-empty buckets */
+    size_t          min;                /* Lower bound on lowest priority */
+    Run             runs[MAX_RUNS];     /* Runs of spilled elements */
+    size_t          nrun;               /* Number of runs */
+    char            *dir;               /* Directory of temporary files */
+};
+
+/* Rounds argument up to a multiple of sizeof(size_t) */
+static size_t align(size_t size)
+{
+    if (size%sizeof(size_t) != 0)
+        size = size - size%sizeof(size_t) + sizeof(size_t);
+    return size;
+}
+
+/* Creates a new (unlinked) temporary file. Returns its descriptor or -1. */
+static int create_temp(BucketHeap *heap)
+{
+    char *path;
+    int fd;
+
+    path = malloc(strlen(heap->dir) + 16);
+    if (path == NULL)
+        return -1;
+    sprintf(path, "%s/heap-XXXXXX", heap->dir);
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    free(path);
+    return fd;
+}
+
+/* Ensures there is a bucket for priority ``priority'' */
+static bool grow_buckets(BucketHeap *heap, size_t priority)
+{
+    Bucket *buckets;
+    uint64_t *nonempty;
+    size_t n;
+
+    if (priority < heap->nbucket)
+        return true;
+
+    n = heap->nbucket > 0 ? heap->nbucket : 64;
+    while (n <= priority)
+        n *= 2;
+    buckets = realloc(heap->buckets, n*sizeof(Bucket));
+    if (buckets == NULL)
+        return false;
+    heap->buckets = buckets;
+    memset(buckets + heap->nbucket, 0, (n - heap->nbucket)*sizeof(Bucket));
+    nonempty = realloc(heap->nonempty, n/64*sizeof(uint64_t));
+    if (nonempty == NULL)
+        return false;
+    heap->nonempty = nonempty;
+    memset( nonempty + heap->nbucket/64, 0,
+            (n - heap->nbucket)/64*sizeof(uint64_t) );
+    heap->nbucket = n;
+    return true;
+}
+
+/* Returns the lowest priority of a non-empty bucket, or NONE */
+static size_t find_min(BucketHeap *heap)
+{
+    size_t i = heap->min/64;
+    uint64_t word;
+
+    if (i >= heap->nbucket/64)
+        return NONE;
+    word = heap->nonempty[i] & (~(uint64_t)0 << heap->min%64);
+    while (word == 0)
+    {
+        if (++i == heap->nbucket/64)
+        {
+            heap->min = heap->nbucket;
+            return NONE;
+        }
+        word = heap->nonempty[i];
+    }
+    heap->min = 64*i + __builtin_ctzll(word);
+    return heap->min;
+}
+
+/* Adds an element at the end of a bucket */
+static bool bucket_push(Bucket *bucket, const void *data, size_t size)
+{
+    size_t record = sizeof(size_t) + align(size), capacity;
+    Segment *seg = bucket->last;
+
+    if (seg == NULL || seg->capacity - seg->end < record)
+    {
+        capacity = seg == NULL ? MIN_SEGMENT_SIZE : 2*seg->capacity;
+        if (capacity > MAX_SEGMENT_SIZE)
+            capacity = MAX_SEGMENT_SIZE;
+        if (capacity < record)
+            capacity = record;
+        seg = malloc(sizeof(Segment) + capacity);
+        if (seg == NULL)
+            return false;
+        seg->next     = NULL;
+        seg->capacity = capacity;
+        seg->begin    = seg->end = 0;
+        if (bucket->last != NULL)
+            bucket->last->next = seg;
+        else
+            bucket->first = seg;
+        bucket->last = seg;
+    }
+
+    memcpy(seg->data + seg->end, &size, sizeof(size_t));
+    memcpy(seg->data + seg->end + sizeof(size_t), data, size);
+    seg->end += record;
+    bucket->count += 1;
+    bucket->bytes += record;
+    return true;
+}
+
+/* Retrieves the first element of a non-empty bucket */
+static void bucket_front(Bucket *bucket, void **data, size_t *size)
+{
+    Segment *seg = bucket->first;
+
+    memcpy(size, seg->data + seg->begin, sizeof(size_t));
+    *data = seg->data + seg->begin + sizeof(size_t);
+}
+
+/* Removes the first element of a non-empty bucket, and returns its size
+   in memory. */
+static size_t bucket_pop(Bucket *bucket)
+{
+    Segment *seg = bucket->first;
+    size_t size, record;
+
+    memcpy(&size, seg->data + seg->begin, sizeof(size_t));
+    record = sizeof(size_t) + align(size);
+    seg->begin += record;
+    if (seg->begin == seg->end)
+    {
+        bucket->first = seg->next;
+        if (bucket->first == NULL)
+            bucket->last = NULL;
+        free(seg);
+    }
+    bucket->count -= 1;
+    bucket->bytes -= record;
+    return record;
+}
+
+/* Frees all segments of a bucket */
+static void bucket_clear(Bucket *bucket)
+{
+    Segment *seg;
+
+    while ((seg = bucket->first) != NULL)
+    {
+        bucket->first = seg->next;
+        free(seg);
+    }
+    memset(bucket, 0, sizeof(Bucket));
+}
+
+/* Writes out the buffered data of a run writer */
+static bool writer_flush(RunWriter *w)
+{
+    size_t pos;
+    ssize_t res;
+
+    for (pos = 0; pos < w->used; pos += (size_t)res)
+    {
+        res = pwrite(w->fd, w->buffer + pos, w->used - pos, w->pos + pos);
+        if (res < 0 && errno != EINTR)
+            return false;
+        if (res < 0)
+            res = 0;
+    }
+    w->pos += (off_t)w->used;
+    w->used = 0;
+    return true;
+}
+
+/* Appends ``size'' bytes to a run */
+static bool writer_write(RunWriter *w, const void *data, size_t size)
+{
+    size_t chunk;
+
+    while (size > 0)
+    {
+        if (w->used == RUN_BUFFER_SIZE && !writer_flush(w))
+            return false;
+        chunk = RUN_BUFFER_SIZE - w->used;
+        if (chunk > size)
+            chunk = size;
+        memcpy(w->buffer + w->used, data, chunk);
+        w->used += chunk;
+        data     = (const char*)data + chunk;
+        size    -= chunk;
+    }
+    return true;
+}
+
+/* Appends an element to a run */
+static bool writer_put( RunWriter *w, unsigned long priority,
+                        const void *data, size_t size )
+{
+    static const char padding[sizeof(size_t)];
+    RunHeader header;
+
+    header.priority = priority;
+    header.size     = size;
+    w->count += 1;
+    return writer_write(w, &header, sizeof(header)) &&
+           writer_write(w, data, size) &&
+           writer_write(w, padding, align(size) - size);
+}
+
+/* Starts writing a new run. Returns false if it could not be created. */
+static bool writer_open(BucketHeap *heap, RunWriter *w)
+{
+    w->fd     = create_temp(heap);
+    w->pos    = 0;
+    w->count  = 0;
+    w->used   = 0;
+    w->buffer = malloc(RUN_BUFFER_SIZE);
+    if (w->fd < 0 || w->buffer == NULL)
+    {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->buffer);
+        return false;
+    }
+    return true;
+}
+
+/* Ensures the buffer of a run holds at least ``need'' bytes */
+static bool run_fill(Run *run, size_t need)
+{
+    char *buffer;
+    ssize_t res;
+
+    if (run->end - run->begin >= need)
+        return true;
+
+    /* Move remaining data to the front of the buffer */
+    memmove(run->buffer, run->buffer + run->begin, run->end - run->begin);
+    run->end  -= run->begin;
+    run->begin = 0;
+    if (run->capacity < need)
+    {
+        buffer = realloc(run->buffer, need);
+        if (buffer == NULL)
+            return false;
+        run->buffer   = buffer;
+        run->capacity = need;
+    }
+
+    while (run->end < need)
+    {
+        res = pread( run->fd, run->buffer + run->end,
+                     run->capacity - run->end, run->pos );
+        if (res == 0 || (res < 0 && errno != EINTR))
+            return false;
+        if (res < 0)
+            res = 0;
+        run->end += (size_t)res;
+        run->pos += res;
+    }
+    return true;
+}
+
+/* Loads the first element of a non-empty run into its buffer */
+static bool run_load(Run *run)
+{
+    if (!run_fill(run, sizeof(RunHeader)))
+        return false;
+    memcpy(&run->head, run->buffer + run->begin, sizeof(RunHeader));
+    return run_fill(run, sizeof(RunHeader) + align(run->head.size));
+}
+
+/* Finishes a run writer and adds the run to the heap. On failure, the run
+   is discarded. */
+static bool writer_close(BucketHeap *heap, RunWriter *w)
+{
+    Run *run;
+
+    assert(heap->nrun < MAX_RUNS);
+    if (!writer_flush(w) || w->count == 0)
+    {
+        close(w->fd);
+        free(w->buffer);
+        return w->count == 0;
+    }
+
+    /* Reuse the write buffer for reading */
+    run = &heap->runs[heap->nrun];
+    run->fd       = w->fd;
+    run->pos      = 0;
+    run->count    = w->count;
+    run->buffer   = w->buffer;
+    run->capacity = RUN_BUFFER_SIZE;
+    run->begin    = run->end = 0;
+    if (!run_load(run))
+    {
+        close(run->fd);
+        free(run->buffer);
+        return false;
+    }
+    heap->nrun += 1;
+    return true;
+}
+
+/* Removes the first element of a run, and removes the run from the heap
+   when it is exhausted. */
+static bool run_pop(BucketHeap *heap, Run *run)
+{
+    run->begin += sizeof(RunHeader) + align(run->head.size);
+    if (--run->count > 0)
+        return run_load(run);
+
+    close(run->fd);
+    free(run->buffer);
+    memmove(run, run + 1, (heap->runs + heap->nrun - (run + 1))*sizeof(Run));
+    heap->nrun -= 1;
+    return true;
+}
+
+/* Returns the run with the lowest element, or NULL if there are no runs */
+static Run *min_run(BucketHeap *heap)
+{
+    Run *best = NULL;
+    size_t n;
+
+    /* Prefer earlier runs, which hold older elements */
+    for (n = 0; n < heap->nrun; ++n)
+    {
+        if (best == NULL || heap->runs[n].head.priority < best->head.priority)
+            best = &heap->runs[n];
+    }
+    return best;
+}
+
+/* Merges all runs into one */
+static bool merge_runs(BucketHeap *heap)
+{
+    RunWriter w;
+    Run *run;
+
+    if (!writer_open(heap, &w))
+        return false;
+    while ((run = min_run(heap)) != NULL)
+    {
+        if ( !writer_put( &w, run->head.priority,
+                          run->buffer + run->begin + sizeof(RunHeader),
+                          run->head.size ) ||
+             !run_pop(heap, run) )
+        {
+            close(w.fd);
+            free(w.buffer);
+            return false;
+        }
+    }
+    return writer_close(heap, &w);
+}
+
+/* Spills the buckets with the highest priorities to a new run, until the
+   elements in memory take up at most half of the memory limit. */
+static bool spill(BucketHeap *heap)
+{
+    RunWriter w;
+    Bucket *bucket;
+    size_t first, last, bytes, priority, size;
+    void *data;
+
+    /* Select buckets to spill */
+    bytes = 0;
+    first = heap->nbucket;
+    while (first > 0 && heap->used - bytes > heap->memory/2)
+        bytes += heap->buckets[--first].bytes;
+    last = heap->nbucket;
+    while (last > first && heap->buckets[last - 1].count == 0)
+        --last;
+
+    if (heap->nrun == MAX_RUNS && !merge_runs(heap))
+        return false;
+    if (!writer_open(heap, &w))
+        return false;
+
+    /* Write them out in order of priority */
+    for (priority = first; priority < last; ++priority)
+    {
+        bucket = &heap->buckets[priority];
+        while (bucket->count > 0)
+        {
+            bucket_front(bucket, &data, &size);
+            if (!writer_put(&w, priority, data, size))
+            {
+                close(w.fd);
+                free(w.buffer);
+                return false;
+            }
+            heap->used -= bucket_pop(bucket);
+        }
+        heap->nonempty[priority/64] &= ~((uint64_t)1 << priority%64);
+    }
+
+    return writer_close(heap, &w);
+}
+
+static void destroy(BucketHeap *heap)
+{
+    size_t n;
+
+    for (n = 0; n < heap->nbucket; ++n)
+        bucket_clear(&heap->buckets[n]);
+    for (n = 0; n < heap->nrun; ++n)
+    {
+        close(heap->runs[n].fd);
+        free(heap->runs[n].buffer);
+    }
+    free(heap->buckets);
+    free(heap->nonempty);
+    free(heap->dir);
+    free(heap);
+}
+
+static bool empty(BucketHeap *heap)
+{
+    return heap->count == 0;
+}
+
+static size_t size(BucketHeap *heap)
+{
+    return heap->count;
+}
+
+static bool push( BucketHeap *heap, unsigned long priority,
+                  const void *data, size_t size )
+{
+    if (priority > BUCKET_HEAP_MAX_PRIORITY)
+    {
+        errno = ERANGE;
+        return false;
+    }
+    if ( !grow_buckets(heap, priority) ||
+         !bucket_push(&heap->buckets[priority], data, size) )
+        return false;
+
+    heap->nonempty[priority/64] |= (uint64_t)1 << priority%64;
+    if (priority < heap->min)
+        heap->min = priority;
+    heap->used  += sizeof(size_t) + align(size);
+    heap->count += 1;
+
+    if (heap->used > heap->memory && !spill(heap))
+        return false;
+
+    return true;
+}
+
+static bool get_min( BucketHeap *heap, unsigned long *priority,
+                     void **data, size_t *size )
+{
+    Run *run;
+    size_t min;
+
+    if (heap->count == 0)
+        return false;
+
+    min = find_min(heap);
+    run = min_run(heap);
+    if (run != NULL && (min == NONE || run->head.priority <= min))
+    {
+        *priority = run->head.priority;
+        *data     = run->buffer + run->begin + sizeof(RunHeader);
+        *size     = run->head.size;
+    }
+    else
+    {
+        *priority = min;
+        bucket_front(&heap->buckets[min], data, size);
+    }
+    return true;
+}
+
+static bool pop_min(BucketHeap *heap)
+{
+    Run *run;
+    size_t min;
+
+    if (heap->count == 0)
+        return false;
+
+    min = find_min(heap);
+    run = min_run(heap);
+    if (run != NULL && (min == NONE || run->head.priority <= min))
+    {
+        if (!run_pop(heap, run))
+            return false;
+    }
+    else
+    {
+        heap->used -= bucket_pop(&heap->buckets[min]);
+        if (heap->buckets[min].count == 0)
+            heap->nonempty[min/64] &= ~((uint64_t)1 << min%64);
+    }
+    heap->count -= 1;
+    return true;
+}
+
+PriorityQueue *Bucket_Heap_create(size_t memory, const char *dir)
+{
+    BucketHeap *heap;
+
+    heap = malloc(sizeof(BucketHeap));
+    if (heap == NULL)
+        return NULL;
+    memset(heap, 0, sizeof(BucketHeap));
+
+    heap->base.destroy = (void*)destroy;
+    heap->base.empty   = (void*)empty;
+    heap->base.size    = (void*)size;
+    heap->base.push    = (void*)push;
+    heap->base.get_min = (void*)get_min;
+    heap->base.pop_min = (void*)pop_min;
+
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+    if (dir == NULL)
+        dir = "/tmp";
+    heap->memory = memory > 0 ? memory : BUCKET_HEAP_MEMORY;
+    heap->dir    = strdup(dir);
+    if (heap->dir == NULL)
+    {
+        free(heap);
+        return NULL;
+    }
+
+    return &heap->base;
+}
@@ -0,0 +1,583 @@
+#include "config.h"
+#include "BufferPool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* A buffer pool caches pages of files in a fixed number of frames, which
+   are read and written with pread() and pwrite(). Unlike memory-mapped
+   storage, this bounds the amount of memory used regardless of the size of
+   the files, and puts eviction (and write-back of modified pages) under
+   control of the application:
+
+    - Pages that are pinned are never evicted.
+    - Among unpinned pages, the victim is chosen by the replacement policy:
+      either the least recently pinned page (kept in a doubly-linked list,
+      most recently used first) or the first page found by a clock hand that
+      has not been pinned since the hand last passed it.
+    - Prefetching hints the kernel to read a page ahead asynchronously
+      (with posix_fadvise()), so the subsequent read is served from the
+      page cache. With direct I/O there is no such cache, so prefetching
+      has no effect.
+
+   Resident pages are found through an open-addressing hash table (with
+   linear probing) that maps (file, page) pairs to frame indices. The frame
+   of the most recent lookup is remembered, since data structures tend to
+   access the same page many times in a row. */
+
+#define NONE ((size_t)-1)
+
+typedef struct Frame Frame;
+
+struct Frame
+{
+    int         file;           /* File of cached page (-1 if frame is free) */
+    size_t      page;           /* Index of cached page in the file */
+    int         pins;           /* Number of times pinned */
+    bool        dirty;          /* Whether modified since it was read */
+    bool        referenced;     /* Whether pinned since the last sweep */
+    size_t      prev, next;     /* Neighbours in LRU list */
+};
+
+struct BufferPool
+{
+    size_t      page_size;      /* Size of pages */
+    size_t      frames;         /* Number of frames */
+    BP_Policy   policy;         /* Replacement policy */
+    char        *dir;           /* Directory of temporary files */
+    bool        direct;         /* Whether to use direct I/O */
+
+    char        *memory;        /* Frame contents */
+    Frame       *frame;         /* Frame descriptors */
+    size_t      *table;         /* Hash table of frame indices */
+    size_t      table_mask;     /* Size of hash table minus one */
+    size_t      lru_head;       /* Most recently used frame */
+    size_t      lru_tail;       /* Least recently used frame */
+    size_t      hand;           /* Position of clock hand */
+    size_t      last;           /* Frame of most recent lookup */
+
+    int         *fds;           /* File descriptors by file number */
+    int         files;          /* Number of file numbers in use */
+
+    /* Statistics */
+    size_t      hits, misses, reads, writes, evictions;
+};
+
+static size_t       shared_memory   = BUFFER_POOL_MEMORY;
+static BP_Policy    shared_policy   = BP_LRU;
+static const char   *shared_dir     = NULL;
+static bool         shared_direct   = false;
+static BufferPool   *shared_pool    = NULL;
+
+static size_t hash(int file, size_t page)
+{
+    uint64_t x;
+
+    x = (uint64_t)page*0x9E3779B97F4A7C15ULL ^
+        (uint64_t)file*0xC2B2AE3D27D4EB4FULL;
+    return (size_t)(x ^ (x >> 29));
+}
+
+#define FRAME_DATA(f) (pool->memory + (f)*pool->page_size)
+
+/* LRU list manipulation */
+static void lru_unlink(BufferPool *pool, size_t f)
+{
+    Frame *frame = &pool->frame[f];
+
+    if (frame->prev != NONE)
+        pool->frame[frame->prev].next = frame->next;
+    else
+        pool->lru_head = frame->next;
+    if (frame->next != NONE)
+        pool->frame[frame->next].prev = frame->prev;
+    else
+        pool->lru_tail = frame->prev;
+}
+
+static void lru_push_front(BufferPool *pool, size_t f)
+{
+    pool->frame[f].prev = NONE;
+    pool->frame[f].next = pool->lru_head;
+    if (pool->lru_head != NONE)
+        pool->frame[pool->lru_head].prev = f;
+    else
+        pool->lru_tail = f;
+    pool->lru_head = f;
+}
+
+static void lru_push_back(BufferPool *pool, size_t f)
+{
+    pool->frame[f].next = NONE;
+    pool->frame[f].prev = pool->lru_tail;
+    if (pool->lru_tail != NONE)
+        pool->frame[pool->lru_tail].next = f;
+    else
+        pool->lru_head = f;
+    pool->lru_tail = f;
+}
+
+/* Returns the hash table slot of the given page, or of the empty slot where
+   it would be inserted. */
+static size_t find_slot(BufferPool *pool, int file, size_t page)
+{
+    size_t i, f;
+
+    for (i = hash(file, page)&pool->table_mask; ;
+         i = (i + 1)&pool->table_mask)
+    {
+        f = pool->table[i];
+        if (f == NONE || (pool->frame[f].file == file &&
+                          pool->frame[f].page == page))
+            return i;
+    }
+}
+
+/* Returns the frame caching the given page, or NONE if it is not resident */
+static size_t lookup(BufferPool *pool, int file, size_t page)
+{
+    size_t f;
+
+    f = pool->last;
+    if (f != NONE && pool->frame[f].file == file && pool->frame[f].page == page)
+        return f;
+
+    f = pool->table[find_slot(pool, file, page)];
+    if (f != NONE)
+        pool->last = f;
+    return f;
+}
+
+/* Removes a resident page from the hash table and frees its frame */
+static void remove_page(BufferPool *pool, size_t f)
+{
+    size_t i, j, k;
+
+    i = find_slot(pool, pool->frame[f].file, pool->frame[f].page);
+    assert(pool->table[i] == f);
+
+    /* Shift back entries that would no longer be found after removal */
+    pool->table[i] = NONE;
+    for (j = (i + 1)&pool->table_mask; pool->table[j] != NONE;
+         j = (j + 1)&pool->table_mask)
+    {
+        k = pool->table[j];
+        k = hash(pool->frame[k].file, pool->frame[k].page)&pool->table_mask;
+        if (((j - k)&pool->table_mask) >= ((j - i)&pool->table_mask))
+        {
+            pool->table[i] = pool->table[j];
+            pool->table[j] = NONE;
+            i = j;
+        }
+    }
+
+    pool->frame[f].file  = -1;
+    pool->frame[f].dirty = false;
+    if (pool->last == f)
+        pool->last = NONE;
+}
+
+/* Reads or writes a frame from/to its page on disk */
+static bool transfer(BufferPool *pool, size_t f, bool write)
+{
+    Frame *frame = &pool->frame[f];
+    char *data = FRAME_DATA(f);
+    off_t offset = (off_t)(frame->page*pool->page_size);
+    size_t pos;
+    ssize_t res;
+
+    for (pos = 0; pos < pool->page_size; pos += (size_t)res)
+    {
+        if (write)
+            res = pwrite( pool->fds[frame->file], data + pos,
+                          pool->page_size - pos, offset + (off_t)pos );
+        else
+            res = pread( pool->fds[frame->file], data + pos,
+                         pool->page_size - pos, offset + (off_t)pos );
+#ifdef O_DIRECT
+        if (res < 0 && errno == EINVAL && pool->direct)
+        {
+            /* Direct I/O is not supported after all */
+            int fd = pool->fds[frame->file];
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            res = 0;
+            continue;
+        }
+#endif
+        if (res < 0)
+            return false;
+        if (res == 0)
+        {
+            /* Read past end of file: page has not been written yet */
+            assert(!write);
+            memset(data + pos, 0, pool->page_size - pos);
+            break;
+        }
+    }
+
+    if (write)
+        ++pool->writes;
+    else
+        ++pool->reads;
+    return true;
+}
+
+/* Selects an unpinned frame to reuse, writing back its page if necessary.
+   Returns the (free) frame, or NONE if all frames are pinned or the page
+   could not be written back. */
+static size_t evict(BufferPool *pool)
+{
+    size_t f, n;
+
+    f = NONE;
+    switch (pool->policy)
+    {
+    case BP_LRU:
+        for (f = pool->lru_tail; f != NONE; f = pool->frame[f].prev)
+        {
+            if (pool->frame[f].pins == 0)
+                break;
+        }
+        break;
+
+    case BP_CLOCK:
+        /* Two full sweeps suffice to clear all reference bits */
+        for (n = 0; n <= 2*pool->frames; ++n)
+        {
+            f = pool->hand;
+            pool->hand = (pool->hand + 1)%pool->frames;
+            if (pool->frame[f].file == -1)
+                break;
+            if (pool->frame[f].pins > 0)
+                continue;
+            if (!pool->frame[f].referenced)
+                break;
+            pool->frame[f].referenced = false;
+        }
+        if (n > 2*pool->frames)
+            f = NONE;
+        break;
+    }
+
+    if (f == NONE || pool->frame[f].file == -1)
+        return f;
+
+    if (pool->frame[f].dirty && !transfer(pool, f, true))
+        return NONE;
+    remove_page(pool, f);
+    ++pool->evictions;
+
+    return f;
+}
+
+BufferPool *BufferPool_create( size_t page_size, size_t frames,
+                               BP_Policy policy, const char *dir, bool direct )
+{
+    BufferPool *pool;
+    void *memory;
+    size_t f, table_size;
+
+    assert(page_size > 0 && frames > 0);
+
+    pool = malloc(sizeof(BufferPool));
+    if (pool == NULL)
+        return NULL;
+
+    /* Frames are aligned to (regular) pages, as required for direct I/O */
+    table_size = 1;
+    while (table_size < 2*frames)
+        table_size *= 2;
+    pool->dir   = strdup(dir);
+    pool->frame = malloc(frames*sizeof(Frame));
+    pool->table = malloc(table_size*sizeof(size_t));
+    if ( pool->dir == NULL || pool->frame == NULL || pool->table == NULL ||
+         posix_memalign(&memory, ALLOC_CHUNK_SIZE, frames*page_size) != 0 )
+    {
+        free(pool->dir);
+        free(pool->frame);
+        free(pool->table);
+        free(pool);
+        return NULL;
+    }
+
+    pool->page_size  = page_size;
+    pool->frames     = frames;
+    pool->policy     = policy;
+    pool->direct     = direct && page_size%ALLOC_CHUNK_SIZE == 0;
+    pool->memory     = memory;
+    pool->table_mask = table_size - 1;
+    pool->lru_head   = NONE;
+    pool->lru_tail   = NONE;
+    pool->hand       = 0;
+    pool->last       = NONE;
+    pool->fds        = NULL;
+    pool->files      = 0;
+    pool->hits       = 0;
+    pool->misses     = 0;
+    pool->reads      = 0;
+    pool->writes     = 0;
+    pool->evictions  = 0;
+
+    for (f = 0; f < frames; ++f)
+    {
+        pool->frame[f].file       = -1;
+        pool->frame[f].page       = 0;
+        pool->frame[f].pins       = 0;
+        pool->frame[f].dirty      = false;
+        pool->frame[f].referenced = false;
+        lru_push_back(pool, f);
+    }
+    for (f = 0; f < table_size; ++f)
+        pool->table[f] = NONE;
+
+    return pool;
+}
+
+void BufferPool_destroy(BufferPool *pool)
+{
+    int file;
+
+    for (file = 0; file < pool->files; ++file)
+    {
+        if (pool->fds[file] != -1)
+            close(pool->fds[file]);
+    }
+    if (pool == shared_pool)
+        shared_pool = NULL;
+    free(pool->fds);
+    free(pool->memory);
+    free(pool->frame);
+    free(pool->table);
+    free(pool->dir);
+    free(pool);
+}
+
+void BufferPool_configure_shared( size_t memory, BP_Policy policy,
+                                  const char *dir, bool direct )
+{
+    assert(shared_pool == NULL);
+    shared_memory = memory;
+    shared_policy = policy;
+    shared_dir    = dir;
+    shared_direct = direct;
+}
+
+BufferPool *BufferPool_shared(void)
+{
+    const char *dir;
+    size_t frames;
+
+    if (shared_pool == NULL)
+    {
+        dir = shared_dir;
+        if (dir == NULL)
+            dir = getenv("TMPDIR");
+        if (dir == NULL)
+            dir = "/tmp";
+        frames = shared_memory/BUFFER_POOL_PAGE_SIZE;
+        if (frames < BUFFER_POOL_MIN_FRAMES)
+            frames = BUFFER_POOL_MIN_FRAMES;
+        shared_pool = BufferPool_create( BUFFER_POOL_PAGE_SIZE, frames,
+                                         shared_policy, dir, shared_direct );
+    }
+
+    return shared_pool;
+}
+
+size_t BufferPool_page_size(BufferPool *pool)
+{
+    return pool->page_size;
+}
+
+int BufferPool_open(BufferPool *pool)
+{
+    char *path;
+    int *fds, fd, file;
+
+    path = malloc(strlen(pool->dir) + 16);
+    if (path == NULL)
+        return -1;
+    sprintf(path, "%s/pool-XXXXXX", pool->dir);
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    free(path);
+    if (fd < 0)
+        return -1;
+
+#ifdef O_DIRECT
+    /* Use direct I/O if the file system supports it */
+    if (pool->direct)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT);
+#endif
+
+    /* Reuse a closed file number, if possible */
+    for (file = 0; file < pool->files; ++file)
+    {
+        if (pool->fds[file] == -1)
+            break;
+    }
+    if (file == pool->files)
+    {
+        fds = realloc(pool->fds, (pool->files + 1)*sizeof(int));
+        if (fds == NULL)
+        {
+            close(fd);
+            return -1;
+        }
+        pool->fds = fds;
+        ++pool->files;
+    }
+    pool->fds[file] = fd;
+
+    return file;
+}
+
+void BufferPool_close(BufferPool *pool, int file)
+{
+    size_t f;
+
+    assert(file >= 0 && file < pool->files && pool->fds[file] != -1);
+
+    for (f = 0; f < pool->frames; ++f)
+    {
+        if (pool->frame[f].file == file)
+        {
+            assert(pool->frame[f].pins == 0);
+            remove_page(pool, f);
+            lru_unlink(pool, f);
+            lru_push_back(pool, f);
+        }
+    }
+    close(pool->fds[file]);
+    pool->fds[file] = -1;
+}
+
+void *BufferPool_pin(BufferPool *pool, int file, size_t page, bool create)
+{
+    Frame *frame;
+    size_t f, slot;
+
+    f = lookup(pool, file, page);
+    if (f != NONE)
+    {
+        ++pool->hits;
+    }
+    else
+    {
+        ++pool->misses;
+        f = evict(pool);
+        if (f == NONE)
+            return NULL;
+
+        frame = &pool->frame[f];
+        frame->file  = file;
+        frame->page  = page;
+        frame->dirty = false;
+        if (create)
+        {
+            memset(FRAME_DATA(f), 0, pool->page_size);
+        }
+        else
+        if (!transfer(pool, f, false))
+        {
+            frame->file = -1;
+            return NULL;
+        }
+
+        slot = find_slot(pool, file, page);
+        assert(pool->table[slot] == NONE);
+        pool->table[slot] = f;
+        pool->last = f;
+    }
+
+    frame = &pool->frame[f];
+    ++frame->pins;
+    frame->referenced = true;
+    if (pool->policy == BP_LRU && pool->lru_head != f)
+    {
+        lru_unlink(pool, f);
+        lru_push_front(pool, f);
+    }
+
+    return FRAME_DATA(f);
+}
+
+void BufferPool_unpin(BufferPool *pool, int file, size_t page, bool dirty)
+{
+    size_t f;
+
+    f = lookup(pool, file, page);
+    assert(f != NONE && pool->frame[f].pins > 0);
+    --pool->frame[f].pins;
+    if (dirty)
+        pool->frame[f].dirty = true;
+}
+
+void *BufferPool_data(BufferPool *pool, int file, size_t page)
+{
+    size_t f;
+
+    f = lookup(pool, file, page);
+    assert(f != NONE && pool->frame[f].pins > 0);
+    return FRAME_DATA(f);
+}
+
+void BufferPool_discard(BufferPool *pool, int file, size_t page)
+{
+    size_t f;
+
+    f = lookup(pool, file, page);
+    if (f != NONE)
+    {
+        assert(pool->frame[f].pins == 0);
+        remove_page(pool, f);
+        lru_unlink(pool, f);
+        lru_push_back(pool, f);
+    }
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate( pool->fds[file], FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+               (off_t)(page*pool->page_size), (off_t)pool->page_size );
+#endif
+}
+
+void BufferPool_prefetch(BufferPool *pool, int file, size_t page)
+{
+    if (pool->direct || lookup(pool, file, page) != NONE)
+        return;
+
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise( pool->fds[file], (off_t)(page*pool->page_size),
+                   (off_t)pool->page_size, POSIX_FADV_WILLNEED );
+#endif
+}
+
+bool BufferPool_parse_policy(const char *str, BP_Policy *policy)
+{
+    if (strcmp(str, "lru") == 0)
+        *policy = BP_LRU;
+    else
+    if (strcmp(str, "clock") == 0)
+        *policy = BP_CLOCK;
+    else
+        return false;
+    return true;
+}
+
+void BufferPool_report(BufferPool *pool, FILE *fp)
+{
+    fprintf( fp, "Buffer pool: %lu frames of %lu bytes, %.2f%% hits, "
+                 "%lu reads, %lu writes, %lu evictions\n",
+             (unsigned long)pool->frames, (unsigned long)pool->page_size,
+             100.0*pool->hits/(pool->hits + pool->misses + (pool->hits +
+                 pool->misses == 0)),
+             (unsigned long)pool->reads, (unsigned long)pool->writes,
+             (unsigned long)pool->evictions );
+}
@@ -0,0 +1,83 @@
+#ifndef BUFFER_POOL_H_INCLUDED
+#define BUFFER_POOL_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct BufferPool BufferPool;
+typedef enum BP_Policy BP_Policy;
+
+/* Page replacement policies */
+enum BP_Policy
+{
+    BP_LRU,                 /* Evict the least recently used page */
+    BP_CLOCK                /* Evict pages not used since the last sweep */
+};
+
+/* Creates a buffer pool of ``frames'' pages of ``page_size'' bytes each,
+   which caches pages of files in ``dir'' using explicit reads and writes
+   (instead of memory-mapping them). With ``direct'', the files are opened
+   with O_DIRECT to bypass the kernel page cache, if the file system and the
+   page size permit it.
+
+   Returns NULL if the pool could not be allocated. */
+BufferPool *BufferPool_create( size_t page_size, size_t frames,
+                               BP_Policy policy, const char *dir, bool direct );
+
+/* Destroys the pool, closing all files that are still open */
+void BufferPool_destroy(BufferPool *pool);
+
+/* Configures the pool returned by BufferPool_shared(), which must not have
+   been created yet. ``memory'' is the total size of its frames, which is
+   rounded up to BUFFER_POOL_MIN_FRAMES frames (see config.h), so that the
+   data structures using the pool never find all frames pinned. */
+void BufferPool_configure_shared( size_t memory, BP_Policy policy,
+                                  const char *dir, bool direct );
+
+/* Returns the pool that is shared by all data structures in the process,
+   creating it if necessary, or NULL if it could not be created. */
+BufferPool *BufferPool_shared(void);
+
+/* Returns the size of pages in the pool */
+size_t BufferPool_page_size(BufferPool *pool);
+
+/* Creates a new (unlinked) temporary file with pages cached by the pool.
+   Returns its file number, or -1 on failure. */
+int BufferPool_open(BufferPool *pool);
+
+/* Discards all cached pages of a file and closes it */
+void BufferPool_close(BufferPool *pool, int file);
+
+/* Pins a page of a file in memory and returns a pointer to its contents,
+   which remains valid until the page is unpinned as often as it was pinned.
+   If ``create'' is set, the page is assumed to be new and is zero-filled
+   instead of read from disk.
+
+   Returns NULL if all frames are pinned or the page could not be read. */
+void *BufferPool_pin(BufferPool *pool, int file, size_t page, bool create);
+
+/* Unpins a page pinned with BufferPool_pin(). If ``dirty'' is set, the page
+   has been modified and must be written back before it is evicted. */
+void BufferPool_unpin(BufferPool *pool, int file, size_t page, bool dirty);
+
+/* Returns the contents of a page that is currently pinned */
+void *BufferPool_data(BufferPool *pool, int file, size_t page);
+
+/* Drops a page without writing it back, and releases its disk space. The
+   page must not be pinned, and should be pinned with ``create'' set if it
+   is used again. */
+void BufferPool_discard(BufferPool *pool, int file, size_t page);
+
+/* Hints that a page will be pinned soon, so it can be read ahead in the
+   background. */
+void BufferPool_prefetch(BufferPool *pool, int file, size_t page);
+
+/* Parses a replacement policy ("lru" or "clock"). Returns false if the
+   string is not recognized. */
+bool BufferPool_parse_policy(const char *str, BP_Policy *policy);
+
+/* Prints hit rate and I/O statistics of the pool */
+void BufferPool_report(BufferPool *pool, FILE *fp);
+
+#endif /* ndef BUFFER_POOL_H_INCLUDED */
@@ -0,0 +1,254 @@
+#include "config.h"
+#include "CacheSim.h"
+#include "parsing.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Simulator of a memory hierarchy of fully-associative caches with LRU
+   replacement.
+
+   Each level is simulated independently on the full stream of accesses, as
+   a single cache of capacity M and block size B in the ideal-cache model,
+   so the number of misses at a level is the number of block transfers
+   between it and the next (larger) level that an algorithm incurs in the
+   external-memory model with those parameters. (In a real hierarchy, only
+   the misses of one level reach the next, but the per-level counts are
+   what the external-memory and cache-oblivious analyses bound.)
+
+   Each level keeps the blocks it holds in a list ordered from most to least
+   recently used, and in a hash table of chained nodes to find them.
+*/
+
+#define NIL ((uint32_t)-1)
+
+typedef struct Node
+{
+    uintptr_t   block;          /* Block number (address / block size) */
+    uint32_t    prev, next;     /* Neighbours in LRU list */
+    uint32_t    chain;          /* Next node in hash chain */
+} Node;
+
+typedef struct Level
+{
+    size_t      block_size;
+    int         block_shift;    /* log2(block_size) */
+    size_t      capacity;       /* Capacity in blocks */
+
+    Node        *nodes;         /* Nodes (``used'' of ``capacity'') */
+    size_t      used;
+    uint32_t    *buckets;       /* Hash table of node chains */
+    size_t      mask;           /* Number of buckets minus one */
+    uint32_t    head, tail;     /* Most and least recently used nodes */
+
+    unsigned long long accesses;    /* Number of blocks accessed */
+    unsigned long long misses;      /* Number of blocks transferred */
+} Level;
+
+struct CacheSim
+{
+    int         levels;
+    Level       level[];
+};
+
+CacheSim *CacheSim_active = NULL;
+
+static size_t hash_block(uintptr_t block)
+{
+    return (size_t)(block*0x9E3779B97F4A7C15ull >> 17);
+}
+
+static bool init_level(Level *level, size_t block_size, size_t size)
+{
+    size_t buckets;
+
+    level->nodes   = NULL;
+    level->buckets = NULL;
+    if ( block_size == 0 || (block_size & (block_size - 1)) != 0 ||
+         size < block_size || size/block_size >= NIL )
+        return false;
+
+    level->block_size  = block_size;
+    level->block_shift = __builtin_ctzll(block_size);
+    level->capacity    = size/block_size;
+    level->used        = 0;
+    level->head        = NIL;
+    level->tail        = NIL;
+    level->accesses    = 0;
+    level->misses      = 0;
+
+    for (buckets = 1; buckets < 2*level->capacity; buckets *= 2) { }
+    level->mask    = buckets - 1;
+    level->nodes   = malloc(level->capacity*sizeof(Node));
+    level->buckets = malloc(buckets*sizeof(uint32_t));
+    if (level->nodes == NULL || level->buckets == NULL)
+        return false;
+    memset(level->buckets, 0xff, buckets*sizeof(uint32_t));
+    return true;
+}
+
+CacheSim *CacheSim_create(const char *spec)
+{
+    CacheSim *sim;
+    const char *p;
+    size_t block_size, size;
+    int levels;
+    bool ok;
+
+    /* Count levels */
+    levels = 1;
+    for (p = spec; *p != '\0'; ++p)
+        levels += *p == ',';
+
+    sim = malloc(sizeof(CacheSim) + levels*sizeof(Level));
+    if (sim == NULL)
+        return NULL;
+    sim->levels = 0;
+
+    p  = spec;
+    ok = true;
+    while (ok && sim->levels < levels)
+    {
+        if (sim->levels > 0 && *p++ != ',')
+        {
+            ok = false;
+            break;
+        }
+        block_size = parse_size(&p);
+        if (*p != ':')
+        {
+            ok = false;
+            break;
+        }
+        ++p;
+        size = parse_size(&p);
+        ok = init_level(&sim->level[sim->levels++], block_size, size);
+    }
+    if (!ok || *p != '\0')
+    {
+        CacheSim_destroy(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+void CacheSim_destroy(CacheSim *sim)
+{
+    int n;
+
+    for (n = 0; n < sim->levels; ++n)
+    {
+        free(sim->level[n].nodes);
+        free(sim->level[n].buckets);
+    }
+    free(sim);
+}
+
+static void unlink_node(Level *level, uint32_t i)
+{
+    Node *node = &level->nodes[i];
+
+    if (node->prev != NIL)
+        level->nodes[node->prev].next = node->next;
+    else
+        level->head = node->next;
+    if (node->next != NIL)
+        level->nodes[node->next].prev = node->prev;
+    else
+        level->tail = node->prev;
+}
+
+static void push_front(Level *level, uint32_t i)
+{
+    Node *node = &level->nodes[i];
+
+    node->prev = NIL;
+    node->next = level->head;
+    if (level->head != NIL)
+        level->nodes[level->head].prev = i;
+    else
+        level->tail = i;
+    level->head = i;
+}
+
+/* Accesses a single block at the given level */
+static void access_block(Level *level, uintptr_t block)
+{
+    uint32_t *p, i;
+
+    level->accesses += 1;
+
+    /* Accesses are often to the most recently used block */
+    if (level->head != NIL && level->nodes[level->head].block == block)
+        return;
+
+    for ( p = &level->buckets[hash_block(block) & level->mask];
+          *p != NIL; p = &level->nodes[*p].chain )
+    {
+        if (level->nodes[*p].block == block)
+        {
+            /* Hit: move to front */
+            i = *p;
+            unlink_node(level, i);
+            push_front(level, i);
+            return;
+        }
+    }
+
+    /* Miss: transfer block, evicting the least recently used one */
+    level->misses += 1;
+    if (level->used < level->capacity)
+    {
+        i = (uint32_t)level->used++;
+    }
+    else
+    {
+        i = level->tail;
+        unlink_node(level, i);
+        for ( p = &level->buckets[hash_block(level->nodes[i].block) &
+                                  level->mask];
+              *p != i; p = &level->nodes[*p].chain ) { }
+        *p = level->nodes[i].chain;
+    }
+    p = &level->buckets[hash_block(block) & level->mask];
+    level->nodes[i].block = block;
+    level->nodes[i].chain = *p;
+    *p = i;
+    push_front(level, i);
+}
+
+void CacheSim_access(CacheSim *sim, const void *addr, size_t size)
+{
+    uintptr_t begin, end, block;
+    int n;
+
+    if (size == 0)
+        return;
+
+    for (n = 0; n < sim->levels; ++n)
+    {
+        Level *level = &sim->level[n];
+
+        begin = (uintptr_t)addr >> level->block_shift;
+        end   = ((uintptr_t)addr + size - 1) >> level->block_shift;
+        for (block = begin; block <= end; ++block)
+            access_block(level, block);
+    }
+}
+
+void CacheSim_report(CacheSim *sim, FILE *fp, unsigned long long ops)
+{
+    const Level *level;
+    int n;
+
+    fprintf( fp, "%-5s %10s %14s %14s %14s %10s\n", "level", "block",
+             "capacity", "accesses", "transfers", "per op" );
+    for (n = 0; n < sim->levels; ++n)
+    {
+        level = &sim->level[n];
+        fprintf( fp, "%-5d %10zu %14zu %14llu %14llu %10.3f\n", n + 1,
+                 level->block_size, level->capacity*level->block_size,
+                 level->accesses, level->misses,
+                 ops > 0 ? (double)level->misses/ops : 0.0 );
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CACHE_SIM_H_INCLUDED
+#define CACHE_SIM_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Simulator of a memory hierarchy, used to count the block transfers made
+   by set implementations (see CacheSim.c).
+
+   Set implementations report the memory they access with CACHE_ACCESS(),
+   which does nothing unless a simulator is made active by assigning it to
+   CacheSim_active (and CACHE_SIM is defined to 1 in config.h, which must be
+   included before this header). */
+
+typedef struct CacheSim CacheSim;
+
+/* Creates a simulator of the hierarchy described by ``spec'': a
+   comma-separated list of levels, each given as block size and capacity
+   in bytes (see parse_size() in parsing.h), separated by a colon (for
+   example: "64:32K,64:8M,4K:1G"). Block sizes must be powers of two.
+   Returns NULL if the description is invalid. */
+CacheSim *CacheSim_create(const char *spec);
+
+/* Frees the simulator. */
+void CacheSim_destroy(CacheSim *sim);
+
+/* Simulates an access to ``size'' bytes of memory at ``addr''. */
+void CacheSim_access(CacheSim *sim, const void *addr, size_t size);
+
+/* Prints the number of block transfers at each level, in total and per
+   operation (given the number of operations performed). */
+void CacheSim_report(CacheSim *sim, FILE *fp, unsigned long long ops);
+
+/* The simulator that memory accesses are reported to (or NULL) */
+extern CacheSim *CacheSim_active;
+
+#if CACHE_SIM
+#define CACHE_ACCESS(addr, size)                                            \
+    do { if (CacheSim_active != NULL)                                       \
+             CacheSim_access(CacheSim_active, (addr), (size));              \
+    } while (0)
+#else
+#define CACHE_ACCESS(addr, size) do { } while (0)
+#endif
+
+#endif /* ndef CACHE_SIM_H_INCLUDED */
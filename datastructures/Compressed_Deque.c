@@ -0,0 +1,401 @@
+#include "Deque.h"
+#include "FileStorage.h"
+#include "compression.h"
+#include <assert.h>
+#include <string.h>
+
+/* Deque implementation with compressed segments
+
+   Elements are stored as in File_Deque.c (with the size stored at both ends
+   of the data, which is padded to a multiple of sizeof(size_t)) but grouped
+   into segments of about SEGMENT_SIZE bytes. Only the segments at the front
+   and back of the deque are kept uncompressed in memory; all segments in
+   between are compressed (see compression.c) and stored as blocks in file
+   storage:
+
+    +---------------+--~ ~-------------------------+---------------+
+    | front segment | block_1 | ... | block_N      | back segment  |
+    +---------------+--~ ~-------------------------+---------------+
+
+   New elements are appended to the back segment; when it is full, it is
+   compressed and appended to the blocks. Elements are removed from the
+   front segment; when it is empty, the first block is decompressed into it,
+   or if there are no blocks, the segments are swapped. The same happens in
+   reverse when elements are removed from the back. Consequently, adding
+   elements never affects the front segment, so elements retrieved from the
+   front remain valid while elements are added.
+
+   Each block consists of a header with the compressed size, the
+   uncompressed size and the number of elements, followed by the compressed
+   data (padded to a multiple of sizeof(size_t)) and the compressed size
+   once more (in order to be able to seek both ways). Segments that do not
+   compress are stored as-is (with equal compressed and uncompressed size).
+
+   As in File_Deque.c, the blocks are moved to the front of the file
+   periodically, and pushing data in front of the deque is not supported.
+*/
+
+#define SEGMENT_SIZE    ((size_t)64 << 10)
+
+typedef struct Segment Segment;
+typedef struct BlockHeader BlockHeader;
+typedef struct CompressedDeque CompressedDeque;
+
+struct Segment
+{
+    char        *data;                  /* Uncompressed elements */
+    size_t      capacity;               /* Size of allocated data */
+    size_t      begin;                  /* Offset to first element */
+    size_t      end;                    /* Offset to end of last element */
+    size_t      count;                  /* Number of elements */
+};
+
+struct BlockHeader
+{
+    size_t      compressed_size;        /* Size of compressed data */
+    size_t      size;                   /* Size of uncompressed data */
+    size_t      count;                  /* Number of elements */
+};
+
+struct CompressedDeque
+{
+    Deque       base;
+    size_t      count;                  /* Number of elements */
+    Segment     front;                  /* Segment at the front */
+    Segment     back;                   /* Segment at the back */
+    size_t      begin;                  /* Offset to first block */
+    size_t      end;                    /* Offset to end of last block */
+    char        *data;                  /* Allocated block data */
+    FileStorage fs;                     /* FileStorage for block data */
+};
+
+/* Rounds argument up to a multiple of sizeof(size_t) */
+static size_t align(size_t size)
+{
+    if (size%sizeof(size_t) != 0)
+        size = size - size%sizeof(size_t) + sizeof(size_t);
+    return size;
+}
+
+/* Returns the size of a block with the given compressed size */
+static size_t block_size(size_t compressed_size)
+{
+    return sizeof(BlockHeader) + align(compressed_size) + sizeof(size_t);
+}
+
+/* Ensures a segment can hold at least ``size'' bytes */
+static bool reserve_segment(Segment *seg, size_t size)
+{
+    char *data;
+
+    if (seg->capacity >= size)
+        return true;
+    if (size < SEGMENT_SIZE)
+        size = SEGMENT_SIZE;
+    data = realloc(seg->data, size);
+    if (data == NULL)
+        return false;
+    seg->data     = data;
+    seg->capacity = size;
+    return true;
+}
+
+/* Compresses the back segment and appends it to the blocks */
+static bool store_back(CompressedDeque *deque)
+{
+    Segment *seg = &deque->back;
+    BlockHeader header;
+    size_t size, compressed_size;
+    char *new_data, *p;
+
+    /* Allocate space for the worst case, and compress into place */
+    size = seg->end - seg->begin;
+    new_data = FS_reserve( &deque->fs, deque->data,
+                           deque->end + block_size(LZ_BOUND(size)) );
+    if (new_data == NULL)
+        return false;
+    deque->data = new_data;
+    p = deque->data + deque->end;
+    compressed_size = lz_compress( seg->data + seg->begin, size,
+                                   p + sizeof(BlockHeader) );
+    if (compressed_size >= size)
+    {
+        compressed_size = size;
+        memcpy(p + sizeof(BlockHeader), seg->data + seg->begin, size);
+    }
+    header.compressed_size = compressed_size;
+    header.size            = size;
+    header.count           = seg->count;
+    memcpy(p, &header, sizeof(header));
+    memcpy( p + block_size(compressed_size) - sizeof(size_t),
+            &compressed_size, sizeof(size_t) );
+
+    new_data = FS_resize( &deque->fs, deque->data,
+                          deque->end + block_size(compressed_size) );
+    assert(new_data == deque->data);
+    deque->end += block_size(compressed_size);
+
+    seg->begin = seg->end = seg->count = 0;
+    return true;
+}
+
+/* Decompresses the block at offset ``pos'' into an empty segment */
+static bool load_block(CompressedDeque *deque, size_t pos, Segment *seg)
+{
+    BlockHeader header;
+    const char *p;
+    bool ok;
+
+    assert(seg->count == 0);
+
+    memcpy(&header, deque->data + pos, sizeof(header));
+    if (!reserve_segment(seg, header.size))
+        return false;
+    p = deque->data + pos + sizeof(BlockHeader);
+    if (header.compressed_size == header.size)
+    {
+        memcpy(seg->data, p, header.size);
+        ok = true;
+    }
+    else
+    {
+        ok = lz_decompress(p, header.compressed_size, seg->data, header.size);
+    }
+    assert(ok);
+    seg->begin = 0;
+    seg->end   = header.size;
+    seg->count = header.count;
+    return ok;
+}
+
+/* Moves the first block into the front segment */
+static bool load_front(CompressedDeque *deque)
+{
+    BlockHeader header;
+
+    memcpy(&header, deque->data + deque->begin, sizeof(header));
+    if (!load_block(deque, deque->begin, &deque->front))
+        return false;
+    deque->begin += block_size(header.compressed_size);
+
+    if (deque->begin == deque->end)
+    {
+        deque->begin = deque->end = 0;
+    }
+    else
+    if (deque->begin > deque->end - deque->begin)
+    {
+        /* Compact space */
+        memmove( deque->data,
+                 deque->data + deque->begin, deque->end - deque->begin );
+        deque->end   -= deque->begin;
+        deque->begin -= deque->begin;
+    }
+    return true;
+}
+
+/* Moves the last block into the back segment */
+static bool load_back(CompressedDeque *deque)
+{
+    size_t compressed_size, pos;
+
+    memcpy( &compressed_size, deque->data + deque->end - sizeof(size_t),
+            sizeof(size_t) );
+    pos = deque->end - block_size(compressed_size);
+    if (!load_block(deque, pos, &deque->back))
+        return false;
+    deque->end = pos;
+    if (deque->begin == deque->end)
+        deque->begin = deque->end = 0;
+    return true;
+}
+
+/* Exchanges the front and back segments */
+static void swap_segments(CompressedDeque *deque)
+{
+    Segment seg;
+
+    seg          = deque->front;
+    deque->front = deque->back;
+    deque->back  = seg;
+}
+
+/* Returns the (non-empty) front segment, loading a block if necessary, or
+   NULL on failure. */
+static Segment *front_segment(CompressedDeque *deque)
+{
+    if (deque->front.count == 0)
+    {
+        if (deque->begin == deque->end)
+            swap_segments(deque);
+        else
+        if (!load_front(deque))
+            return NULL;
+    }
+    return &deque->front;
+}
+
+/* Returns the (non-empty) back segment, loading a block if necessary, or
+   NULL on failure. */
+static Segment *back_segment(CompressedDeque *deque)
+{
+    if (deque->back.count == 0)
+    {
+        if (deque->begin == deque->end)
+            swap_segments(deque);
+        else
+        if (!load_back(deque))
+            return NULL;
+    }
+    return &deque->back;
+}
+
+static void destroy(CompressedDeque *deque)
+{
+    FS_destroy(&deque->fs, deque->data);
+    free(deque->front.data);
+    free(deque->back.data);
+    free(deque);
+}
+
+static size_t size(CompressedDeque *deque)
+{
+    return deque->count;
+}
+
+static bool empty(CompressedDeque *deque)
+{
+    return deque->count == 0;
+}
+
+static bool push_back(CompressedDeque *deque, const void *data, size_t size)
+{
+    Segment *seg = &deque->back;
+    size_t aligned_size = align(size);
+
+    /* Store full segment */
+    if ( seg->count > 0 &&
+         seg->end + 2*sizeof(size_t) + aligned_size > SEGMENT_SIZE &&
+         !store_back(deque) )
+        return false;
+
+    if (!reserve_segment(seg, seg->end + 2*sizeof(size_t) + aligned_size))
+        return false;
+
+    /* Append item */
+    memcpy(seg->data + seg->end, &size, sizeof(size_t));
+    memcpy(seg->data + seg->end + sizeof(size_t), data, size);
+    memcpy( seg->data + seg->end + sizeof(size_t) + aligned_size,
+            &size, sizeof(size_t) );
+    seg->end += 2*sizeof(size_t) + aligned_size;
+    ++seg->count;
+    ++deque->count;
+
+    return true;
+}
+
+static bool push_front(CompressedDeque *deque, const void *data, size_t size)
+{
+    /* NOT IMPLEMENTED */
+    return false;
+}
+
+static bool get_back(CompressedDeque *deque, void **data, size_t *size)
+{
+    Segment *seg;
+
+    if (deque->count == 0 || (seg = back_segment(deque)) == NULL)
+        return false;
+
+    memcpy(size, seg->data + seg->end - sizeof(size_t), sizeof(size_t));
+    *data = seg->data + seg->end - sizeof(size_t) - align(*size);
+    return true;
+}
+
+static bool get_front(CompressedDeque *deque, void **data, size_t *size)
+{
+    Segment *seg;
+
+    if (deque->count == 0 || (seg = front_segment(deque)) == NULL)
+        return false;
+
+    memcpy(size, seg->data + seg->begin, sizeof(size_t));
+    *data = seg->data + seg->begin + sizeof(size_t);
+    return true;
+}
+
+static bool pop_back(CompressedDeque *deque)
+{
+    Segment *seg;
+    size_t size;
+
+    if (deque->count == 0 || (seg = back_segment(deque)) == NULL)
+        return false;
+
+    memcpy(&size, seg->data + seg->end - sizeof(size_t), sizeof(size_t));
+    seg->end -= 2*sizeof(size_t) + align(size);
+    if (--seg->count == 0)
+        seg->begin = seg->end = 0;
+    --deque->count;
+
+    return true;
+}
+
+static bool pop_front(CompressedDeque *deque)
+{
+    Segment *seg;
+    size_t size;
+
+    if (deque->count == 0 || (seg = front_segment(deque)) == NULL)
+        return false;
+
+    memcpy(&size, seg->data + seg->begin, sizeof(size_t));
+    seg->begin += 2*sizeof(size_t) + align(size);
+    if (--seg->count == 0)
+        seg->begin = seg->end = 0;
+    --deque->count;
+
+    return true;
+}
+
+static bool reserve(CompressedDeque *deque, size_t count, size_t size)
+{
+    /* Segments are allocated on demand */
+    return true;
+}
+
+Deque *Compressed_Deque_create(const char *filepath)
+{
+    CompressedDeque *deque;
+
+    /* Allocate memory */
+    deque = malloc(sizeof(CompressedDeque));
+    if (deque == NULL)
+        return NULL;
+
+    deque->base.destroy    = (void*)destroy;
+    deque->base.empty      = (void*)empty;
+    deque->base.size       = (void*)size;
+    deque->base.push_back  = (void*)push_back;
+    deque->base.push_front = (void*)push_front;
+    deque->base.get_back   = (void*)get_back;
+    deque->base.get_front  = (void*)get_front;
+    deque->base.pop_back   = (void*)pop_back;
+    deque->base.pop_front  = (void*)pop_front;
+    deque->base.reserve    = (void*)reserve;
+
+    memset(&deque->front, 0, sizeof(Segment));
+    memset(&deque->back, 0, sizeof(Segment));
+    deque->count = 0;
+    deque->begin = 0;
+    deque->end   = 0;
+    deque->data  = NULL;
+
+    if (!FS_create(&deque->fs, filepath))
+    {
+        free(deque);
+        return NULL;
+    }
+
+    return &deque->base;
+}
@@ -1,15 +1,49 @@
 #ifndef DEQUE_H_INCLUDED
 #define DEQUE_H_INCLUDED
 
-#include <stdlib.h>
+#include "BufferPool.h"
+#include "FileStorage.h"
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 typedef struct Deque Deque;
 
 /* Creates a new deque backed by the given file. */
 Deque *File_Deque_create(const char *filepath);
 
-/* Creates a new deque backed by memory. */
+/* Creates a new deque backed by the given file (or anonymous memory, if
+   ``filepath'' is NULL) that is mapped using the given kind of pages. */
+Deque *File_Deque_create_pages(const char *filepath, FS_Pages pages);
+
+/* Creates a new deque backed by a temporary file with pages cached by the
+   given buffer pool. */
+Deque *Pool_Deque_create(BufferPool *pool);
+
+/* Creates a new deque backed by the given file, in which elements are
+   stored in compressed segments. */
+Deque *Compressed_Deque_create(const char *filepath);
+
+/* Creates a new deque that keeps only blocks near its ends in memory, and
+   writes the others to a temporary file in ``dir'' (or $TMPDIR if NULL) in
+   a background thread. */
+Deque *Async_Deque_create(const char *dir);
+
+/* Prints I/O statistics of a deque created with Async_Deque_create() */
+void Async_Deque_report(Deque *deque, FILE *fp);
+
+/* Creates a deque that forwards all operations to ``deque'' (which it takes
+   ownership of) and records their latencies, to be printed with
+   Timed_Deque_report(). */
+Deque *Timed_Deque_create(Deque *deque);
+
+/* Prints latency percentiles (in nanoseconds) per operation type of a deque
+   created with Timed_Deque_create() since the previous report, or since its
+   creation if ``total'' is true. Does nothing for other deques. */
+void Timed_Deque_report(Deque *deque, FILE *fp, bool total);
+
+/* Creates a new deque backed by large chunks of memory, which (unlike the
+   other implementations) also supports pushing data in front. */
 Deque *Memory_Deque_create();
 
 
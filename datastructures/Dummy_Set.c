@@ -10,6 +10,12 @@ static bool contains(Set *set, const void *key_data, size_t key_size)
     return false;
 }
 
+static bool enumerate( Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    return true;
+}
+
 static void destroy(Set *set)
 {
     free(set);
@@ -24,12 +30,14 @@ Set *Dummy_Set_create()
     if (set == NULL)
         return NULL;
 
-    set->context  = NULL;
-    set->destroy  = destroy;
-    set->insert   = insert;
-    set->contains = contains;
-    set->hash     = NULL;
-    set->compare  = NULL;
+    set->context      = NULL;
+    set->destroy      = destroy;
+    set->insert       = insert;
+    set->contains     = contains;
+    set->insert_batch = NULL;
+    set->enumerate    = enumerate;
+    set->hash         = NULL;
+    set->compare      = NULL;
 
     return set;
 }
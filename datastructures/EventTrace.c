@@ -0,0 +1,118 @@
+#include "config.h"
+#include "EventTrace.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* Events are stored as fixed-size records in a ring buffer of which the
+   size is a power of two. Threads claim the next record with an atomic
+   increment of ``trace_next'', so recording does not take a lock; the
+   buffer must not be exported while events are being recorded. */
+
+typedef struct EventRecord
+{
+    uint64_t    start, end;     /* Ticks of Histogram_ticks() */
+    uint64_t    arg[2];
+    uint16_t    type;
+    uint16_t    tid;            /* Small thread number (from 1) */
+    uint32_t    reserved;
+} EventRecord;
+
+static const struct
+{
+    const char *name, *category, *arg0, *arg1;
+} event_info[TRACE_EVENT_COUNT] = {
+    { "grow",           "Bender_Impl",  "order",        "capacity" },
+    { "redistribute",   "Bender_Impl",  "level",        "window" },
+    { "split",          "Btree_Set",    "page",         "new_page" },
+    { "new_root",       "Btree_Set",    "root",         "old_root" },
+    { "compact",        "File_Deque",   "bytes",        "offset" },
+    { "grow",           "FileStorage",  "old_capacity", "new_capacity" },
+    { "remap",          "FileStorage",  "old_reserved", "new_reserved" },
+    { "resize",         "Hash_Set",     "old_size",     "new_size" } };
+
+bool EventTrace_active = false;
+
+static EventRecord          *trace_records  = NULL;
+static size_t               trace_mask      = 0;    /* Capacity minus one */
+static unsigned long long   trace_next      = 0;    /* Records written */
+static unsigned long long   trace_base      = 0;    /* Tick of start */
+static unsigned             trace_threads   = 0;
+static __thread unsigned    trace_tid       = 0;
+
+bool EventTrace_start(size_t capacity)
+{
+    size_t size;
+
+    EventTrace_active = false;
+    for (size = 1; size < capacity; size *= 2) { }
+    free(trace_records);
+    trace_records = malloc(size*sizeof(EventRecord));
+    if (trace_records == NULL)
+        return false;
+    trace_mask = size - 1;
+    trace_next = 0;
+    Histogram_ns_per_tick();    /* calibrate now rather than when exporting */
+    trace_base = Histogram_ticks();
+    EventTrace_active = true;
+    return true;
+}
+
+void EventTrace_stop(void)
+{
+    EventTrace_active = false;
+}
+
+void EventTrace_record( TraceEvent type, unsigned long long start,
+                        unsigned long long arg0, unsigned long long arg1 )
+{
+    EventRecord *rec;
+
+    /* Ignore events that started before tracing did */
+    if (start < trace_base)
+        return;
+
+    if (trace_tid == 0)
+        trace_tid = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+
+    rec = &trace_records[ __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED)
+                          & trace_mask ];
+    rec->start  = start;
+    rec->end    = Histogram_ticks();
+    rec->arg[0] = arg0;
+    rec->arg[1] = arg1;
+    rec->type   = (uint16_t)type;
+    rec->tid    = (uint16_t)trace_tid;
+}
+
+bool EventTrace_export(const char *path)
+{
+    FILE *fp;
+    const EventRecord *rec;
+    unsigned long long n, first;
+    double scale;
+
+    fp = fopen(path, "wt");
+    if (fp == NULL)
+        return false;
+
+    /* Only the most recent events are kept if the buffer overflowed */
+    first = trace_next > trace_mask + 1 ? trace_next - (trace_mask + 1) : 0;
+    scale = Histogram_ns_per_tick()/1000;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (n = first; n < trace_next; ++n)
+    {
+        rec = &trace_records[n & trace_mask];
+        fprintf( fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"%s\":%llu,\"%s\":%llu}}%s\n",
+                 event_info[rec->type].name, event_info[rec->type].category,
+                 scale*(rec->start - trace_base), scale*(rec->end - rec->start),
+                 (unsigned)rec->tid,
+                 event_info[rec->type].arg0, (unsigned long long)rec->arg[0],
+                 event_info[rec->type].arg1, (unsigned long long)rec->arg[1],
+                 n + 1 < trace_next ? "," : "" );
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef EVENT_TRACE_H_INCLUDED
+#define EVENT_TRACE_H_INCLUDED
+
+#include "Histogram.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Tracing of expensive structural maintenance operations (resizes, splits,
+   redistributions, compactions) in data structure implementations.
+
+   Events are recorded in a ring buffer of fixed-size binary records, which
+   keeps the most recent events when it overflows, and can be exported as a
+   JSON file in the Chrome trace event format (to be viewed on a timeline in
+   chrome://tracing or Perfetto, for example).
+
+   Implementations mark events with TRACE_START() and TRACE_END(), which
+   cost a single branch unless tracing was started with EventTrace_start()
+   (and nothing at all unless EVENT_TRACE is defined to 1 in config.h, which
+   must be included before this header). */
+
+typedef enum TraceEvent
+{
+    TRACE_BENDER_GROW,          /* order, capacity of new table */
+    TRACE_BENDER_REDISTRIBUTE,  /* level, window size */
+    TRACE_BTREE_SPLIT,          /* page, new page */
+    TRACE_BTREE_NEW_ROOT,       /* new root page, old root page */
+    TRACE_DEQUE_COMPACT,        /* bytes moved, offset moved from */
+    TRACE_FS_GROW,              /* old capacity, new capacity */
+    TRACE_FS_REMAP,             /* old reserved size, new reserved size */
+    TRACE_HASH_RESIZE,          /* old size, new size */
+    TRACE_EVENT_COUNT
+} TraceEvent;
+
+/* Starts recording events in a ring buffer of ``capacity'' events (rounded
+   up to a power of two), discarding events recorded before. Returns false
+   if the buffer could not be allocated. */
+bool EventTrace_start(size_t capacity);
+
+/* Stops recording events (but keeps those recorded so far). */
+void EventTrace_stop(void);
+
+/* Writes the recorded events to the given file in the Chrome trace event
+   format, with timestamps in microseconds since tracing was started.
+   Returns false and sets errno if the file could not be written. */
+bool EventTrace_export(const char *path);
+
+/* Records an event of the given type that started at tick ``start'' (of
+   Histogram_ticks()) and ends now, with two type-specific arguments. */
+void EventTrace_record( TraceEvent type, unsigned long long start,
+                        unsigned long long arg0, unsigned long long arg1 );
+
+/* Whether events are being recorded */
+extern bool EventTrace_active;
+
+#if EVENT_TRACE
+#define TRACE_START() (EventTrace_active ? Histogram_ticks() : 0)
+#define TRACE_END(type, start, arg0, arg1)                                  \
+    do { if (EventTrace_active)                                             \
+             EventTrace_record((type), (start), (arg0), (arg1));            \
+    } while (0)
+#else
+#define TRACE_START() 0
+#define TRACE_END(type, start, arg0, arg1) do { (void)(start); } while (0)
+#endif
+
+#endif /* ndef EVENT_TRACE_H_INCLUDED */
@@ -1,17 +1,67 @@
 #include "config.h"
+#include "EventTrace.h"
 #include "FileStorage.h"
 
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Storage is allocated as follows: a large range of address space is
+   reserved with a single mapping, of which only the first ``capacity''
+   bytes are in use (for file-backed storage, the file is only as large as
+   the capacity). The capacity grows geometrically, so growing the used size
+   a little at a time only rarely requires a system call, and since the
+   mapping does not have to be moved until the reserved range is exhausted,
+   pointers into the storage remain valid most of the time.
+
+   When transparent huge pages are requested, the reserved range is aligned
+   to the huge page size and marked with madvise(MADV_HUGEPAGE). Explicit
+   huge pages are mapped with MAP_HUGETLB instead; since such mappings cannot
+   be resized and running out of huge pages after mapping them would be
+   fatal, they are reserved up-front (without MAP_NORESERVE), and copied when
+   they need to grow.
+
+   The capacity of all anonymous storage (and of memory allocated by
+   Allocator_malloc) is tallied against an optional memory budget. When a
+   storage area grows past the budget, its contents are written to a
+   temporary file which is then mapped over the same address range, turning
+   it into file-backed storage without moving it.
+
+   Storage that is attributed to a usage record (see FS_use()) is kept in a
+   list per record once it is first mapped, so the residency of its pages
+   can be sampled. */
+
+/* Size of transparent huge pages */
+#define THP_SIZE ((size_t)2 << 20)
+
+static size_t       fs_budget       = 0;    /* Memory budget (0: none) */
+static const char   *fs_spill_dir   = NULL; /* Directory for spill files */
+static size_t       fs_used         = 0;    /* Anonymous memory in use */
+static size_t       fs_spilled      = 0;    /* Storage spilled to files */
+static FS_Usage     *fs_usages      = NULL; /* List of usage records */
+static FS_Usage     *fs_usage       = NULL; /* Current usage record */
+
+/* Bits of the residency recorded per page by FS_sample_usage() */
+#define PAGE_RESIDENT   1   /* resident when last sampled */
+#define PAGE_SEEN       2   /* found resident at some sample */
+
 bool FS_create(FileStorage *fs, const char *path)
+{
+    return FS_create_pages(fs, path, FS_PAGES_DEFAULT);
+}
+
+bool FS_create_pages(FileStorage *fs, const char *path, FS_Pages pages)
 {
     int fd;
 
@@ -33,15 +83,49 @@ bool FS_create(FileStorage *fs, const char *path)
     /* Initialize FileStorage structure */
     fs->size       = 0;
     fs->capacity   = 0;
+    fs->reserved   = 0;
     fs->fd         = fd;
+    fs->pages      = pages;
+    fs->hugetlb    = false;
+    fs->spilled    = false;
+    fs->usage      = fs_usage;
+    fs->data       = NULL;
+    fs->pages_seen = NULL;
+    fs->pages_known = 0;
+    fs->next       = NULL;
+
+    /* Explicit huge pages are only available for anonymous memory */
+    if (fd != -1 && (pages == FS_PAGES_2M || pages == FS_PAGES_1G))
+        fs->pages = FS_PAGES_THP;
 
     return true;
 }
 
 void FS_destroy(FileStorage *fs, void *data)
 {
+    FileStorage **p;
+
+    if (fs->spilled)
+        fs_spilled -= fs->capacity;
+    else
+    if (fs->fd == -1)
+        fs_used -= fs->capacity;
+
+    if (fs->usage != NULL)
+    {
+        fs->usage->reserved -= fs->reserved;
+        fs->usage->mapped   -= fs->capacity;
+        if (fs->data != NULL)
+        {
+            for (p = &fs->usage->storage; *p != fs; p = &(*p)->next)
+                assert(*p != NULL);
+            *p = fs->next;
+        }
+        free(fs->pages_seen);
+    }
+
     if (data != NULL)
-        munmap(data, fs->size);
+        munmap(data, fs->reserved);
     if (fs->fd != -1)
         close(fs->fd);
 }
@@ -54,58 +138,495 @@ void *FS_resize(FileStorage *fs, void *data, size_t size)
     return data;
 }
 
+/* Returns the size of the pages used for the storage */
+static size_t page_size(const FileStorage *fs)
+{
+    switch (fs->pages)
+    {
+    case FS_PAGES_2M:   return (size_t)2 << 20;
+    case FS_PAGES_1G:   return (size_t)1 << 30;
+    default:            return ALLOC_CHUNK_SIZE;
+    }
+}
+
+/* Maps ``size'' bytes of the storage at an address that is a multiple of
+   ``align'' (or anywhere, if ``align'' is 0). Returns MAP_FAILED on
+   failure. */
+static void *map_aligned(FileStorage *fs, size_t size, size_t align, int flags)
+{
+    char *area, *data;
+
+    if (align == 0)
+        return mmap(NULL, size, PROT_READ|PROT_WRITE, flags, fs->fd, (off_t)0);
+
+    /* Reserve a larger area, map the storage at the aligned address inside
+       it and release the remainder. */
+    area = mmap( NULL, size + align, PROT_NONE,
+                 MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, (off_t)0 );
+    if (area == MAP_FAILED)
+        return MAP_FAILED;
+    data = area + (align - (size_t)area%align)%align;
+    if (mmap( data, size, PROT_READ|PROT_WRITE, flags|MAP_FIXED,
+              fs->fd, (off_t)0 ) == MAP_FAILED)
+    {
+        munmap(area, size + align);
+        return MAP_FAILED;
+    }
+    if (data > area)
+        munmap(area, data - area);
+    if (data + size < area + size + align)
+        munmap(data + size, area + align - data);
+    return data;
+}
+
+/* Maps ``size'' bytes of anonymous memory using explicit huge pages and
+   moves the contents of ``data'' (if any) there. Returns the new data
+   pointer, or NULL if no huge pages could be mapped. */
+static void *map_hugetlb(FileStorage *fs, void *data, size_t size)
+{
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    void *new_data;
+    int flags;
+
+    flags = MAP_PRIVATE|MAP_ANON|MAP_HUGETLB;
+    if (fs->pages == FS_PAGES_2M)
+        flags |= 21 << MAP_HUGE_SHIFT;
+    else
+        flags |= 30 << MAP_HUGE_SHIFT;
+    new_data = mmap(NULL, size, PROT_READ|PROT_WRITE, flags, -1, (off_t)0);
+    if (new_data == MAP_FAILED)
+        return NULL;
+
+    if (data != NULL)
+    {
+        memcpy(new_data, data, fs->capacity);
+        munmap(data, fs->reserved);
+    }
+    fs->hugetlb  = true;
+    fs->reserved = size;
+    return new_data;
+#else
+    return NULL;
+#endif
+}
+
+/* Maps (or remaps) ``data'' to a reserved range of ``size'' bytes.
+   Returns the new data pointer, or NULL if mapping failed (in which case
+   the old mapping is still intact). */
+static void *map_reserved(FileStorage *fs, void *data, size_t size)
+{
+    void *new_data;
+    size_t align;
+    int flags;
+
+    flags = MAP_NORESERVE |
+            (fs->fd == -1 ? (MAP_PRIVATE|MAP_ANON) : MAP_SHARED);
+    align = fs->pages == FS_PAGES_THP ? THP_SIZE : 0;
+
+    if (data == NULL)
+    {
+        new_data = map_aligned(fs, size, align, flags);
+    }
+    else
+    if (HAVE_MREMAP && !fs->hugetlb)
+    {
+#if HAVE_MREMAP
+        if (align == 0)
+        {
+            new_data = mremap(data, fs->reserved, size, MREMAP_MAYMOVE);
+        }
+        else
+        {
+            /* Move the mapping into an aligned placeholder */
+            new_data = map_aligned(fs, size, align, flags);
+            if (new_data != MAP_FAILED &&
+                mremap( data, fs->reserved, size,
+                        MREMAP_MAYMOVE|MREMAP_FIXED, new_data ) == MAP_FAILED)
+            {
+                munmap(new_data, size);
+                new_data = MAP_FAILED;
+            }
+        }
+#endif
+    }
+    else
+    {
+        new_data = map_aligned(fs, size, align, flags);
+        if (new_data != MAP_FAILED)
+        {
+            if (fs->fd == -1)
+                memcpy(new_data, data, fs->capacity);
+            munmap(data, fs->reserved);
+        }
+    }
+
+    /* Check wether mapping was succesful.*/
+    if (new_data == NULL || new_data == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (fs->pages == FS_PAGES_THP)
+        madvise(new_data, size, MADV_HUGEPAGE);
+#endif
+
+    fs->hugetlb  = false;
+    fs->reserved = size;
+    return new_data;
+}
+
+/* Returns whether a chunk of memory contains only zero bytes */
+static bool is_zero(const char *p, size_t size)
+{
+    return size == 0 || (p[0] == 0 && memcmp(p, p + 1, size - 1) == 0);
+}
+
+/* Moves the first ``used'' bytes of anonymous storage to a new temporary
+   file, and maps the file in its place. Chunks that are all zero are not
+   written, so they remain holes in the file. Returns whether this was
+   successful; if not, the storage is left unchanged. */
+static bool spill(FileStorage *fs, void *data, size_t used)
+{
+    const char *dir, *p;
+    char *path;
+    ssize_t written;
+    size_t pos, len;
+    int fd;
+
+    assert(fs->fd == -1 && !fs->hugetlb);
+
+    /* Create an anonymous file in the spill directory */
+    dir = fs_spill_dir;
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+    if (dir == NULL)
+        dir = "/tmp";
+    path = malloc(strlen(dir) + 16);
+    if (path == NULL)
+        return false;
+    sprintf(path, "%s/spill-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    free(path);
+    if (fd < 0)
+        return false;
+
+    /* Copy contents and map the file over the reserved range */
+    if (fs->usage != NULL)
+        fs->usage->truncates += 1;
+    if (ftruncate(fd, (off_t)fs->capacity) != 0)
+        goto failed;
+    for (pos = 0, p = data; pos < used; pos += len)
+    {
+        len = used - pos < ALLOC_CHUNK_SIZE ? used - pos : ALLOC_CHUNK_SIZE;
+        if (is_zero(p + pos, len))
+            continue;
+        written = pwrite(fd, p + pos, len, (off_t)pos);
+        if (written != (ssize_t)len)
+            goto failed;
+    }
+    if (mmap( data, fs->reserved, PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_NORESERVE|MAP_FIXED, fd, (off_t)0 ) == MAP_FAILED)
+        goto failed;
+
+    fs->fd      = fd;
+    fs->spilled = true;
+    fs->pages   = FS_PAGES_DEFAULT;
+    fs_used    -= fs->capacity;
+    fs_spilled += fs->capacity;
+    return true;
+
+failed:
+    close(fd);
+    return false;
+}
+
 void *FS_reserve(FileStorage *fs, void *data, size_t size)
 {
-    int res;
-    size_t old_size, new_size;
+    void *new_data;
+    size_t old_capacity, old_reserved, new_capacity, new_reserved;
+    unsigned long long start, remap_start;
 
     /* First, check to see if any reallocation is required */
     if (size <= fs->capacity)
         return data;
+    start = TRACE_START();
 
-    /* Round desired size up to the next page boundary. */
-    old_size = fs->capacity;
-    new_size = size;
-    if (new_size%ALLOC_CHUNK_SIZE != 0)
+    /* Grow capacity geometrically, and round it up to the next chunk
+       (or page) boundary. */
+    new_capacity = 2*fs->capacity;
+    if (new_capacity < size)
+        new_capacity = size;
+    if (new_capacity%page_size(fs) != 0)
     {
-        new_size += ALLOC_CHUNK_SIZE - new_size%ALLOC_CHUNK_SIZE;
-        if (new_size < size)
+        new_capacity += page_size(fs) - new_capacity%page_size(fs);
+        if (new_capacity < size)
             return NULL;   /* overflow */
     }
 
-    /* Change file size */
+    /* Change file size before remapping, so that a failure leaves the
+       storage (and the caller's pointer) unchanged */
     assert(sizeof(off_t) >= sizeof(size_t));
     if (fs->fd != -1)
     {
-        res = ftruncate(fs->fd, (off_t)new_size);
-        if (res != 0)
+        if (fs->usage != NULL)
+            fs->usage->truncates += 1;
+        if (ftruncate(fs->fd, (off_t)new_capacity) != 0)
             return NULL;
     }
 
-    /* Remap memory */
-    if (HAVE_MREMAP && data != NULL)
+    /* Reserve more address space if necessary. If a large range cannot be
+       reserved, settle for the required capacity. If explicit huge pages
+       are not available, fall back to transparent huge pages. */
+    if (new_capacity > fs->reserved)
     {
-#if HAVE_MREMAP
-        data = mremap(data, old_size, new_size, MREMAP_MAYMOVE);
-#endif
-        /* FIXME: If this fails, does the old mapping still exist? */
+        remap_start  = TRACE_START();
+        old_reserved = fs->reserved;
+        new_reserved = fs->reserved > 0 ? 4*fs->reserved : FS_RESERVE_SIZE;
+        while (new_reserved < new_capacity && new_reserved > fs->reserved)
+            new_reserved *= 2;
+        new_data = NULL;
+        if (fs->pages == FS_PAGES_2M || fs->pages == FS_PAGES_1G)
+        {
+            if (new_reserved > fs->reserved)
+                new_data = map_hugetlb(fs, data, new_reserved);
+            if (new_data == NULL)
+                new_data = map_hugetlb(fs, data, new_capacity);
+            if (new_data == NULL)
+                fs->pages = FS_PAGES_THP;
+        }
+        if (new_data == NULL && new_reserved > fs->reserved)
+            new_data = map_reserved(fs, data, new_reserved);
+        if (new_data == NULL)
+            new_data = map_reserved(fs, data, new_capacity);
+        if (new_data == NULL)
+            return NULL;
+        if (fs->usage != NULL)
+        {
+            fs->usage->reserved += fs->reserved - old_reserved;
+            if (data != NULL)
+            {
+                fs->usage->remaps   += 1;
+                fs->usage->remapped += fs->capacity;
+            }
+            else
+            {
+                /* Only storage that is mapped is listed for sampling */
+                fs->next = fs->usage->storage;
+                fs->usage->storage = fs;
+            }
+        }
+        data = new_data;
+        fs->data = data;
+        TRACE_END(TRACE_FS_REMAP, remap_start, old_reserved, fs->reserved);
     }
+
+#if FS_POPULATE
+    /* Prefault the pages that were added */
+#ifdef MADV_POPULATE_WRITE
+    madvise( (char*)data + fs->capacity, new_capacity - fs->capacity,
+             MADV_POPULATE_WRITE );
+#else
+    madvise( (char*)data + fs->capacity, new_capacity - fs->capacity,
+             MADV_WILLNEED );
+#endif
+#endif
+
+    /* Update capacity */
+    old_capacity = fs->capacity;
+    if (fs->spilled)
+        fs_spilled += new_capacity - old_capacity;
     else
+    if (fs->fd == -1)
+        fs_used += new_capacity - old_capacity;
+    if (fs->usage != NULL)
+        fs->usage->mapped += new_capacity - old_capacity;
+    fs->capacity = new_capacity;
+
+    /* Spill to disk when over budget (memory past the old capacity has
+       not been written yet) */
+    if ( fs_budget > 0 && fs_used > fs_budget &&
+         fs->fd == -1 && !fs->hugetlb )
+        spill(fs, data, old_capacity);
+
+    TRACE_END(TRACE_FS_GROW, start, old_capacity, new_capacity);
+    return data;
+}
+
+void FS_set_budget(size_t budget, const char *spill_dir)
+{
+    fs_budget    = budget;
+    fs_spill_dir = spill_dir;
+}
+
+void FS_account(FS_Usage *usage, size_t old_size, size_t new_size)
+{
+    fs_used += new_size - old_size;
+    if (usage != NULL)
+        usage->allocated += new_size - old_size;
+}
+
+size_t FS_memory_used(void)
+{
+    return fs_used;
+}
+
+size_t FS_memory_spilled(void)
+{
+    return fs_spilled;
+}
+
+FS_Usage *FS_usage(const char *name)
+{
+    FS_Usage *usage, **p;
+
+    for (p = &fs_usages; *p != NULL; p = &(*p)->next)
     {
-        if (data != NULL)
-            munmap(data, old_size);
-        data = mmap( NULL, new_size, PROT_READ|PROT_WRITE,
-                     fs->fd == -1 ? (MAP_PRIVATE|MAP_ANON) : MAP_SHARED,
-                     fs->fd, (off_t)0 );
-        /* FIXME: if this fails, the old mapping is destroyed! */
+        if (strcmp((*p)->name, name) == 0)
+            return *p;
     }
 
-    /* Check wether remapping was succesful.*/
-    if (data == NULL || data == MAP_FAILED)
+    usage = calloc(1, sizeof(FS_Usage));
+    if (usage == NULL)
         return NULL;
+    usage->name = name;
+    *p = usage;
+    return usage;
+}
 
-    /* Update capacity */
-    fs->capacity = new_size;
+FS_Usage *FS_use(FS_Usage *usage)
+{
+    FS_Usage *previous = fs_usage;
 
-    return data;
+    fs_usage = usage;
+    return previous;
+}
+
+FS_Usage *FS_current_usage(void)
+{
+    return fs_usage;
+}
+
+/* Samples the residency of the pages of the storage, adds the number of
+   bytes resident to its usage record and counts refaults. */
+static void sample_storage(FileStorage *fs)
+{
+    unsigned char vec[4096], *seen;
+    size_t pagesize, pages, pos, len, n;
+    FS_Usage *usage = fs->usage;
+
+    if (fs->data == NULL || fs->capacity == 0)
+        return;
+
+    pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    pages = (fs->capacity + pagesize - 1)/pagesize;
+    if (pages > fs->pages_known)
+    {
+        seen = realloc(fs->pages_seen, pages);
+        if (seen == NULL)
+            return;
+        memset(seen + fs->pages_known, 0, pages - fs->pages_known);
+        fs->pages_seen  = seen;
+        fs->pages_known = pages;
+    }
+
+    for (pos = 0; pos < pages; pos += len)
+    {
+        len = pages - pos < sizeof(vec) ? pages - pos : sizeof(vec);
+        if (mincore((char*)fs->data + pos*pagesize, len*pagesize, vec) != 0)
+            memset(vec, 0, len);
+        for (n = 0; n < len; ++n)
+        {
+            seen = &fs->pages_seen[pos + n];
+            if (vec[n] & 1)
+            {
+                usage->resident += pagesize;
+                if (*seen == PAGE_SEEN)
+                    usage->refaults += 1;
+                *seen = PAGE_SEEN | PAGE_RESIDENT;
+            }
+            else
+            {
+                *seen &= ~PAGE_RESIDENT;
+            }
+        }
+    }
+}
+
+void FS_sample_usage(void)
+{
+    FS_Usage *usage;
+    FileStorage *fs;
+
+    for (usage = fs_usages; usage != NULL; usage = usage->next)
+    {
+        usage->resident = 0;
+        for (fs = usage->storage; fs != NULL; fs = fs->next)
+            sample_storage(fs);
+    }
+}
+
+void FS_report_usage(FILE *fp)
+{
+    const double MiB = 1048576.0;
+    FS_Usage *usage;
+
+    for (usage = fs_usages; usage != NULL; usage = usage->next)
+    {
+        fprintf( fp, "# %s: reserved %.1f MiB, mapped %.1f MiB, "
+                     "resident %.1f MiB, malloc %.1f MiB, "
+                     "%lu truncates, %lu remaps (%.1f MiB), %llu refaults\n",
+                 usage->name, usage->reserved/MiB, usage->mapped/MiB,
+                 usage->resident/MiB, usage->allocated/MiB,
+                 usage->truncates, usage->remaps, usage->remapped/MiB,
+                 usage->refaults );
+    }
+}
+
+bool FS_parse_pages(const char *str, FS_Pages *pages)
+{
+    if (strcmp(str, "thp") == 0)
+        *pages = FS_PAGES_THP;
+    else
+    if (strcmp(str, "2m") == 0)
+        *pages = FS_PAGES_2M;
+    else
+    if (strcmp(str, "1g") == 0)
+        *pages = FS_PAGES_1G;
+    else
+        return false;
+    return true;
+}
+
+size_t FS_huge_page_usage(void)
+{
+    static const char * const fields[] = {
+        "AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:",
+        "Shared_Hugetlb:", "Private_Hugetlb:", NULL };
+    FILE *fp;
+    char line[256];
+    unsigned long kb;
+    size_t total;
+    int n;
+
+    /* Sum huge page usage over all mappings (the summary in smaps_rollup
+       is cheaper to read, but not available on older kernels) */
+    fp = fopen("/proc/self/smaps_rollup", "rt");
+    if (fp == NULL)
+        fp = fopen("/proc/self/smaps", "rt");
+    if (fp == NULL)
+        return 0;
+    total = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        for (n = 0; fields[n] != NULL; ++n)
+        {
+            if ( strncmp(line, fields[n], strlen(fields[n])) == 0 &&
+                 sscanf(line + strlen(fields[n]), "%lu", &kb) == 1 )
+                total += (size_t)kb*1024;
+        }
+    }
+    fclose(fp);
+
+    return total;
 }
@@ -2,16 +2,63 @@
 #define FILE_STORAGE_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 typedef struct FileStorage FileStorage;
+typedef struct FS_Usage FS_Usage;
+typedef enum FS_Pages FS_Pages;
+
+/* Kinds of pages that storage can be mapped with */
+enum FS_Pages
+{
+    FS_PAGES_DEFAULT,       /* Regular pages */
+    FS_PAGES_THP,           /* Transparent huge pages (madvise()d) */
+    FS_PAGES_2M,            /* Explicit 2 MiB huge pages (MAP_HUGETLB) */
+    FS_PAGES_1G             /* Explicit 1 GiB huge pages (MAP_HUGETLB) */
+};
 
 /* Models a memory-mapped storage area backed by a file. */
 struct FileStorage
 {
     size_t  size;           /* Size of memory used */
     size_t  capacity;       /* Size of memory allocated */
+    size_t  reserved;       /* Size of address space reserved */
     int     fd;             /* Open file descriptor */
+    FS_Pages pages;         /* Kind of pages requested */
+    bool    hugetlb;        /* Whether mapped with explicit huge pages */
+    bool    spilled;        /* Whether moved to a spill file */
+
+    /* For usage accounting (see FS_use()): */
+    FS_Usage    *usage;     /* Usage record (or NULL if not accounted) */
+    FileStorage *next;      /* Next storage with the same usage record */
+    void        *data;      /* Current mapping */
+    unsigned char *pages_seen;  /* Residency of each page when sampled */
+    size_t      pages_known;    /* Number of entries in pages_seen */
+};
+
+/* Usage of memory and I/O by the storage of a named data structure.
+
+   Storage is attributed to the usage record that is selected with FS_use()
+   when the storage is created, and counts towards it until it is destroyed.
+   Residency is determined by sampling the mappings with mincore(2); a page
+   that is found resident after it was found to be evicted at an earlier
+   sample counts as a refault, which estimates the number of major faults
+   (pages that are evicted and read back in between two samples are missed).
+*/
+struct FS_Usage
+{
+    const char          *name;
+    size_t              reserved;   /* Address space reserved */
+    size_t              mapped;     /* Storage capacity mapped */
+    size_t              allocated;  /* Memory allocated with malloc() */
+    size_t              resident;   /* Mapped memory resident when sampled */
+    unsigned long       truncates;  /* Number of calls to ftruncate() */
+    unsigned long       remaps;     /* Number of times storage was remapped */
+    unsigned long long  remapped;   /* Bytes of storage moved by remapping */
+    unsigned long long  refaults;   /* Pages paged in again after eviction */
+    FileStorage         *storage;   /* List of storage with this record */
+    FS_Usage            *next;      /* Next usage record */
 };
 
 /* Creates an empty storage area backed by a file with the specified path.
@@ -19,12 +66,21 @@ struct FileStorage
    opened, or returns false and sets errno. */
 bool FS_create(FileStorage *fs, const char *path);
 
+/* Creates an empty storage area like FS_create(), which will be mapped using
+   the given kind of pages. Explicit huge pages can only be used for
+   anonymous storage and are only available if the system administrator has
+   reserved them; otherwise, transparent huge pages are used instead (which
+   the system may not provide either, in which case regular pages are used).
+*/
+bool FS_create_pages(FileStorage *fs, const char *path, FS_Pages pages);
+
 /* Releases all associated resources */
 void FS_destroy(FileStorage *fs, void *data);
 
 /* Resizes the used memory size.
-   This may cause the underlying file to be extended, in which case ``data''
-   may have to be moved!
+   This may cause the underlying file to be extended. The capacity grows
+   geometrically, and ``data'' only has to be moved when the address space
+   reserved for the storage is exhausted (which is rare, but possible!)
 
    Returns a new data pointer or returns NULL and sets errno. */
 void *FS_resize(FileStorage *fs, void *data, size_t new_size);
@@ -35,4 +91,54 @@ void *FS_resize(FileStorage *fs, void *data, size_t new_size);
    Returns a new data pointer or returns NULL and sets errno. */
 void *FS_reserve(FileStorage *fs, void *data, size_t new_size);
 
+/* Sets a process-wide budget (in bytes) for anonymous memory, or disables
+   it if ``budget'' is 0. When growing anonymous storage would exceed the
+   budget, the storage is moved to an (unlinked) temporary file in the
+   directory ``spill_dir'' (or $TMPDIR or /tmp, if it is NULL) instead, so
+   its cold pages are written back to that file rather than swapped out.
+   Pointers into spilled storage remain valid. Storage mapped with explicit
+   huge pages is never spilled.
+
+   Memory allocated by Allocator_malloc counts towards the budget, but
+   cannot be spilled. */
+void FS_set_budget(size_t budget, const char *spill_dir);
+
+/* Accounts for a change in the size of an anonymous allocation that is not
+   managed by file storage (from ``old_size'' to ``new_size'' bytes), which
+   belongs to the given usage record (or NULL). */
+void FS_account(FS_Usage *usage, size_t old_size, size_t new_size);
+
+/* Returns the usage record with the given name, which is created if it
+   does not exist yet, or NULL if memory could not be allocated. Records
+   exist until the end of the process. */
+FS_Usage *FS_usage(const char *name);
+
+/* Selects the usage record (or NULL) to which storage and allocations
+   created from now on are attributed, and returns the previous one. */
+FS_Usage *FS_use(FS_Usage *usage);
+
+/* Returns the usage record currently selected with FS_use() */
+FS_Usage *FS_current_usage(void);
+
+/* Updates the resident size and refault count of all usage records by
+   sampling the residency of their storage. */
+void FS_sample_usage(void);
+
+/* Prints a line for each usage record (starting with a '#'). */
+void FS_report_usage(FILE *fp);
+
+/* Returns the number of bytes of anonymous memory currently accounted */
+size_t FS_memory_used(void);
+
+/* Returns the number of bytes of storage currently spilled to disk */
+size_t FS_memory_spilled(void);
+
+/* Parses a kind of pages ("thp", "2m" or "1g"). Returns false if the string
+   is not recognized. */
+bool FS_parse_pages(const char *str, FS_Pages *pages);
+
+/* Returns the number of bytes of memory of this process that are currently
+   mapped using huge pages (of either kind), or 0 if this is unknown. */
+size_t FS_huge_page_usage(void);
+
 #endif /* ndef FILE_STORAGE_H_INCLUDED */
@@ -1,4 +1,6 @@
 #include "Deque.h"
+#include "config.h"
+#include "EventTrace.h"
 #include "FileStorage.h"
 #include <assert.h>
 #include <string.h>
@@ -143,8 +145,11 @@ static bool pop_front(FileDeque *deque)
     if (deque->begin > deque->end - deque->begin)
     {
         /* Compact space */
+        unsigned long long start = TRACE_START();
         memmove( deque->data,
                  deque->data + deque->begin, deque->end - deque->begin );
+        TRACE_END( TRACE_DEQUE_COMPACT, start,
+                   deque->end - deque->begin, deque->begin );
         deque->end   -= deque->begin;
         deque->begin -= deque->begin;
     }
@@ -165,6 +170,11 @@ static bool reserve(FileDeque *deque, size_t count, size_t size)
 }
 
 Deque *File_Deque_create(const char *filepath)
+{
+    return File_Deque_create_pages(filepath, FS_PAGES_DEFAULT);
+}
+
+Deque *File_Deque_create_pages(const char *filepath, FS_Pages pages)
 {
     FileDeque *deque;
 
@@ -188,7 +198,7 @@ Deque *File_Deque_create(const char *filepath)
     deque->end   = 0;
     deque->data  = NULL;
 
-    if (!FS_create(&deque->fs, filepath))
+    if (!FS_create_pages(&deque->fs, filepath, pages))
     {
         free(deque);
         return NULL;
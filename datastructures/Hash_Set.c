@@ -1,4 +1,6 @@
 #include "config.h"
+#include "CacheSim.h"
+#include "EventTrace.h"
 #include "comparison.h"
 #include "Set.h"
 #include "FileStorage.h"
@@ -70,10 +72,17 @@ static void debug_print_data(Hash_Set *set, FILE *fp)
     fprintf(fp, "----\n");
 }
 
+/* Resizes the data to ``new_size'' bytes. This happens on every insertion,
+   so only resizes that move the data are traced as events. */
 static void resize(Hash_Set *set, size_t new_size)
 {
+    unsigned long long start = TRACE_START();
+    char *old_data = set->data;
+
     set->data = (*set->allocator)(&set->alloc, set->data, new_size);
     assert(set->data != NULL);
+    if (set->data != old_data)
+        TRACE_END(TRACE_HASH_RESIZE, start, set->size, new_size);
     set->size = new_size;
 }
 
@@ -86,6 +95,7 @@ static bool find_or_insert( Hash_Set *set, const void *key_data, size_t key_size
     /* Find initial entry */
     hash = set->base.hash(set->base.context, key_data, key_size);
     next = (size_t*)set->data + hash%set->capacity;
+    CACHE_ACCESS(next, sizeof(size_t));
     while (*next != 0)
     {
         size_t size;
@@ -97,6 +107,7 @@ static bool find_or_insert( Hash_Set *set, const void *key_data, size_t key_size
 
         size = *(size_t*)(set->data + *next + sizeof(size_t));
         data = set->data + *next + 2*sizeof(size_t);
+        CACHE_ACCESS(set->data + *next, 2*sizeof(size_t) + size);
         if (set->base.compare( set->base.context,
                                key_data, key_size, data, size ) == 0)
         {
@@ -137,6 +148,7 @@ static bool find_or_insert( Hash_Set *set, const void *key_data, size_t key_size
         *(size_t*)(set->data + begin) = 0;
         *(size_t*)(set->data + begin + sizeof(size_t)) = key_size;
         memcpy(set->data + begin + 2*sizeof(size_t), key_data, key_size);
+        CACHE_ACCESS(set->data + begin, end - begin);
 
         /* debug_print_data(set, stderr); */
     }
@@ -154,6 +166,27 @@ static bool set_contains(Hash_Set *set, const void *key_data, size_t key_size)
     return find_or_insert(set, key_data, key_size, false);
 }
 
+/* Enumerates entries in the order in which they are stored, which is the
+   order in which they were inserted. */
+static bool set_enumerate( Hash_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    size_t pos, size;
+
+    pos = set->capacity*sizeof(size_t);
+    while (pos < set->size)
+    {
+        /* Entries are aligned to sizeof(size_t) */
+        pos = (pos + (sizeof(size_t) - 1))&~(sizeof(size_t) - 1);
+        size = *(size_t*)(set->data + pos + sizeof(size_t));
+        if (!callback(arg, set->data + pos + 2*sizeof(size_t), size))
+            return false;
+        pos += 2*sizeof(size_t) + size;
+    }
+
+    return true;
+}
+
 /* Destroys a set data structure, by closing the backing file
    and freeing all associated resources. */
 static void set_destroy(Hash_Set *set)
@@ -174,12 +207,14 @@ Set *Hash_Set_create(Allocator *allocator, size_t capacity)
     if (set == NULL)
         return NULL;
 
-    set->base.context  = NULL;
-    set->base.destroy  = (void*)set_destroy;
-    set->base.insert   = (void*)set_insert;
-    set->base.contains = (void*)set_contains;
-    set->base.compare  = default_compare;
-    set->base.hash     = default_hash;
+    set->base.context      = NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = NULL;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.compare      = default_compare;
+    set->base.hash         = default_hash;
 
     set->capacity      = capacity;
     set->data          = NULL;
@@ -0,0 +1,101 @@
+#include "Histogram.h"
+#include <string.h>
+
+static int bucket_index(unsigned long long value)
+{
+    int e;
+
+    if (value < HISTOGRAM_SUB)
+        return (int)value;
+    e = 63 - __builtin_clzll(value);
+    return HISTOGRAM_SUB*(e - HISTOGRAM_LOG_SUB + 1) +
+           (int)(value >> (e - HISTOGRAM_LOG_SUB)) - HISTOGRAM_SUB;
+}
+
+/* Returns the lowest value counted in the given bucket */
+static unsigned long long bucket_value(int index)
+{
+    int e;
+
+    if (index < HISTOGRAM_SUB)
+        return (unsigned long long)index;
+    e = index/HISTOGRAM_SUB + HISTOGRAM_LOG_SUB - 1;
+    return (unsigned long long)(index%HISTOGRAM_SUB + HISTOGRAM_SUB)
+           << (e - HISTOGRAM_LOG_SUB);
+}
+
+void Histogram_clear(Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void Histogram_add(Histogram *h, unsigned long long value)
+{
+    h->count += 1;
+    h->total += value;
+    if (value > h->max)
+        h->max = value;
+    h->buckets[bucket_index(value)] += 1;
+}
+
+void Histogram_merge(Histogram *dst, const Histogram *src)
+{
+    int n;
+
+    dst->count += src->count;
+    dst->total += src->total;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    for (n = 0; n < HISTOGRAM_BUCKETS; ++n)
+        dst->buckets[n] += src->buckets[n];
+}
+
+unsigned long long Histogram_percentile(const Histogram *h, double p)
+{
+    unsigned long long seen, target;
+    int n;
+
+    target = (unsigned long long)(p*h->count);
+    seen = 0;
+    for (n = 0; n < HISTOGRAM_BUCKETS; ++n)
+    {
+        seen += h->buckets[n];
+        if (seen > target)
+            return bucket_value(n) < h->max ? bucket_value(n) : h->max;
+    }
+    return h->max;
+}
+
+void Histogram_report(FILE *fp, const char *name, const Histogram *h,
+                      double scale)
+{
+    fprintf( fp, "# %-18s %10llu %8.0f %8.0f %8.0f %10.0f\n", name, h->count,
+             scale*Histogram_percentile(h, 0.5),
+             scale*Histogram_percentile(h, 0.99),
+             scale*Histogram_percentile(h, 0.999),
+             scale*h->max );
+}
+
+double Histogram_ns_per_tick(void)
+{
+    static double ns_per_tick = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec t0, t1, delay = { 0, 10000000 };
+    unsigned long long c0, c1;
+
+    if (ns_per_tick == 0)
+    {
+        /* Compare the time stamp counter against the monotonic clock */
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        c0 = Histogram_ticks();
+        nanosleep(&delay, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        c1 = Histogram_ticks();
+        ns_per_tick = ( 1e9*(t1.tv_sec - t0.tv_sec) +
+                        (t1.tv_nsec - t0.tv_nsec) ) / (double)(c1 - c0);
+    }
+#else
+    ns_per_tick = 1;
+#endif
+    return ns_per_tick;
+}
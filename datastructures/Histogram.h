@@ -0,0 +1,71 @@
+#ifndef HISTOGRAM_H_INCLUDED
+#define HISTOGRAM_H_INCLUDED
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Log-linear histogram of latencies (or other non-negative values).
+
+   Values below HISTOGRAM_SUB are counted exactly; larger values are counted
+   in buckets of which the width grows with their value, HISTOGRAM_SUB
+   buckets per power of two, so percentiles have a relative error of at most
+   1/HISTOGRAM_SUB while the histogram has a small fixed size. */
+
+#define HISTOGRAM_LOG_SUB   4
+#define HISTOGRAM_SUB       (1 << HISTOGRAM_LOG_SUB)
+#define HISTOGRAM_BUCKETS   (HISTOGRAM_SUB*(64 - HISTOGRAM_LOG_SUB + 1))
+
+typedef struct Histogram
+{
+    unsigned long long count;
+    unsigned long long total;       /* sum of values */
+    unsigned long long max;
+    unsigned long long buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/* Resets the histogram to empty. */
+void Histogram_clear(Histogram *h);
+
+/* Adds a value to the histogram. */
+void Histogram_add(Histogram *h, unsigned long long value);
+
+/* Adds all values counted in ``src'' to ``dst''. */
+void Histogram_merge(Histogram *dst, const Histogram *src);
+
+/* Returns the value below which the given fraction of the values lies (to
+   within the resolution of the histogram). */
+unsigned long long Histogram_percentile(const Histogram *h, double p);
+
+/* Prints a line of the form "# name count p50 p99 p99.9 max", with the
+   percentiles and maximum multiplied by ``scale''. */
+void Histogram_report(FILE *fp, const char *name, const Histogram *h,
+                      double scale);
+
+/* Returns the time of the monotonic clock in nanoseconds. */
+static inline unsigned long long Histogram_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* Returns a timestamp of a clock that is cheap to read: the time stamp
+   counter on x86, or a monotonic clock in nanoseconds elsewhere. */
+static inline unsigned long long Histogram_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return Histogram_now_ns();
+#endif
+}
+
+/* Returns the length of a tick of Histogram_ticks() in nanoseconds (which
+   is measured once, on the first call). */
+double Histogram_ns_per_tick(void);
+
+#endif /* ndef HISTOGRAM_H_INCLUDED */
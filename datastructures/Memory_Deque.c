@@ -1,22 +1,49 @@
 #include "Deque.h"
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
-/* In-memory deque implemented as a circular double-linked list.
+/* In-memory deque implemented as a ring of chunks.
 
-   Nodes and their data are allocated in a contiguous block of memory, to
-   reduce the number of memory allocations somewhat.
+   Elements are stored contiguously in large chunks of memory, each element
+   with its size (as a 32-bit integer) stored at both ends, and padded to a
+   multiple of 8 bytes:
+
+       +------+------+------+--------+--~ ~-+--------+------+------+
+       | free | size | data | size_1 |      | data_N | size | free |
+       +------+------+------+--------+--~ ~-+--------+------+------+
+              |- 4 --|      |-- 4 ---|      |        |- 4 --|
+            begin                                          end
+
+   Elements start at offsets that are 4 modulo 8 within a chunk, so the
+   data of each element is aligned to 8 bytes.
+
+   The chunks in use are kept in a circular array, in order. Elements are
+   added at the end of the last chunk (or at the beginning of the first
+   chunk, when pushing in front) until it is full, at which point a new
+   chunk is added to the ring. Chunks that become empty are removed from the
+   ring, and one of them is kept as a spare to avoid allocating a new chunk
+   every time the deque crosses a chunk boundary. Reserving space allocates
+   spare chunks in advance. Chunks count towards the memory budget (see
+   FS_set_budget()) but are never spilled to disk.
+
+   Since elements are never moved, pointers to elements remain valid until
+   the elements are removed.
 */
 
-typedef struct MemDeque MemDeque;
+#define CHUNK_SIZE      ((size_t)1 << 20)   /* Default size of chunks */
+#define SIZE_BYTES      sizeof(uint32_t)    /* Size of element size fields */
 
-typedef struct Node Node;
+typedef struct MemDeque MemDeque;
+typedef struct Chunk Chunk;
 
-struct Node
+struct Chunk
 {
-    Node *prev, *next;
-    void *data;
-    size_t size;
+    size_t  capacity;       /* Size of data */
+    size_t  begin;          /* Offset to first element */
+    size_t  end;            /* Offset to end of last element */
+    Chunk   *next;          /* Next spare chunk */
+    char    data[];         /* Elements (aligned to 8 bytes) */
 };
 
 struct MemDeque
@@ -24,33 +51,154 @@ struct MemDeque
     Deque   base;
 
     size_t  count;          /* Number of elements */
-    Node    *last;          /* Last node (or NULL if empty) */
+    Chunk   **ring;         /* Circular array of chunks in use */
+    size_t  ring_size;      /* Size of circular array (a power of 2) */
+    size_t  first;          /* Index of first chunk in the ring */
+    size_t  chunks;         /* Number of chunks in use */
+    Chunk   *spare;         /* List of spare chunks */
+    FS_Usage *usage;        /* Usage record the chunks count towards */
 };
 
+/* Returns the i-th chunk in use */
+#define CHUNK(deque, i) ((deque)->ring[((deque)->first + (i)) & \
+                                       ((deque)->ring_size - 1)])
+#define FIRST(deque)    CHUNK(deque, 0)
+#define LAST(deque)     CHUNK(deque, (deque)->chunks - 1)
+
+/* Returns the space taken by an element of the given size */
+static size_t record_size(size_t size)
+{
+    return SIZE_BYTES + (size + 7)/8*8 + SIZE_BYTES;
+}
+
+static uint32_t read_size(const char *p)
+{
+    uint32_t size;
+
+    memcpy(&size, p, sizeof(size));
+    return size;
+}
+
+/* Writes an element to the given position */
+static void write_record(char *p, const void *data, size_t size)
+{
+    uint32_t size32 = (uint32_t)size;
+
+    memcpy(p, &size32, SIZE_BYTES);
+    memcpy(p + SIZE_BYTES, data, size);
+    memcpy(p + record_size(size) - SIZE_BYTES, &size32, SIZE_BYTES);
+}
+
+/* Allocates a new chunk that can hold at least ``record'' bytes */
+static Chunk *new_chunk(MemDeque *deque, size_t record)
+{
+    Chunk *chunk;
+    size_t capacity;
+
+    capacity = CHUNK_SIZE;
+    if (capacity < record + 2*SIZE_BYTES)
+        capacity = record + 2*SIZE_BYTES;
+    chunk = malloc(sizeof(Chunk) + capacity);
+    if (chunk != NULL)
+    {
+        chunk->capacity = capacity;
+        FS_account(deque->usage, 0, sizeof(Chunk) + capacity);
+    }
+    return chunk;
+}
+
+/* Frees a chunk allocated with new_chunk() */
+static void free_chunk(MemDeque *deque, Chunk *chunk)
+{
+    FS_account(deque->usage, sizeof(Chunk) + chunk->capacity, 0);
+    free(chunk);
+}
 
-/* N.B. This assumes that sizeof(Node) is such that data appended after the
-        Node structure is properly aligned. */
-static Node *alloc_node(const void *data, size_t size)
+/* Returns a chunk that can hold at least ``record'' bytes, taken from the
+   spare chunks if possible, or NULL if allocation fails. */
+static Chunk *get_chunk(MemDeque *deque, size_t record)
 {
-    Node *node;
+    Chunk *chunk, **p;
 
-    if (size + sizeof(Node) < size)
-        return NULL;    /* overflow */
+    for (p = &deque->spare; *p != NULL; p = &(*p)->next)
+    {
+        if ((*p)->capacity >= record + 2*SIZE_BYTES)
+        {
+            chunk = *p;
+            *p = chunk->next;
+            return chunk;
+        }
+    }
 
-    node = malloc(size + sizeof(Node));
-    if (node != NULL)
+    return new_chunk(deque, record);
+}
+
+/* Returns a chunk to the spare list, or frees it if there already is a
+   spare chunk. */
+static void put_chunk(MemDeque *deque, Chunk *chunk)
+{
+    if (deque->spare == NULL)
     {
-        node->size = size;
-        node->data = (char*)node + sizeof(Node);
-        memcpy(node->data, data, size);
+        chunk->next  = NULL;
+        deque->spare = chunk;
     }
+    else
+    {
+        free_chunk(deque, chunk);
+    }
+}
+
+/* Ensures the ring has room for at least ``extra'' more chunks */
+static bool grow_ring(MemDeque *deque, size_t extra)
+{
+    Chunk **ring;
+    size_t n, ring_size;
+
+    if (deque->chunks + extra <= deque->ring_size)
+        return true;
+
+    ring_size = deque->ring_size;
+    while (ring_size < deque->chunks + extra)
+        ring_size *= 2;
+    ring = malloc(ring_size*sizeof(Chunk*));
+    if (ring == NULL)
+        return false;
+    for (n = 0; n < deque->chunks; ++n)
+        ring[n] = CHUNK(deque, n);
+    free(deque->ring);
+    deque->ring      = ring;
+    deque->ring_size = ring_size;
+    deque->first     = 0;
+    return true;
+}
+
+/* Adds an empty chunk at the back of the ring, with room for at least
+   ``record'' bytes. */
+static bool add_last(MemDeque *deque, size_t record)
+{
+    Chunk *chunk;
 
-    return node;
+    if (!grow_ring(deque, 1) || (chunk = get_chunk(deque, record)) == NULL)
+        return false;
+    chunk->begin = chunk->end = SIZE_BYTES;
+    ++deque->chunks;
+    LAST(deque) = chunk;
+    return true;
 }
 
-static void free_node(Node *node)
+/* Adds an empty chunk at the front of the ring, with room for at least
+   ``record'' bytes. */
+static bool add_first(MemDeque *deque, size_t record)
 {
-    free(node);
+    Chunk *chunk;
+
+    if (!grow_ring(deque, 1) || (chunk = get_chunk(deque, record)) == NULL)
+        return false;
+    chunk->begin = chunk->end = chunk->capacity - SIZE_BYTES;
+    deque->first = (deque->first - 1) & (deque->ring_size - 1);
+    ++deque->chunks;
+    FIRST(deque) = chunk;
+    return true;
 }
 
 static size_t size(MemDeque *deque)
@@ -65,22 +213,22 @@ static bool empty(MemDeque *deque)
 
 static bool push_back(MemDeque *deque, const void *data, size_t size)
 {
-    Node *node = alloc_node(data, size);
+    size_t record = record_size(size);
+    Chunk *chunk;
 
-    if (node == NULL)
+    if ((uint32_t)size != size)
         return false;
 
-    if (deque->count == 0)
-    {
-        deque->last = node->prev = node->next = node;
-    }
-    else
+    if ( deque->chunks == 0 ||
+         LAST(deque)->capacity - SIZE_BYTES - LAST(deque)->end < record )
     {
-        node->prev = deque->last;
-        node->next = deque->last->next;
-        deque->last = node->prev->next = node->next->prev = node;
+        if (!add_last(deque, record))
+            return false;
     }
 
+    chunk = LAST(deque);
+    write_record(chunk->data + chunk->end, data, size);
+    chunk->end += record;
     ++deque->count;
 
     return true;
@@ -88,49 +236,68 @@ static bool push_back(MemDeque *deque, const void *data, size_t size)
 
 static bool push_front(MemDeque *deque, const void *data, size_t size)
 {
-    if (!push_back(deque, data, size))
+    size_t record = record_size(size);
+    Chunk *chunk;
+
+    if ((uint32_t)size != size)
         return false;
 
-    deque->last = deque->last->prev;
+    if (deque->chunks == 0 || FIRST(deque)->begin - SIZE_BYTES < record)
+    {
+        if (!add_first(deque, record))
+            return false;
+    }
+
+    chunk = FIRST(deque);
+    chunk->begin -= record;
+    write_record(chunk->data + chunk->begin, data, size);
+    ++deque->count;
 
     return true;
 }
 
-static bool get_back(MemDeque *deque, const void **data, size_t *size)
+static bool get_back(MemDeque *deque, void **data, size_t *size)
 {
+    Chunk *chunk;
+
     if (deque->count == 0)
         return false;
 
-    *data = deque->last->data;
-    *size = deque->last->size;
+    chunk = LAST(deque);
+    *size = read_size(chunk->data + chunk->end - SIZE_BYTES);
+    *data = chunk->data + chunk->end - record_size(*size) + SIZE_BYTES;
 
     return true;
 }
 
-static bool get_front(MemDeque *deque, const void **data, size_t *size)
+static bool get_front(MemDeque *deque, void **data, size_t *size)
 {
+    Chunk *chunk;
+
     if (deque->count == 0)
         return false;
 
-    *data = deque->last->next->data;
-    *size = deque->last->next->size;
+    chunk = FIRST(deque);
+    *size = read_size(chunk->data + chunk->begin);
+    *data = chunk->data + chunk->begin + SIZE_BYTES;
 
     return true;
 }
 
 static bool pop_back(MemDeque *deque)
 {
-    Node *last;
+    Chunk *chunk;
 
     if (deque->count == 0)
         return false;
 
-    last = deque->last;
-    deque->last = last->prev;
-    last->prev->next = last->next;
-    last->next->prev = last->prev;
-    free_node(last);
-
+    chunk = LAST(deque);
+    chunk->end -= record_size(read_size(chunk->data + chunk->end - SIZE_BYTES));
+    if (chunk->begin == chunk->end)
+    {
+        --deque->chunks;
+        put_chunk(deque, chunk);
+    }
     --deque->count;
 
     return true;
@@ -138,25 +305,72 @@ static bool pop_back(MemDeque *deque)
 
 static bool pop_front(MemDeque *deque)
 {
+    Chunk *chunk;
+
     if (deque->count == 0)
         return false;
 
-    deque->last = deque->last->next;
-    pop_back(deque); /* can only succeed at this point */
+    chunk = FIRST(deque);
+    chunk->begin += record_size(read_size(chunk->data + chunk->begin));
+    if (chunk->begin == chunk->end)
+    {
+        deque->first = (deque->first + 1) & (deque->ring_size - 1);
+        --deque->chunks;
+        put_chunk(deque, chunk);
+    }
+    --deque->count;
 
     return true;
 }
 
 static void destroy(MemDeque *deque)
 {
-    while (!empty(deque))
-        pop_back(deque);
+    Chunk *chunk;
+
+    while (deque->chunks > 0)
+    {
+        free_chunk(deque, LAST(deque));
+        --deque->chunks;
+    }
+    while ((chunk = deque->spare) != NULL)
+    {
+        deque->spare = chunk->next;
+        free_chunk(deque, chunk);
+    }
+    free(deque->ring);
     free(deque);
 }
 
 static bool reserve(MemDeque *deque, size_t count, size_t size)
 {
-    return false;
+    size_t record = record_size(size), room, chunks;
+    Chunk *chunk;
+
+    /* Count space available at the back */
+    room = 0;
+    chunks = 0;
+    if (deque->chunks > 0)
+        room += (LAST(deque)->capacity - SIZE_BYTES - LAST(deque)->end)/record;
+    for (chunk = deque->spare; chunk != NULL; chunk = chunk->next)
+    {
+        room += (chunk->capacity - 2*SIZE_BYTES)/record;
+        ++chunks;
+    }
+
+    /* Allocate spare chunks until there is enough */
+    while (room < count)
+    {
+        chunk = new_chunk(deque, record);
+        if (chunk == NULL)
+            return false;
+        chunk->next  = deque->spare;
+        deque->spare = chunk;
+        room += (chunk->capacity - 2*SIZE_BYTES)/record;
+        ++chunks;
+    }
+
+    /* Make room in the ring for the spare chunks */
+    return grow_ring(deque, chunks);
 }
 
 Deque *Memory_Deque_create()
@@ -178,8 +392,19 @@ Deque *Memory_Deque_create()
     deque->base.pop_front  = (void*)pop_front;
     deque->base.reserve    = (void*)reserve;
 
-    deque->count = 0;
-    deque->last  = NULL;
+    assert(sizeof(Chunk)%8 == 0);
+    deque->count     = 0;
+    deque->ring_size = 16;
+    deque->ring      = malloc(deque->ring_size*sizeof(Chunk*));
+    deque->first     = 0;
+    deque->chunks    = 0;
+    deque->spare     = NULL;
+    deque->usage     = FS_current_usage();
+    if (deque->ring == NULL)
+    {
+        free(deque);
+        return NULL;
+    }
 
     return &deque->base;
 }
@@ -1,7 +1,10 @@
 #include "Set.h"
+#include "SetTrace.h"
 #include "comparison.h"
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -17,12 +20,40 @@ struct Mock_Set
     /* When recording: */
     Set     *impl;
     FILE    *fp;
+    bool    trace;      /* write a full trace (see SetTrace.h) */
+    uint64_t count;     /* number of records traced */
 
     /* When replaying */
     char    *begin, *end, *pos;
     int     fd;
 };
 
+/* Appends a record for an operation to the trace file */
+static void trace_record( Mock_Set *set, int op, bool result,
+                          const void *key_data, size_t key_size )
+{
+    static const char padding[8];
+    SetTraceRecord record;
+    size_t res;
+
+    memset(&record, 0, sizeof(record));
+    record.op     = (uint8_t)op;
+    record.result = result;
+    record.size   = (uint32_t)key_size;
+    assert(record.size == key_size);
+    res = fwrite(&record, sizeof(record), 1, set->fp);
+    assert(res == 1);
+    if (key_data != NULL)
+    {
+        res = fwrite(key_data, 1, key_size, set->fp);
+        assert(res == key_size);
+        key_size = SET_TRACE_RECORD_SIZE(key_size) - sizeof(record) - key_size;
+        res = fwrite(padding, 1, key_size, set->fp);
+        assert(res == key_size);
+    }
+    set->count += 1;
+}
+
 static bool set_insert(Mock_Set *set, const void *key_data, size_t key_size)
 {
     bool res;
@@ -36,9 +67,16 @@ static bool set_insert(Mock_Set *set, const void *key_data, size_t key_size)
         set->impl->compare = set->base.compare;
         res = set->impl->insert(set->impl, key_data, key_size);
 
-        /* Write result to file */
-        ch = fputc(res, set->fp);
-        assert(ch == 0 || ch == 1);
+        /* Write result (or operation) to file */
+        if (set->trace)
+        {
+            trace_record(set, SET_TRACE_INSERT, res, key_data, key_size);
+        }
+        else
+        {
+            ch = fputc(res, set->fp);
+            assert(ch == 0 || ch == 1);
+        }
     }
     else
     {
@@ -61,9 +99,16 @@ static bool set_contains(Mock_Set *set, const void *key_data, size_t key_size)
         /* Use real set implementation to obtain result */
         res = set->impl->contains(set->impl, key_data, key_size);
 
-        /* Write result to file */
-        ch = fputc(res, set->fp);
-        assert(ch == 0 || ch == 1);
+        /* Write result (or operation) to file */
+        if (set->trace)
+        {
+            trace_record(set, SET_TRACE_CONTAINS, res, key_data, key_size);
+        }
+        else
+        {
+            ch = fputc(res, set->fp);
+            assert(ch == 0 || ch == 1);
+        }
     }
     else
     {
@@ -75,12 +120,50 @@ static bool set_contains(Mock_Set *set, const void *key_data, size_t key_size)
     return res;
 }
 
+/* Only used when tracing */
+static void set_insert_batch( Mock_Set *set, size_t count,
+    const void * const *key_data, const size_t *key_size, bool *result )
+{
+    size_t n;
+
+    set->impl->hash    = set->base.hash;
+    set->impl->compare = set->base.compare;
+    Set_insert_batch(set->impl, count, key_data, key_size, result);
+
+    trace_record(set, SET_TRACE_BATCH, false, NULL, count);
+    for (n = 0; n < count; ++n)
+    {
+        trace_record( set, SET_TRACE_INSERT, result[n],
+                      key_data[n], key_size[n] );
+    }
+}
+
+static bool set_enumerate( Mock_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    /* Only possible when recording */
+    if (set->impl == NULL)
+        return false;
+
+    return set->impl->enumerate(set->impl, callback, arg);
+}
+
 static void set_destroy(Mock_Set *set)
 {
     if (set->impl != NULL)
         set->impl->destroy(set->impl);
     if (set->fp != NULL)
+    {
+        /* Complete the trace header */
+        if (set->trace)
+        {
+            int res = fseek(set->fp, offsetof(SetTraceHeader, count), SEEK_SET);
+            assert(res == 0);
+            res = fwrite(&set->count, sizeof(set->count), 1, set->fp);
+            assert(res == 1);
+        }
         fclose(set->fp);
+    }
     if (set->begin != NULL)
         munmap(set->begin, set->end - set->begin);
     if (set->fd != -1)
@@ -88,7 +171,7 @@ static void set_destroy(Mock_Set *set)
     free(set);
 }
 
-Set *Mock_Set_create(const char *path, bool recording)
+static Set *create(const char *path, bool recording, bool trace)
 {
     Mock_Set *set;
 
@@ -103,6 +186,8 @@ Set *Mock_Set_create(const char *path, bool recording)
     set->end   = NULL;
     set->pos   = NULL;
     set->fd    = -1;
+    set->trace = trace;
+    set->count = 0;
 
     if (recording)
     {
@@ -121,6 +206,20 @@ Set *Mock_Set_create(const char *path, bool recording)
             set_destroy(set);
             return NULL;
         }
+
+        /* Write trace header (the count is completed on destruction) */
+        if (trace)
+        {
+            SetTraceHeader header;
+
+            memcpy(header.magic, SET_TRACE_MAGIC, sizeof(header.magic));
+            header.count = 0;
+            if (fwrite(&header, sizeof(header), 1, set->fp) != 1)
+            {
+                set_destroy(set);
+                return NULL;
+            }
+        }
     }
     else
     {
@@ -146,12 +245,24 @@ Set *Mock_Set_create(const char *path, bool recording)
         set->pos = set->begin;
     }
 
-    set->base.context  = NULL;
-    set->base.destroy  = (void*)set_destroy;
-    set->base.insert   = (void*)set_insert;
-    set->base.contains = (void*)set_contains;
-    set->base.hash     = default_hash;
-    set->base.compare  = default_compare;
+    set->base.context      = NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = trace ? (void*)set_insert_batch : NULL;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.hash         = default_hash;
+    set->base.compare      = default_compare;
 
     return &set->base;
 }
+
+Set *Mock_Set_create(const char *path, bool recording)
+{
+    return create(path, recording, false);
+}
+
+Set *Mock_Set_create_trace(const char *path)
+{
+    return create(path, true, true);
+}
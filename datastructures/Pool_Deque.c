@@ -0,0 +1,338 @@
+#include "Deque.h"
+#include "BufferPool.h"
+#include <assert.h>
+#include <string.h>
+
+/* Deque implementation using a buffer pool
+
+   Elements are stored in the same format as in File_Deque.c (with the size
+   stored at both ends of the data, which is padded to a multiple of
+   sizeof(size_t)) but in a temporary file whose pages are cached by a
+   buffer pool, so only the pages near the ends of the deque that are
+   actually used need to be kept in memory. Elements may span page
+   boundaries; such elements are copied to a separate buffer when they are
+   retrieved.
+
+   Pages that no longer contain any elements are discarded (releasing their
+   disk space), and the file offset is reset whenever the deque becomes
+   empty. When the front of the deque moves to a new page, the next few
+   pages are prefetched.
+
+   As in File_Deque.c, pushing data in front of the deque is not supported.
+*/
+
+/* Number of pages to prefetch ahead of the front of the deque */
+#define PREFETCH_PAGES 4
+
+typedef struct PoolDeque PoolDeque;
+
+struct PoolDeque
+{
+    Deque       base;
+    BufferPool  *pool;                  /* Buffer pool caching pages */
+    int         file;                   /* File number in buffer pool */
+    size_t      page_size;              /* Size of pages */
+    size_t      count;                  /* Number of elements */
+    size_t      begin;                  /* Offset to start of data */
+    size_t      end;                    /* Offset to end of data */
+    size_t      created;                /* Offset to end of created pages */
+    bool        held;                   /* Whether a page is held pinned */
+    size_t      held_page;              /* Page held by get_back/get_front */
+    char        *buffer;                /* Buffer for elements spanning pages */
+    size_t      buffer_size;            /* Size of buffer */
+};
+
+/* Rounds argument up to a multiple of sizeof(size_t) */
+static size_t align(size_t size)
+{
+    if (size%sizeof(size_t) != 0)
+        size = size - size%sizeof(size_t) + sizeof(size_t);
+    return size;
+}
+
+/* Unpins the page holding the element last retrieved (which is invalidated
+   when elements are retrieved or removed, but not when they are added). */
+static void release(PoolDeque *deque)
+{
+    if (deque->held)
+    {
+        BufferPool_unpin(deque->pool, deque->file, deque->held_page, false);
+        deque->held = false;
+    }
+}
+
+/* Copies ``size'' bytes from ``data'' to the file at offset ``pos''.
+   Pages that have not been created yet are zero-filled instead of read. */
+static bool copy_in(PoolDeque *deque, size_t pos, const void *data, size_t size)
+{
+    size_t page, offset, chunk;
+    char *p;
+
+    while (size > 0)
+    {
+        page   = pos/deque->page_size;
+        offset = pos%deque->page_size;
+        chunk  = deque->page_size - offset;
+        if (chunk > size)
+            chunk = size;
+        p = BufferPool_pin( deque->pool, deque->file, page,
+                            page*deque->page_size >= deque->created );
+        if (p == NULL)
+            return false;
+        if (deque->created < (page + 1)*deque->page_size)
+            deque->created = (page + 1)*deque->page_size;
+        memcpy(p + offset, data, chunk);
+        BufferPool_unpin(deque->pool, deque->file, page, true);
+        data  = (const char*)data + chunk;
+        pos  += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+/* Copies ``size'' bytes from the file at offset ``pos'' to ``data'' */
+static bool copy_out(PoolDeque *deque, size_t pos, void *data, size_t size)
+{
+    size_t page, offset, chunk;
+    char *p;
+
+    while (size > 0)
+    {
+        page   = pos/deque->page_size;
+        offset = pos%deque->page_size;
+        chunk  = deque->page_size - offset;
+        if (chunk > size)
+            chunk = size;
+        p = BufferPool_pin(deque->pool, deque->file, page, false);
+        if (p == NULL)
+            return false;
+        memcpy(data, p + offset, chunk);
+        BufferPool_unpin(deque->pool, deque->file, page, false);
+        data  = (char*)data + chunk;
+        pos  += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+/* Retrieves ``size'' bytes of data at offset ``pos''. If the data lies
+   within a single page, that page is held pinned and a pointer into it is
+   returned; otherwise, the data is copied to the buffer. */
+static bool retrieve(PoolDeque *deque, size_t pos, size_t size, void **data)
+{
+    size_t page;
+    char *buffer, *p;
+
+    page = pos/deque->page_size;
+    if (size == 0 || (pos + size - 1)/deque->page_size == page)
+    {
+        p = BufferPool_pin(deque->pool, deque->file, page, false);
+        if (p == NULL)
+            return false;
+        deque->held      = true;
+        deque->held_page = page;
+        *data = p + pos%deque->page_size;
+        return true;
+    }
+
+    if (deque->buffer_size < size)
+    {
+        buffer = realloc(deque->buffer, size);
+        if (buffer == NULL)
+            return false;
+        deque->buffer      = buffer;
+        deque->buffer_size = size;
+    }
+    if (!copy_out(deque, pos, deque->buffer, size))
+        return false;
+    *data = deque->buffer;
+    return true;
+}
+
+/* Discards pages in range [first:last) */
+static void discard(PoolDeque *deque, size_t first, size_t last)
+{
+    for ( ; first < last; ++first)
+        BufferPool_discard(deque->pool, deque->file, first);
+}
+
+/* Resets the file offset when the deque has become empty */
+static void reset(PoolDeque *deque)
+{
+    if (deque->count == 0)
+    {
+        discard( deque, deque->begin/deque->page_size,
+                 deque->created/deque->page_size );
+        deque->begin   = 0;
+        deque->end     = 0;
+        deque->created = 0;
+    }
+}
+
+static void destroy(PoolDeque *deque)
+{
+    release(deque);
+    BufferPool_close(deque->pool, deque->file);
+    free(deque->buffer);
+    free(deque);
+}
+
+static size_t size(PoolDeque *deque)
+{
+    return deque->count;
+}
+
+static bool empty(PoolDeque *deque)
+{
+    return deque->count == 0;
+}
+
+static bool push_back(PoolDeque *deque, const void *data, size_t size)
+{
+    size_t aligned_size = align(size);
+
+    /* Append item */
+    if ( !copy_in(deque, deque->end, &size, sizeof(size_t)) ||
+         !copy_in(deque, deque->end + sizeof(size_t), data, size) ||
+         !copy_in( deque, deque->end + sizeof(size_t) + aligned_size,
+                   &size, sizeof(size_t) ) )
+        return false;
+    deque->end += 2*sizeof(size_t) + aligned_size;
+    ++deque->count;
+
+    return true;
+}
+
+static bool push_front(PoolDeque *deque, const void *data, size_t size)
+{
+    /* NOT IMPLEMENTED */
+    return false;
+}
+
+static bool get_back(PoolDeque *deque, void **data, size_t *size)
+{
+    release(deque);
+
+    if (deque->count == 0)
+        return false;
+
+    return copy_out(deque, deque->end - sizeof(size_t), size, sizeof(size_t)) &&
+           retrieve( deque, deque->end - sizeof(size_t) - align(*size),
+                     *size, data );
+}
+
+static bool get_front(PoolDeque *deque, void **data, size_t *size)
+{
+    release(deque);
+
+    if (deque->count == 0)
+        return false;
+
+    return copy_out(deque, deque->begin, size, sizeof(size_t)) &&
+           retrieve(deque, deque->begin + sizeof(size_t), *size, data);
+}
+
+static bool pop_back(PoolDeque *deque)
+{
+    size_t size, end;
+
+    release(deque);
+
+    if (deque->count == 0)
+        return false;
+
+    if (!copy_out(deque, deque->end - sizeof(size_t), &size, sizeof(size_t)))
+        return false;
+    end = deque->end - 2*sizeof(size_t) - align(size);
+    discard( deque, (end + deque->page_size - 1)/deque->page_size,
+             deque->created/deque->page_size );
+    deque->end     = end;
+    deque->created = (end + deque->page_size - 1)/deque->page_size*
+                     deque->page_size;
+    --deque->count;
+    reset(deque);
+
+    return true;
+}
+
+static bool pop_front(PoolDeque *deque)
+{
+    size_t size, begin, n;
+
+    release(deque);
+
+    if (deque->count == 0)
+        return false;
+
+    if (!copy_out(deque, deque->begin, &size, sizeof(size_t)))
+        return false;
+    begin = deque->begin + 2*sizeof(size_t) + align(size);
+    if (begin/deque->page_size > deque->begin/deque->page_size)
+    {
+        /* Moved to a new page */
+        discard( deque, deque->begin/deque->page_size,
+                 begin/deque->page_size );
+        for (n = 1; n <= PREFETCH_PAGES; ++n)
+        {
+            if ((begin/deque->page_size + n)*deque->page_size >= deque->end)
+                break;
+            BufferPool_prefetch( deque->pool, deque->file,
+                                 begin/deque->page_size + n );
+        }
+    }
+    deque->begin = begin;
+    --deque->count;
+    reset(deque);
+
+    return true;
+}
+
+static bool reserve(PoolDeque *deque, size_t count, size_t size)
+{
+    /* Pages are allocated on demand */
+    return true;
+}
+
+Deque *Pool_Deque_create(BufferPool *pool)
+{
+    PoolDeque *deque;
+
+    /* Allocate memory */
+    deque = malloc(sizeof(PoolDeque));
+    if (deque == NULL)
+        return NULL;
+
+    deque->base.destroy    = (void*)destroy;
+    deque->base.empty      = (void*)empty;
+    deque->base.size       = (void*)size;
+    deque->base.push_back  = (void*)push_back;
+    deque->base.push_front = (void*)push_front;
+    deque->base.get_back   = (void*)get_back;
+    deque->base.get_front  = (void*)get_front;
+    deque->base.pop_back   = (void*)pop_back;
+    deque->base.pop_front  = (void*)pop_front;
+    deque->base.reserve    = (void*)reserve;
+
+    assert(BufferPool_page_size(pool)%sizeof(size_t) == 0);
+    deque->pool        = pool;
+    deque->page_size   = BufferPool_page_size(pool);
+    deque->count       = 0;
+    deque->begin       = 0;
+    deque->end         = 0;
+    deque->created     = 0;
+    deque->held        = false;
+    deque->held_page   = 0;
+    deque->buffer      = NULL;
+    deque->buffer_size = 0;
+
+    deque->file = BufferPool_open(pool);
+    if (deque->file < 0)
+    {
+        free(deque);
+        return NULL;
+    }
+
+    return &deque->base;
+}
@@ -0,0 +1,57 @@
+#ifndef PRIORITY_QUEUE_H_INCLUDED
+#define PRIORITY_QUEUE_H_INCLUDED
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct PriorityQueue PriorityQueue;
+
+/* Creates a new priority queue that keeps up to ``memory'' bytes of
+   elements in an in-memory bucket heap (or BUCKET_HEAP_MEMORY bytes if
+   ``memory'' is 0), and spills elements beyond that to sorted runs in
+   temporary files in ``dir'' (or $TMPDIR if NULL). Priorities range from
+   0 to BUCKET_HEAP_MAX_PRIORITY (see config.h). */
+PriorityQueue *Bucket_Heap_create(size_t memory, const char *dir);
+
+
+/* The PriorityQueue structure implements a priority queue: a collection of
+   elements from which the element with the lowest priority is removed
+   first. Elements with equal priority are removed in the order in which
+   they were added, as far as possible.
+
+   Contains the following methods:
+
+    void destroy()
+        Destroys the queue and frees all allocated resources.
+
+    bool empty()
+        Returns wether the queue is empty.
+
+    size_t size()
+        Returns the number of elements in the queue.
+
+    bool push(unsigned long priority, const void *data, size_t length)
+        Adds an element with the given priority to the queue or returns
+        false in case of failure. Fails with errno set to ERANGE if the
+        priority exceeds the highest priority the queue supports.
+
+    bool get_min(unsigned long *priority, void **data, size_t *length)
+        Retrieves the element with the lowest priority or returns false if
+        the queue is empty or the element could not be retrieved. The data
+        remains valid until the queue is next modified.
+
+    bool pop_min()
+        Removes the element with the lowest priority or returns false if the
+        queue is empty or the element could not be removed.
+*/
+struct PriorityQueue
+{
+    void (*destroy)(struct PriorityQueue *);
+    bool (*empty)(struct PriorityQueue *);
+    size_t (*size)(struct PriorityQueue *);
+    bool (*push)(struct PriorityQueue *, unsigned long, const void *, size_t);
+    bool (*get_min)(struct PriorityQueue *, unsigned long *, void **, size_t *);
+    bool (*pop_min)(struct PriorityQueue *);
+};
+
+#endif /* ndef PRIORITY_QUEUE_H_INCLUDED */
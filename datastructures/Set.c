@@ -6,7 +6,8 @@
 #include <unistd.h>
 
 typedef enum SetType {
-    Btree, Hash, BDB_Unspecified, BDB_Hash, BDB_Btree, Bender, Mock, Dummy
+    Btree, Hash, BDB_Unspecified, BDB_Hash, BDB_Btree, Bender, Mock, Dummy,
+    Static
 } SetType;
 
 
@@ -17,8 +18,10 @@ typedef enum SetType {
     parameters cannot be constructed, NULL is returned. (This is not very
     user-friendly.)
 
-    "btree [pagesize=P] .."
+    "btree [pagesize=P] [pool] .."
     Creates a B-tree based set with a pagesize of P bytes (default: 4096).
+    With pool, pages are cached by the shared buffer pool (see BufferPool.h)
+    instead of allocated, and the page size is that of the pool.
 
     "hash [capacity=C] .."
     Creates a hash table based with capacity C items (default: 1,000,000).
@@ -29,12 +32,21 @@ typedef enum SetType {
     "BerkeleyDB hash path=FP .."
     Creates a BerkeleyDB hash table based set.
 
-    "Bender density=0.x"
+    "Bender [density=0.x] [varlen] [prefix]"
     Creates a cache-oblivious set (as proposed by Bender et al.)
     The density parameter must be in range [0-1] (default: 0.5)
+    With varlen, keys are stored in a compact heap of variable-length keys
+    instead of in fixed-size slots.
+    With prefix, key prefixes are stored in the tree index, so that lookups
+    mostly compare integers instead of keys.
 
-    "Mock path=FP [record|replay]"
+    "Mock path=FP [record|replay|trace]"
     Creates a mock implementation recording/replaying to/from a file.
+    With trace, all operations are recorded with their keys (see SetTrace.h)
+    so they can be replayed against another set with bench-set.
+
+    "static path=FP"
+    Loads a read-only set from a file written by Set_freeze().
 
     Common arguments:
 
@@ -43,6 +55,11 @@ typedef enum SetType {
 
     [malloc]
     Use the malloc allocator
+
+    [hugepages=thp|2m|1g]
+    Map memory using transparent huge pages, or explicit huge pages of 2 MiB
+    or 1 GiB (which fall back to transparent huge pages if none have been
+    reserved). Requires the mmap allocator.
 */
 Set *Set_create_from_args(int argc, const char * const *argv)
 {
@@ -51,7 +68,8 @@ Set *Set_create_from_args(int argc, const char * const *argv)
     char *path;
     Set *result;
     Allocator *allocator;
-    bool record, replay;
+    bool record, replay, trace, varlen, prefix, pool;
+    FS_Pages pages;
     double density = -1;
 
     if (argc < 1)
@@ -61,6 +79,11 @@ Set *Set_create_from_args(int argc, const char * const *argv)
     allocator = NULL;
     record = false;
     replay = false;
+    trace = false;
+    varlen = false;
+    prefix = false;
+    pool = false;
+    pages = FS_PAGES_DEFAULT;
 
     if (strcmp(*argv, "btree") == 0)
     {
@@ -94,6 +117,11 @@ Set *Set_create_from_args(int argc, const char * const *argv)
         type = Dummy;
     }
     else
+    if (strcmp(*argv, "static") == 0)
+    {
+        type = Static;
+    }
+    else
     {
         /* Invalid type! */
         return NULL;
@@ -130,11 +158,12 @@ Set *Set_create_from_args(int argc, const char * const *argv)
                 return NULL;
         }
         else
-        if (path == NULL && sscanf(*argv, "path=%as", &path) == 1)
+        if (path == NULL && sscanf(*argv, "path=%ms", &path) == 1)
         {
             if (path == NULL)
                 return NULL;
-            if (!(type == BDB_Btree || type == BDB_Hash || type == Mock))
+            if (!( type == BDB_Btree || type == BDB_Hash || type == Mock ||
+                   type == Static ))
                 return NULL;
         }
         else
@@ -154,18 +183,54 @@ Set *Set_create_from_args(int argc, const char * const *argv)
         else
         if (strcmp(*argv, "record") == 0)
         {
-            if (record || replay)
+            if (record || replay || trace)
                 return NULL;
             record = true;
         }
         else
         if (strcmp(*argv, "replay") == 0)
         {
-            if (record || replay)
+            if (record || replay || trace)
                 return NULL;
             replay = true;
         }
         else
+        if (strcmp(*argv, "trace") == 0)
+        {
+            if (record || replay || trace)
+                return NULL;
+            trace = true;
+        }
+        else
+        if (strcmp(*argv, "varlen") == 0)
+        {
+            if (type != Bender || varlen)
+                return NULL;
+            varlen = true;
+        }
+        else
+        if (strcmp(*argv, "prefix") == 0)
+        {
+            if (type != Bender || prefix)
+                return NULL;
+            prefix = true;
+        }
+        else
+        if (strcmp(*argv, "pool") == 0)
+        {
+            if (type != Btree || pool)
+                return NULL;
+            pool = true;
+        }
+        else
+        if (strncmp(*argv, "hugepages=", 10) == 0)
+        {
+            if (pages != FS_PAGES_DEFAULT)
+                return NULL;
+            if (!FS_parse_pages(*argv + 10, &pages))
+                return NULL;
+        }
+        else
         if (density == -1 && sscanf(*argv, "density=%lf", &density) == 1)
         {
             if (type != Bender)
@@ -180,14 +245,42 @@ Set *Set_create_from_args(int argc, const char * const *argv)
         }
     }
 
+    /* Pooled pages are not allocated */
+    if (pool && (allocator != NULL || pages != FS_PAGES_DEFAULT))
+        return NULL;
+
     /* Set default allocator */
     if (allocator == NULL)
         allocator = Allocator_mmap;
 
+    /* Select huge page variant of the mmap allocator */
+    if (pages != FS_PAGES_DEFAULT)
+    {
+        if (allocator != Allocator_mmap)
+            return NULL;
+        switch (pages)
+        {
+        case FS_PAGES_THP: allocator = Allocator_mmap_thp; break;
+        case FS_PAGES_2M:  allocator = Allocator_mmap_2m;  break;
+        case FS_PAGES_1G:  allocator = Allocator_mmap_1g;  break;
+        default: assert(0);
+        }
+    }
+
     switch (type)
     {
     case Btree:
-        result = Btree_Set_create(allocator, pagesize);
+        if (pool)
+        {
+            if ( BufferPool_shared() == NULL ||
+                 (size_t)pagesize != BufferPool_page_size(BufferPool_shared()) )
+                return NULL;
+            result = Btree_Set_create_pooled(BufferPool_shared());
+        }
+        else
+        {
+            result = Btree_Set_create(allocator, pagesize);
+        }
         break;
 
     case Hash:
@@ -216,19 +309,28 @@ Set *Set_create_from_args(int argc, const char * const *argv)
         /* Set default density (if none specified) */
         if (density == -1)
             density = 0.5;
-        result = Bender_Set_create(allocator, density);
+        result = Bender_Set_create(allocator, density, varlen, prefix);
         break;
 
     case Mock:
-        if (!(record || replay) || path == NULL)
+        if (!(record || replay || trace) || path == NULL)
             return NULL;
-        result = Mock_Set_create(path, record);
+        if (trace)
+            result = Mock_Set_create_trace(path);
+        else
+            result = Mock_Set_create(path, record);
         break;
 
     case Dummy:
         result = Dummy_Set_create();
         break;
 
+    case Static:
+        if (path == NULL)
+            return NULL;
+        result = Static_Set_create(path);
+        break;
+
     default:
         /* No valid set selected */
         result = NULL;
@@ -237,3 +339,19 @@ Set *Set_create_from_args(int argc, const char * const *argv)
 
     return result;
 }
+
+void Set_insert_batch( Set *set, size_t count, const void * const *key_data,
+                       const size_t *key_size, bool *result )
+{
+    size_t n;
+
+    if (set->insert_batch != NULL)
+    {
+        set->insert_batch(set, count, key_data, key_size, result);
+    }
+    else
+    {
+        for (n = 0; n < count; ++n)
+            result[n] = set->insert(set, key_data[n], key_size[n]);
+    }
+}
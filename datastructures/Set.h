@@ -2,8 +2,10 @@
 #define SET_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "Alloc.h"
+#include "BufferPool.h"
 
 typedef struct Set Set;
 
@@ -36,6 +38,20 @@ int compare(const void *context, const void *data1, size_t size1,
 unsigned hash(const void *context, const void *key_data, size_t key_size)
     Computes a hash value for the given key.
 
+void insert_batch(Set *set, size_t count, const void * const *key_data,
+                  const size_t *key_size, bool *result)
+    Inserts ``count'' keys into the set, with the same effect as calling
+    insert() for each of them in order, and stores the return values in
+    ``result''. This function is optional (it is NULL if the set does not
+    implement it); see Set_insert_batch().
+
+bool enumerate(Set *set, bool (*callback)(void *arg, const void *key_data,
+                                          size_t key_size), void *arg)
+    Calls ``callback'' once for every key element in the set (in no
+    particular order) and returns true, or returns false if the set does not
+    support enumeration. If the callback returns false, enumeration stops
+    and false is returned.
+
 */
 struct Set {
     void *context;
@@ -44,12 +60,21 @@ struct Set {
     void (*destroy)(Set *);
     bool (*insert)(Set *, const void *, size_t);
     bool (*contains)(Set *, const void *, size_t);
+    void (*insert_batch)( Set *, size_t, const void * const *,
+                          const size_t *, bool * );
+    bool (*enumerate)(Set *, bool (*)(void *, const void *, size_t), void *);
 
     /* These functions may be overridden by the caller */
     int (*compare)(const void *, const void *, size_t, const void *, size_t);
     unsigned (*hash)(const void *, const void *, size_t);
 };
 
+/* Inserts a batch of keys into a set (see the description of insert_batch
+   above) using the set's insert_batch() function, or by calling insert()
+   for each key if the set does not implement it. */
+void Set_insert_batch( Set *set, size_t count, const void * const *key_data,
+                       const size_t *key_size, bool *result );
+
 /* Creates a set data structure backed by a BerkeleyDB B-tree. */
 Set *BDB_Btree_Set_create(const char *filepath);
 
@@ -59,6 +84,10 @@ Set *BDB_Hash_Set_create(const char *filepath);
 /* Creates a set data structure backed by a custom B-tree implementation. */
 Set *Btree_Set_create(Allocator *alloc, int pagesize);
 
+/* Creates a B-tree based set whose pages are cached by a buffer pool
+   instead of mapped in memory. The page size is that of the pool. */
+Set *Btree_Set_create_pooled(BufferPool *pool);
+
 /* Creates a set data structure backed by a custom hash table implementation. */
 Set *Hash_Set_create(Allocator *alloc, size_t capacity);
 
@@ -67,13 +96,49 @@ Set *Hash_Set_create(Allocator *alloc, size_t capacity);
 
    Density is the density of the top-level window before it is overflowing
    (between 0 and 1). Low values make updates cheaper, but result in larger
-   files. */
-Set *Bender_Set_create(Allocator *alloc, double density);
+   files.
+
+   If ``varlen'' is true, keys are stored compactly in a separate key heap
+   instead of in fixed-size slots (rounded up to a power of two) and the
+   set is ordered by key hash values.
+
+   If ``prefix'' is true, the first bytes of keys are stored in the tree
+   index as integers, which makes lookups faster but the index larger.
+   The set must then be used with the default comparison function. */
+Set *Bender_Set_create( Allocator *alloc, double density,
+                        bool varlen, bool prefix );
+
+/* Creates a read-only set data structure from a file previously written by
+   Set_freeze(). The file is memory-mapped, so loading is cheap. Inserting a
+   key that is not in the set aborts the program. */
+Set *Static_Set_create(const char *filepath);
+
+/* Writes the contents of the given set to a file, as an immutable search
+   structure in van Emde Boas lay-out that can be loaded with
+   Static_Set_create(). The set must support enumeration.
+
+   Returns true on success, or false and sets errno on failure. */
+bool Set_freeze(Set *set, const char *filepath);
 
 /* Creates a mock set data structure that records/replays answers to/from the
    given file path. This is useful for benchmarking purposes. */
 Set *Mock_Set_create(const char *filepath, bool record);
 
+/* Creates a mock set data structure that records every operation, with its
+   key and result, to a trace file in the format described in SetTrace.h,
+   which can be replayed against other set implementations with bench-set. */
+Set *Mock_Set_create_trace(const char *filepath);
+
+/* Creates a set that forwards all operations to ``set'' (which it takes
+   ownership of) and records their latencies, to be printed with
+   Timed_Set_report(). */
+Set *Timed_Set_create(Set *set);
+
+/* Prints latency percentiles (in nanoseconds) per operation type of a set
+   created with Timed_Set_create() since the previous report, or since its
+   creation if ``total'' is true. Does nothing for other sets. */
+void Timed_Set_report(Set *set, FILE *fp, bool total);
+
 /* Creates a dummy set data structure that always returns false.
    This is useful for benchmarking purposes. */
 Set *Dummy_Set_create();
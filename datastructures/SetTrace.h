@@ -0,0 +1,48 @@
+#ifndef SET_TRACE_H_INCLUDED
+#define SET_TRACE_H_INCLUDED
+
+#include <stdint.h>
+
+/* Binary trace of set operations, written by a mock set created with
+   Mock_Set_create_trace() and replayed by bench-set.
+
+   The file starts with a header, followed by one record per operation. Each
+   record consists of a SetTraceRecord structure followed by the key data,
+   padded to a multiple of 8 bytes, so the records of a memory-mapped trace
+   can be accessed in place:
+
+       +--------+--------+------+--------+------+--~ ~-+--------+------+
+       | header | record | key  | record | key  |      | record | key  |
+       +--------+--------+------+--------+------+--~ ~-+--------+------+
+       |- 16 ---|-- 8 ---|      |-- 8 ---|
+
+   A batch of insertions (see Set_insert_batch()) is recorded as a
+   SET_TRACE_BATCH record without key data, of which the size field holds the
+   number of SET_TRACE_INSERT records that follow it. */
+
+#define SET_TRACE_MAGIC     "SetTrc01"      /* 8 bytes, without terminator */
+
+/* Operation types */
+#define SET_TRACE_INSERT    1
+#define SET_TRACE_CONTAINS  2
+#define SET_TRACE_BATCH     3
+
+typedef struct SetTraceHeader
+{
+    char        magic[8];
+    uint64_t    count;      /* number of operation records */
+} SetTraceHeader;
+
+typedef struct SetTraceRecord
+{
+    uint8_t     op;         /* operation type */
+    uint8_t     result;     /* result of the operation when recorded */
+    uint16_t    reserved;
+    uint32_t    size;       /* key size (or batch size) in bytes */
+} SetTraceRecord;
+
+/* Returns the size of a record with the given key size in bytes */
+#define SET_TRACE_RECORD_SIZE(size) \
+    (sizeof(SetTraceRecord) + ((size_t)(size) + 7)/8*8)
+
+#endif /* ndef SET_TRACE_H_INCLUDED */
@@ -0,0 +1,425 @@
+#include "config.h"
+#include "comparison.h"
+#include "Set.h"
+#include "VEB_Layout.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Immutable set data structure, created by freezing a populated set.
+
+   The keys are stored in a static binary search tree in van Emde Boas
+   lay-out (like the tree index in Bender_Impl) which is written to a file
+   that is memory-mapped when the set is loaded. Since the tree is never
+   updated, it is packed densely and node positions are computed from the
+   node index (see VEB_Layout.h) instead of being stored.
+
+   File lay-out (assuming sizeof(size_t) == 8):
+
+    +--------+-------------------+----------+
+    | Header | Tree nodes        | Key heap |
+    +--------+-------------------+----------+
+    |-- 32 --|-- 16*(2^H - 1) ---|-- K ----|
+
+   The header consists of a magic string, the number of keys N, the tree
+   height H and the key heap size K, each 8 bytes. H is the smallest height
+   such that 2^H - 1 >= N.
+
+   Each tree node consists of the first 8 bytes of a key (as a big-endian
+   integer; see default_prefix()) and the offset of the key in the heap, or
+   (size_t)-1 for nodes that do not store a key. The i-th node in in-order
+   stores the i-th smallest key; nodes after the N-th are empty and compare
+   greater than all keys.
+
+   The key heap stores keys in sorted order, each as a 4-byte size followed
+   by the key data (without any padding).
+
+   Note that the file must be loaded with the same comparison function as the
+   one that was used by the set when it was frozen. Key prefixes are only
+   used when the default comparison function is in effect.
+*/
+
+#define MAGIC       "vEBset1"
+#define EMPTY       ((size_t)-1)
+
+typedef struct Header Header;
+typedef struct Node Node;
+typedef struct Static_Set Static_Set;
+typedef struct Builder Builder;
+
+struct Header
+{
+    char        magic[8];
+    size_t      count;
+    size_t      height;
+    size_t      heap_size;
+};
+
+struct Node
+{
+    unsigned long long  prefix;
+    size_t              offset;
+};
+
+struct Static_Set
+{
+    Set         base;
+    VEB_Layout  layout;
+    size_t      count;          /* Number of keys */
+    const Node  *tree;          /* Tree nodes in van Emde Boas lay-out */
+    const char  *heap;          /* Key heap */
+    char        *data;          /* Mapped file contents */
+    size_t      size;           /* Size of mapped file */
+};
+
+/* Temporary state used while freezing a set */
+struct Builder
+{
+    Set         *set;
+    char        *keys;          /* Collected keys (size + data) */
+    size_t      keys_size;
+    Alloc       keys_alloc;
+    size_t      *index;         /* Offsets of keys in ``keys'' */
+    size_t      count;
+    Alloc       index_alloc;
+    bool        failed;
+
+    VEB_Layout  layout;
+    Node        *tree;
+};
+
+
+/* Reads a key stored at the given position in the heap (which may be
+   unaligned). */
+#define KEY_SIZE(p) (read_key_size(p))
+#define KEY_DATA(p) ((const char*)(p) + sizeof(unsigned))
+
+static size_t read_key_size(const char *p)
+{
+    unsigned size;
+
+    memcpy(&size, p, sizeof(size));
+    return size;
+}
+
+/* Compares a key against a tree node */
+static int compare_node( Static_Set *set, const Node *node,
+    unsigned long long prefix, const void *key_data, size_t key_size )
+{
+    const char *p;
+
+    if (node->offset == EMPTY)
+        return -1;
+
+    if (set->base.compare == default_compare)
+    {
+        if (prefix != node->prefix)
+            return prefix < node->prefix ? -1 : +1;
+    }
+
+    p = set->heap + node->offset;
+    return set->base.compare( set->base.context, key_data, key_size,
+                              KEY_DATA(p), KEY_SIZE(p) );
+}
+
+static bool set_contains(Static_Set *set, const void *key_data, size_t key_size)
+{
+    size_t pos[VEB_MAX_HEIGHT], index;
+    unsigned long long prefix;
+    int depth, d;
+
+    if (set->count == 0)
+        return false;
+
+    prefix = default_prefix(key_data, key_size);
+    pos[0] = 0;
+    index  = 1;
+    depth  = 0;
+    for (;;)
+    {
+        d = compare_node(set, &set->tree[pos[depth]], prefix, key_data, key_size);
+        if (d == 0)
+            return true;
+
+        if (++depth == set->layout.height)
+            return false;
+
+        index = 2*index + (d > 0);
+        pos[depth] = VEB_POS(&set->layout, pos, depth, index);
+    }
+}
+
+/* The set is immutable, so inserting a key that is not present yet cannot
+   succeed; reporting it as inserted would silently lose the key. */
+static bool set_insert(Static_Set *set, const void *key_data, size_t key_size)
+{
+    if (set_contains(set, key_data, key_size))
+        return true;
+    fprintf(stderr, "Cannot insert a new key into a static set!\n");
+    abort();
+}
+
+static bool set_enumerate( Static_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    const char *p, *end;
+
+    end = set->heap + ((const Header*)set->data)->heap_size;
+    for (p = set->heap; p < end; p += sizeof(unsigned) + KEY_SIZE(p))
+    {
+        if (!callback(arg, KEY_DATA(p), KEY_SIZE(p)))
+            return false;
+    }
+
+    return true;
+}
+
+static void set_destroy(Static_Set *set)
+{
+    if (set->data != NULL)
+        munmap(set->data, set->size);
+    free(set);
+}
+
+Set *Static_Set_create(const char *filepath)
+{
+    Static_Set *set;
+    const Header *header;
+    struct stat st;
+    int fd;
+
+    set = malloc(sizeof(Static_Set));
+    if (set == NULL)
+        return NULL;
+
+    set->base.context      = NULL;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = NULL;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.compare      = default_compare;
+    set->base.hash         = default_hash;
+    set->data           = NULL;
+
+    /* Map file */
+    fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+    {
+        free(set);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        close(fd);
+        free(set);
+        return NULL;
+    }
+    set->size = (size_t)st.st_size;
+    set->data = mmap(NULL, set->size, PROT_READ, MAP_SHARED, fd, (off_t)0);
+    close(fd);
+    if (set->data == MAP_FAILED)
+    {
+        free(set);
+        return NULL;
+    }
+
+    /* Verify header (without computing sizes that could overflow, since
+       the height and heap size are read from the file) */
+    header = (const Header*)set->data;
+    if ( memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+         header->height < 1 || header->height >= VEB_MAX_HEIGHT ||
+         header->count > ((size_t)1 << header->height) - 1 ||
+         ((size_t)1 << header->height) - 1 >
+            (set->size - sizeof(Header))/sizeof(Node) ||
+         header->heap_size > set->size - sizeof(Header) -
+            sizeof(Node)*(((size_t)1 << header->height) - 1) )
+    {
+        errno = EINVAL;
+        set->base.destroy(&set->base);
+        return NULL;
+    }
+
+    VEB_Layout_init(&set->layout, (int)header->height);
+    set->count = header->count;
+    set->tree  = (const Node*)(set->data + sizeof(Header));
+    set->heap  = (const char*)(set->tree + ((size_t)1 << header->height) - 1);
+
+    return &set->base;
+}
+
+
+/* Adds a key to the builder (called while enumerating the source set) */
+static bool collect_key(Builder *b, const void *key_data, size_t key_size)
+{
+    char *keys;
+    size_t *index;
+    unsigned size;
+
+    assert((unsigned)key_size == key_size);
+
+    keys = Allocator_mmap( &b->keys_alloc, b->keys,
+                           b->keys_size + sizeof(unsigned) + key_size );
+    index = Allocator_mmap( &b->index_alloc, (char*)b->index,
+                            sizeof(size_t)*(b->count + 1) );
+    if (keys == NULL || index == NULL)
+    {
+        b->failed = true;
+        return false;
+    }
+    b->keys  = keys;
+    b->index = index;
+
+    size = (unsigned)key_size;
+    memcpy(b->keys + b->keys_size, &size, sizeof(size));
+    memcpy(b->keys + b->keys_size + sizeof(unsigned), key_data, key_size);
+    b->index[b->count++] = b->keys_size;
+    b->keys_size += sizeof(unsigned) + key_size;
+
+    return true;
+}
+
+static int compare_keys(const void *a, const void *b, void *arg)
+{
+    Builder *builder = arg;
+    const char *p = builder->keys + *(const size_t*)a,
+               *q = builder->keys + *(const size_t*)b;
+
+    return builder->set->compare( builder->set->context,
+                                  KEY_DATA(p), KEY_SIZE(p),
+                                  KEY_DATA(q), KEY_SIZE(q) );
+}
+
+/* Fills in the subtree rooted at the node with breadth-first index
+   ``index'' at depth ``depth''. At this point, b->index contains the heap
+   offsets of the keys in sorted order. */
+static void build_subtree( Builder *b, const char *heap,
+                           size_t *pos, int depth, size_t index )
+{
+    Node *node;
+    size_t rank;
+    int height = b->layout.height;
+
+    if (depth > 0)
+        pos[depth] = VEB_POS(&b->layout, pos, depth, index);
+
+    /* Compute in-order rank of this node */
+    rank = ((2*(index - ((size_t)1 << depth)) + 1) << (height - 1 - depth)) - 1;
+
+    node = &b->tree[pos[depth]];
+    if (rank < b->count)
+    {
+        node->offset = b->index[rank];
+        node->prefix = default_prefix( KEY_DATA(heap + node->offset),
+                                       KEY_SIZE(heap + node->offset) );
+    }
+    else
+    {
+        node->offset = EMPTY;
+        node->prefix = 0;
+    }
+
+    if (depth + 1 < height)
+    {
+        build_subtree(b, heap, pos, depth + 1, 2*index);
+        build_subtree(b, heap, pos, depth + 1, 2*index + 1);
+    }
+}
+
+bool Set_freeze(Set *set, const char *filepath)
+{
+    Builder b;
+    FileStorage fs;
+    Header *header;
+    char *data, *heap;
+    size_t n, height, nodes, offset, size, pos[VEB_MAX_HEIGHT];
+    bool result;
+
+    if (set->enumerate == NULL)
+    {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    /* Collect all keys */
+    b.set       = set;
+    b.keys      = NULL;
+    b.keys_size = 0;
+    b.index     = NULL;
+    b.count     = 0;
+    b.failed    = false;
+    if (!set->enumerate(set, (void*)collect_key, &b))
+    {
+        if (!b.failed)
+            errno = ENOTSUP;
+        result = false;
+        goto cleanup;
+    }
+
+    /* Sort keys (an empty set has no index to sort) */
+    if (b.count > 0)
+        qsort_r(b.index, b.count, sizeof(size_t), compare_keys, &b);
+
+    /* Create file */
+    height = 1;
+    while ((((size_t)1 << height) - 1) < b.count)
+        ++height;
+    nodes = ((size_t)1 << height) - 1;
+    size  = sizeof(Header) + sizeof(Node)*nodes + b.keys_size;
+    if (!FS_create(&fs, filepath))
+    {
+        result = false;
+        goto cleanup;
+    }
+    data = FS_resize(&fs, NULL, size);
+    if (data == NULL)
+    {
+        FS_destroy(&fs, NULL);
+        result = false;
+        goto cleanup;
+    }
+
+    /* Write keys to the heap in sorted order, and replace their indices
+       with heap offsets */
+    heap = data + sizeof(Header) + sizeof(Node)*nodes;
+    offset = 0;
+    for (n = 0; n < b.count; ++n)
+    {
+        const char *p = b.keys + b.index[n];
+
+        memcpy(heap + offset, p, sizeof(unsigned) + KEY_SIZE(p));
+        b.index[n] = offset;
+        offset += sizeof(unsigned) + KEY_SIZE(p);
+    }
+
+    /* Write tree */
+    VEB_Layout_init(&b.layout, (int)height);
+    b.tree = (Node*)(data + sizeof(Header));
+    pos[0] = 0;
+    build_subtree(&b, heap, pos, 0, 1);
+
+    /* Write header last */
+    header = (Header*)data;
+    memcpy(header->magic, MAGIC, sizeof(header->magic));
+    header->count     = b.count;
+    header->height    = height;
+    header->heap_size = b.keys_size;
+
+    result = msync(data, size, MS_SYNC) == 0;
+    FS_destroy(&fs, data);
+
+cleanup:
+    if (b.keys != NULL)
+        Allocator_mmap(&b.keys_alloc, b.keys, 0);
+    if (b.index != NULL)
+        Allocator_mmap(&b.index_alloc, (char*)b.index, 0);
+
+    return result;
+}
@@ -0,0 +1,151 @@
+#include "Deque.h"
+#include "Histogram.h"
+
+/* Deque decorator that records the latency of each operation performed on
+   the underlying deque (see Timed_Set.c). */
+
+enum { OP_PUSH_BACK, OP_PUSH_FRONT, OP_GET_BACK, OP_GET_FRONT,
+       OP_POP_BACK, OP_POP_FRONT, OP_RESERVE, OPS };
+
+static const char *op_names[OPS] = {
+    "queue.push_back", "queue.push_front", "queue.get_back",
+    "queue.get_front", "queue.pop_back", "queue.pop_front", "queue.reserve" };
+
+typedef struct TimedDeque
+{
+    Deque       base;
+    Deque       *impl;
+    Histogram   interval[OPS];
+    Histogram   total[OPS];
+} TimedDeque;
+
+/* Calls ``call'' on the underlying deque, and records its latency as an
+   operation of type ``op'' */
+#define TIMED(op, call)                                                     \
+    do { unsigned long long t0 = Histogram_ticks();                         \
+         res = deque->impl->call;                                           \
+         Histogram_add(&deque->interval[op], Histogram_ticks() - t0);       \
+    } while (0)
+
+static size_t size(TimedDeque *deque)
+{
+    return deque->impl->size(deque->impl);
+}
+
+static bool empty(TimedDeque *deque)
+{
+    return deque->impl->empty(deque->impl);
+}
+
+static bool push_back(TimedDeque *deque, const void *data, size_t size)
+{
+    bool res;
+
+    TIMED(OP_PUSH_BACK, push_back(deque->impl, data, size));
+    return res;
+}
+
+static bool push_front(TimedDeque *deque, const void *data, size_t size)
+{
+    bool res;
+
+    TIMED(OP_PUSH_FRONT, push_front(deque->impl, data, size));
+    return res;
+}
+
+static bool get_back(TimedDeque *deque, void **data, size_t *size)
+{
+    bool res;
+
+    TIMED(OP_GET_BACK, get_back(deque->impl, data, size));
+    return res;
+}
+
+static bool get_front(TimedDeque *deque, void **data, size_t *size)
+{
+    bool res;
+
+    TIMED(OP_GET_FRONT, get_front(deque->impl, data, size));
+    return res;
+}
+
+static bool pop_back(TimedDeque *deque)
+{
+    bool res;
+
+    TIMED(OP_POP_BACK, pop_back(deque->impl));
+    return res;
+}
+
+static bool pop_front(TimedDeque *deque)
+{
+    bool res;
+
+    TIMED(OP_POP_FRONT, pop_front(deque->impl));
+    return res;
+}
+
+static bool reserve(TimedDeque *deque, size_t count, size_t size)
+{
+    bool res;
+
+    TIMED(OP_RESERVE, reserve(deque->impl, count, size));
+    return res;
+}
+
+static void destroy(TimedDeque *deque)
+{
+    deque->impl->destroy(deque->impl);
+    free(deque);
+}
+
+Deque *Timed_Deque_create(Deque *impl)
+{
+    TimedDeque *deque;
+    int n;
+
+    deque = malloc(sizeof(TimedDeque));
+    if (deque == NULL)
+        return NULL;
+
+    deque->base.destroy    = (void*)destroy;
+    deque->base.empty      = (void*)empty;
+    deque->base.size       = (void*)size;
+    deque->base.push_back  = (void*)push_back;
+    deque->base.push_front = (void*)push_front;
+    deque->base.get_back   = (void*)get_back;
+    deque->base.get_front  = (void*)get_front;
+    deque->base.pop_back   = (void*)pop_back;
+    deque->base.pop_front  = (void*)pop_front;
+    deque->base.reserve    = (void*)reserve;
+
+    deque->impl = impl;
+    for (n = 0; n < OPS; ++n)
+    {
+        Histogram_clear(&deque->interval[n]);
+        Histogram_clear(&deque->total[n]);
+    }
+
+    return &deque->base;
+}
+
+void Timed_Deque_report(Deque *base, FILE *fp, bool total)
+{
+    TimedDeque *deque = (TimedDeque*)base;
+    int n;
+
+    if (base->destroy != (void*)destroy)
+        return;     /* not a timed deque */
+
+    for (n = 0; n < OPS; ++n)
+    {
+        Histogram_merge(&deque->total[n], &deque->interval[n]);
+        if (!total && deque->interval[n].count > 0)
+            Histogram_report( fp, op_names[n], &deque->interval[n],
+                              Histogram_ns_per_tick() );
+        if (total && deque->total[n].count > 0)
+            Histogram_report( fp, op_names[n], &deque->total[n],
+                              Histogram_ns_per_tick() );
+        Histogram_clear(&deque->interval[n]);
+    }
+}
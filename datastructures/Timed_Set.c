@@ -0,0 +1,131 @@
+#include "Set.h"
+#include "Histogram.h"
+
+/* Set decorator that records the latency of each operation performed on
+   the underlying set in a histogram per operation type, both for the
+   interval since the last report and for the whole run. Latencies are
+   measured in ticks of Histogram_ticks() and converted when reported. */
+
+enum { OP_INSERT, OP_CONTAINS, OP_INSERT_BATCH, OP_ENUMERATE, OPS };
+
+static const char *op_names[OPS] = {
+    "set.insert", "set.contains", "set.insert_batch", "set.enumerate" };
+
+typedef struct Timed_Set
+{
+    Set         base;
+    Set         *impl;
+    Histogram   interval[OPS];
+    Histogram   total[OPS];
+} Timed_Set;
+
+/* Passes the hash and comparison functions on to the underlying set */
+static void update_impl(Timed_Set *set)
+{
+    set->impl->context = set->base.context;
+    set->impl->hash    = set->base.hash;
+    set->impl->compare = set->base.compare;
+}
+
+static bool set_insert(Timed_Set *set, const void *key_data, size_t key_size)
+{
+    unsigned long long t0;
+    bool res;
+
+    update_impl(set);
+    t0 = Histogram_ticks();
+    res = set->impl->insert(set->impl, key_data, key_size);
+    Histogram_add(&set->interval[OP_INSERT], Histogram_ticks() - t0);
+    return res;
+}
+
+static bool set_contains(Timed_Set *set, const void *key_data, size_t key_size)
+{
+    unsigned long long t0;
+    bool res;
+
+    update_impl(set);
+    t0 = Histogram_ticks();
+    res = set->impl->contains(set->impl, key_data, key_size);
+    Histogram_add(&set->interval[OP_CONTAINS], Histogram_ticks() - t0);
+    return res;
+}
+
+static void set_insert_batch( Timed_Set *set, size_t count,
+    const void * const *key_data, const size_t *key_size, bool *result )
+{
+    unsigned long long t0;
+
+    update_impl(set);
+    t0 = Histogram_ticks();
+    Set_insert_batch(set->impl, count, key_data, key_size, result);
+    Histogram_add(&set->interval[OP_INSERT_BATCH], Histogram_ticks() - t0);
+}
+
+static bool set_enumerate( Timed_Set *set,
+    bool (*callback)(void *, const void *, size_t), void *arg )
+{
+    unsigned long long t0;
+    bool res;
+
+    update_impl(set);
+    t0 = Histogram_ticks();
+    res = set->impl->enumerate(set->impl, callback, arg);
+    Histogram_add(&set->interval[OP_ENUMERATE], Histogram_ticks() - t0);
+    return res;
+}
+
+static void set_destroy(Timed_Set *set)
+{
+    set->impl->destroy(set->impl);
+    free(set);
+}
+
+Set *Timed_Set_create(Set *impl)
+{
+    Timed_Set *set;
+    int n;
+
+    set = malloc(sizeof(Timed_Set));
+    if (set == NULL)
+        return NULL;
+
+    set->base.context      = impl->context;
+    set->base.destroy      = (void*)set_destroy;
+    set->base.insert       = (void*)set_insert;
+    set->base.contains     = (void*)set_contains;
+    set->base.insert_batch = (void*)set_insert_batch;
+    set->base.enumerate    = (void*)set_enumerate;
+    set->base.hash         = impl->hash;
+    set->base.compare      = impl->compare;
+
+    set->impl = impl;
+    for (n = 0; n < OPS; ++n)
+    {
+        Histogram_clear(&set->interval[n]);
+        Histogram_clear(&set->total[n]);
+    }
+
+    return &set->base;
+}
+
+void Timed_Set_report(Set *base, FILE *fp, bool total)
+{
+    Timed_Set *set = (Timed_Set*)base;
+    int n;
+
+    if (base->destroy != (void*)set_destroy)
+        return;     /* not a timed set */
+
+    for (n = 0; n < OPS; ++n)
+    {
+        Histogram_merge(&set->total[n], &set->interval[n]);
+        if (!total && set->interval[n].count > 0)
+            Histogram_report( fp, op_names[n], &set->interval[n],
+                              Histogram_ns_per_tick() );
+        if (total && set->total[n].count > 0)
+            Histogram_report( fp, op_names[n], &set->total[n],
+                              Histogram_ns_per_tick() );
+        Histogram_clear(&set->interval[n]);
+    }
+}
@@ -0,0 +1,46 @@
+#include "VEB_Layout.h"
+#include <assert.h>
+
+/* Fills in the lay-out description for the subtree of height ``height''
+   rooted at depth ``depth''. Every depth (except 0) is the root depth of
+   bottom trees for exactly one split, which is recorded here. */
+static void split(VEB_Layout *layout, int depth, int height)
+{
+    int top_height, bottom_height;
+
+    if (height <= 1)
+        return;
+
+    top_height    = height/2;
+    bottom_height = height - top_height;
+
+    layout->top[depth + top_height]         = depth;
+    layout->top_size[depth + top_height]    = ((size_t)1 << top_height) - 1;
+    layout->bottom_size[depth + top_height] = ((size_t)1 << bottom_height) - 1;
+
+    split(layout, depth, top_height);
+    split(layout, depth + top_height, bottom_height);
+}
+
+void VEB_Layout_init(VEB_Layout *layout, int height)
+{
+    assert(height > 0 && height < VEB_MAX_HEIGHT);
+
+    layout->height         = height;
+    layout->top[0]         = 0;
+    layout->top_size[0]    = 0;
+    layout->bottom_size[0] = 0;
+    split(layout, 0, height);
+}
+
+void VEB_Layout_path( const VEB_Layout *layout,
+                      size_t index, int depth, size_t *pos )
+{
+    int d;
+
+    assert(depth < layout->height);
+
+    pos[0] = 0;
+    for (d = 1; d <= depth; ++d)
+        pos[d] = VEB_POS(layout, pos, d, index >> (depth - d));
+}
@@ -0,0 +1,47 @@
+#ifndef VEB_LAYOUT_H_INCLUDED
+#define VEB_LAYOUT_H_INCLUDED
+
+#include <stdlib.h>
+
+/* Describes the van Emde Boas lay-out of a complete binary tree of a given
+   height, so that positions of nodes can be computed arithmetically instead
+   of being stored in the nodes (as described by Brodal, Fagerberg and Jacob
+   in "Cache oblivious search trees via binary trees of small height").
+
+   A tree of height h is stored by storing its top subtree of height h/2
+   (rounded down) first, followed by the bottom subtrees from left to right,
+   each of which is stored in the same way recursively.
+
+   Nodes are identified by their depth (0 for the root) and their index in
+   breadth-first order (1 for the root; node i has children 2i and 2i+1).
+   While descending the tree, the caller keeps track of the positions of all
+   nodes on the path from the root in an array indexed by depth.
+*/
+
+#define VEB_MAX_HEIGHT 64
+
+typedef struct VEB_Layout VEB_Layout;
+
+struct VEB_Layout
+{
+    int     height;                         /* Height of the tree */
+    int     top[VEB_MAX_HEIGHT];            /* Depth of the top tree root */
+    size_t  top_size[VEB_MAX_HEIGHT];       /* Nodes in the top tree */
+    size_t  bottom_size[VEB_MAX_HEIGHT];    /* Nodes in each bottom tree */
+};
+
+/* Initializes the lay-out description of a tree with the given height. */
+void VEB_Layout_init(VEB_Layout *layout, int height);
+
+/* Returns the position of the node with breadth-first index ``index'' at
+   depth ``depth'' > 0, given the positions of its ancestors in ``pos''. */
+#define VEB_POS(layout, pos, depth, index)                                  \
+    ( (pos)[(layout)->top[depth]] + (layout)->top_size[depth] +             \
+      ((index) & (layout)->top_size[depth])*(layout)->bottom_size[depth] )
+
+/* Stores the positions of the nodes on the path from the root to the node
+   with breadth-first index ``index'' at depth ``depth'' in pos[0..depth]. */
+void VEB_Layout_path( const VEB_Layout *layout,
+                      size_t index, int depth, size_t *pos );
+
+#endif /* ndef VEB_LAYOUT_H_INCLUDED */
@@ -0,0 +1,128 @@
+#include "Alloc.h"
+#include "Bender_Impl.h"
+#include "comparison.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Measures lookup latency of Bender's set implementation (see Bender_Impl.c)
+   against the depth of its tree index, with and without normalized keys.
+
+   Random keys are inserted into two implementations (one of which stores key
+   prefixes in its tree index) until the tree reaches the next depth, after
+   which the same sequence of lookups for keys that are present is timed on
+   both of them. */
+
+#define KEY_SIZE 16
+
+static unsigned long long rng_state;
+
+/* xorshift64 pseudo-random number generator */
+static unsigned long long rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Generates the i-th key of the key sequence */
+static void make_key(char *buf, long i)
+{
+    unsigned long long x;
+
+    rng_state = 0x9E3779B97F4A7C15ULL*((unsigned long long)i + 1);
+    rng(); rng();
+    x = rng();
+    memcpy(buf, &x, sizeof(x));
+    x = rng();
+    memcpy(buf + sizeof(x), &x, sizeof(x));
+}
+
+static unsigned long long key_prefix( const void *ignored,
+                                      const void *data, size_t size )
+{
+    (void)ignored;
+    return default_prefix(data, size);
+}
+
+static double now()
+{
+    struct timeval tv;
+    int res;
+
+    res = gettimeofday(&tv, NULL);
+    assert(res == 0);
+    return (double)tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+/* Performs ``count'' lookups of random keys among the first ``keys'' ones
+   and returns the average time per lookup in nanoseconds. */
+static double lookup(Bender_Impl *bi, long count, long keys)
+{
+    char buf[KEY_SIZE];
+    long n, found;
+    double t;
+
+    found = 0;
+    t = now();
+    for (n = 0; n < count; ++n)
+    {
+        make_key(buf, (long)((unsigned long long)n*7919%keys));
+        found += Bender_Impl_contains(bi, buf, KEY_SIZE);
+    }
+    t = now() - t;
+    assert(found == count);
+
+    return 1e9*t/count;
+}
+
+int main(int argc, char *argv[])
+{
+    Bender_Impl plain, prefix;
+    long queries, keys;
+    int depth, max_depth;
+    char buf[KEY_SIZE];
+
+    if (argc > 3)
+    {
+        printf("Usage: bench-bender [<max depth> [<queries>]]\n");
+        return 1;
+    }
+    max_depth = argc > 1 ? atoi(argv[1]) : 22;
+    queries   = argc > 2 ? atol(argv[2]) : 1000000;
+    if (max_depth <= 0 || queries <= 0)
+    {
+        printf("Depth and query count must be positive integers!\n");
+        return 1;
+    }
+
+    Bender_Impl_create(&plain, Allocator_malloc, KEY_SIZE, 0.5, NULL);
+    Bender_Impl_create(&prefix, Allocator_malloc, KEY_SIZE, 0.5, key_prefix);
+    plain.compare  = prefix.compare = default_compare;
+    plain.context  = prefix.context = NULL;
+
+    printf("#depth      keys  plain(ns) prefix(ns)\n");
+    keys = 0;
+    for (depth = plain.table->O + 1; depth <= max_depth; ++depth)
+    {
+        /* Insert keys until the tree has grown to the next depth */
+        while (plain.table->O < depth || plain.old != NULL)
+        {
+            make_key(buf, keys++);
+            Bender_Impl_insert(&plain, buf, KEY_SIZE);
+            Bender_Impl_insert(&prefix, buf, KEY_SIZE);
+        }
+        assert(prefix.table->O == depth);
+
+        printf( "%6d %9ld %10.1f %10.1f\n", depth, keys,
+                lookup(&plain, queries, keys), lookup(&prefix, queries, keys) );
+    }
+
+    Bender_Impl_destroy(&plain);
+    Bender_Impl_destroy(&prefix);
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include "config.h"
+#include "CacheSim.h"
+#include "EventTrace.h"
+#include "Histogram.h"
+#include "Set.h"
+#include "SetTrace.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Replays a trace of set operations (recorded by a mock set in trace mode;
+   see SetTrace.h) against a set created from the given description, and
+   reports throughput, latency per operation type, memory use and page faults.
+
+   This measures the performance of a set implementation on the workload of
+   a real search, without the cost of running the virtual machine. The result
+   of each operation is compared with the recorded result, so replaying also
+   checks that the set behaves the same as the one that was traced.
+
+   With the -c option, the memory accessed by the set implementation is
+   also fed to a simulated memory hierarchy (see CacheSim.h), and the number
+   of block transfers per operation at each level is reported. Timings are
+   then meaningless, since simulation is much slower than the set itself.
+
+   With the -e option, structural maintenance events (such as resizes and
+   splits) are written to the given file as a Chrome trace (see
+   EventTrace.h), to see which of them cause latency spikes. */
+
+static const char *op_names[] = { NULL, "insert", "contains", "batch" };
+
+/* Latencies (in nanoseconds) per operation type */
+static Histogram histograms[4];
+
+/* Returns the resident set size in bytes */
+static long resident_size()
+{
+    FILE *fp;
+    long pages, rss;
+
+    rss = 0;
+    fp = fopen("/proc/self/statm", "rt");
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+            rss = 0;
+        fclose(fp);
+    }
+    return rss*sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    const SetTraceHeader *header;
+    const SetTraceRecord *record;
+    const char *begin, *end, *pos;
+    const void **batch_data;
+    size_t *batch_size;
+    bool *batch_result;
+    struct rusage ru0, ru1;
+    struct stat st;
+    unsigned long long t0, t1, start, ops, mismatches;
+    long rss0;
+    size_t n, count;
+    const char *events_path;
+    CacheSim *sim;
+    Set *set;
+    int fd, op;
+
+    sim = NULL;
+    events_path = NULL;
+    while ((op = getopt(argc, argv, "+c:e:")) >= 0)
+    {
+        if (op == 'e')
+        {
+            events_path = optarg;
+            continue;
+        }
+        if (op != 'c' || sim != NULL || (sim = CacheSim_create(optarg)) == NULL)
+        {
+            printf("Invalid cache hierarchy (e.g. 64:32K,64:8M,4K:1G)\n");
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 3)
+    {
+        printf( "Usage: bench-set [-c <hierarchy>] [-e <events.json>] "
+                "<trace> (set description)\n" );
+        return 1;
+    }
+
+    /* Map trace file */
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror("Could not open trace");
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(SetTraceHeader))
+    {
+        printf("Trace is too short!\n");
+        return 1;
+    }
+    begin = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                  fd, (off_t)0 );
+    if (begin == MAP_FAILED)
+    {
+        perror("Could not map trace");
+        return 1;
+    }
+    madvise((void*)begin, (size_t)st.st_size, MADV_SEQUENTIAL);
+    end    = begin + st.st_size;
+    header = (const SetTraceHeader*)begin;
+    if (memcmp(header->magic, SET_TRACE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        printf("Not a set trace!\n");
+        return 1;
+    }
+
+    /* Create set */
+    set = Set_create_from_args(argc - 2, (const char * const *)argv + 2);
+    if (set == NULL)
+    {
+        printf("Could not create set (invalid description?)\n");
+        return 1;
+    }
+
+    /* Allocate room for the largest possible batch */
+    count = (size_t)(end - begin)/sizeof(SetTraceRecord);
+    batch_data   = malloc(count*sizeof(void*));
+    batch_size   = malloc(count*sizeof(size_t));
+    batch_result = malloc(count*sizeof(bool));
+    assert(batch_data != NULL && batch_size != NULL && batch_result != NULL);
+
+    /* Replay operations */
+    getrusage(RUSAGE_SELF, &ru0);
+    rss0 = resident_size();
+    ops = mismatches = 0;
+    CacheSim_active = sim;
+    if (events_path != NULL && !EventTrace_start(EVENT_TRACE_CAPACITY))
+    {
+        printf("Could not allocate event trace buffer!\n");
+        return 1;
+    }
+    start = Histogram_now_ns();
+    for (pos = begin + sizeof(SetTraceHeader); pos < end; )
+    {
+        record = (const SetTraceRecord*)pos;
+        if ( (size_t)(end - pos) < sizeof(SetTraceRecord) ||
+             (size_t)(end - pos) < SET_TRACE_RECORD_SIZE(record->size) )
+        {
+            printf("Trace is truncated!\n");
+            break;
+        }
+        op = record->op;
+        if (op == SET_TRACE_INSERT || op == SET_TRACE_CONTAINS)
+        {
+            t0 = Histogram_now_ns();
+            if (op == SET_TRACE_INSERT)
+                mismatches += set->insert(set, record + 1, record->size) !=
+                              record->result;
+            else
+                mismatches += set->contains(set, record + 1, record->size) !=
+                              record->result;
+            t1 = Histogram_now_ns();
+            Histogram_add(&histograms[op], t1 - t0);
+            pos += SET_TRACE_RECORD_SIZE(record->size);
+            ops += 1;
+        }
+        else
+        if (op == SET_TRACE_BATCH)
+        {
+            /* Collect the insertions that follow */
+            count = record->size;
+            pos += sizeof(SetTraceRecord);
+            for (n = 0; n < count; ++n)
+            {
+                record = (const SetTraceRecord*)pos;
+                assert(pos < end && record->op == SET_TRACE_INSERT);
+                batch_data[n] = record + 1;
+                batch_size[n] = record->size;
+                pos += SET_TRACE_RECORD_SIZE(record->size);
+            }
+
+            t0 = Histogram_now_ns();
+            Set_insert_batch(set, count, batch_data, batch_size, batch_result);
+            t1 = Histogram_now_ns();
+            Histogram_add(&histograms[op], t1 - t0);
+
+            /* Check results against the recorded ones */
+            for (n = 0; n < count; ++n)
+            {
+                record = (const SetTraceRecord*)batch_data[n] - 1;
+                mismatches += batch_result[n] != record->result;
+            }
+            ops += count;
+        }
+        else
+        {
+            printf("Invalid operation in trace!\n");
+            break;
+        }
+    }
+    t1 = Histogram_now_ns();
+    CacheSim_active = NULL;
+    EventTrace_stop();
+    getrusage(RUSAGE_SELF, &ru1);
+
+    /* Report */
+    printf( "%llu operations in %.3fs (%.0f operations/s)\n",
+            ops, (t1 - start)/1e9, ops/((t1 - start)/1e9) );
+    printf( "%-8s %10s %8s %8s %8s %8s %8s %10s\n", "op", "count",
+            "mean", "p50", "p90", "p99", "p99.9", "max (ns)" );
+    for (op = 1; op < 4; ++op)
+    {
+        const Histogram *h = &histograms[op];
+
+        if (h->count == 0)
+            continue;
+        printf( "%-8s %10llu %8.0f %8llu %8llu %8llu %8llu %10llu\n",
+                op_names[op], h->count, (double)h->total/h->count,
+                Histogram_percentile(h, 0.5), Histogram_percentile(h, 0.9),
+                Histogram_percentile(h, 0.99), Histogram_percentile(h, 0.999),
+                h->max );
+    }
+    printf( "Resident size: %.1f MiB (grown by %.1f MiB, peak %.1f MiB)\n",
+            resident_size()/1048576.0, (resident_size() - rss0)/1048576.0,
+            ru1.ru_maxrss/1024.0 );
+    printf( "Page faults: %ld minor, %ld major\n",
+            ru1.ru_minflt - ru0.ru_minflt, ru1.ru_majflt - ru0.ru_majflt );
+    if (sim != NULL)
+    {
+        CacheSim_report(sim, stdout, ops);
+        CacheSim_destroy(sim);
+    }
+    if (events_path != NULL && !EventTrace_export(events_path))
+        perror("Could not write event trace");
+    if (mismatches > 0)
+        printf("Results differ from the trace for %llu operations!\n",
+               mismatches);
+
+    set->destroy(set);
+    free(batch_data);
+    free(batch_size);
+    free(batch_result);
+    munmap((void*)begin, (size_t)st.st_size);
+    close(fd);
+
+    return mismatches > 0;
+}
@@ -0,0 +1,144 @@
+#include "Set.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* Compares lookup performance of a frozen set (see Static_Set.c) against
+   the live B-tree it was created from.
+
+   Random keys are inserted in a B-tree based set, which is then frozen to
+   a file and loaded again. Then, the same sequence of lookups (half of them
+   for keys that are present, half for keys that are absent) is performed on
+   both sets. */
+
+static unsigned long long rng_state;
+
+/* xorshift64 pseudo-random number generator */
+static unsigned long long rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Generates the i-th key of the key sequence with the given seed */
+static size_t make_key(char *buf, unsigned long long seed, long i)
+{
+    size_t size, n;
+
+    rng_state = seed*0x9E3779B97F4A7C15ULL + (unsigned long long)i + 1;
+    rng(); rng();
+    size = 8 + rng()%57;
+    for (n = 0; n < size; ++n)
+        buf[n] = (char)rng();
+    return size;
+}
+
+static double now()
+{
+    struct timeval tv;
+    int res;
+
+    res = gettimeofday(&tv, NULL);
+    assert(res == 0);
+    return (double)tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+/* Performs ``count'' lookups (alternating between present and absent keys)
+   and returns the number of keys found. */
+static long lookup(Set *set, long count, long keys)
+{
+    char buf[64];
+    size_t size;
+    long n, found;
+
+    found = 0;
+    for (n = 0; n < count; ++n)
+    {
+        size = make_key(buf, n%2 ? 2 : 1, (long)((unsigned long long)n*7919%keys));
+        found += set->contains(set, buf, size);
+    }
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    Set *btree, *frozen;
+    long keys, queries, n, found1, found2;
+    char buf[64], path[] = "/tmp/bench-static-XXXXXX";
+    double t0, t1, t2, t3;
+    size_t size;
+    int fd;
+
+    if (argc > 3)
+    {
+        printf("Usage: bench-static [<keys> [<queries>]]\n");
+        return 1;
+    }
+    keys    = argc > 1 ? atol(argv[1]) : 1000000;
+    queries = argc > 2 ? atol(argv[2]) : 2*keys;
+    if (keys <= 0 || queries <= 0)
+    {
+        printf("Key and query counts must be positive integers!\n");
+        return 1;
+    }
+
+    /* Populate B-tree */
+    btree = Btree_Set_create(Allocator_mmap, 4096);
+    assert(btree != NULL);
+    t0 = now();
+    for (n = 0; n < keys; ++n)
+    {
+        size = make_key(buf, 1, n);
+        btree->insert(btree, buf, size);
+    }
+
+    /* Freeze it */
+    t1 = now();
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("Could not create temporary file");
+        return 1;
+    }
+    close(fd);
+    if (!Set_freeze(btree, path))
+    {
+        perror("Could not freeze set");
+        unlink(path);
+        return 1;
+    }
+    t2 = now();
+    frozen = Static_Set_create(path);
+    assert(frozen != NULL);
+    t3 = now();
+    printf("Inserted %ld keys in %.3fs; froze in %.3fs; loaded in %.3fs\n",
+           keys, t1 - t0, t2 - t1, t3 - t2);
+
+    /* Compare lookups */
+    t0 = now();
+    found1 = lookup(btree, queries, keys);
+    t1 = now();
+    found2 = lookup(frozen, queries, keys);
+    t2 = now();
+    printf("btree:  %ld lookups in %.3fs (%.0f lookups/s)\n",
+           queries, t1 - t0, queries/(t1 - t0));
+    printf("static: %ld lookups in %.3fs (%.0f lookups/s)\n",
+           queries, t2 - t1, queries/(t2 - t1));
+    if (found1 != found2)
+    {
+        printf("Results differ! (btree: %ld found; static: %ld found)\n",
+               found1, found2);
+        return 1;
+    }
+
+    btree->destroy(btree);
+    frozen->destroy(frozen);
+    unlink(path);
+
+    return 0;
+}
@@ -19,3 +19,15 @@ int default_compare( const void *ignored,
     }
     return dif;
 }
+
+unsigned long long default_prefix(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    unsigned long long prefix;
+    size_t n;
+
+    prefix = 0;
+    for (n = 0; n < 8; ++n)
+        prefix = (prefix << 8) | (n < size ? p[n] : 0);
+    return prefix;
+}
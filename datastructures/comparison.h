@@ -9,6 +9,11 @@ int default_compare( const void *ignored,
                      const void *d1, size_t s1,
                      const void *d2, size_t s2 );
 
+/* Returns the first 8 bytes of a key (padded with zeroes) as a big-endian
+   integer. If the prefix of one key is less than that of another, the first
+   key is also less than the second according to default_compare(). */
+unsigned long long default_prefix(const void *data, size_t size);
+
 /* Default hash function */
 unsigned default_hash( const void *ignored,
                        const void *data, size_t size );
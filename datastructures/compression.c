@@ -0,0 +1,237 @@
+#include "compression.h"
+#include <stdint.h>
+#include <string.h>
+
+/*  Byte-oriented LZ77 compression in the style of LZ4.
+    Yann Collet.
+
+    See also:
+    https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+    Compressed data is a sequence of (literals, match) pairs, each starting
+    with a token byte whose high nibble is the number of literals and whose
+    low nibble is the match length minus MIN_MATCH. A nibble of 15 is
+    followed by extra length bytes, which are added until one is less than
+    255. The literals follow the token, and the match is encoded as a 2-byte
+    little-endian offset back into the decompressed data. The final sequence
+    consists of literals only.
+
+    Matches are found by hashing 4-byte sequences into a table of recent
+    positions (without chaining), which favours speed over compression
+    ratio. This format is not compatible with LZ4 proper. */
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  65535
+#define HASH_BITS   12
+#define WILD_COPY   16      /* Copy granularity when buffers have slack */
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/* Returns the length of the common prefix of ``p'' and ``q'' (where ``q''
+   precedes ``p''), up to ``end'' */
+static size_t match_length( const unsigned char *p, const unsigned char *q,
+                            const unsigned char *end )
+{
+    const unsigned char *start = p;
+    uint64_t diff;
+
+    while (end - p >= 8)
+    {
+        diff = read64(p) ^ read64(q);
+        if (diff != 0)
+        {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return (size_t)(p - start) + (size_t)__builtin_ctzll(diff)/8;
+#else
+            break;
+#endif
+        }
+        p += 8;
+        q += 8;
+    }
+    while (p < end && *p == *q)
+        ++p, ++q;
+    return (size_t)(p - start);
+}
+
+static size_t hash4(uint32_t value)
+{
+    return (size_t)((value*2654435761u) >> (32 - HASH_BITS));
+}
+
+/* Copies ``size'' bytes in chunks of WILD_COPY bytes, which may write up to
+   WILD_COPY - 1 bytes past the end. */
+static void wild_copy(unsigned char *dst, const unsigned char *src, size_t size)
+{
+    unsigned char *end = dst + size;
+
+    do {
+        memcpy(dst, src, WILD_COPY);
+        dst += WILD_COPY;
+        src += WILD_COPY;
+    } while (dst < end);
+}
+
+/* Writes the extra bytes of a length whose nibble is 15 */
+static unsigned char *put_length(unsigned char *op, size_t length)
+{
+    for ( ; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/* Writes a sequence of ``literals'' bytes at ``anchor'' followed by a match
+   of ``length'' bytes at ``offset'' (or no match if ``length'' is 0) */
+static unsigned char *put_sequence( unsigned char *op,
+    const unsigned char *anchor, size_t literals, size_t offset, size_t length )
+{
+    unsigned char *token = op++;
+
+    *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15)
+        op = put_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    if (length > 0)
+    {
+        *op++ = (unsigned char)(offset & 255);
+        *op++ = (unsigned char)(offset >> 8);
+        length -= MIN_MATCH;
+        *token |= (unsigned char)(length < 15 ? length : 15);
+        if (length >= 15)
+            op = put_length(op, length - 15);
+    }
+
+    return op;
+}
+
+size_t lz_compress(const void *src, size_t size, void *dst)
+{
+    const unsigned char *base = src, *ip = base, *anchor = base,
+                        *end = base + size, *ref;
+    unsigned char *op = dst;
+    size_t table[1 << HASH_BITS], h, length;
+
+    memset(table, 0, sizeof(table));
+    while (end - ip >= MIN_MATCH)
+    {
+        h = hash4(read32(ip));
+        ref = base + table[h];
+        table[h] = (size_t)(ip - base);
+        if (ref < ip && ip - ref <= MAX_OFFSET && read32(ref) == read32(ip))
+        {
+            length = MIN_MATCH + match_length( ip + MIN_MATCH,
+                                               ref + MIN_MATCH, end );
+            op = put_sequence( op, anchor, (size_t)(ip - anchor),
+                               (size_t)(ip - ref), length );
+            ip += length;
+            anchor = ip;
+        }
+        else
+        {
+            ++ip;
+        }
+    }
+
+    /* Write remaining literals */
+    op = put_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+
+    return (size_t)(op - (unsigned char*)dst);
+}
+
+/* Reads the extra bytes of a length whose nibble is 15 */
+static bool get_length( const unsigned char **ip, const unsigned char *end,
+                        size_t *length )
+{
+    unsigned char byte;
+
+    do {
+        if (*ip == end)
+            return false;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+bool lz_decompress( const void *src, size_t size,
+                    void *dst, size_t dst_size )
+{
+    const unsigned char *ip = src, *end = ip + size, *ref;
+    unsigned char *op = dst, *op_begin = dst, *op_end = op + dst_size;
+    size_t literals, offset, length, n;
+    unsigned char token;
+
+    while (ip < end)
+    {
+        /* Copy literals */
+        token = *ip++;
+        literals = token >> 4;
+        if (literals == 15 && !get_length(&ip, end, &literals))
+            return false;
+        if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op))
+            return false;
+        if ( (size_t)(end - ip) >= literals + WILD_COPY &&
+             (size_t)(op_end - op) >= literals + WILD_COPY )
+            wild_copy(op, ip, literals);
+        else
+            memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end)
+            break;
+
+        /* Copy match */
+        if (end - ip < 2)
+            return false;
+        offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        length = token & 15;
+        if (length == 15 && !get_length(&ip, end, &length))
+            return false;
+        length += MIN_MATCH;
+        if ( offset == 0 || offset > (size_t)(op - op_begin) ||
+             length > (size_t)(op_end - op) )
+            return false;
+        ref = op - offset;
+        if (offset >= WILD_COPY && (size_t)(op_end - op) >= length + WILD_COPY)
+        {
+            wild_copy(op, ref, length);
+            op += length;
+        }
+        else
+        if (offset >= length)
+        {
+            memcpy(op, ref, length);
+            op += length;
+        }
+        else
+        {
+            /* Overlapping match: repeat the pattern, doubling its length */
+            memcpy(op, ref, offset);
+            for (n = offset; 2*n <= length; n *= 2)
+                memcpy(op + n, op, n);
+            memcpy(op + n, op, length - n);
+            op += length;
+        }
+    }
+
+    return op == op_end;
+}
@@ -0,0 +1,21 @@
+#ifndef COMPRESSION_H_INCLUDED
+#define COMPRESSION_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Upper bound on the compressed size of ``size'' bytes of data */
+#define LZ_BOUND(size) ((size) + (size)/255 + 16)
+
+/* Compresses ``size'' bytes of data from ``src'' into ``dst'', which must
+   have room for at least LZ_BOUND(size) bytes. Returns the compressed size.
+*/
+size_t lz_compress(const void *src, size_t size, void *dst);
+
+/* Decompresses ``size'' bytes of compressed data from ``src'' into ``dst'',
+   which must decompress to exactly ``dst_size'' bytes. Returns false if the
+   data is corrupt. */
+bool lz_decompress( const void *src, size_t size,
+                    void *dst, size_t dst_size );
+
+#endif /* ndef COMPRESSION_H_INCLUDED */
@@ -9,3 +9,69 @@
 #endif 
 
 #define ALLOC_CHUNK_SIZE 4096
+
+/* Initial size of the address space reserved for file storage (see
+   FileStorage.c) */
+#ifndef FS_RESERVE_SIZE
+#  define FS_RESERVE_SIZE ((size_t)1 << (sizeof(size_t) >= 8 ? 30 : 24))
+#endif
+
+/* Define to 1 to prefault memory when file storage grows */
+#ifndef FS_POPULATE
+#  define FS_POPULATE 0
+#endif
+
+/* Size of pages and default total size of the shared buffer pool (see
+   BufferPool.c) */
+#ifndef BUFFER_POOL_PAGE_SIZE
+#  define BUFFER_POOL_PAGE_SIZE 4096
+#endif
+#ifndef BUFFER_POOL_MEMORY
+#  define BUFFER_POOL_MEMORY ((size_t)64 << 20)
+#endif
+
+/* Minimum number of frames of the shared buffer pool: enough to pin the
+   path from the root of the tallest B-tree (see Btree_Set.c) to a leaf,
+   the page being split off and the pages held by a Pool_Deque */
+#ifndef BUFFER_POOL_MIN_FRAMES
+#  define BUFFER_POOL_MIN_FRAMES 72
+#endif
+
+/* Size of blocks and number of blocks read ahead and written behind by the
+   asynchronous deque (see Async_Deque.c) */
+#ifndef ASYNC_DEQUE_BLOCK_SIZE
+#  define ASYNC_DEQUE_BLOCK_SIZE ((size_t)1 << 20)
+#endif
+#ifndef ASYNC_DEQUE_READ_AHEAD
+#  define ASYNC_DEQUE_READ_AHEAD 4
+#endif
+#ifndef ASYNC_DEQUE_WRITE_BEHIND
+#  define ASYNC_DEQUE_WRITE_BEHIND 4
+#endif
+
+/* Default memory limit of the bucket heap, and the highest priority it
+   accepts (see Bucket_Heap.c) */
+#ifndef BUCKET_HEAP_MEMORY
+#  define BUCKET_HEAP_MEMORY ((size_t)256 << 20)
+#endif
+#ifndef BUCKET_HEAP_MAX_PRIORITY
+#  define BUCKET_HEAP_MAX_PRIORITY ((1ul << 20) - 1)
+#endif
+
+/* Define to 0 to compile out the hooks through which set implementations
+   report memory accesses to the cache simulator (see CacheSim.c) */
+#ifndef CACHE_SIM
+#  define CACHE_SIM 1
+#endif
+
+/* Define to 0 to compile out the hooks through which data structures record
+   structural maintenance events (see EventTrace.h) */
+#ifndef EVENT_TRACE
+#  define EVENT_TRACE 1
+#endif
+
+/* Number of events kept in the event trace ring buffer (the most recent
+   ones are kept if more are recorded) */
+#ifndef EVENT_TRACE_CAPACITY
+#  define EVENT_TRACE_CAPACITY (1 << 20)
+#endif
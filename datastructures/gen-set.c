@@ -0,0 +1,303 @@
+#include "SetTrace.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Generates a workload of set operations for test-set, in the binary trace
+   format of SetTrace.h (so it can be replayed by bench-set too).
+
+   The workload consists of insertions and lookups on a working set of K
+   distinct keys. Each operation is a lookup with the given probability, or
+   else an insertion. Insertions add the keys of the working set one by one,
+   in increasing lexicographical order (-o sorted) or in a random order (-o
+   random); once all keys have been added, further insertions re-insert
+   existing keys. The key to look up (or to re-insert) is chosen from the
+   keys in insertion order, with rank r chosen with probability proportional
+   to 1/(r+1)^s (a Zipf distribution; s = 0 gives a uniform distribution),
+   so with s > 0 the oldest keys are the most popular ones. Lookups may hit
+   keys that have not been inserted yet.
+
+   Keys consist of printable characters. The first characters encode the
+   key number in base 62 (with a fixed number of digits, so the order of
+   key numbers is the lexicographical order of the keys) and the rest are
+   pseudo-random; key sizes are uniformly distributed in [min:max].
+
+   The expected result of each operation is recorded in the trace, so
+   replaying it also checks the set implementation. */
+
+static const char digits[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static unsigned long long rng_state;
+
+/* xorshift64 pseudo-random number generator */
+static unsigned long long rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Returns a pseudo-random number in [0:1) */
+static double rng_double()
+{
+    return (rng() >> 11)*(1.0/9007199254740992.0);
+}
+
+/* Returns a rank in [0:keys) from the Zipf distribution, given its
+   cumulative distribution function, or a uniformly distributed rank if
+   ``cdf'' is NULL. */
+static unsigned long pick(const double *cdf, unsigned long keys)
+{
+    unsigned long lo, hi, mid;
+    double x;
+
+    if (cdf == NULL)
+        return (unsigned long)(rng()%keys);
+
+    x = rng_double()*cdf[keys - 1];
+    lo = 0;
+    hi = keys - 1;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo)/2;
+        if (cdf[mid] <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Writes key number ``i'' to ``buf'' and returns its size */
+static size_t make_key( char *buf, unsigned long i, int width,
+                        size_t min_size, size_t max_size,
+                        unsigned long long seed )
+{
+    unsigned long long saved, x;
+    size_t size, n;
+    int d;
+
+    x = i;
+    for (d = width - 1; d >= 0; --d)
+    {
+        buf[d] = digits[x%62];
+        x /= 62;
+    }
+
+    /* Contents depend only on the seed and key number */
+    saved = rng_state;
+    rng_state = seed*0x9E3779B97F4A7C15ULL + (unsigned long long)i + 1;
+    rng(); rng();
+    size = min_size + (size_t)(rng()%(max_size - min_size + 1));
+    for (n = (size_t)width; n < size; ++n)
+        buf[n] = digits[rng()%62];
+    rng_state = saved;
+    return size;
+}
+
+/* Writes a record with the given key to ``fp'' */
+static void write_record( FILE *fp, int op, bool result,
+                          const char *key, size_t size )
+{
+    static const char padding[8];
+    SetTraceRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.op     = (uint8_t)op;
+    record.result = result;
+    record.size   = (uint32_t)size;
+    fwrite(&record, sizeof(record), 1, fp);
+    fwrite(key, 1, size, fp);
+    fwrite( padding, 1, SET_TRACE_RECORD_SIZE(size) - sizeof(record) - size,
+            fp );
+}
+
+static void usage()
+{
+    printf( "Usage: gen-set [options] <output file>\n"
+            "Options:\n"
+            "  -n <count>    number of operations (default: 400000)\n"
+            "  -k <count>    number of distinct keys (default: 100000)\n"
+            "  -l <ratio>    fraction of lookups (default: 0.5)\n"
+            "  -s <min-max>  key size range in bytes (default: 5-15)\n"
+            "  -z <s>        Zipf exponent of key popularity (default: 0)\n"
+            "  -o <order>    insertion order: random or sorted "
+                             "(default: random)\n"
+            "  -r <seed>     random seed (default: 1)\n" );
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long ops, keys, inserted, n, i, r, t;
+    unsigned long *order;
+    unsigned long long seed;
+    size_t min_size, max_size, size;
+    double lookups, skew, sum, *cdf;
+    bool sorted, contains;
+    SetTraceHeader header;
+    char *key, *end;
+    FILE *fp;
+    int width, op;
+
+    ops      = 400000;
+    keys     = 100000;
+    lookups  = 0.5;
+    min_size = 5;
+    max_size = 15;
+    skew     = 0;
+    sorted   = false;
+    seed     = 1;
+
+    while ((op = getopt(argc, argv, "n:k:l:s:z:o:r:")) >= 0)
+    {
+        switch (op)
+        {
+        case 'n':
+            ops = strtoul(optarg, &end, 10);
+            break;
+        case 'k':
+            keys = strtoul(optarg, &end, 10);
+            break;
+        case 'l':
+            lookups = strtod(optarg, &end);
+            break;
+        case 's':
+            min_size = max_size = strtoul(optarg, &end, 10);
+            if (*end == '-')
+                max_size = strtoul(end + 1, &end, 10);
+            break;
+        case 'z':
+            skew = strtod(optarg, &end);
+            break;
+        case 'o':
+            if (strcmp(optarg, "sorted") == 0)
+                sorted = true;
+            else
+            if (strcmp(optarg, "random") == 0)
+                sorted = false;
+            else
+            {
+                printf("Invalid insertion order: %s\n", optarg);
+                return 1;
+            }
+            continue;
+        case 'r':
+            seed = strtoull(optarg, &end, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+        if (end == optarg || *end != '\0')
+        {
+            printf("Invalid argument to -%c: %s\n", op, optarg);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        usage();
+        return 1;
+    }
+
+    /* Number of base-62 digits needed to distinguish all keys */
+    width = 1;
+    for (n = 62; n < keys && width < 11; n *= 62)
+        ++width;
+
+    if ( keys == 0 || lookups < 0 || lookups > 1 || skew < 0 ||
+         min_size > max_size || min_size < (size_t)width )
+    {
+        printf( "Invalid parameters (note that keys must be at least %d "
+                "bytes to distinguish %lu keys)\n", width, keys );
+        return 1;
+    }
+
+    /* Determine insertion order */
+    order = malloc(keys*sizeof(*order));
+    key   = malloc(max_size);
+    assert(order != NULL && key != NULL);
+    for (n = 0; n < keys; ++n)
+        order[n] = n;
+    rng_state = seed*0x2545F4914F6CDD1DULL + 1;
+    rng(); rng();
+    if (!sorted)
+    {
+        for (n = keys - 1; n > 0; --n)
+        {
+            r = (unsigned long)(rng()%(n + 1));
+            t = order[n];
+            order[n] = order[r];
+            order[r] = t;
+        }
+    }
+
+    /* Compute cumulative distribution of key popularity */
+    cdf = NULL;
+    if (skew > 0)
+    {
+        cdf = malloc(keys*sizeof(*cdf));
+        assert(cdf != NULL);
+        sum = 0;
+        for (n = 0; n < keys; ++n)
+        {
+            sum += pow((double)(n + 1), -skew);
+            cdf[n] = sum;
+        }
+    }
+
+    fp = fopen(argv[optind], "wb");
+    if (fp == NULL)
+    {
+        perror("Could not open output file");
+        return 1;
+    }
+    memcpy(header.magic, SET_TRACE_MAGIC, sizeof(header.magic));
+    header.count = ops;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    inserted = 0;
+    for (n = 0; n < ops; ++n)
+    {
+        if (rng_double() < lookups)
+        {
+            op = SET_TRACE_CONTAINS;
+            r = pick(cdf, keys);
+            contains = r < inserted;
+        }
+        else
+        if (inserted < keys)
+        {
+            op = SET_TRACE_INSERT;
+            r = inserted++;
+            contains = false;
+        }
+        else
+        {
+            op = SET_TRACE_INSERT;
+            r = pick(cdf, keys);
+            contains = true;
+        }
+        i = order[r];
+        size = make_key(key, i, width, min_size, max_size, seed);
+        write_record(fp, op, contains, key, size);
+    }
+
+    if (fclose(fp) != 0)
+    {
+        perror("Could not write output file");
+        return 1;
+    }
+
+    free(cdf);
+    free(key);
+    free(order);
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+#include "parsing.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+size_t parse_size(const char **str)
+{
+    static const char suffixes[] = "KMGT";
+    const char *suffix;
+    char *end;
+    double size;
+
+    size = strtod(*str, &end);
+    if (end == *str || !(size >= 1))
+        return 0;
+    if ( *end != '\0' &&
+         (suffix = strchr(suffixes, toupper((unsigned char)*end))) != NULL )
+    {
+        /* Scale once for each suffix up to and including this one */
+        for ( ; suffix >= suffixes; --suffix)
+            size *= 1024;
+        ++end;
+    }
+    if (!(size < (double)SIZE_MAX))
+        return 0;
+    *str = end;
+    return (size_t)size;
+}
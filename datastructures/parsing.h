@@ -0,0 +1,12 @@
+#ifndef PARSING_H_INCLUDED
+#define PARSING_H_INCLUDED
+
+#include <stdlib.h>
+
+/* Parses a size in bytes with an optional K, M, G or T suffix (in either
+   case; each multiplies by 1024) at the start of ``str'', and advances
+   ``str'' past it. Returns 0 (leaving ``str'' unchanged) if no positive
+   size is found. */
+size_t parse_size(const char **str);
+
+#endif /* ndef PARSING_H_INCLUDED */
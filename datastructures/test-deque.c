@@ -11,7 +11,14 @@ int main(int argc, char *argv[])
     size_t len;
     void *data;
     size_t size;
+    void *front_data;
+    char front_copy[sizeof(line)];
+    size_t front_size;
+    const char *path;
 
+    path = argc == 3 ? argv[2] : NULL;
+    front_data = NULL;
+    front_size = 0;
     if (argc == 1)
     {
         deque = Memory_Deque_create();
@@ -22,10 +29,31 @@ int main(int argc, char *argv[])
         deque = File_Deque_create(argv[1]);
     }
     else
+    if (argc <= 3 && strcmp(argv[1], "-c") == 0)
+    {
+        deque = Compressed_Deque_create(path);
+    }
+    else
+    if (argc <= 3 && strcmp(argv[1], "-a") == 0)
+    {
+        deque = Async_Deque_create(path);
+    }
+    else
+    if (argc == 2 && strcmp(argv[1], "-p") == 0)
+    {
+        deque = Pool_Deque_create(BufferPool_shared());
+    }
+    else
     {
         printf("Usage:\n"
                "  test-deque            -- use the in-memory deque\n"
                "  test-deque <path>     -- use the file-based deque\n"
+               "  test-deque -c [path]  -- use the compressed deque (backed by\n"
+               "                           anonymous memory if no path is given)\n"
+               "  test-deque -a [dir]   -- use the asynchronous deque, with a\n"
+               "                           temporary file in the given directory\n"
+               "  test-deque -p         -- use the deque cached by the shared\n"
+               "                           buffer pool\n"
                "\n"
                "Commands:\n"
                "  destroy       -- destroy the deque and exit\n"
@@ -35,6 +63,9 @@ int main(int argc, char *argv[])
                "  push_front    -- add element at the front\n"
                "  get_back      -- print element at the back\n"
                "  get_front     -- print element at the front\n"
+               "  check_front   -- check that the element returned by the last\n"
+               "                   get_front is still intact (it must remain\n"
+               "                   valid until the front is popped)\n"
                "  pop_back      -- remove element at the back\n"
                "  pop_front     -- remove element at the front\n");
         return 1;
@@ -99,24 +130,44 @@ int main(int argc, char *argv[])
         if (strcmp(line, "get_front") == 0)
         {
             if (!deque->get_front(deque, &data, &size))
+            {
                 printf("get_front failed!\n");
+                front_data = NULL;
+            }
             else
             {
                 fwrite(data, size, 1, stdout);
                 fputc('\n', stdout);
+                front_data = data;
+                front_size = size < sizeof(front_copy) ? size
+                                                       : sizeof(front_copy);
+                memcpy(front_copy, data, front_size);
             }
         }
         else
+        if (strcmp(line, "check_front") == 0)
+        {
+            if (front_data == NULL)
+                printf("check_front failed!\n");
+            else
+                printf( "front=%s\n",
+                        memcmp(front_data, front_copy, front_size) == 0
+                        ? "intact" : "changed" );
+        }
+        else
         if (strcmp(line, "pop_back") == 0)
         {
             if (!deque->pop_back(deque))
                 printf("pop_back failed!\n");
+            if (deque->empty(deque))
+                front_data = NULL;
         }
         else
         if (strcmp(line, "pop_front") == 0)
         {
             if (!deque->pop_front(deque))
                 printf("pop_front failed!\n");
+            front_data = NULL;
         }
         else
         {
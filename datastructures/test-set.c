@@ -1,38 +1,209 @@
+#include "Histogram.h"
 #include "Set.h"
+#include "SetTrace.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-int main(int argc, char *argv[])
+/* Runs a workload of set operations (generated by gen-set, or recorded by
+   a mock set in trace mode; see SetTrace.h) against sets created from each
+   of the given descriptions, and reports the throughput for each.
+
+   The workload is loaded into memory before any set is created, so only
+   the set operations themselves are timed. Each description is a single
+   argument, with the words of the description separated by spaces, e.g.:
+
+       test-set workload.bin hash "btree pagesize=8192" "Bender varlen"
+
+   Batch insertions in recorded traces are performed one by one. The result
+   of each operation is compared with the recorded result; the exit status
+   is nonzero if any result differs. */
+
+/* A single operation of the workload */
+typedef struct Operation
 {
-    Set *set;
-    char line[4096];
+    const void  *data;
+    size_t      size;
+    int         op;
+    bool        result;
+} Operation;
 
-    set = Set_create_from_args(argc - 1, (const char**)argv + 1);
+/* Reads the file at ``path'' into memory and stores its size in ``size''.
+   Returns NULL if the file cannot be read. */
+static char *read_file(const char *path, size_t *size)
+{
+    FILE *fp;
+    char *data;
+    long len;
 
-    if (set == NULL)
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+    data = NULL;
+    if ( fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 &&
+         fseek(fp, 0, SEEK_SET) == 0 )
     {
-        fprintf(stderr, "Unable to create set with given parameters!\n");
-        exit(1);
+        data = malloc(len > 0 ? (size_t)len : 1);
+        if (data != NULL && fread(data, 1, (size_t)len, fp) != (size_t)len)
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)len;
     }
+    fclose(fp);
+    return data;
+}
+
+/* Parses the operations in a workload of ``size'' bytes into ``ops'' (with
+   room for at least one operation per record) and returns their number, or
+   -1 if the workload is invalid. */
+static long parse_workload(const char *data, size_t size, Operation *ops)
+{
+    const SetTraceRecord *record;
+    const char *pos, *end;
+    long count;
 
-    while (fgets(line, sizeof(line), stdin) != NULL)
+    if ( size < sizeof(SetTraceHeader) ||
+         memcmp(data, SET_TRACE_MAGIC, sizeof(SET_TRACE_MAGIC) - 1) != 0 )
+        return -1;
+
+    count = 0;
+    end = data + size;
+    for (pos = data + sizeof(SetTraceHeader); pos < end; )
     {
-        if (line[0] == '?')
+        record = (const SetTraceRecord*)pos;
+        if ( (size_t)(end - pos) < sizeof(SetTraceRecord) ||
+             (size_t)(end - pos) < SET_TRACE_RECORD_SIZE(record->size) )
+            return -1;
+        if (record->op == SET_TRACE_BATCH)
         {
-            fputs( set->contains(set, line + 1, strlen(line) - 2) ?
-                    "Present.\n" : "Absent.\n",  stdout );
+            /* The insertions that follow are performed individually */
+            pos += sizeof(SetTraceRecord);
+            continue;
         }
+        if (record->op != SET_TRACE_INSERT && record->op != SET_TRACE_CONTAINS)
+            return -1;
+        ops[count].data   = record + 1;
+        ops[count].size   = record->size;
+        ops[count].op     = record->op;
+        ops[count].result = record->result;
+        ++count;
+        pos += SET_TRACE_RECORD_SIZE(record->size);
+    }
+    return count;
+}
+
+/* Creates a set from a description of space-separated words */
+static Set *create_set(const char *descr)
+{
+    const char *args[64];
+    char *copy, *word;
+    int argc;
+    Set *set;
+
+    copy = strdup(descr);
+    assert(copy != NULL);
+    argc = 0;
+    for (word = strtok(copy, " "); word != NULL; word = strtok(NULL, " "))
+    {
+        if (argc == sizeof(args)/sizeof(*args))
+        {
+            free(copy);
+            return NULL;
+        }
+        args[argc++] = word;
+    }
+    set = Set_create_from_args(argc, args);
+    free(copy);
+    return set;
+}
+
+/* Performs the operations on the set and returns the number of results
+   that differ from the expected ones. */
+static long run(Set *set, const Operation *ops, long count)
+{
+    long n, mismatches;
+
+    mismatches = 0;
+    for (n = 0; n < count; ++n)
+    {
+        if (ops[n].op == SET_TRACE_INSERT)
+            mismatches += set->insert(set, ops[n].data, ops[n].size) !=
+                          ops[n].result;
         else
+            mismatches += set->contains(set, ops[n].data, ops[n].size) !=
+                          ops[n].result;
+    }
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long t0, t1;
+    long count, lookups, mismatches, total_mismatches, n;
+    Operation *ops;
+    size_t size;
+    char *data;
+    Set *set;
+    int arg;
+
+    if (argc < 3)
+    {
+        printf( "Usage: test-set <workload> <set description> "
+                "[<set description> ...]\n" );
+        return 1;
+    }
+
+    data = read_file(argv[1], &size);
+    if (data == NULL)
+    {
+        perror("Could not read workload");
+        return 1;
+    }
+    ops = malloc((size/sizeof(SetTraceRecord) + 1)*sizeof(Operation));
+    assert(ops != NULL);
+    count = parse_workload(data, size, ops);
+    if (count < 0)
+    {
+        printf("Invalid workload!\n");
+        return 1;
+    }
+    lookups = 0;
+    for (n = 0; n < count; ++n)
+        lookups += ops[n].op == SET_TRACE_CONTAINS;
+    printf( "%ld operations (%ld insertions, %ld lookups)\n",
+            count, count - lookups, lookups );
+
+    total_mismatches = 0;
+    for (arg = 2; arg < argc; ++arg)
+    {
+        set = create_set(argv[arg]);
+        if (set == NULL)
         {
-            fputs( set->insert(set, line, strlen(line) - 1) ?
-                    "Replaced.\n" : "Added.\n",  stdout );
+            printf("%-32s invalid description!\n", argv[arg]);
+            total_mismatches += 1;
+            continue;
         }
+
+        t0 = Histogram_now_ns();
+        mismatches = run(set, ops, count);
+        t1 = Histogram_now_ns();
+        set->destroy(set);
+
+        printf( "%-32s %8.3fs %12.0f operations/s", argv[arg],
+                (t1 - t0)/1e9, count/((t1 - t0)/1e9) );
+        if (mismatches > 0)
+            printf(" (%ld results differ!)", mismatches);
+        printf("\n");
+        total_mismatches += mismatches;
     }
 
-    set->destroy(set);
+    free(ops);
+    free(data);
 
-    return 0;
+    return total_mismatches > 0;
 }
@@ -0,0 +1,108 @@
+#include "Set.h"
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Checks frozen sets (see Static_Set.c) created from a small B-tree and
+   from an empty set:
+    - each set survives a freeze/load round trip with the same contents;
+    - inserting a key that is present reports it as present;
+    - inserting a key that is absent aborts, instead of reporting the key
+      as inserted without storing it.
+   The exit status is nonzero if any check fails. */
+
+static const char *keys[] = { "apple", "banana", "cherry", "date", "elder",
+                              "fig", "grape" };
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static bool count_key(void *arg, const void *data, size_t size)
+{
+    (void)data;
+    (void)size;
+    *(size_t*)arg += 1;
+    return true;
+}
+
+/* Returns whether inserting ``key'' in ``set'' aborts the process */
+static bool insert_aborts(Set *set, const char *key)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        /* The abort message is expected; keep it out of the output */
+        freopen("/dev/null", "w", stderr);
+        set->insert(set, key, strlen(key));
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+/* Freezes a B-tree set holding the first ``count'' keys and checks the
+   frozen copy. */
+static void test_freeze(size_t count)
+{
+    char path[] = "/tmp/test-static-XXXXXX";
+    Set *btree, *frozen;
+    size_t n, found;
+    int fd;
+
+    btree = Btree_Set_create(Allocator_mmap, 4096);
+    assert(btree != NULL);
+    for (n = 0; n < count; ++n)
+        btree->insert(btree, keys[n], strlen(keys[n]));
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    check(Set_freeze(btree, path), "freeze");
+    frozen = Static_Set_create(path);
+    unlink(path);
+    btree->destroy(btree);
+    check(frozen != NULL, "load");
+    if (frozen == NULL)
+        return;
+
+    found = 0;
+    check(frozen->enumerate(frozen, count_key, &found), "enumerate");
+    check(found == count, "number of keys");
+    for (n = 0; n < sizeof(keys)/sizeof(*keys); ++n)
+    {
+        check( frozen->contains(frozen, keys[n], strlen(keys[n])) ==
+               (n < count), "contains" );
+    }
+    if (count > 0)
+        check(frozen->insert(frozen, keys[0], strlen(keys[0])), "insert");
+    check(insert_aborts(frozen, "zz"), "insert of an absent key aborts");
+
+    frozen->destroy(frozen);
+}
+
+int main()
+{
+    test_freeze(sizeof(keys)/sizeof(*keys));
+    test_freeze(0);
+    if (failures == 0)
+        printf("All checks passed.\n");
+    return failures > 0;
+}
@@ -0,0 +1,804 @@
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Benchmark driver: runs the search program on every combination of model,
+   set description and queue type given in a matrix file, and writes the
+   median and a 95% confidence interval of each measurement per combination
+   to a single tab-separated results file.
+
+   The matrix file consists of lines of the form KEY=value (values may be
+   quoted; lines starting with # are ignored):
+
+    MODEL=name          Model to search (models/<name>.b), or a synthetic
+                        state space as synthetic:<spec> (see search -G);
+                        may be repeated.
+    SET=description     Set description passed to search; may be repeated.
+    QUEUE=type          Queue type passed to search -q; may be repeated
+                        (default: file).
+    OPTIONS=args        Additional arguments passed to search.
+    REPEAT=n            Number of measured runs per combination (default 7).
+    WARMUP=n            Number of unmeasured runs per combination before
+                        measuring starts (default 1).
+    MAXIT=n             Iteration limit passed to search (default 10000000).
+    MAXVSS=kb           Limit on the virtual memory size of search in KiB,
+                        or "unlimited" (default).
+    MAXRSS=kb           Limit on the resident memory of search in KiB, or
+                        "unlimited" (default); see below.
+    SPILLDIR=dir        Directory in which a private directory for the
+                        spill and queue files of search (search -S) is
+                        created (default: $TMPDIR or /tmp).
+    CGROUP=dir          Delegated cgroup (v2) directory in which to create
+                        the cgroup that limits resident memory (default:
+                        the cgroup of the benchmark driver).
+    PAUSE=s             Seconds to sleep after each run, to give the system
+                        a chance to settle (default 10).
+    BASELINE=1          Also measure, for each model, a search that replays
+                        the answers of a recorded set (a mock set), which
+                        gives the cost of the search without the set.
+
+   Every run is a separate process, and runs of different combinations are
+   interleaved, so that slow drift of the system affects all combinations
+   equally rather than biasing a few of them.
+
+   Unlike a limit on virtual memory, which makes the search fail when it is
+   reached, a limit on resident memory makes it page, to measure the data
+   structures when they are larger than main memory. Without root access,
+   this is done in one of two ways:
+
+    - If cgroup v2 is available and a cgroup can be created with the memory
+      controller enabled (which requires a delegated cgroup, e.g. one
+      created by systemd-run --user -p Delegate=yes), each run is placed in
+      a cgroup with memory.max set to the limit.
+
+    - Otherwise, a balloon process locks all memory that is available
+      except for the limit (with mlock(), if RLIMIT_MEMLOCK allows it, or
+      else by touching it, which only works if there is no swap space),
+      for the duration of the benchmark. This limits the memory available
+      to the search only approximately, since other processes compete for
+      the rest of it.
+
+   Memory only pages to disk if it is backed by files (or swap space), so
+   such runs should let search spill its storage to files (with -M) or use
+   disk-backed queues. The spill files of search are created in a private
+   directory, whose files are evicted from the page cache before every run,
+   so that every run starts with a cold cache.
+*/
+
+enum { M_WCTIME, M_UTIME, M_STIME, M_MAXRSS, M_FAULTS, M_MAJFAULTS,
+       M_EXPANDED, M_TRANSITIONS, M_RATE, METRICS };
+
+static const char *metric_names[METRICS] = {
+    "wctime", "utime", "stime", "maxrss", "faults", "majfaults", "expanded",
+    "transitions", "expanded/s" };
+
+#define MAX_ITEMS 64
+
+typedef struct Combination
+{
+    const char  *model;
+    const char  *set;               /* Set description (or "baseline") */
+    const char  *set_args;          /* Set description passed to search */
+    const char  *queue;
+    size_t      runs;               /* Number of succesful runs */
+    size_t      failures;           /* Number of failed runs */
+    double      *values[METRICS];   /* Measurements of succesful runs */
+} Combination;
+
+static const char   *opt_search         = "./search";
+static const char   *opt_models         = "models";
+static const char   *opt_output         = "bench-results.tsv";
+
+/* Matrix parameters */
+static const char   *models[MAX_ITEMS];
+static const char   *sets[MAX_ITEMS];
+static const char   *queues[MAX_ITEMS];
+static int          model_count         = 0;
+static int          set_count           = 0;
+static int          queue_count         = 0;
+static const char   *options            = "";
+static long         repeat              = 7;
+static long         warmup              = 1;
+static long         max_iterations      = 10000000;
+static long         max_vss             = -1;
+static long         max_rss             = -1;
+static const char   *spill_parent       = NULL;
+static const char   *cgroup_parent      = NULL;
+static long         pause_seconds       = 10;
+static bool         baseline            = false;
+
+/* Memory pressure state */
+static char         *spill_dir          = NULL; /* Private spill directory */
+static char         *cgroup_dir         = NULL; /* Cgroup of runs (or NULL) */
+static pid_t        balloon_pid         = -1;   /* Balloon process (or -1) */
+
+static void usage()
+{
+    printf(
+        "Usage:\n"
+        "    benchmark [<options>] <matrix file>\n"
+        "Options:\n"
+        "    -s path     -- search program to run (default: ./search)\n"
+        "    -d dir      -- directory containing model bytecode files\n"
+        "                   (default: models)\n"
+        "    -o path     -- results file (default: bench-results.tsv)\n" );
+    exit(1);
+}
+
+/* Adds an item to a list of at most MAX_ITEMS items */
+static void add_item(const char **items, int *count, const char *value)
+{
+    if (*count == MAX_ITEMS)
+    {
+        printf("Too many items in matrix (at most %d)!\n", MAX_ITEMS);
+        exit(1);
+    }
+    items[(*count)++] = value;
+}
+
+/* Parses the matrix file. Exits on errors. */
+static void parse_matrix(const char *path)
+{
+    FILE *fp;
+    char line[1024], *key, *value, *end;
+    int lineno;
+
+    fp = fopen(path, "rt");
+    if (fp == NULL)
+    {
+        perror("Could not open matrix file");
+        exit(1);
+    }
+
+    for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; ++lineno)
+    {
+        /* Strip white space and quotes */
+        for (key = line; isspace(*key); ++key) { }
+        if (*key == '\0' || *key == '#')
+            continue;
+        value = strchr(key, '=');
+        if (value == NULL)
+        {
+            printf("%s:%d: expected KEY=value\n", path, lineno);
+            exit(1);
+        }
+        *value++ = '\0';
+        end = value + strlen(value);
+        while (end > value && isspace(end[-1]))
+            *--end = '\0';
+        if (end - value >= 2 && (*value == '"' || *value == '\'') &&
+            end[-1] == *value)
+        {
+            *--end = '\0';
+            ++value;
+        }
+        value = strdup(value);
+        assert(value != NULL);
+
+        if (strcmp(key, "MODEL") == 0)
+            add_item(models, &model_count, value);
+        else
+        if (strcmp(key, "SET") == 0)
+            add_item(sets, &set_count, value);
+        else
+        if (strcmp(key, "QUEUE") == 0)
+            add_item(queues, &queue_count, value);
+        else
+        if (strcmp(key, "OPTIONS") == 0)
+            options = value;
+        else
+        if (strcmp(key, "REPEAT") == 0)
+            repeat = atol(value);
+        else
+        if (strcmp(key, "WARMUP") == 0)
+            warmup = atol(value);
+        else
+        if (strcmp(key, "MAXIT") == 0)
+            max_iterations = atol(value);
+        else
+        if (strcmp(key, "MAXVSS") == 0)
+            max_vss = strcmp(value, "unlimited") == 0 ? -1 : atol(value);
+        else
+        if (strcmp(key, "MAXRSS") == 0)
+            max_rss = strcmp(value, "unlimited") == 0 ? -1 : atol(value);
+        else
+        if (strcmp(key, "SPILLDIR") == 0)
+            spill_parent = value;
+        else
+        if (strcmp(key, "CGROUP") == 0)
+            cgroup_parent = value;
+        else
+        if (strcmp(key, "PAUSE") == 0)
+            pause_seconds = atol(value);
+        else
+        if (strcmp(key, "BASELINE") == 0)
+            baseline = atoi(value) != 0;
+        else
+        {
+            printf("%s:%d: unknown key: %s\n", path, lineno, key);
+            exit(1);
+        }
+    }
+    fclose(fp);
+
+    if (queue_count == 0)
+        add_item(queues, &queue_count, "file");
+    if (model_count == 0 || set_count + baseline == 0 || repeat <= 0 ||
+        warmup < 0 || max_iterations < 0)
+    {
+        printf("%s: no models or sets given, or invalid parameters\n", path);
+        exit(1);
+    }
+}
+
+/* Splits ``str'' at white space and appends the words to ``argv''.
+   Returns the copy of ``str'' that the words point into. */
+static char *split_args(const char *str, const char **argv, int *argc)
+{
+    char *copy, *word;
+
+    copy = strdup(str);
+    assert(copy != NULL);
+    for ( word = strtok(copy, " \t"); word != NULL;
+          word = strtok(NULL, " \t") )
+        argv[(*argc)++] = word;
+    return copy;
+}
+
+/* Writes ``text'' to the file at ``path''. Returns false on failure. */
+static bool write_file(const char *path, const char *text)
+{
+    int fd;
+    bool ok;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return false;
+    ok = write(fd, text, strlen(text)) == (ssize_t)strlen(text);
+    return close(fd) == 0 && ok;
+}
+
+/* Creates a cgroup (v2) that limits memory to ``limit'' KiB, in the given
+   parent directory or else in the cgroup of this process. Returns the
+   path of the new cgroup, or NULL if it could not be created. */
+static char *create_cgroup(const char *parent, long limit)
+{
+    static const char * const mounts[] = {
+        "/sys/fs/cgroup", "/sys/fs/cgroup/unified", NULL };
+    char line[1024], own[1024], dir[1100], file[1200], value[32];
+    FILE *fp;
+    int n;
+
+    if (parent == NULL)
+    {
+        /* Find the cgroup of this process in the unified hierarchy */
+        fp = fopen("/proc/self/cgroup", "rt");
+        if (fp == NULL)
+            return NULL;
+        while (fgets(line, sizeof(line), fp) != NULL &&
+               strncmp(line, "0::", 3) != 0) { }
+        fclose(fp);
+        if (strncmp(line, "0::", 3) != 0)
+            return NULL;
+        line[strcspn(line, "\n")] = '\0';
+        for (n = 0; mounts[n] != NULL; ++n)
+        {
+            snprintf(file, sizeof(file), "%s/cgroup.controllers", mounts[n]);
+            if (access(file, R_OK) == 0)
+                break;
+        }
+        if (mounts[n] == NULL)
+            return NULL;
+        snprintf(own, sizeof(own), "%s%.900s", mounts[n], line + 3);
+        parent = own;
+    }
+
+    snprintf(file, sizeof(file), "%.1023s/cgroup.subtree_control", parent);
+    write_file(file, "+memory");        /* (may already be enabled) */
+    snprintf(dir, sizeof(dir), "%.1023s/benchmark-%ld",
+             parent, (long)getpid());
+    if (mkdir(dir, 0755) != 0)
+        return NULL;
+    snprintf(file, sizeof(file), "%s/memory.max", dir);
+    snprintf(value, sizeof(value), "%ld", limit*1024);
+    if (!write_file(file, value))
+    {
+        rmdir(dir);
+        return NULL;
+    }
+    return strdup(dir);
+}
+
+/* Returns the memory available to new processes in KiB, or -1 if it is
+   unknown. */
+static long memory_available()
+{
+    char line[256];
+    long kb;
+    FILE *fp;
+
+    kb = -1;
+    fp = fopen("/proc/meminfo", "rt");
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+/* Starts a process that occupies ``size'' bytes of memory, and returns its
+   process id once the memory is occupied, or -1 if it could not be
+   started. */
+static pid_t start_balloon(size_t size)
+{
+    struct rlimit rl;
+    size_t pos;
+    char *balloon, ready;
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) != 0)
+        return -1;
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+#ifdef PR_SET_PDEATHSIG
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+        if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0)
+        {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_MEMLOCK, &rl);
+        }
+        balloon = mmap( NULL, size, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, (off_t)0 );
+        if (balloon == MAP_FAILED)
+            _exit(1);
+        if (mlock(balloon, size) != 0)
+        {
+            fprintf( stderr, "Could not lock balloon memory; "
+                             "it is only effective without swap space.\n" );
+            for (pos = 0; pos < size; pos += 4096)
+                balloon[pos] = 1;
+        }
+        if (write(fds[1], "", 1) != 1)
+            _exit(1);
+        for (;;)
+            pause();
+    }
+    close(fds[1]);
+    if (pid > 0 && read(fds[0], &ready, 1) != 1)
+    {
+        waitpid(pid, NULL, 0);
+        pid = -1;
+    }
+    close(fds[0]);
+    return pid;
+}
+
+/* Evicts the files in the given directory from the page cache (or removes
+   them, if ``remove'' is true). */
+static void drop_files(const char *dir, bool remove)
+{
+    char path[1024];
+    struct dirent *entry;
+    DIR *d;
+    int fd;
+
+    d = opendir(dir);
+    if (d == NULL)
+        return;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (remove)
+        {
+            unlink(path);
+            continue;
+        }
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    closedir(d);
+}
+
+/* Releases the resources of start_pressure() (called at exit) */
+static void stop_pressure()
+{
+    if (balloon_pid > 0)
+    {
+        kill(balloon_pid, SIGKILL);
+        waitpid(balloon_pid, NULL, 0);
+    }
+    if (cgroup_dir != NULL)
+        rmdir(cgroup_dir);
+    drop_files(spill_dir, true);
+    rmdir(spill_dir);
+}
+
+/* Sets up the spill directory and the limit on resident memory. Exits on
+   errors. */
+static void start_pressure()
+{
+    const char *parent;
+    long available;
+
+    parent = spill_parent;
+    if (parent == NULL)
+        parent = getenv("TMPDIR");
+    if (parent == NULL)
+        parent = "/tmp";
+    spill_dir = malloc(strlen(parent) + 32);
+    assert(spill_dir != NULL);
+    sprintf(spill_dir, "%s/bench-spill-XXXXXX", parent);
+    if (mkdtemp(spill_dir) == NULL)
+    {
+        perror("Could not create spill directory");
+        exit(1);
+    }
+    atexit(stop_pressure);
+
+    if (max_rss < 0)
+        return;
+    cgroup_dir = create_cgroup(cgroup_parent, max_rss);
+    if (cgroup_dir != NULL)
+    {
+        printf("Limiting resident memory with cgroup %s\n", cgroup_dir);
+        return;
+    }
+    if (cgroup_parent != NULL)
+    {
+        printf("Could not create a memory cgroup in %s!\n", cgroup_parent);
+        exit(1);
+    }
+    available = memory_available();
+    if (available < 0)
+    {
+        printf("Could not determine available memory!\n");
+        exit(1);
+    }
+    if (available <= max_rss)
+    {
+        printf("Less memory available than MAXRSS; not limiting it.\n");
+        return;
+    }
+    balloon_pid = start_balloon((size_t)(available - max_rss)*1024);
+    if (balloon_pid < 0)
+    {
+        printf("Could not start balloon process!\n");
+        exit(1);
+    }
+    printf( "Limiting resident memory with a balloon of %ld MiB\n",
+            (available - max_rss)/1024 );
+}
+
+/* Runs the search on the given combination, and stores the measurements in
+   ``values''. Returns false if the search failed or did not report. */
+static bool run(const char *model, const char *set, const char *queue,
+                double values[METRICS])
+{
+    const char *argv[256];
+    char model_path[1024], limit[32], line[1024], report[1024];
+    char procs[1024];
+    char *options_copy, *set_copy;
+    struct rusage ru;
+    struct rlimit rl;
+    int argc, fds[2], status;
+    long expanded, queued, transitions;
+    double wctime;
+    pid_t pid;
+    FILE *fp;
+
+    snprintf(model_path, sizeof(model_path), "%s/%s.b", opt_models, model);
+    snprintf(limit, sizeof(limit), "%ld", max_iterations);
+    argc = 0;
+    argv[argc++] = opt_search;
+    argv[argc++] = "-l";
+    argv[argc++] = limit;
+    if (strncmp(model, "synthetic:", 10) == 0)
+    {
+        argv[argc++] = "-G";
+        argv[argc++] = model + 10;
+    }
+    else
+    {
+        argv[argc++] = "-m";
+        argv[argc++] = model_path;
+    }
+    argv[argc++] = "-q";
+    argv[argc++] = queue;
+    argv[argc++] = "-S";
+    argv[argc++] = spill_dir;
+    options_copy = split_args(options, argv, &argc);
+    set_copy     = split_args(set, argv, &argc);
+    argv[argc] = NULL;
+
+    /* Start with the spill files of earlier runs evicted */
+    drop_files(spill_dir, false);
+
+    pid = -1;
+    if (pipe(fds) == 0)
+        pid = fork();
+    if (pid == 0)
+    {
+        /* Child: write report to pipe and run search */
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (max_vss >= 0)
+        {
+            rl.rlim_cur = rl.rlim_max = (rlim_t)max_vss*1024;
+            setrlimit(RLIMIT_AS, &rl);
+        }
+        if (cgroup_dir != NULL)
+        {
+            snprintf(procs, sizeof(procs), "%s/cgroup.procs", cgroup_dir);
+            snprintf(limit, sizeof(limit), "%ld", (long)getpid());
+            if (!write_file(procs, limit))
+            {
+                perror("Could not join memory cgroup");
+                _exit(127);
+            }
+        }
+        execv(opt_search, (char * const *)argv);
+        perror("Could not execute search");
+        _exit(127);
+    }
+
+    free(options_copy);
+    free(set_copy);
+    if (pid < 0)
+        return false;
+
+    /* Parent: keep the last (final) report line */
+    close(fds[1]);
+    fp = fdopen(fds[0], "rt");
+    assert(fp != NULL);
+    report[0] = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (isdigit(line[strspn(line, " ")]))
+            strcpy(report, line);
+    }
+    fclose(fp);
+    if (wait4(pid, &status, 0, &ru) != pid)
+        return false;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return false;
+    if ( sscanf( report, "%ld %ld %ld %lf",
+                 &expanded, &queued, &transitions, &wctime ) != 4 )
+        return false;
+
+    values[M_WCTIME]      = wctime;
+    values[M_UTIME]       = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6;
+    values[M_STIME]       = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+    values[M_MAXRSS]      = ru.ru_maxrss*1024.0;
+    values[M_FAULTS]      = ru.ru_minflt + ru.ru_majflt;
+    values[M_MAJFAULTS]   = ru.ru_majflt;
+    values[M_EXPANDED]    = expanded;
+    values[M_TRANSITIONS] = transitions;
+    values[M_RATE]        = wctime > 0 ? expanded/wctime : 0;
+    return true;
+}
+
+/* Runs the search on a combination once, recording the measurements if
+   ``measure'' is true, and prints progress. */
+static void run_combination(Combination *c, bool measure)
+{
+    double values[METRICS];
+    int m;
+
+    printf( "%-12s %-28s %-10s %s ... ", c->model, c->set, c->queue,
+            measure ? "run" : "warmup" );
+    fflush(stdout);
+    if (!run(c->model, c->set_args, c->queue, values))
+    {
+        printf("failed!\n");
+        c->failures += 1;
+    }
+    else
+    {
+        printf("%.3fs\n", values[M_WCTIME]);
+        if (measure)
+        {
+            for (m = 0; m < METRICS; ++m)
+                c->values[m][c->runs] = values[m];
+            c->runs += 1;
+        }
+    }
+    if (pause_seconds > 0)
+        sleep((unsigned)pause_seconds);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Computes the (0-based) ranks of the order statistics of ``n'' samples that
+   bound a distribution-free confidence interval of at least 95% for the
+   median: the largest k such that P(B < k) <= 2.5% for B ~ Bin(n, 1/2).
+   For fewer than 6 samples, no such interval exists, and the minimum and
+   maximum are used instead. */
+static void median_interval(size_t n, size_t *lo, size_t *hi)
+{
+    double term, cdf;
+    size_t k;
+
+    for (term = 1, k = 0; k < n; ++k)
+        term /= 2;
+    cdf = term;
+    for (k = 0; k < n/2 && cdf <= 0.025; ++k)
+    {
+        term = term*(n - k)/(k + 1);
+        cdf += term;
+    }
+    *lo = k > 0 ? k - 1 : 0;
+    *hi = n - 1 - *lo;
+}
+
+static void write_results(FILE *fp, Combination *combs, size_t count)
+{
+    size_t n, lo, hi, k;
+    double *v, median;
+    int m;
+
+    fprintf( fp, "model\tset\tqueue\tmetric\truns\tfailures\tmedian\t"
+                 "ci_low\tci_high\tmin\tmax\n" );
+    for (n = 0; n < count; ++n)
+    {
+        Combination *c = &combs[n];
+
+        for (m = 0; m < METRICS; ++m)
+        {
+            v = c->values[m];
+            k = c->runs;
+            fprintf( fp, "%s\t%s\t%s\t%s\t%zu\t%zu", c->model, c->set,
+                     c->queue, metric_names[m], c->runs, c->failures );
+            if (k == 0)
+            {
+                fprintf(fp, "\t\t\t\t\t\n");
+                continue;
+            }
+            qsort(v, k, sizeof(double), compare_doubles);
+            median = k%2 ? v[k/2] : (v[k/2 - 1] + v[k/2])/2;
+            median_interval(k, &lo, &hi);
+            fprintf( fp, "\t%.6g\t%.6g\t%.6g\t%.6g\t%.6g\n",
+                     median, v[lo], v[hi], v[0], v[k - 1] );
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Combination *combs;
+    size_t count, n;
+    char *mock_paths[MAX_ITEMS], *mock_set;
+    double values[METRICS];
+    int ch, i, j, k, m, fd;
+    long r;
+    FILE *fp;
+
+    while ((ch = getopt(argc, argv, "s:d:o:")) >= 0)
+    {
+        switch (ch)
+        {
+        case 's': opt_search = optarg; break;
+        case 'd': opt_models = optarg; break;
+        case 'o': opt_output = optarg; break;
+        default:  usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    parse_matrix(argv[optind]);
+    start_pressure();
+
+    /* Create combinations (with a baseline set per model first) */
+    count  = (size_t)model_count*(set_count + baseline)*queue_count;
+    combs  = calloc(count, sizeof(Combination));
+    assert(combs != NULL);
+    n = 0;
+    mock_set = NULL;
+    for (i = 0; i < model_count; ++i)
+    {
+        for (j = -(int)baseline; j < set_count; ++j)
+        {
+            if (j < 0)
+            {
+                /* Record the answers given by the set to the search once,
+                   to be replayed by a mock set in the baseline runs */
+                mock_paths[i] = strdup("/tmp/bench-mock-XXXXXX");
+                mock_set = malloc(strlen("mock record path=") + 32);
+                assert(mock_paths[i] != NULL && mock_set != NULL);
+                fd = mkstemp(mock_paths[i]);
+                if (fd < 0)
+                {
+                    perror("Could not create mock set file");
+                    return 1;
+                }
+                close(fd);
+                sprintf(mock_set, "mock record path=%s", mock_paths[i]);
+                printf("%-12s recording baseline ...\n", models[i]);
+                if (!run(models[i], mock_set, queues[0], values))
+                    printf("Recording baseline failed!\n");
+                sprintf(mock_set, "mock replay path=%s", mock_paths[i]);
+            }
+            for (k = 0; k < queue_count; ++k)
+            {
+                combs[n].model    = models[i];
+                combs[n].set      = j < 0 ? "baseline" : sets[j];
+                combs[n].set_args = j < 0 ? mock_set : sets[j];
+                combs[n].queue    = queues[k];
+                for (m = 0; m < METRICS; ++m)
+                {
+                    combs[n].values[m] = malloc(repeat*sizeof(double));
+                    assert(combs[n].values[m] != NULL);
+                }
+                ++n;
+            }
+        }
+    }
+    assert(n == count);
+
+    /* Warm up, then measure with runs of all combinations interleaved */
+    for (r = 0; r < warmup; ++r)
+    {
+        for (n = 0; n < count; ++n)
+            run_combination(&combs[n], false);
+    }
+    for (r = 0; r < repeat; ++r)
+    {
+        for (n = 0; n < count; ++n)
+            run_combination(&combs[n], true);
+    }
+
+    /* Write results */
+    fp = fopen(opt_output, "wt");
+    if (fp == NULL)
+    {
+        perror("Could not open results file");
+        return 1;
+    }
+    write_results(fp, combs, count);
+    if (fclose(fp) != 0)
+    {
+        perror("Could not write results file");
+        return 1;
+    }
+    printf("Results written to %s\n", opt_output);
+
+    for (i = 0; baseline && i < model_count; ++i)
+        unlink(mock_paths[i]);
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "counters.h"
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#define COLUMN_WIDTH 13
+
+static const char *phase_names[PHASE_COUNT] = { "vm", "set", "queue" };
+
+static const char *event_names[EVENT_COUNT] = {
+    "L1D", "LLC", "dTLB", "instr", "cycles", "minflt", "majflt" };
+
+#if defined(__linux__)
+/* Opens a counter for the calling thread, or returns -1 if that fails */
+static int open_event(CounterEvent event)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (event)
+    {
+    case EVENT_L1D_MISSES:
+    case EVENT_LLC_MISSES:
+    case EVENT_DTLB_MISSES:
+        attr.type   = PERF_TYPE_HW_CACHE;
+        attr.config = (event == EVENT_L1D_MISSES ? PERF_COUNT_HW_CACHE_L1D :
+                       event == EVENT_LLC_MISSES ? PERF_COUNT_HW_CACHE_LL :
+                                                   PERF_COUNT_HW_CACHE_DTLB) |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+
+    case EVENT_INSTRUCTIONS:
+        attr.type   = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+
+    case EVENT_CYCLES:
+        attr.type   = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+
+    case EVENT_MINOR_FAULTS:
+    case EVENT_MAJOR_FAULTS:
+        attr.type   = PERF_TYPE_SOFTWARE;
+        attr.config = event == EVENT_MINOR_FAULTS ?
+                      PERF_COUNT_SW_PAGE_FAULTS_MIN :
+                      PERF_COUNT_SW_PAGE_FAULTS_MAJ;
+        break;
+
+    default:
+        return -1;
+    }
+
+    /* Count user space only (which unprivileged users are allowed to do)
+       and scale for the time the counter was not running if there are more
+       counters than the hardware can count at once. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                          PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Returns the current (scaled) value of an open counter */
+static unsigned long long read_event(int fd)
+{
+    unsigned long long values[3];   /* value, time enabled, time running */
+
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+        return 0;
+    if (values[2] < values[1])
+        return (unsigned long long)((double)values[0]*values[1]/values[2]);
+    return values[0];
+}
+#else
+static int open_event(CounterEvent event)
+{
+    return -1;
+}
+
+static unsigned long long read_event(int fd)
+{
+    return 0;
+}
+#endif
+
+int counters_open(Counters *counters)
+{
+    int n, available;
+
+    memset(counters, 0, sizeof(*counters));
+    counters->phase = PHASE_VM;
+    available = 0;
+    for (n = 0; n < EVENT_COUNT; ++n)
+    {
+        counters->fd[n] = open_event((CounterEvent)n);
+        if (counters->fd[n] >= 0)
+        {
+            counters->last[n] = read_event(counters->fd[n]);
+            ++available;
+        }
+    }
+    return available;
+}
+
+void counters_close(Counters *counters)
+{
+    int n;
+
+    for (n = 0; n < EVENT_COUNT; ++n)
+    {
+        if (counters->fd[n] >= 0)
+            close(counters->fd[n]);
+        counters->fd[n] = -1;
+    }
+}
+
+void counters_switch(Counters *counters, CounterPhase phase)
+{
+    unsigned long long value;
+    int n;
+
+    for (n = 0; n < EVENT_COUNT; ++n)
+    {
+        if (counters->fd[n] >= 0)
+        {
+            value = read_event(counters->fd[n]);
+            if (value > counters->last[n])
+            {
+                counters->total[counters->phase][n] +=
+                    value - counters->last[n];
+            }
+            counters->last[n] = value;
+        }
+    }
+    counters->phase = phase;
+}
+
+void counters_report_header(FILE *fp, bool underline)
+{
+    char name[COLUMN_WIDTH + 1];
+    int p, n;
+
+    for (p = 0; p < PHASE_COUNT; ++p)
+    {
+        for (n = 0; n < EVENT_COUNT; ++n)
+        {
+            if (underline)
+            {
+                fprintf(fp, " %.*s", COLUMN_WIDTH,
+                        "-------------------------------------");
+            }
+            else
+            {
+                snprintf( name, sizeof(name), "%s.%s",
+                          phase_names[p], event_names[n] );
+                fprintf(fp, " %*s", COLUMN_WIDTH, name);
+            }
+        }
+    }
+}
+
+void counters_report(FILE *fp, Counters *counters)
+{
+    int p, n;
+
+    /* Attribute counts up to now, without changing phase */
+    counters_switch(counters, counters->phase);
+
+    for (p = 0; p < PHASE_COUNT; ++p)
+    {
+        for (n = 0; n < EVENT_COUNT; ++n)
+        {
+            if (counters->fd[n] >= 0)
+                fprintf(fp, " %*llu", COLUMN_WIDTH, counters->total[p][n]);
+            else
+                fprintf(fp, " %*s", COLUMN_WIDTH, "-");
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef COUNTERS_H_INCLUDED
+#define COUNTERS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Performance counters (measured with perf_event_open(2) on Linux) that
+   are attributed to the phase of the search that is executing when they
+   are incremented. Counters that cannot be opened (because the hardware
+   does not support them, or the system does not allow it) are absent and
+   reported as such. */
+
+/* Phases of the search to which counts are attributed */
+typedef enum CounterPhase
+{
+    PHASE_VM,           /* generating successor states in the VM */
+    PHASE_SET,          /* visited set operations */
+    PHASE_QUEUE,        /* queue operations (and the rest of the search) */
+    PHASE_COUNT
+} CounterPhase;
+
+/* Counted events */
+typedef enum CounterEvent
+{
+    EVENT_L1D_MISSES,
+    EVENT_LLC_MISSES,
+    EVENT_DTLB_MISSES,
+    EVENT_INSTRUCTIONS,
+    EVENT_CYCLES,
+    EVENT_MINOR_FAULTS,
+    EVENT_MAJOR_FAULTS,
+    EVENT_COUNT
+} CounterEvent;
+
+typedef struct Counters
+{
+    int                 fd[EVENT_COUNT];    /* -1 if absent */
+    CounterPhase        phase;
+    unsigned long long  last[EVENT_COUNT];  /* values at the last switch */
+    unsigned long long  total[PHASE_COUNT][EVENT_COUNT];
+} Counters;
+
+/* Opens all counters that are available and starts counting for the VM
+   phase. Returns the number of counters available. */
+int counters_open(Counters *counters);
+
+/* Closes the counters. */
+void counters_close(Counters *counters);
+
+/* Attributes the counts since the last switch to the current phase, and
+   continues counting for the given phase. */
+void counters_switch(Counters *counters, CounterPhase phase);
+
+/* Prints the column names (or, if ``underline'' is true, the line below
+   them) for the counters in the layout of the search report, without a line
+   terminator. */
+void counters_report_header(FILE *fp, bool underline);
+
+/* Prints the counts attributed to each phase (without a line terminator) in
+   the layout of the search report; absent counters are printed as "-". */
+void counters_report(FILE *fp, Counters *counters);
+
+#endif /* ndef COUNTERS_H_INCLUDED */
@@ -1,17 +1,53 @@
 #include <assert.h>
+#include <dlfcn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "search.h"
-#include "nips_vm/bytecode.h"
+#include <datastructures/config.h>
+#include <datastructures/EventTrace.h>
+#include <datastructures/parsing.h>
 
 static const char   *opt_bytecode_path      = NULL;
+static bool         opt_synthetic           = false;
 static long         opt_max_iterations      = 0;
 static long         opt_report_interval     = 0;
+static long         opt_batch_size          = 0;
 static bool         opt_dfs                 = false;
+static FS_Pages     opt_queue_pages         = FS_PAGES_DEFAULT;
+static bool         opt_report_pages        = false;
+static size_t       opt_memory_budget       = 0;
+static const char   *opt_spill_dir          = NULL;
+static bool         opt_pool                = false;
+static const char   *opt_queue              = NULL;
+static size_t       opt_pool_memory         = 0;
+static BP_Policy    opt_pool_policy         = BP_LRU;
+static bool         opt_pool_direct         = false;
+static const char   *opt_heuristic          = NULL;
+static bool         opt_astar               = false;
+static bool         opt_counters            = false;
+static bool         opt_timed               = false;
+static const char   *opt_events_path        = NULL;
+static bool         opt_usage               = false;
 static Set          *set                    = NULL;
 
+/* Parameters of the synthetic state space (if opt_synthetic is set): */
+static SyntheticParams  synthetic_params;
+
+/* Heuristic for best-first search and its argument: */
+static SearchHeuristic  heuristic           = NULL;
+static void             *heuristic_arg      = NULL;
+
+/* Built-in heuristic: bytes that should have given values in error states */
+typedef struct BytePattern
+{
+    size_t          count;
+    size_t          *offsets;
+    unsigned char   *values;
+} BytePattern;
+
 static void usage()
 {
     printf(
@@ -20,13 +56,147 @@ static void usage()
         "Options:\n"
         "    -B          -- use breadth-first search (default)\n"
         "    -D          -- use depth-first search\n"
+        "    -H spec     -- use best-first search guided by a heuristic:\n"
+        "                   a shared library defining search_heuristic(),\n"
+        "                   or the distance to a byte pattern in states\n"
+        "                   given as offset=value[,offset=value...]\n"
+        "    -a          -- add the depth of states to the heuristic (A*)\n"
         "    -m model    -- path to model bytecode file\n"
+        "    -G spec     -- search a synthetic state space instead of a model,\n"
+        "                   given as key=value,... with keys: states, size\n"
+        "                   (bytes, or a range min-max), branch, dup (fraction\n"
+        "                   of successors that are not new), prefix (bytes\n"
+        "                   shared by all states) and seed\n"
         "    -l cnt      -- iteration limit\n"
         "    -i cnt      -- reporting interval\n"
+        "    -C          -- report performance counters (cache and TLB misses,\n"
+        "                   instructions, cycles, page faults) per phase\n"
+        "    -T          -- report latency percentiles of set and queue\n"
+        "                   operations\n"
+        "    -E file     -- write structural maintenance events (resizes,\n"
+        "                   splits, compactions) to file as a Chrome trace\n"
+        "    -U          -- report memory reserved, mapped and resident,\n"
+        "                   file operations and refaults of the storage of\n"
+        "                   the set and queue\n"
+        "    -b cnt      -- insert successors into the visited set in batches\n"
+        "    -p pages    -- map the file queue with huge pages (thp, 2m or 1g)\n"
+        "    -M size     -- memory budget (e.g. 24G); spill to disk beyond it\n"
+        "    -S dir      -- directory for spill, buffer pool and queue files\n"
+        "                   (default: $TMPDIR)\n"
+        "    -P size[,lru|clock][,direct]\n"
+        "                -- keep the queue (and btree sets with the pool\n"
+        "                   option) in files cached by a buffer pool\n"
+        "    -q type     -- queue type: file (default), memory, compressed or\n"
+        "                   async (disk-backed with background I/O)\n"
         );
     exit(1);
 }
 
+/* Parses a size in bytes with an optional K, M, G or T suffix. Returns 0 if
+   the string is not a valid size. */
+static size_t parse_size_arg(const char *str)
+{
+    size_t size;
+
+    size = parse_size(&str);
+    return *str == '\0' ? size : 0;
+}
+
+/* Parses the buffer pool option: a size optionally followed by a
+   replacement policy and/or "direct", separated by commas. */
+static bool parse_pool(char *str)
+{
+    char *tok;
+
+    tok = strtok(str, ",");
+    if (tok == NULL || (opt_pool_memory = parse_size_arg(tok)) == 0)
+        return false;
+    while ((tok = strtok(NULL, ",")) != NULL)
+    {
+        if (strcmp(tok, "direct") == 0)
+            opt_pool_direct = true;
+        else
+        if (!BufferPool_parse_policy(tok, &opt_pool_policy))
+            return false;
+    }
+    return true;
+}
+
+/* Returns the number of bytes in the state that differ from the pattern */
+static unsigned long byte_pattern_distance( const void *state, size_t size,
+                                            void *arg )
+{
+    const BytePattern *pattern = arg;
+    const unsigned char *bytes = state;
+    unsigned long distance = 0;
+    size_t n;
+
+    for (n = 0; n < pattern->count; ++n)
+    {
+        if ( pattern->offsets[n] >= size ||
+             bytes[pattern->offsets[n]] != pattern->values[n] )
+            ++distance;
+    }
+    return distance;
+}
+
+/* Parses a byte pattern given as comma-separated offset=value pairs.
+   Returns NULL if the string is not a valid pattern. */
+static BytePattern *parse_byte_pattern(char *str)
+{
+    BytePattern *pattern;
+    unsigned long offset, value;
+    char *tok, *end;
+
+    pattern = malloc(sizeof(BytePattern));
+    if (pattern == NULL)
+        return NULL;
+    pattern->count   = 0;
+    pattern->offsets = malloc(strlen(str)*sizeof(size_t));
+    pattern->values  = malloc(strlen(str));
+    if (pattern->offsets == NULL || pattern->values == NULL)
+        return NULL;
+
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        offset = strtoul(tok, &end, 0);
+        if (end == tok || *end != '=')
+            return NULL;
+        tok = end + 1;
+        value = strtoul(tok, &end, 0);
+        if (end == tok || *end != '\0' || value > 255)
+            return NULL;
+        pattern->offsets[pattern->count] = offset;
+        pattern->values[pattern->count]  = (unsigned char)value;
+        ++pattern->count;
+    }
+    return pattern->count > 0 ? pattern : NULL;
+}
+
+/* Loads the heuristic: a byte pattern if the specification contains an
+   equals sign, or else the search_heuristic() function from a shared
+   library. Returns false if the heuristic could not be loaded. */
+static bool load_heuristic(char *spec)
+{
+    void *library;
+
+    if (strchr(spec, '=') != NULL)
+    {
+        heuristic     = byte_pattern_distance;
+        heuristic_arg = parse_byte_pattern(spec);
+        return heuristic_arg != NULL;
+    }
+
+    library = dlopen(spec, RTLD_NOW);
+    if (library == NULL)
+    {
+        printf("%s\n", dlerror());
+        return false;
+    }
+    *(void**)&heuristic = dlsym(library, "search_heuristic");
+    return heuristic != NULL;
+}
+
 static void parse_args(int argc, char *argv[])
 {
     int ch;
@@ -34,7 +204,7 @@ static void parse_args(int argc, char *argv[])
 
     if (argc < 2) usage();
 
-    while ((ch = getopt(argc, argv, "BDm:l:i:")) >= 0)
+    while ((ch = getopt(argc, argv, "BDH:am:G:l:i:CTE:Ub:p:M:S:P:q:")) >= 0)
     {
         switch (ch)
         {
@@ -46,8 +216,35 @@ static void parse_args(int argc, char *argv[])
             dfs = true;
             break;
 
+        case 'H':
+            if (opt_heuristic != NULL || !load_heuristic(optarg))
+            {
+                printf("Could not load heuristic!\n\n");
+                usage();
+            }
+            opt_heuristic = optarg;
+            break;
+
+        case 'a':
+            opt_astar = true;
+            break;
+
+        case 'G':
+            if (opt_bytecode_path != NULL || opt_synthetic)
+            {
+                printf("At most one model can be specified!\n\n");
+                usage();
+            }
+            if (!synthetic_parse(optarg, &synthetic_params))
+            {
+                printf("Invalid synthetic state space description!\n\n");
+                usage();
+            }
+            opt_synthetic = true;
+            break;
+
         case 'm':
-            if (opt_bytecode_path != NULL)
+            if (opt_bytecode_path != NULL || opt_synthetic)
             {
                 printf("At most one model can be specified!\n\n");
                 usage();
@@ -73,14 +270,82 @@ static void parse_args(int argc, char *argv[])
             }
             break;
 
+        case 'C':
+            opt_counters = true;
+            break;
+
+        case 'T':
+            opt_timed = true;
+            break;
+
+        case 'E':
+            opt_events_path = optarg;
+            break;
+
+        case 'U':
+            opt_usage = true;
+            break;
+
+        case 'b':
+            opt_batch_size = atol(optarg);
+            if (opt_batch_size <= 0)
+            {
+                printf("Batch size must be a positive integer!\n\n");
+                usage();
+            }
+            break;
+
+        case 'p':
+            if (!FS_parse_pages(optarg, &opt_queue_pages))
+            {
+                printf("Page kind must be one of thp, 2m or 1g!\n\n");
+                usage();
+            }
+            opt_report_pages = true;
+            break;
+
+        case 'M':
+            opt_memory_budget = parse_size_arg(optarg);
+            if (opt_memory_budget == 0)
+            {
+                printf("Memory budget must be a positive size!\n\n");
+                usage();
+            }
+            break;
+
+        case 'S':
+            opt_spill_dir = optarg;
+            break;
+
+        case 'P':
+            if (opt_pool || !parse_pool(optarg))
+            {
+                printf("Invalid buffer pool specification!\n\n");
+                usage();
+            }
+            opt_pool = true;
+            break;
+
+        case 'q':
+            if ( strcmp(optarg, "file") != 0 &&
+                 strcmp(optarg, "memory") != 0 &&
+                 strcmp(optarg, "compressed") != 0 &&
+                 strcmp(optarg, "async") != 0 )
+            {
+                printf("Invalid queue type!\n\n");
+                usage();
+            }
+            opt_queue = optarg;
+            break;
+
         case '?':
             usage();
         }
     }
 
-    if (bfs && dfs)
+    if ((bfs && dfs) || ((bfs || dfs) && opt_heuristic != NULL))
     {
-        printf("At most one of -B or -D may be given!\n\n");
+        printf("At most one of -B, -D or -H may be given!\n\n");
         usage();
     }
     else
@@ -89,11 +354,43 @@ static void parse_args(int argc, char *argv[])
         opt_dfs = dfs;
     }
 
-    if (opt_bytecode_path == NULL)
+    if (opt_pool && opt_queue != NULL)
+    {
+        printf("At most one of -P or -q may be given!\n\n");
+        usage();
+    }
+    if (opt_heuristic != NULL && (opt_pool || opt_queue != NULL))
+    {
+        printf("The queue type cannot be chosen with -H!\n\n");
+        usage();
+    }
+    if ( opt_queue_pages != FS_PAGES_DEFAULT &&
+         ( opt_pool || opt_heuristic != NULL ||
+           (opt_queue != NULL && strcmp(opt_queue, "file") != 0) ) )
+    {
+        printf("Option -p only applies to the file queue (-q file)!\n\n");
+        usage();
+    }
+    if (opt_astar && opt_heuristic == NULL)
+    {
+        printf("Option -a requires a heuristic (-H)!\n\n");
+        usage();
+    }
+    if (opt_queue == NULL)
+        opt_queue = "file";
+
+    if (opt_bytecode_path == NULL && !opt_synthetic)
     {
         printf("A model must be specified!\n\n");
         usage();
     }
+#if NO_NIPS_VM
+    if (opt_bytecode_path != NULL)
+    {
+        printf("Built without the NIPS VM; use a synthetic model (-G)!\n\n");
+        usage();
+    }
+#endif
 
     argc -= optind;
     argv += optind;
@@ -103,6 +400,23 @@ static void parse_args(int argc, char *argv[])
         usage();
     }
 
+    /* Set memory budget before any memory is allocated */
+    if (opt_memory_budget > 0)
+        FS_set_budget(opt_memory_budget, opt_spill_dir);
+    if (opt_pool)
+    {
+        BufferPool_configure_shared( opt_pool_memory, opt_pool_policy,
+                                     opt_spill_dir, opt_pool_direct );
+    }
+
+    for (ch = 0; ch < argc; ++ch)
+    {
+        if (strncmp(argv[ch], "hugepages=", 10) == 0)
+            opt_report_pages = true;
+    }
+
+    if (opt_usage)
+        FS_use(FS_usage("visited"));
     set = Set_create_from_args(argc, (const char**)argv);
     if (set == NULL)
     {
@@ -115,6 +429,7 @@ int main(int argc, char *argv[])
 {
     int status = 0;
     struct SearchParams params;
+    Deque *queue;
 
     parse_args(argc, argv);
 
@@ -123,10 +438,23 @@ int main(int argc, char *argv[])
     params.max_iterations  = opt_max_iterations;
     params.report_fp       = stdout;
     params.report_interval = opt_report_interval;
+    params.batch_size      = (size_t)opt_batch_size;
+    params.queue           = NULL;
+    params.pqueue          = NULL;
+    params.heuristic       = heuristic;
+    params.heuristic_arg   = heuristic_arg;
+    params.astar           = opt_astar;
+    params.counters        = opt_counters;
+    params.model           = NULL;
+    params.synthetic       = opt_synthetic ? &synthetic_params : NULL;
+    params.visited_usage   = opt_usage ? FS_usage("visited") : NULL;
+    params.queue_usage     = opt_usage ? FS_usage("queue") : NULL;
 
+#if !NO_NIPS_VM
     /* Load bytecode from file */
-    params.model = bytecode_load_from_file(opt_bytecode_path, NULL);
-    if (params.model == NULL)
+    if (!opt_synthetic)
+        params.model = bytecode_load_from_file(opt_bytecode_path, NULL);
+    if (!opt_synthetic && params.model == NULL)
     {
         fprintf( stderr, "Could not load bytecode from file \"%s\": ",
                          opt_bytecode_path );
@@ -134,22 +462,96 @@ int main(int argc, char *argv[])
         status = 1;
         goto cleanup;
     }
+#endif
 
-    /* Create deque data structure */
-    params.queue = File_Deque_create(NULL);
-    if (params.queue == NULL)
+    /* Create priority queue (for best-first search) or deque data structure */
+    FS_use(params.queue_usage);
+    if (opt_heuristic != NULL)
+    {
+        params.pqueue = Bucket_Heap_create(0, opt_spill_dir);
+        if (params.pqueue == NULL)
+        {
+            perror("Could not create priority queue");
+            status = 1;
+            goto cleanup;
+        }
+    }
+    else
+    if (opt_pool)
+        params.queue = BufferPool_shared() != NULL ?
+                       Pool_Deque_create(BufferPool_shared()) : NULL;
+    else
+    if (strcmp(opt_queue, "memory") == 0)
+        params.queue = Memory_Deque_create();
+    else
+    if (strcmp(opt_queue, "compressed") == 0)
+        params.queue = Compressed_Deque_create(NULL);
+    else
+    if (strcmp(opt_queue, "async") == 0)
+        params.queue = Async_Deque_create(opt_spill_dir);
+    else
+        params.queue = File_Deque_create_pages(NULL, opt_queue_pages);
+    if (params.pqueue == NULL && params.queue == NULL)
     {
         perror("Could not create deque");
         status = 1;
         goto cleanup;
     }
 
+    /* Time set and queue operations */
+    queue = params.queue;
+    if (opt_timed)
+    {
+        params.visited = Timed_Set_create(params.visited);
+        if (params.queue != NULL)
+            params.queue = Timed_Deque_create(params.queue);
+        if (params.visited == NULL || (queue != NULL && params.queue == NULL))
+        {
+            perror("Could not create timed data structures");
+            status = 1;
+            goto cleanup;
+        }
+    }
+
     /* Do search */
+    if (opt_events_path != NULL && !EventTrace_start(EVENT_TRACE_CAPACITY))
+    {
+        perror("Could not allocate event trace buffer");
+        status = 1;
+        goto cleanup;
+    }
     if (search(&params) < 0)
     {
         fprintf(stderr, "State space search failed!\n");
         status = 1;
     }
+    EventTrace_stop();
+
+    /* Write structural maintenance events */
+    if (opt_events_path != NULL && !EventTrace_export(opt_events_path))
+        perror("Could not write event trace");
+
+    /* Report buffer pool statistics */
+    if (opt_pool)
+        BufferPool_report(BufferPool_shared(), stdout);
+
+    /* Report queue I/O bandwidth */
+    if (queue != NULL && strcmp(opt_queue, "async") == 0)
+        Async_Deque_report(queue, stdout);
+
+    /* Report how much memory was spilled to disk */
+    if (opt_memory_budget > 0)
+    {
+        printf( "Memory in use: %.1f MiB, spilled to disk: %.1f MiB\n",
+                FS_memory_used()/1048576.0, FS_memory_spilled()/1048576.0 );
+    }
+
+    /* Report how much memory actually ended up on huge pages */
+    if (opt_report_pages)
+    {
+        printf( "Memory mapped on huge pages: %.1f MiB\n",
+                FS_huge_page_usage()/1048576.0 );
+    }
 
     /* Clean-up */
 cleanup:
@@ -157,8 +559,12 @@ cleanup:
         params.visited->destroy(params.visited);
     if (params.queue != NULL)
         params.queue->destroy(params.queue);
+    if (params.pqueue != NULL)
+        params.pqueue->destroy(params.pqueue);
+#if !NO_NIPS_VM
     if (params.model != NULL)
         bytecode_unload(params.model);
+#endif
 
     return status;
 }
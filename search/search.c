@@ -1,6 +1,10 @@
 #include "search.h"
+#include "counters.h"
+#include "synthetic.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
 #if defined(__APPLE__)
@@ -10,13 +14,18 @@
 #elif defined(__linux__)
 #include <asm/param.h>                  /* HZ */
 #endif
+#if !NO_NIPS_VM
 #include <nips_vm/nipsvm.h>
+#endif
 
 const int PAGESIZE = 4096;
 
 typedef struct SearchContext
 {
+#if !NO_NIPS_VM
     nipsvm_t        *vm;
+#endif
+    SyntheticModel  *synthetic;     /* used instead of the VM if not NULL */
     Deque           *queue;
     Set             *visited;
     long            expanded;
@@ -26,13 +35,36 @@ typedef struct SearchContext
     long            report_interval;
     FILE            *report_fp;
 
+    /* For best-first search (pqueue is NULL otherwise): */
+    PriorityQueue   *pqueue;
+    SearchHeuristic heuristic;
+    void            *heuristic_arg;
+    bool            astar;
+    unsigned long   depth;          /* depth of the state being expanded */
+    char            *element;       /* buffer for queue elements */
+    size_t          element_size;
+
+    /* Successor states waiting to be inserted into the visited set: */
+    size_t          batch_size;
+    size_t          batch_count;
+    size_t          batch_capacity;
+    void            **batch_data;
+    size_t          *batch_sizes;
+    unsigned long   *batch_depths;
+    bool            *batch_result;
+
     /* To capture VM errors: */
     int             err_code;
+#if !NO_NIPS_VM
     nipsvm_pid_t    err_pid;
     nipsvm_pc_t     err_pc;
+#endif
 
     /* For reporting stats: */
     double          time_start;
+    Counters        *counters;      /* NULL if not measured */
+    FS_Usage        *visited_usage; /* NULL if not reported */
+    FS_Usage        *queue_usage;
 
 } SearchContext;
 
@@ -108,12 +140,17 @@ static double now()
     return tv_to_sec(&tv);
 }
 
-void report_header(FILE *fp)
+void report_header(FILE *fp, SearchContext *sc)
 {
     fprintf( fp,
-        "#expanded   queued   transit. wc.time  u.time  s.time  res.size    virt.size\n");
+        "#expanded   queued   transit. wc.time  u.time  s.time  res.size    virt.size");
+    if (sc->counters != NULL)
+        counters_report_header(fp, false);
     fprintf( fp,
-        "#-------- --------- --------- ------- -------  ------ ----------- -----------\n");
+        "\n#-------- --------- --------- ------- -------  ------ ----------- -----------");
+    if (sc->counters != NULL)
+        counters_report_header(fp, true);
+    fputc('\n', fp);
 }
 
 void report(FILE *fp, SearchContext *sc)
@@ -164,25 +201,74 @@ void report(FILE *fp, SearchContext *sc)
 #else
 #error "Reporting not implemented.  Try getrusage()."
 #endif
-    fprintf( fp, "%9ld %9ld %9ld %7.3f %7.3f %7.3f %11ld %11lu\n",
+    fprintf( fp, "%9ld %9ld %9ld %7.3f %7.3f %7.3f %11ld %11lu",
              sc->expanded,
-             (long)sc->queue->size(sc->queue),
+             (long)(sc->pqueue != NULL ? sc->pqueue->size(sc->pqueue)
+                                       : sc->queue->size(sc->queue)),
              sc->transitions,
              now() - sc->time_start,
              utime,
              stime,
              rss,
              vsize );
+    if (sc->counters != NULL)
+        counters_report(fp, sc->counters);
+    fputc('\n', fp);
+}
+
+/* Prints latency percentiles of the visited set and queue, if they were
+   wrapped with Timed_Set_create() and Timed_Deque_create() */
+static void report_latencies(FILE *fp, SearchContext *sc, bool total)
+{
+    Timed_Set_report(sc->visited, fp, total);
+    if (sc->queue != NULL)
+        Timed_Deque_report(sc->queue, fp, total);
+}
+
+/* Samples and prints the memory and I/O usage of the storage of the
+   visited set and queue, if requested */
+static void report_usage(FILE *fp, SearchContext *sc)
+{
+    if (sc->visited_usage != NULL)
+    {
+        FS_sample_usage();
+        FS_report_usage(fp);
+    }
+}
+
+/* Attributes performance counts (and storage created) from now on to the
+   given phase */
+static void enter_phase(SearchContext *sc, CounterPhase phase)
+{
+    if (sc->counters != NULL)
+        counters_switch(sc->counters, phase);
+    if (sc->visited_usage != NULL)
+        FS_use(phase == PHASE_SET ? sc->visited_usage : sc->queue_usage);
 }
 
 /* Makes a copy of the given state with specified size in dynamic memory
    which must be freed by the caller using free(). */
-nipsvm_state_t *duplicate_state(nipsvm_state_t *state, size_t state_size)
+static void *duplicate_state( SearchContext *sc, const void *state,
+                              size_t state_size )
 {
-    nipsvm_state_t *copy;
+    void *copy;
+#if !NO_NIPS_VM
     unsigned long buf_size;
     char *buf_data;
+#endif
 
+    /* Synthetic states are just bytes */
+    if (sc->synthetic != NULL)
+    {
+        copy = malloc(state_size);
+        if (copy != NULL)
+            memcpy(copy, state, state_size);
+        return copy;
+    }
+
+#if NO_NIPS_VM
+    return NULL;
+#else
     /* Allocate memory for copy */
     buf_size = (unsigned long)state_size;
     buf_data = malloc(state_size);
@@ -190,7 +276,8 @@ nipsvm_state_t *duplicate_state(nipsvm_state_t *state, size_t state_size)
         return NULL;
 
     /* Copy state */
-    copy = nipsvm_state_copy(state_size, state, &buf_data, &buf_size);
+    copy = nipsvm_state_copy( state_size, (nipsvm_state_t*)state,
+                              &buf_data, &buf_size );
     if (copy == NULL)
     {
         free(buf_data);
@@ -198,24 +285,153 @@ nipsvm_state_t *duplicate_state(nipsvm_state_t *state, size_t state_size)
     }
 
     return copy;
+#endif
 }
 
-static nipsvm_status_t scheduler_callback(
-    size_t succ_size, nipsvm_state_t *succ,
-    nipsvm_transition_information_t *ti, void *context )
+/* Adds a copy of a successor state to the batch of states waiting to be
+   inserted into the visited set. Returns false if memory runs out. */
+static bool add_to_batch(SearchContext *sc, const void *succ,
+                         size_t succ_size)
+{
+    size_t new_capacity;
+    void *copy;
+
+    if (sc->batch_count == sc->batch_capacity)
+    {
+        new_capacity = 2*sc->batch_capacity;
+        if (new_capacity < sc->batch_size)
+            new_capacity = sc->batch_size;
+
+        sc->batch_data = realloc( sc->batch_data,
+                                  new_capacity*sizeof(void*) );
+        sc->batch_sizes = realloc( sc->batch_sizes,
+                                   new_capacity*sizeof(size_t) );
+        sc->batch_depths = realloc( sc->batch_depths,
+                                    new_capacity*sizeof(unsigned long) );
+        sc->batch_result = realloc( sc->batch_result,
+                                    new_capacity*sizeof(bool) );
+        if ( sc->batch_data == NULL || sc->batch_sizes == NULL ||
+             sc->batch_depths == NULL || sc->batch_result == NULL )
+            return false;
+        sc->batch_capacity = new_capacity;
+    }
+
+    copy = malloc(succ_size);
+    if (copy == NULL)
+        return false;
+    memcpy(copy, succ, succ_size);
+
+    sc->batch_data[sc->batch_count]  = copy;
+    sc->batch_sizes[sc->batch_count] = succ_size;
+    sc->batch_depths[sc->batch_count] = sc->depth + 1;
+    sc->batch_count += 1;
+
+    return true;
+}
+
+/* Adds an unvisited state at the given depth to the queue. In best-first
+   search, the state is prefixed with its depth and added to the priority
+   queue with the priority given by the heuristic (plus the depth, for A*).
+   Returns false if the state could not be added. */
+static bool enqueue( SearchContext *sc, const void *state, size_t size,
+                     unsigned long depth )
+{
+    unsigned long priority;
+    char *element;
+
+    if (sc->pqueue == NULL)
+        return sc->queue->push_back(sc->queue, state, size);
+
+    if (sc->element_size < sizeof(depth) + size)
+    {
+        element = realloc(sc->element, sizeof(depth) + size);
+        if (element == NULL)
+            return false;
+        sc->element      = element;
+        sc->element_size = sizeof(depth) + size;
+    }
+    memcpy(sc->element, &depth, sizeof(depth));
+    memcpy(sc->element + sizeof(depth), state, size);
+
+    priority = sc->heuristic(state, size, sc->heuristic_arg);
+    if (sc->astar)
+        priority += depth;
+
+    return sc->pqueue->push( sc->pqueue, priority,
+                             sc->element, sizeof(depth) + size );
+}
+
+/* Inserts the batch of successor states into the visited set and adds the
+   unvisited ones to the queue, in the order in which they were generated.
+   Returns false if a state could not be added to the queue. */
+static bool flush_batch(SearchContext *sc)
+{
+    bool ok = true;
+    size_t n;
+
+    if (sc->batch_count == 0)
+        return true;
+
+    enter_phase(sc, PHASE_SET);
+    Set_insert_batch( sc->visited, sc->batch_count,
+                      (const void * const *)sc->batch_data, sc->batch_sizes,
+                      sc->batch_result );
+    enter_phase(sc, PHASE_QUEUE);
+
+    for (n = 0; n < sc->batch_count; ++n)
+    {
+        if (ok && sc->batch_result[n] == false)
+        {
+            /* Unvisited successor state! Add it to the queue. */
+            ok = enqueue( sc, sc->batch_data[n], sc->batch_sizes[n],
+                          sc->batch_depths[n] );
+        }
+        free(sc->batch_data[n]);
+    }
+    sc->batch_count = 0;
+
+    return ok;
+}
+
+/* Handles a successor state generated by the model */
+static void add_successor(SearchContext *sc, const void *succ, size_t succ_size)
 {
-    SearchContext *sc = context;
     bool b;
 
     sc->transitions += 1;
 
-    if (sc->visited->insert(sc->visited, succ, succ_size) == false)
+    if (sc->batch_size > 0)
     {
-        /* Unvisited successor state! Add it to the queue. */
-        b = sc->queue->push_back(sc->queue, succ, succ_size);
+        b = add_to_batch(sc, succ, succ_size);
         assert(b);
     }
+    else
+    {
+        enter_phase(sc, PHASE_SET);
+        if (sc->visited->insert(sc->visited, succ, succ_size) == false)
+        {
+            /* Unvisited successor state! Add it to the queue. */
+            enter_phase(sc, PHASE_QUEUE);
+            b = enqueue(sc, succ, succ_size, sc->depth + 1);
+            assert(b);
+        }
+        enter_phase(sc, PHASE_VM);
+    }
+}
 
+static SyntheticStatus synthetic_callback( size_t succ_size, void *succ,
+                                           void *context )
+{
+    add_successor(context, succ, succ_size);
+    return SYNTHETIC_CONTINUE;
+}
+
+#if !NO_NIPS_VM
+static nipsvm_status_t scheduler_callback(
+    size_t succ_size, nipsvm_state_t *succ,
+    nipsvm_transition_information_t *ti, void *context )
+{
+    add_successor(context, succ, succ_size);
     return IC_CONTINUE;
 }
 
@@ -231,12 +447,20 @@ static nipsvm_status_t error_callback( nipsvm_errorcode_t err,
 
     return IC_STOP;
 }
+#endif
 
-static bool expand_state(SearchContext *sc, nipsvm_state_t *state)
+static bool expand_state(SearchContext *sc, void *state)
 {
     sc->expanded += 1;
 
-    nipsvm_scheduler_iter(sc->vm, state, sc);
+    enter_phase(sc, PHASE_VM);
+    if (sc->synthetic != NULL)
+        synthetic_scheduler_iter(sc->synthetic, state, sc);
+#if !NO_NIPS_VM
+    else
+        nipsvm_scheduler_iter(sc->vm, state, sc);
+#endif
+    enter_phase(sc, PHASE_QUEUE);
     if (sc->err_code != -1)
         return false;
 
@@ -251,6 +475,8 @@ static bool expand_state(SearchContext *sc, nipsvm_state_t *state)
         if (--sc->report_iterations_left == 0)
         {
             report(sc->report_fp, sc);
+            report_latencies(sc->report_fp, sc, false);
+            report_usage(sc->report_fp, sc);
             sc->report_iterations_left = sc->report_interval;
         }
     }
@@ -264,18 +490,30 @@ static bool expand_state(SearchContext *sc, nipsvm_state_t *state)
 static int depth_first_search(SearchContext *sc)
 {
     Deque *queue = sc->queue;
-    nipsvm_state_t *state;
+    void *state;
     size_t state_size;
 
-    while (!queue->empty(queue) && sc->iterations_left != 0)
+    for (;;)
     {
+        /* Insert pending successors when the batch is full, or when they
+           are needed to continue the search. */
+        if ( sc->batch_count >= sc->batch_size ||
+             (sc->batch_count > 0 && queue->empty(queue)) )
+        {
+            if (!flush_batch(sc))
+                return -1;
+        }
+
+        if (queue->empty(queue) || sc->iterations_left == 0)
+            break;
+
         /* Remove state from the queue */
         if (!queue->get_back(queue, (void**)&state, &state_size))
         {
             return -1;
         }
 
-        state = duplicate_state(state, state_size);
+        state = duplicate_state(sc, state, state_size);
         if (state == NULL)
         {
             return -1;
@@ -305,14 +543,31 @@ static int depth_first_search(SearchContext *sc)
 static int breadth_first_search(SearchContext *sc)
 {
     Deque *queue = sc->queue;
-    nipsvm_state_t *state;
+    void *state;
     size_t state_size;
     int status;
 
     status = 0;
     state_size = 1;
-    while (!queue->empty(queue) && sc->iterations_left != 0)
+    for (;;)
     {
+        /* Insert pending successors when the batch is full, or when they
+           are needed to continue the search. (This is done only after the
+           current state has been popped, so the pointer to it is never
+           invalidated by adding states to the queue.) */
+        if ( sc->batch_count >= sc->batch_size ||
+             (sc->batch_count > 0 && queue->empty(queue)) )
+        {
+            if (!flush_batch(sc))
+            {
+                status = -1;
+                break;
+            }
+        }
+
+        if (queue->empty(queue) || sc->iterations_left == 0)
+            break;
+
         /* HACK: reserve some space in advance, otherwise the pointer to the
                  current state may be invalidated when new states are added to
                  the queue when expand_state() is called. */
@@ -340,36 +595,120 @@ static int breadth_first_search(SearchContext *sc)
     return status;
 }
 
+/* Searches the search space best-first, expanding the state with the lowest
+   priority in the priority queue first, and returns 0, or -1 on error. The
+   priority queue should initially be non-empty (or no states are expanded). */
+static int best_first_search(SearchContext *sc)
+{
+    PriorityQueue *pqueue = sc->pqueue;
+    void *state;
+    unsigned long priority;
+    void *element;
+    size_t element_size;
+
+    for (;;)
+    {
+        /* Insert pending successors when the batch is full, or when they
+           are needed to continue the search. */
+        if ( sc->batch_count >= sc->batch_size ||
+             (sc->batch_count > 0 && pqueue->empty(pqueue)) )
+        {
+            if (!flush_batch(sc))
+                return -1;
+        }
+
+        if (pqueue->empty(pqueue) || sc->iterations_left == 0)
+            break;
+
+        /* Remove most promising state from the queue */
+        if (!pqueue->get_min(pqueue, &priority, &element, &element_size))
+        {
+            return -1;
+        }
+
+        memcpy(&sc->depth, element, sizeof(sc->depth));
+        state = duplicate_state( sc, (char*)element + sizeof(sc->depth),
+                                 element_size - sizeof(sc->depth) );
+        if (state == NULL)
+        {
+            return -1;
+        }
+        if (!pqueue->pop_min(pqueue))
+        {
+            free(state);
+            return -1;
+        }
+
+        /* Expand state */
+        if (!expand_state(sc, state))
+        {
+            free(state);
+            return -1;
+        }
+
+        free(state);
+    }
+
+    return 0;
+}
+
 int search(const struct SearchParams *params)
 {
     SearchContext sc;
+    Counters counters;
+#if !NO_NIPS_VM
     nipsvm_t vm;
-    nipsvm_state_t *state = NULL;
+#endif
+    SyntheticModel synthetic;
+    const void *initial;
+    void *state = NULL;
     size_t state_size;
     int status;
 
     /* Initialize output variables */
     status       = 0;
+    sc.counters  = NULL;    /* (checked on clean-up) */
+    sc.synthetic = NULL;
 
-    /* Initialize VM */
-    nipsvm_module_init();
-    if (nipsvm_init( &vm, params->model,
-                     scheduler_callback, error_callback ) != 0)
+    if (params->synthetic != NULL)
     {
-        perror("Could not initialize NIPS VM");
-        return -1;
+        /* Initialize synthetic model */
+        if (!synthetic_init(&synthetic, params->synthetic, synthetic_callback))
+        {
+            fprintf(stderr, "Could not initialize synthetic model!\n");
+            return -1;
+        }
+        sc.synthetic = &synthetic;
+        initial = synthetic_initial_state(&synthetic, &state_size);
     }
-
-    /* Obtain initial state */
-    state = nipsvm_initial_state(&vm);
-    if (state == NULL)
+    else
     {
-        perror("Could not obtain initial state");
-        status = -1;
-        goto cleanup;
+#if NO_NIPS_VM
+        fprintf(stderr, "Search was built without the NIPS VM!\n");
+        return -1;
+#else
+        /* Initialize VM */
+        nipsvm_module_init();
+        if (nipsvm_init( &vm, params->model,
+                         scheduler_callback, error_callback ) != 0)
+        {
+            perror("Could not initialize NIPS VM");
+            return -1;
+        }
+        sc.vm = &vm;
+
+        /* Obtain initial state */
+        initial = nipsvm_initial_state(&vm);
+        if (initial == NULL)
+        {
+            perror("Could not obtain initial state");
+            status = -1;
+            goto cleanup;
+        }
+        state_size = nipsvm_state_size((nipsvm_state_t*)initial);
+#endif
     }
-    state_size = nipsvm_state_size(state);
-    state = duplicate_state(state, state_size);
+    state = duplicate_state(&sc, initial, state_size);
     if (state == NULL)
     {
         perror("Could not duplicate initial state");
@@ -377,13 +716,7 @@ int search(const struct SearchParams *params)
         goto cleanup;
     }
 
-    if (params->report_fp != NULL)
-    {
-        report_header(params->report_fp);
-    }
-
     /* Initialize search context */
-    sc.vm                       = &vm;
     sc.queue                    = params->queue;
     sc.visited                  = params->visited;
     sc.expanded                 = 0;
@@ -393,25 +726,70 @@ int search(const struct SearchParams *params)
     sc.report_iterations_left   = params->report_interval;
     sc.report_interval          = params->report_interval;
     sc.report_fp                = params->report_fp;
+    sc.pqueue                   = params->pqueue;
+    sc.heuristic                = params->heuristic;
+    sc.heuristic_arg            = params->heuristic_arg;
+    sc.astar                    = params->astar;
+    sc.depth                    = 0;
+    sc.element                  = NULL;
+    sc.element_size             = 0;
+    sc.batch_size               = params->batch_size;
+    sc.batch_count              = 0;
+    sc.batch_capacity           = 0;
+    sc.batch_data               = NULL;
+    sc.batch_sizes              = NULL;
+    sc.batch_depths             = NULL;
+    sc.batch_result             = NULL;
     sc.err_code                 = -1;
     sc.time_start               = now();
+    sc.visited_usage            = params->visited_usage;
+    sc.queue_usage              = params->queue_usage;
+
+    /* Open performance counters */
+    if (params->counters)
+    {
+        if (counters_open(&counters) < EVENT_COUNT)
+            fprintf(stderr, "Some performance counters are unavailable.\n");
+        counters_switch(&counters, PHASE_QUEUE);
+        sc.counters = &counters;
+    }
+    enter_phase(&sc, PHASE_QUEUE);
+
+    if (params->report_fp != NULL)
+    {
+        report_header(params->report_fp, &sc);
+    }
 
     /* Add initial state to the queue */
     sc.visited->insert(sc.visited, state, state_size);
-    if (!sc.queue->push_back(sc.queue, state, state_size))
+    if (!enqueue(&sc, state, state_size, 0))
     {
         perror("Could not add initial state to queue");
         status = -1;
         goto cleanup;
     }
 
-    /* Do bfs/dfs search */
+    /* Do best-first/bfs/dfs search */
+    if (sc.pqueue != NULL)
+        status = best_first_search(&sc);
+    else
     if (params->dfs)
         status = depth_first_search(&sc);
     else
         status = breadth_first_search(&sc);
 
+    /* Discard successors left over when the iteration limit was reached
+       (or an error occurred) */
+    while (sc.batch_count > 0)
+        free(sc.batch_data[--sc.batch_count]);
+    free(sc.batch_data);
+    free(sc.batch_sizes);
+    free(sc.batch_depths);
+    free(sc.batch_result);
+    free(sc.element);
+
     /* Print VM error */
+#if !NO_NIPS_VM
     if (sc.err_code != -1)
     {
         char err_msg[256];
@@ -421,13 +799,25 @@ int search(const struct SearchParams *params)
         return -1;
     }
     else
+#endif
     {
         if (params->report_fp != NULL)
+        {
             report(params->report_fp, &sc);
+            report_latencies(params->report_fp, &sc, true);
+            report_usage(params->report_fp, &sc);
+        }
     }
 
 cleanup:
-    nipsvm_finalize(&vm);
+    if (sc.counters != NULL)
+        counters_close(sc.counters);
+    if (sc.synthetic != NULL)
+        synthetic_finalize(sc.synthetic);
+#if !NO_NIPS_VM
+    else
+        nipsvm_finalize(&vm);
+#endif
 
     return status;
 }
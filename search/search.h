@@ -5,29 +5,73 @@
 #include <stdio.h>
 #include <datastructures/Set.h>
 #include <datastructures/Deque.h>
+#include <datastructures/PriorityQueue.h>
+#include "synthetic.h"
+#if NO_NIPS_VM
+typedef struct st_bytecode st_bytecode;
+#else
 #include <nips_vm/bytecode.h>
+#endif
+
+/* A heuristic function estimates the distance from a state (of ``size''
+   bytes) to an error state; lower values are considered more promising.
+   ``arg'' is the heuristic argument given in the search parameters. The
+   priority queue rejects values (plus the depth, for A*) above its highest
+   priority, which ends the search with an error. */
+typedef unsigned long (*SearchHeuristic)( const void *state, size_t size,
+                                          void *arg );
 
 /* A structure describing parameters used for searching.
 
     bytecode            NIPS VM bytecode of the model to use.
+    synthetic           Parameters of a synthetic state space to search
+                        instead of the model (NULL: search the model).
     queue               Deque instance to use for the BFS queue/DFS stack.
     visited             Set instance to use to record visited states.
     dfs                 Use depth-first search instead of breadth-first search.
     max_iterations      Maximum number of iterations to perform (0: no limit).
     report_fp           File to write status reports to.
     report_interval     Number of iterations between reporting.
+    batch_size          Number of successor states to collect before
+                        inserting them into the visited set at once, using
+                        Set_insert_batch() (0: insert states one by one).
+    pqueue              PriorityQueue instance to use for best-first search
+                        instead of the queue (NULL: do a BFS/DFS).
+    heuristic           Heuristic function that gives the priority of states
+                        in best-first search.
+    heuristic_arg       Argument passed to the heuristic function.
+    astar               Add the depth of states to their priority, as in A*.
+    counters            Measure performance counters (cache and TLB misses,
+                        instructions, cycles and page faults) separately for
+                        successor generation, visited set operations and
+                        queue operations, and include them in reports.
+    visited_usage       Usage records of the storage of the visited set and
+    queue_usage         of the queue (see FS_use()), which are sampled and
+                        included in reports (NULL: do not report usage).
+                        Storage created while the visited set is accessed is
+                        attributed to the first, and all other storage to
+                        the second.
 
     In the above, an iteration is a single state expansion.
 */
 struct SearchParams
 {
-    st_bytecode *model;
-    Deque       *queue;
-    Set         *visited;
-    bool        dfs;
-    long        max_iterations;
-    FILE        *report_fp;
-    long        report_interval;
+    st_bytecode     *model;
+    SyntheticParams *synthetic;
+    Deque           *queue;
+    Set             *visited;
+    bool            dfs;
+    long            max_iterations;
+    FILE            *report_fp;
+    long            report_interval;
+    size_t          batch_size;
+    PriorityQueue   *pqueue;
+    SearchHeuristic heuristic;
+    void            *heuristic_arg;
+    bool            astar;
+    bool            counters;
+    FS_Usage        *visited_usage;
+    FS_Usage        *queue_usage;
 };
 
 /* Does a state space search and returns 0, or -1 if an error occurs while
@@ -0,0 +1,158 @@
+#include "synthetic.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Returns a pseudo-random 64-bit value determined by ``x'' (SplitMix64) */
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27))*0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+/* Returns the size of state ``i'' */
+static size_t state_size(const SyntheticModel *model, uint64_t i)
+{
+    const SyntheticParams *p = &model->params;
+
+    return p->min_size +
+           (size_t)(mix(i ^ mix(p->seed))%(p->max_size - p->min_size + 1));
+}
+
+/* Builds state ``i'' in the model's buffer and returns its size */
+static size_t build_state(SyntheticModel *model, uint64_t i)
+{
+    const SyntheticParams *p = &model->params;
+    unsigned char *s = model->state;
+    size_t size, pos;
+    uint64_t r;
+
+    /* The prefix is left in the buffer by synthetic_init() */
+    size = state_size(model, i);
+    memcpy(s + p->prefix, &i, sizeof(i));
+    r = mix(i + p->seed);
+    for (pos = p->prefix + sizeof(i); pos < size; ++pos)
+    {
+        if ((pos - p->prefix)%8 == 0)
+            r = mix(r);
+        s[pos] = (unsigned char)(r >> 8*((pos - p->prefix)%8));
+    }
+    return size;
+}
+
+bool synthetic_parse(const char *spec, SyntheticParams *params)
+{
+    const char *p;
+    char *end;
+    size_t len;
+
+    params->states     = 1000000;
+    params->min_size   = 64;
+    params->max_size   = 64;
+    params->branching  = 4;
+    params->duplicates = 0.5;
+    params->prefix     = 0;
+    params->seed       = 1;
+
+    for (p = spec; *p != '\0'; p = *end == ',' ? end + 1 : end)
+    {
+        len = strcspn(p, "=");
+        if (p[len] != '=')
+            return false;
+        if (len == 6 && strncmp(p, "states", len) == 0)
+            params->states = strtoul(p + len + 1, &end, 10);
+        else
+        if (len == 4 && strncmp(p, "size", len) == 0)
+        {
+            params->min_size = params->max_size =
+                strtoul(p + len + 1, &end, 10);
+            if (*end == '-')
+                params->max_size = strtoul(end + 1, &end, 10);
+        }
+        else
+        if (len == 6 && strncmp(p, "branch", len) == 0)
+            params->branching = (unsigned)strtoul(p + len + 1, &end, 10);
+        else
+        if (len == 3 && strncmp(p, "dup", len) == 0)
+            params->duplicates = strtod(p + len + 1, &end);
+        else
+        if (len == 6 && strncmp(p, "prefix", len) == 0)
+            params->prefix = strtoul(p + len + 1, &end, 10);
+        else
+        if (len == 4 && strncmp(p, "seed", len) == 0)
+            params->seed = strtoul(p + len + 1, &end, 10);
+        else
+            return false;
+        if (end == p + len + 1 || (*end != ',' && *end != '\0'))
+            return false;
+    }
+
+    return true;
+}
+
+bool synthetic_init( SyntheticModel *model, const SyntheticParams *params,
+                     SyntheticCallback callback )
+{
+    size_t n;
+
+    if ( params->states == 0 || params->branching == 0 ||
+         params->duplicates < 0 || params->duplicates > 1 ||
+         params->min_size > params->max_size ||
+         params->min_size < params->prefix + sizeof(uint64_t) )
+        return false;
+
+    model->params   = *params;
+    model->fresh    = (unsigned)(params->branching*(1 - params->duplicates)
+                                 + 0.5);
+    if (model->fresh == 0)
+        model->fresh = 1;
+    model->callback = callback;
+    model->state    = malloc(params->max_size);
+    if (model->state == NULL)
+        return false;
+
+    /* Fill in the prefix shared by all states */
+    for (n = 0; n < params->prefix; ++n)
+        model->state[n] = (unsigned char)mix(params->seed + n);
+
+    return true;
+}
+
+void synthetic_finalize(SyntheticModel *model)
+{
+    free(model->state);
+    model->state = NULL;
+}
+
+const void *synthetic_initial_state(SyntheticModel *model, size_t *size)
+{
+    *size = build_state(model, 0);
+    return model->state;
+}
+
+void synthetic_scheduler_iter( SyntheticModel *model, const void *state,
+                               void *context )
+{
+    const SyntheticParams *p = &model->params;
+    uint64_t i, succ;
+    unsigned k;
+    size_t size;
+
+    memcpy(&i, (const unsigned char*)state + p->prefix, sizeof(i));
+    assert(i < p->states);
+
+    for (k = 0; k < p->branching; ++k)
+    {
+        /* Tree successor if it exists, or else a pseudo-random state */
+        succ = (uint64_t)i*model->fresh + 1 + k;
+        if (k >= model->fresh || succ >= p->states)
+            succ = mix(mix(p->seed) ^ (i*p->branching + k))%p->states;
+
+        size = build_state(model, succ);
+        if (model->callback(size, model->state, context) == SYNTHETIC_STOP)
+            break;
+    }
+}
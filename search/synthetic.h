@@ -0,0 +1,78 @@
+#ifndef SYNTHETIC_H_INCLUDED
+#define SYNTHETIC_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Synthetic state space, which can be searched instead of a NIPS VM model
+   to benchmark the search and data structures without the VM, at any scale
+   and with a known number of states and transitions.
+
+   States are numbered 0 to N-1, and state 0 is the initial state. State i
+   consists of the shared prefix, its number (8 bytes) and pseudo-random
+   bytes, up to a size that is uniformly distributed in [min_size:max_size].
+   Each state has exactly B successors: the first F = B*(1 - duplicates)
+   (rounded, at least 1) are the states iF+1 to iF+F of a tree spanning all
+   states (where these exist), and the others are pseudo-random states.
+
+   So a complete search expands exactly N states and makes exactly N*B
+   transitions, of which N-1 reach a new state. Everything is determined
+   by the parameters (including the seed), so every search of the same
+   space does the same work. */
+
+typedef struct SyntheticParams
+{
+    unsigned long   states;         /* Number of states (N) */
+    size_t          min_size;       /* Minimum state size in bytes */
+    size_t          max_size;       /* Maximum state size in bytes */
+    unsigned        branching;      /* Successors per state (B) */
+    double          duplicates;     /* Fraction of successors that are
+                                       not tree edges */
+    size_t          prefix;         /* Bytes shared by all states */
+    unsigned long   seed;           /* Seed for pseudo-random contents */
+} SyntheticParams;
+
+typedef enum SyntheticStatus
+{
+    SYNTHETIC_CONTINUE, SYNTHETIC_STOP
+} SyntheticStatus;
+
+/* Called for each successor of a state expanded by
+   synthetic_scheduler_iter(). The successor is only valid during the
+   call. Returning SYNTHETIC_STOP skips the remaining successors. */
+typedef SyntheticStatus (*SyntheticCallback)( size_t succ_size, void *succ,
+                                              void *context );
+
+typedef struct SyntheticModel
+{
+    SyntheticParams     params;
+    unsigned            fresh;      /* Tree successors per state (F) */
+    SyntheticCallback   callback;
+    unsigned char       *state;     /* Buffer in which states are built */
+} SyntheticModel;
+
+/* Parses a description of a synthetic state space of the form
+   "key=value,..." with keys: states, size (a size or a range "min-max"),
+   branch, dup, prefix and seed. Unspecified parameters get defaults.
+   Returns false if the description is invalid. */
+bool synthetic_parse(const char *spec, SyntheticParams *params);
+
+/* Initializes a model with the given parameters, which calls ``callback''
+   for successors. Returns false if the parameters are invalid or memory
+   could not be allocated. */
+bool synthetic_init( SyntheticModel *model, const SyntheticParams *params,
+                     SyntheticCallback callback );
+
+/* Frees the resources used by the model. */
+void synthetic_finalize(SyntheticModel *model);
+
+/* Returns the initial state, which is valid until the next call to one of
+   these functions, and stores its size in ``size''. */
+const void *synthetic_initial_state(SyntheticModel *model, size_t *size);
+
+/* Calls the model's callback for each successor of the given state, with
+   ``context'' as the last argument. */
+void synthetic_scheduler_iter( SyntheticModel *model, const void *state,
+                               void *context );
+
+#endif /* ndef SYNTHETIC_H_INCLUDED */
@@ -1,6 +0,0 @@
-#!/bin/sh
-
-for file in config/*
-do
-	./run-test.sh "$file"
-done